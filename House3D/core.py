@@ -11,10 +11,12 @@ import logging
 import six
 import cv2
 import pickle
+from multiprocessing import cpu_count
+from multiprocessing.pool import ThreadPool
 
 import gym
 from .house import House
-from .objrender import RenderMode
+from .objrender import RenderMode, _HouseSet
 
 __all__ = ['Environment', 'MultiHouseEnv']
 
@@ -26,28 +28,81 @@ def _vec_to_array(pos):
     return np.array([pos.x, pos.y, pos.z])
 
 
-def create_house(houseID, config, cachefile=None):
+_RENDER_MODES = {
+    'rgb': RenderMode.RGB,
+    'depth': RenderMode.DEPTH,
+    'semantic': RenderMode.SEMANTIC,
+    'instance': RenderMode.INSTANCE,
+    'invdepth': RenderMode.INVDEPTH,
+}
+
+
+def _to_render_mode(mode):
+    if isinstance(mode, six.string_types):
+        return _RENDER_MODES[mode.lower()]
+    assert mode in set(_RENDER_MODES.values())
+    return mode
+
+
+def _house_files(houseID, config, cachefile=None):
+    """the (jsonFile, objFile, cachefile) of a house, where cachefile is None if there is none"""
     objFile = os.path.join(config['prefix'], houseID, 'house.obj')
     jsonFile = os.path.join(config['prefix'], houseID, 'house.json')
     assert (os.path.isfile(objFile) and os.path.isfile(jsonFile)), '[Environment] house objects not found! objFile=<{}>'.format(objFile)
     if cachefile is None:
-        cachefile = os.path.join(config['prefix'], houseID, 'cachedmap1k.pkl')
+        # the maps of House.saveMaps, or else the pickled ones of the ground floor
+        cachefile = os.path.join(config['prefix'], houseID, 'cachedmap1k.maps')
+        if not os.path.isfile(cachefile):
+            cachefile = os.path.join(config['prefix'], houseID, 'cachedmap1k.pkl')
     if not os.path.isfile(cachefile):
         cachefile = None
+    return jsonFile, objFile, cachefile
+
+
+def create_house(houseID, config, cachefile=None, preloaded=None):
+    """preloaded: (houseSet, i) of a _HouseSet that has read the files of this house, see House"""
+    jsonFile, objFile, cachefile = _house_files(houseID, config, cachefile)
+    # the distances to the targets of all the houses are kept in config['connMapCacheDir'], if set
     house = House(jsonFile, objFile, config["modelCategoryFile"],
-                  CachedFile=cachefile, GenRoomTypeMap=True)
+                  CachedFile=cachefile, GenRoomTypeMap=True,
+                  ConnMapCacheDir=config.get('connMapCacheDir'),
+                  Preloaded=preloaded)
     return house
 
-def local_create_house(h, config):
-    if not isinstance(h, House):
-        h = create_house(h, config)
-    return h
+
+def create_houses(houses, config):
+    """
+    Build the houses of a list of house ids or `House` instances in this process.
+
+    The files of all the houses are read at once by the threads of a _HouseSet,
+    then the houses are built by a pool of threads, in which House releases the GIL
+    while it computes its maps. Unlike a pool of processes, the houses are not
+    pickled back to the caller.
+    """
+    new = [i for i, h in enumerate(houses) if not isinstance(h, House)]
+    ret = list(houses)
+    if len(new) == 0:
+        return ret
+    files = [_house_files(houses[i], config) for i in new]
+    houseSet = _HouseSet([objFile for _, objFile, _ in files],
+                         [cachefile or '' for _, _, cachefile in files])
+
+    def build(j):
+        return create_house(houses[new[j]], config, files[j][2], preloaded=(houseSet, j))
+    pool = ThreadPool(min(len(new), cpu_count()))
+    try:
+        for i, h in zip(new, pool.map(build, range(len(new)))):
+            ret[i] = h
+    finally:
+        pool.close()
+    return ret
+
 
 class Environment():
     def __init__(self, api, house, config, seed=None):
         """
         Args:
-            api: A RenderAPI or RenderAPIThread instance.
+            api: A RenderAPI or RenderAPIThread instance, or a CPURenderAPI for the modes other than RGB.
             house: either a house object or a house id
             config: configurations containing path to meta-data files
             seed: if not None, set the seed
@@ -63,6 +118,7 @@ class Environment():
 
         self.api_mode = RenderMode.RGB
         self.api = api
+        self.portal_culling = False
 
         if seed is not None:
             np.random.seed(seed)
@@ -76,6 +132,20 @@ class Environment():
         self.api.loadScene(self.house.objFile, self.house.metaDataFile, self.config['colorFile'])
         self.api.setMode(self.api_mode)
         self.cam = self.api.getCamera()
+        if self.portal_culling:
+            self.api.setRooms(*self.house.getRoomPortals())
+
+    def set_portal_culling(self, enabled):
+        """
+        Args:
+            enabled (bool): whether to skip the rooms hidden from the camera's room when rendering.
+                            Assumes the rooms are only open at their doors and windows.
+        """
+        self.portal_culling = enabled
+        if enabled:
+            self.api.setRooms(*self.house.getRoomPortals())
+        else:
+            self.api.setRooms(np.zeros((0, 4), dtype=np.float32), np.zeros((0, 6), dtype=np.float32))
 
     def set_render_mode(self, mode):
         """
@@ -83,19 +153,7 @@ class Environment():
             mode (str or enum): either a RenderMode value or its string version.
                                 'rgb', 'depth', 'semantic', 'instance', or 'invdepth'
         """
-        mappings = {
-            'rgb': RenderMode.RGB,
-            'depth': RenderMode.DEPTH,
-            'semantic': RenderMode.SEMANTIC,
-            'instance': RenderMode.INSTANCE,
-            'invdepth': RenderMode.INVDEPTH,
-        }
-        if isinstance(mode, six.string_types):
-            mode = mode.lower()
-            self.api_mode = mappings[mode]
-        else:
-            assert mode in set(mappings.values())
-            self.api_mode = mode
+        self.api_mode = _to_render_mode(mode)
         self.api.setMode(self.api_mode)
 
     def render(self, mode=None, copy=False):
@@ -115,6 +173,82 @@ class Environment():
             self.set_render_mode(backup)
             return ret
 
+    def render_depth(self, copy=False):
+        """
+        Render the depth in meters of each pixel, regardless of the render mode.
+
+        Returns:
+            A float32 image of shape (h, w, 1), with np.inf where nothing is drawn.
+            It is not quantized like the 'depth' and 'invdepth' modes.
+        """
+        return np.array(self.api.renderDepth(), copy=copy)
+
+    def render_instance_ids(self, copy=False):
+        """
+        Render the instance id of each pixel, regardless of the render mode.
+
+        Returns:
+            A uint32 image of shape (h, w, 1), with 0 where nothing is drawn.
+            get_instance_names()[id] is the object name of an id.
+        """
+        return np.array(self.api.renderInstanceIds(), copy=copy)
+
+    def count_instance_pixels(self):
+        """
+        Count the pixels of each instance in the current view on the GPU,
+        without reading back the image.
+
+        Returns:
+            An int array, indexed by instance id like get_instance_names().
+        """
+        return np.array(self.api.countInstancePixels())
+
+    def get_instance_names(self):
+        """
+        Returns:
+            The list of object names of each instance id of the current house.
+            The first one, of id 0, is ''.
+        """
+        return self.api.getInstanceNames()
+
+    def render_multi(self, modes):
+        """
+        Render several modes with a single pass over the scene.
+
+        Args:
+            modes (list of str or enum): the modes to render, see set_render_mode().
+
+        Returns:
+            A list of images, one per mode, same as render(mode=...) would return.
+            The current render mode is not changed.
+        """
+        modes = [_to_render_mode(m) for m in modes]
+        return [np.array(img, copy=False) for img in self.api.renderMulti(modes)]
+
+    def render_into(self, out, mode=None):
+        """
+        Same as render(), but write the image into a preallocated array
+        instead of allocating a new one.
+
+        Args:
+            out (np.ndarray): a writeable, C-contiguous uint8 array of shape (h, w, c),
+                where c is the number of channels of the mode (3, or 2 for depth).
+            mode (str or enum or None): If None, use the current mode.
+
+        Returns:
+            out
+        """
+        if mode is None:
+            self.api.renderInto(out)
+        else:
+            backup = self.api_mode
+            self.set_render_mode(mode)
+            try:
+                self.api.renderInto(out)
+            finally:
+                self.set_render_mode(backup)
+        return out
+
 
     def render_cube_map(self, mode=None, copy=False):
         """
@@ -193,6 +327,22 @@ class Environment():
                 return False
         return True
 
+    def check_moves(self, starts, ends):
+        """
+        Same as _check_collision, for N moves at once, e.g. of the agents of a
+        vectorized environment in the same house.
+
+        Args:
+            starts, ends: (N, 2) arrays of (x, y) in meters
+
+        Returns:
+            success: (N,) bool array
+            endpoints: (N, 2) array, the last valid point of each move, or its start
+        """
+        if USE_FAST_COLLISION_CHECK:
+            return self.house.check_moves(starts, ends, FAST_COLLISION_CHECK_SAMPLES, fast=True)
+        return self.house.check_moves(starts, ends, 5, fast=False)
+
     def move_forward(self, dist_fwd, dist_hor=0):
         """
         Move with `fwd` distance to the front and `hor` distance to the right.
@@ -240,7 +390,7 @@ class Environment():
         if yaw is None:
             yaw = np.random.rand() * 360 - 180
         self.cam.pos.x = x
-        self.cam.pos.y = self.house.robotHei
+        self.cam.pos.y = self.house.floorHei + self.house.robotHei
         self.cam.pos.z = y
         self.cam.yaw = yaw
         self.cam.updateDirection()
@@ -354,15 +504,13 @@ class MultiHouseEnv(Environment):
         ts = time.time()
         if not isinstance(houses, list):
             houses = [houses]
-        from multiprocessing import Pool
-        _args = [(h, config) for h in houses]
-        k = len(houses)
-        with Pool(k) as pool:
-            self.all_houses = pool.starmap(local_create_house, _args)  # parallel version for initialization
+        self.all_houses = create_houses(houses, config)  # parallel version for initialization
         print('  >> Done! Time Elapsed = %.4f(s)' % (time.time() - ts))
         for i, h in enumerate(self.all_houses):
             h._id = i
             h._cachedLocMap = None
+            if h is not self.all_houses[0]:
+                h.packMaps()  # until reset_house picks it
         super(MultiHouseEnv, self).__init__(
             api, house=self.all_houses[0], config=config, seed=seed)
 
@@ -374,16 +522,32 @@ class MultiHouseEnv(Environment):
             house_id (int): a integer in range(0, self.num_house).
                 If None, will choose a random one.
         """
+        self.house.packMaps()
         if house_id is None:
             self.house = random.choice(self.all_houses)
         else:
             self.house = self.all_houses[house_id]
+        self.house.unpackMaps()
         self._load_objects()
 
+    def prefetch_house(self, house_id):
+        """
+        Start parsing a house in the background, so that a later
+        reset_house(house_id) doesn't have to wait for it.
+
+        Args:
+            house_id (int): a integer in range(0, self.num_house).
+        """
+        house = self.all_houses[house_id]
+        self.api.prefetchScene(house.objFile, house.metaDataFile, self.config['colorFile'])
+
     def cache_shortest_distance(self):
         # TODO
         for house in self.all_houses:
+            house.unpackMaps()
             house.cache_all_target()
+            if house is not self.house:
+                house.packMaps()
 
     @property
     def info(self):
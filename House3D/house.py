@@ -5,13 +5,14 @@
 # LICENSE file in the root directory of this source tree.
 
 import csv
-import cv2
-import itertools
 import json
 import numpy as np
+import os
 import pickle
 import time
 
+from .objrender import _House, _ConnMap, _DistanceOracle
+
 __all__ = ['House']
 
 ######################################
@@ -48,44 +49,39 @@ def _get_pred_room_tp_id(room):
 
 
 def parse_walls(objFile, lower_bound = 1.0):
-    def create_box(vers):
-        if len(vers) == 0:
-            return None
-        v_max = [-1e20, -1e20, -1e20]
-        v_min = [1e20, 1e20, 1e20]
-        for v in vers:
-            for i in range(3):
-                if v[i] < v_min[i]: v_min[i] = v[i]
-                if v[i] > v_max[i]: v_max[i] = v[i]
-        obj = {}
-        obj['bbox'] = {}
-        obj['bbox']['min']=v_min
-        obj['bbox']['max']=v_max
-        if v_min[1] < lower_bound:
-            return obj
-        return None
-    walls = []
-    with open(objFile, 'r') as file:
-        vers = []
-        for line in file.readlines():
-            if len(line) < 2: continue
-            if line[0] == 'g':
-                if (vers is not None) and (len(vers) > 0): walls.append(create_box(vers))
-                if ('Wall' in line):
-                    vers = []
-                else:
-                    vers = None
-            if (vers is not None) and (line[0] == 'v') and (line[1] == ' '):
-                vals = line[2:]
-                coor =[float(v) for v in vals.split(' ') if len(v)>0]
-                if len(coor) != 3:
-                    print('line = {}'.format(line))
-                    print('coor = {}'.format(coor))
-                    assert(False)
-                vers.append(coor)
-    if (vers is not None) and (len(vers) > 0): walls.append(create_box(vers))
-    ret_walls = [w for w in walls if w is not None]
-    return ret_walls
+    """bboxes of the walls of objFile that reach below lower_bound, scanned natively"""
+    return _House.parseWalls(objFile, lower_bound)
+
+
+def _bbox_array(objs):
+    """(k, 4) array of the (x1, y1, x2, y2) of the bboxes of objs, for _House"""
+    boxes = [[o['bbox']['min'][0], o['bbox']['min'][2], o['bbox']['max'][0], o['bbox']['max'][2]]
+             for o in objs]
+    return np.array(boxes, dtype=np.float64).reshape(-1, 4)
+
+
+# the attributes of House that belong to its current level, see House.setLevel
+_LEVEL_ATTRS = ['level', 'floorHei', 'L_min_coor', 'L_lo', 'L_max_coor', 'L_hi', 'L_det', 'grid_det',
+                '_native', 'all_walls', 'all_obj', 'all_rooms', 'all_roomTypes', 'all_desired_roomTypes',
+                'default_roomTp', 'tinyObsMap', 'eagleMap', 'obsMap', 'moveMap', '_debugMap',
+                'connMapDict', 'roomTypeLocMap', 'targetRoomTp', 'targetRooms', 'connMap',
+                'connectedCoors', 'inroomDist', 'maxConnDist', 'roomTypeMap', '_distOracle', '_activeConn']
+
+# the maps of _LEVEL_ATTRS with 0/1 cells, kept packed to 1 bit per cell while their level is not in use
+_PACKED_LEVEL_ATTRS = ['obsMap', 'moveMap']
+
+# the maps of _LEVEL_ATTRS expanded from the _ConnMap of the target, dropped while their level is not in use
+_CONN_LEVEL_ATTRS = ['connMap', 'connectedCoors', 'inroomDist']
+
+
+def _pack_map(m):
+    return (m.shape, m.dtype, np.packbits(m != 0, axis=None))
+
+
+def _unpack_map(packed):
+    shape, dtype, bits = packed
+    n = int(np.prod(shape))
+    return np.unpackbits(bits)[:n].reshape(shape).astype(dtype)
 
 
 def fill_region(proj, x1, y1, x2, y2, c):
@@ -116,7 +112,9 @@ class House(object):
                  SetTarget=True,
                  ApproximateMovableMap=False,
                  _IgnoreSmallHouse=False,  # should be only set true when called by "cache_houses.py"
-                 DebugMessages=True
+                 DebugMessages=True,
+                 ConnMapCacheDir=None,
+                 Preloaded=None
                  ):
         """Initialization and Robot Parameters
 
@@ -128,8 +126,9 @@ class House(object):
             JsonFile (str): file name of the house json file (house.json)
             ObjFile (str): file name of the house object file (house.obj)
             MetaDataFile (str): file name of the meta data (ModelCategoryMapping.csv)
-            CachedFile (str, recommended): file name of the pickled cached data for this house, None if no such cache (cachedmap1k.pkl)
-            StorageFile (str, optional): if CachedFile is None, pickle all the data and store in this file
+            CachedFile (str, recommended): file name of the cached maps of this house written by saveMaps (cachedmap1k.maps),
+                or of the pickled maps of its ground floor (cachedmap1k.pkl). None if no such cache
+            StorageFile (str, optional): store the maps of all the levels in this file, see saveMaps
             GenRoomTypeMap (bool, optional): if turned on, generate the room type map for each location
             EagleViewRes (int, optional): resolution of the topdown 2d map
             DebugInfoOn (bool, optional): store additional debugging information when this option is on
@@ -138,8 +137,12 @@ class House(object):
             RobotHeight (double, optional): height of the robot/agent (generally should not be changed)
             CarpetHeight (double, optional): maximum height of the obstacles that agent can directly go through (gennerally should not be changed)
             SetTarget (bool, optional): whether or not to choose a default target room and pre-compute the valid locations
-            ApproximateMovableMap (bool, optional): Fast initialization of valid locations which are not as accurate or fine-grained.  Requires OpenCV if true
+            ApproximateMovableMap (bool, optional): Fast initialization of valid locations which are not as accurate or fine-grained
             DebugMessages=True (bool, optional): whether or not to show debug messages
+            ConnMapCacheDir (str, optional): directory of the distances to the target rooms, computed on first use
+                and shared by all the processes using the same directory, see setTargetRoom
+            Preloaded (tuple, optional): (houseSet, i), where house i of the _HouseSet houseSet has read ObjFile
+                and CachedFile, which are then not read again
         """
         if DebugMessages == True:
             ts = time.time()
@@ -147,32 +150,102 @@ class House(object):
 
         self.metaDataFile = MetaDataFile
         self.objFile = ObjFile
+        # SUNCG houses are in <prefix>/<houseID>/house.json
+        self.houseID = os.path.basename(os.path.dirname(os.path.abspath(JsonFile)))
+        self._connMapCacheDir = ConnMapCacheDir
         self.robotHei = RobotHeight
         self.carpetHei = CarpetHeight
         self.robotRad = RobotRadius
+        self.n_row = ColideRes
+        self.eagle_n_row = EagleViewRes
         self._debugMap = None if not DebugInfoOn else True
         with open(JsonFile) as jfile:
             self.house = house = json.load(jfile)
-        self.all_walls = parse_walls(ObjFile, RobotHeight)
 
         # validity check
         if abs(house['scaleToMeters'] - 1.0) > 1e-8:
             print('[Error] Currently <scaleToMeters> must be 1.0!')
             assert(False)
-        if len(house['levels']) > 1 and DebugMessages == True:
-            print('[Warning] Currently only support ground floor! <total floors = %d>' % (len(house['levels'])))
 
-        self.level = level = house['levels'][0]  # only support ground floor now
+        # every level with a bbox has its own maps, see setLevel()
+        self.all_levels = house['levels']
+        self.validLevels = [k for k, level in enumerate(self.all_levels) if 'bbox' in level]
+        assert 0 in self.validLevels, '[House] the ground floor has no bbox!'
+        top_floor = max(self._floor_height(k) for k in self.validLevels)
+        if Preloaded is not None:
+            walls = Preloaded[0].walls(Preloaded[1], top_floor + RobotHeight)
+        else:
+            walls = parse_walls(ObjFile, top_floor + RobotHeight)
+        if DebugMessages == True:
+            print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
+
+        cachedMaps = []
+        if CachedFile is not None:
+            assert not DebugInfoOn, 'Please set DebugInfoOn=True when loading data from cached file!'
+            cachedMaps = self._load_cached_maps(CachedFile, DebugMessages, Preloaded)
+        self._levelStates = [None] * len(self.all_levels)
+        self.levelIdx = None
+        self._packed = False    # see packMaps
+        for k in self.validLevels:
+            if len(self.validLevels) > 1 and DebugMessages == True:
+                print('Processing Level {} of {} ...'.format(k, len(self.all_levels)))
+            self._levelStates[k] = state = {}
+            self.levelIdx = k
+            cached = cachedMaps[k] if k < len(cachedMaps) else None
+            self._init_level(k, walls, MetaDataFile, cached, SetTarget, GenRoomTypeMap,
+                             ApproximateMovableMap, _IgnoreSmallHouse, DebugMessages)
+            self._store_level(state, pack=k != max(self.validLevels))
+            if k == 0 and len(self.all_desired_roomTypes) == 0:
+                return  # a small house skipped by _IgnoreSmallHouse
+
+        if StorageFile is not None:
+            if DebugMessages == True:
+                print('Storing Obstacle Map and Movability Map to Cache File ...')
+                ts = time.time()
+            self.saveMaps(StorageFile)
+            if DebugMessages == True:
+                print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
+        self.setLevel(0)
+
+
+    def _floor_height(self, k):
+        """the height the obstacles of level k are measured from: SUNCG puts the ground floor at 0"""
+        return 0.0 if k == 0 else self.all_levels[k]['bbox']['min'][1]
+
+    def _load_cached_maps(self, CachedFile, DebugMessages, Preloaded=None):
+        """the (obsMap, moveMap) of each level in CachedFile, written by saveMaps(), or by pickle for the ground floor"""
+        if DebugMessages == True:
+            print('Loading Obstacle Map and Movability Map From Cache File ...')
+            ts = time.time()
+        if Preloaded is not None:
+            maps = Preloaded[0].maps(Preloaded[1])
+        else:
+            maps = _House.loadMaps(CachedFile)
+        if maps is None:
+            with open(CachedFile, 'rb') as f:
+                maps = [tuple(pickle.load(f))]
+        if DebugMessages == True:
+            print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
+        return maps
+
+    def _init_level(self, k, walls, MetaDataFile, cached, SetTarget, GenRoomTypeMap,
+                    ApproximateMovableMap, _IgnoreSmallHouse, DebugMessages):
+        """compute the attributes of level k in _LEVEL_ATTRS"""
+        self.level = level = self.all_levels[k]
+        self.floorHei = self._floor_height(k)
         self.L_min_coor = _L_lo = np.array(level['bbox']['min'])
         self.L_lo = min(_L_lo[0], _L_lo[2])
         self.L_max_coor = _L_hi = np.array(level['bbox']['max'])
         self.L_hi = max(_L_hi[0], _L_hi[2])
         self.L_det = self.L_hi - self.L_lo
-        self.n_row = ColideRes
-        self.eagle_n_row = EagleViewRes
         self.grid_det = self.L_det / self.n_row
-        self.all_obj = [node for node in level['nodes'] if node['type'].lower() == 'object']
-        self.all_rooms = [node for node in level['nodes'] if (node['type'].lower() == 'room') and ('roomTypes' in node)]
+        self._native = _House(self.L_lo, self.L_det, self.robotRad)  # native implementations of the grid methods
+        self.all_walls = [w for w in walls if w['bbox']['min'][1] < self.floorHei + self.robotHei]
+        if k > 0:
+            # the walls of the level below end around this floor, and are not obstacles on it
+            self.all_walls = [w for w in self.all_walls if w['bbox']['max'][1] > self.floorHei + self.carpetHei]
+        self.all_obj = [node for node in level.get('nodes', []) if node['type'].lower() == 'object']
+        self.all_rooms = [node for node in level.get('nodes', []) if (node['type'].lower() == 'room') and ('roomTypes' in node)]
         self.all_roomTypes = [room['roomTypes'] for room in self.all_rooms]
         self.all_desired_roomTypes = []
         self.default_roomTp = None
@@ -180,13 +253,14 @@ class House(object):
             if any([any([_equal_room_tp(tp, roomTp) for tp in tps]) for tps in self.all_roomTypes]):
                 self.all_desired_roomTypes.append(roomTp)
                 if self.default_roomTp is None: self.default_roomTp = roomTp
-        assert self.default_roomTp is not None, 'Cannot Find Any Desired Rooms!'
+        # the upper floors may have no target room
+        assert k > 0 or self.default_roomTp is not None, 'Cannot Find Any Desired Rooms!'
 
-        if DebugMessages == True:
+        if DebugMessages == True and self.default_roomTp is not None:
             print('>> Default Target Room Type Selected = {}'.format(self.default_roomTp))
-            print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
 
-        if _IgnoreSmallHouse and ((len(self.all_desired_roomTypes) < 2) or ('kitchen' not in self.all_desired_roomTypes)):
+        if _IgnoreSmallHouse and k == 0 and \
+                ((len(self.all_desired_roomTypes) < 2) or ('kitchen' not in self.all_desired_roomTypes)):
             self.all_desired_roomTypes=[]
             return
 
@@ -202,18 +276,8 @@ class House(object):
         if DebugMessages == True:
             print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
 
-        # load from cache
-        if CachedFile is not None:
-            assert not DebugInfoOn, 'Please set DebugInfoOn=True when loading data from cached file!'
-
-            if DebugMessages == True:
-                print('Loading Obstacle Map and Movability Map From Cache File ...')
-                ts = time.time()
-            with open(CachedFile, 'rb') as f:
-                self.obsMap, self.moveMap = pickle.load(f)
-
-            if DebugMessages == True:
-                print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
+        if cached is not None:
+            self.obsMap, self.moveMap = cached
         else:
             # generate obstacle map
             if DebugMessages == True:
@@ -236,25 +300,20 @@ class House(object):
             if DebugMessages == True:
                 print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
 
-            if StorageFile is not None:
-                if DebugMessages == True:
-                    print('Storing Obstacle Map and Movability Map to Cache File ...')
-                    ts = time.time()
-                with open(StorageFile, 'wb') as f:
-                    pickle.dump([self.obsMap, self.moveMap], f)
-                if DebugMessages == True:
-                    print('  --> Done! Elapsed = %.2fs' % (time.time()-ts))
-
         # set target room connectivity
         if DebugMessages == True:
             ts = time.time()
+        self._distOracle = None     # built on the first geodesic query
         self.connMapDict = {}
         self.roomTypeLocMap = {}    # roomType -> feasible locations
         self.targetRoomTp = None
         self.targetRooms = []
         self.connMap = None
+        self.connectedCoors = None
         self.inroomDist = None
-        if SetTarget:
+        self.maxConnDist = None
+        self._activeConn = None     # the _ConnMap of connMap, if it is of a target room
+        if SetTarget and self.default_roomTp is not None:
             if DebugMessages == True:
                 print('Generate Target connectivity Map (Default <{}>) ...'.format(self.default_roomTp))
             self.setTargetRoom(self.default_roomTp, _setEagleMap=True)
@@ -271,6 +330,85 @@ class House(object):
             if DebugMessages == True:
                 print('  --> Done! Elapsed = %.2fs' % (time.time() - ts))
 
+    def setLevel(self, k):
+        """
+        Switch to level k of house['levels']: from now on, the maps, rooms, objects
+        and targets of the house are those of level k, as they were left on it.
+
+        Args:
+            k (int): one of self.validLevels, the levels with a bbox
+
+        Returns:
+            whether the level changed
+        """
+        assert k in self.validLevels, '[House] level {} is not valid!'.format(k)
+        if k == self.levelIdx:
+            return False
+        if self._packed:
+            self._packed = False
+        else:
+            self._store_level(self._levelStates[self.levelIdx], pack=True)
+        self._load_level(k)
+        return True
+
+    def packMaps(self):
+        """
+        Keep the maps of the current level in the compact form of the levels not in use, e.g.
+        while a MultiHouseEnv is on another house. The maps are None until unpackMaps().
+        """
+        if self._packed or self.levelIdx is None:
+            return
+        self._store_level(self._levelStates[self.levelIdx], pack=True)
+        for attr in _PACKED_LEVEL_ATTRS + _CONN_LEVEL_ATTRS:
+            setattr(self, attr, None)
+        self._packed = True
+
+    def unpackMaps(self):
+        """expand the maps of the current level again, after packMaps()"""
+        if self._packed:
+            self._packed = False
+            self._load_level(self.levelIdx)
+
+    def _load_level(self, k):
+        """make level k the current one, from the state saved by _store_level"""
+        self.levelIdx = k
+        for attr, value in self._levelStates[k].items():
+            if attr in _PACKED_LEVEL_ATTRS and isinstance(value, tuple):
+                value = _unpack_map(value)
+            setattr(self, attr, value)
+        if self._activeConn is not None and self.connMap is None:
+            self._use_conn_map(self._activeConn)
+
+    def _store_level(self, state, pack):
+        """
+        save the attributes of the current level to state. If pack, the level is not in use, so only
+        a compact form of its maps is kept: obstacles and movability 1 bit per cell, and the
+        distances to the target room in its _ConnMap only
+        """
+        for attr in _LEVEL_ATTRS:
+            value = getattr(self, attr, None)
+            if pack and attr in _PACKED_LEVEL_ATTRS and isinstance(value, np.ndarray):
+                value = _pack_map(value)
+            if pack and attr in _CONN_LEVEL_ATTRS and getattr(self, '_activeConn', None) is not None:
+                value = None
+            state[attr] = value
+
+    def saveMaps(self, fname):
+        """
+        Store the obstacle and movability maps of all the valid levels to fname, in the
+        bit-packed format that CachedFile loads without unpickling.
+        """
+        maps = []
+        for k in range(max(self.validLevels) + 1):
+            if k == self.levelIdx and not self._packed:
+                obs, move = self.obsMap, self.moveMap
+            elif self._levelStates[k] is not None:
+                obs, move = [_unpack_map(self._levelStates[k][attr]) for attr in _PACKED_LEVEL_ATTRS]
+            else:  # no maps for invalid levels
+                obs = move = np.zeros((0, 0), dtype=np.uint8)
+            maps.append((obs, move))
+        _House.saveMaps(fname, maps)
+
 
     def _generate_room_type_map(self):
         rtMap = self.roomTypeMap
@@ -299,7 +437,12 @@ class House(object):
         @:param dirs: connected directions, by default 4-connected (L,R,U,D)
         """
         if dirs is None:
-            dirs = [[0, 1], [1, 0], [-1, 0], [0, -1]]
+            # components are (k, 2) arrays of coors
+            comps = self._native.findComponents(self._native_move_map(), x1, y1, x2, y2,
+                                                return_largest, return_open)
+            if return_open and not return_largest and not isinstance(comps, list):
+                print('WARNING!!!! [House] <find components in Target Room [%s]> No Open Components Found!!!! Return Largest Instead!!!!' % self.targetRoomTp)
+            return comps
         comps = []
         open_comps = set()
         visit = {}
@@ -347,48 +490,14 @@ class House(object):
     Sets self.connMap to distances to target point with some margin
     """
     def setTargetPoint(self, x, y, margin_x=15, margin_y=15):
-        self.connMap = connMap = np.ones((self.n_row+1, self.n_row+1), dtype=np.int32) * -1
-        self.inroomDist = inroomDist = np.ones((self.n_row+1, self.n_row+1), dtype=np.float32) * -1
-        dirs = [[0, 1], [1, 0], [-1, 0], [0, -1]]
-
         x1, y1, x2, y2 = x-margin_x, y-margin_y, x+margin_x, y+margin_y
         _x, _y = self.to_coor(x, y)
-
-        curr_components = self._find_components(x1, y1, x2, y2, dirs=dirs, return_open=True)
-        if len(curr_components) == 0:
+        self.connMap, coors, self.inroomDist, maxConnDist, _, _ = \
+            self._native.genConnMaps(self._native_move_map(), [[[x1, y1, x2, y2, _x, _y]]], False)[0]
+        self._activeConn = None
+        if len(coors) == 0:
             return False
-
-        que = []
-        if isinstance(curr_components[0], list):  # join all the coors in the open components
-            curr_major_coors = list(itertools.chain(*curr_components))
-        else:
-            curr_major_coors = curr_components
-        min_dist_to_center = 1e50
-        for xx, yy in curr_major_coors:
-            connMap[xx, yy] = 0
-            que.append((xx, yy))
-            tx, ty = self.to_coor(xx, yy)
-            tdist = np.sqrt((tx - _x) ** 2 + (ty - _y) ** 2)
-            if tdist < min_dist_to_center:
-                min_dist_to_center = tdist
-            inroomDist[xx, yy] = tdist
-        for xx, yy in curr_major_coors:
-            inroomDist[xx, yy] -= min_dist_to_center
-
-        ptr = 0
-        self.maxConnDist = 1
-        while ptr < len(que):
-            xx, yy = que[ptr]
-            cur_dist = connMap[xx, yy]
-            ptr += 1
-            for dx, dy in dirs:
-                tx, ty = xx+dx, yy+dy
-                if self.inside(tx,ty) and self.canMove(tx,ty) and not self.isConnect(tx, ty):
-                    que.append((tx,ty))
-                    connMap[tx,ty] = cur_dist + 1
-                    if cur_dist + 1 > self.maxConnDist:
-                        self.maxConnDist = cur_dist + 1
-
+        self.maxConnDist = maxConnDist
         return True
 
     """
@@ -404,7 +513,7 @@ class House(object):
         ###########
         # Caching
         if targetRoomTp in self.connMapDict:
-            self.connMap, self.connectedCoors, self.inroomDist, self.maxConnDist = self.connMapDict[targetRoomTp]
+            self._use_conn_map(self.connMapDict[targetRoomTp])
             return True  # room Changed!
         self.targetRooms = targetRooms = \
             [room for room in self.all_rooms if any([ _equal_room_tp(tp, targetRoomTp) for tp in room['roomTypes']])]
@@ -418,61 +527,107 @@ class House(object):
                 _x2, _, _y2 = room['bbox']['max']
                 x1,y1,x2,y2 = self.rescale(_x1,_y1,_x2,_y2,self.eagleMap.shape[1]-1)
                 self.eagleMap[1, x1:(x2+1), y1:(y2+1)]=1
-        print('[House] Caching New ConnMap for Target <{}>! (total {} rooms involved)'.format(targetRoomTp,len(targetRooms)))
-        self.connMap = connMap = np.ones((self.n_row+1, self.n_row+1), dtype=np.int32) * -1
-        self.inroomDist = inroomDist = np.ones((self.n_row+1, self.n_row+1), dtype=np.float32) * -1
-        dirs = [[0, 1], [1, 0], [-1, 0], [0, -1]]
-        que = []
-        for flag_find_open_components in [True, False]:
-            if not flag_find_open_components:
-                print('WARINING!!!! [House] No Space Found for Room Type {}! Now search even for closed region!!!'.format(targetRoomTp))
-            for room in targetRooms:
+        conn = self._load_conn_map(targetRoomTp)
+        if conn is None:
+            print('[House] Caching New ConnMap for Target <{}>! (total {} rooms involved)'.format(targetRoomTp,len(targetRooms)))
+            conn = self._gen_conn_maps([targetRoomTp])[0]
+            print(' >>>> ConnMap Cached!')
+        self.connMapDict[targetRoomTp] = conn
+        self._use_conn_map(conn)
+        return True  # room changed!
+
+    def _use_conn_map(self, conn):
+        """set connMap, connectedCoors, inroomDist and maxConnDist to those of a _ConnMap"""
+        self._activeConn = conn
+        self.connMap = conn.connMap()
+        self.connectedCoors = conn.connectedCoors()
+        self.inroomDist = conn.inroomDist()
+        self.maxConnDist = conn.maxConnDist
+
+    def _conn_map_file(self, roomTp):
+        """the file of the distances to roomTp on the current level in ConnMapCacheDir, or None"""
+        if self._connMapCacheDir is None:
+            return None
+        return os.path.join(self._connMapCacheDir, '{}.{}.{}.conn'.format(self.houseID, self.levelIdx, roomTp))
+
+    def _load_conn_map(self, roomTp):
+        """the _ConnMap of roomTp in ConnMapCacheDir, or None if it's not there or is for another moveMap"""
+        fname = self._conn_map_file(roomTp)
+        if fname is None:
+            return None
+        return _ConnMap.load(fname, _ConnMap.hashMoveMap(self._native_move_map()))
+
+    def _gen_conn_maps(self, roomTps):
+        """
+        compute the _ConnMap of each room type, in parallel, and store them in ConnMapCacheDir if any
+        """
+        targets, all_rooms = [], []
+        for roomTp in roomTps:
+            regions = []
+            all_rooms.append(self._getRooms(roomTp))
+            for room in all_rooms[-1]:
                 _x1, _, _y1 = room['bbox']['min']
                 _x2, _, _y2 = room['bbox']['max']
-                cx, cy = (_x1 + _x2) / 2, (_y1 + _y2) / 2
-                x1,y1,x2,y2 = self.rescale(_x1,_y1,_x2,_y2)
-                curr_components = self._find_components(x1, y1, x2, y2, dirs=dirs, return_open=flag_find_open_components)  # find all the open components
-                if len(curr_components) == 0:
-                    print('WARNING!!!! [House] No Space Found in TargetRoom <tp=%s, bbox=[%.2f, %2f] x [%.2f, %.2f]>' %
-                          (targetRoomTp, _x1, _x2, _y1, _y2))
-                    continue
-                if isinstance(curr_components[0], list):  # join all the coors in the open components
-                    curr_major_coors = list(itertools.chain(*curr_components))
-                else:
-                    curr_major_coors = curr_components
-                min_dist_to_center = 1e50
-                for x, y in curr_major_coors:
-                    connMap[x, y] = 0
-                    que.append((x, y))
-                    tx, ty = self.to_coor(x, y)
-                    tdist = np.sqrt((tx - cx) ** 2 + (ty - cy) ** 2)
-                    if tdist < min_dist_to_center:
-                        min_dist_to_center = tdist
-                    inroomDist[x, y] = tdist
-                for x, y in curr_major_coors:
-                    inroomDist[x, y] -= min_dist_to_center
-            if len(que) > 0:
-                break
-        assert len(que) > 0, "Error!! [House] No space found for room type {}. House ID = {}"\
-            .format(targetRoomTp, (self._id if hasattr(self, '_id') else 'NA'))
-        ptr = 0
-        self.maxConnDist = 1
-        while ptr < len(que):
-            x,y = que[ptr]
-            cur_dist = connMap[x, y]
-            ptr += 1
-            for dx,dy in dirs:
-                tx,ty = x+dx,y+dy
-                if self.inside(tx,ty) and self.canMove(tx,ty) and not self.isConnect(tx, ty):
-                    que.append((tx,ty))
-                    connMap[tx,ty] = cur_dist + 1
-                    if cur_dist + 1 > self.maxConnDist:
-                        self.maxConnDist = cur_dist + 1
-        self.connMapDict[targetRoomTp] = (connMap, que, inroomDist, self.maxConnDist)
-        self.connectedCoors = que
-        print(' >>>> ConnMap Cached!')
-        return True  # room changed!
+                regions.append(self.rescale(_x1, _y1, _x2, _y2) + ((_x1 + _x2) / 2, (_y1 + _y2) / 2))
+            targets.append(np.array(regions, dtype=np.float64).reshape(-1, 6))
+        ret = []
+        move = self._native_move_map()
+        results = self._native.genConnMaps(move, targets, True)
+        move_hash = _ConnMap.hashMoveMap(move)
+        if self._connMapCacheDir is not None and not os.path.isdir(self._connMapCacheDir):
+            try:
+                os.makedirs(self._connMapCacheDir)
+            except OSError:  # made by another process
+                pass
+        for roomTp, rooms, (connMap, que, inroomDist, maxConnDist, closed, empty) in \
+                zip(roomTps, all_rooms, results):
+            if closed:
+                print('WARINING!!!! [House] No Space Found for Room Type {}! Now search even for closed region!!!'.format(roomTp))
+            for k in empty:
+                _x1, _, _y1 = rooms[k]['bbox']['min']
+                _x2, _, _y2 = rooms[k]['bbox']['max']
+                print('WARNING!!!! [House] No Space Found in TargetRoom <tp=%s, bbox=[%.2f, %2f] x [%.2f, %.2f]>' %
+                      (roomTp, _x1, _x2, _y1, _y2))
+            assert len(que) > 0, "Error!! [House] No space found for room type {}. House ID = {}"\
+                .format(roomTp, (self._id if hasattr(self, '_id') else 'NA'))
+            conn = _ConnMap(connMap, inroomDist, maxConnDist, move_hash)
+            fname = self._conn_map_file(roomTp)
+            if fname is not None:
+                conn.save(fname)
+            ret.append(conn)
+        return ret
+
+    def _native_move_map(self):
+        """moveMap as the int8 array used by self._native"""
+        if self.moveMap.dtype == np.int8 and self.moveMap.flags.c_contiguous:
+            return self.moveMap
+        return np.ascontiguousarray(self.moveMap, dtype=np.int8)
+
+    def _distance_oracle(self):
+        """the _DistanceOracle of moveMap, built the first time it's needed"""
+        if getattr(self, '_distOracle', None) is None:
+            self._distOracle = _DistanceOracle(self._native_move_map())
+        return self._distOracle
 
+    """
+    the geodesic distance, in grid moves, from grid cell (gx1, gy1) to (gx2, gy2)
+    on moveMap, as the distances of connMap; -1 if they are not connected
+    """
+    def geodesic(self, gx1, gy1, gx2, gy2):
+        return self._distance_oracle().geodesic(gx1, gy1, gx2, gy2)
+
+    """
+    the geodesic distances between the rows of two (N, 2) arrays of grid cells
+    """
+    def geodesics(self, starts, ends):
+        return self._distance_oracle().geodesics(starts, ends)
+
+    """
+    the grid cells of a shortest path from (gx1, gy1) to (gx2, gy2), both included,
+    as a (k, 2) array; empty if they are not connected
+    """
+    def shortestPath(self, gx1, gy1, gx2, gy2):
+        return self._distance_oracle().path(gx1, gy1, gx2, gy2)
 
     def _getRoomBounds(self, room):
         _x1, _, _y1 = room['bbox']['min']
@@ -490,7 +645,7 @@ class House(object):
         rooms = self._getRooms(roomTp)
         for room in rooms:
             room_locs = self._getValidRoomLocations(room)
-            if room_locs and len(room_locs) > 0:
+            if room_locs is not None and len(room_locs) > 0:
                 locations.extend(room_locs)
 
         # choose random location
@@ -529,12 +684,20 @@ class House(object):
     cache the shortest distance to all the possible room types
     """
     def cache_all_target(self):
+        for t in self.all_desired_roomTypes:
+            if t not in self.connMapDict:
+                conn = self._load_conn_map(t)
+                if conn is not None:
+                    self.connMapDict[t] = conn
+        new_roomTps = [t for t in self.all_desired_roomTypes if t not in self.connMapDict]
+        for t, conn in zip(new_roomTps, self._gen_conn_maps(new_roomTps)):
+            self.connMapDict[t] = conn
         for t in self.all_desired_roomTypes:
             self.setTargetRoom(t)
         self.setTargetRoom(self.default_roomTp)
 
-    def genObstacleMap(self, MetaDataFile, gen_debug_map=True, dest=None, n_row=None):
-        # load all the doors
+    def _loadModelIds(self, MetaDataFile):
+        """the model ids of the doors, windows and persons in MetaDataFile"""
         target_match_class = 'nyuv2_40class'
         target_door_labels = ['door', 'fence', 'arch']
         door_ids = set()
@@ -551,20 +714,48 @@ class House(object):
                     window_ids.add(row['model_id'])
                 if row[fine_grained_class] in ignored_labels:
                     person_ids.add(row['model_id'])
+        return door_ids, window_ids, person_ids
+
+    def getRoomPortals(self):
+        """
+        Returns the rooms and portals for RenderAPI.setRooms():
+            a (k, 4) array of the (x1, z1, x2, z2) floor rectangles of all the rooms,
+            and a (m, 6) array of the (x1, y1, z1, x2, y2, z2) boxes of all the doors and windows.
+        """
+        door_ids, window_ids, _ = self._loadModelIds(self.metaDataFile)
+        rooms = [node for node in self.level['nodes'] if node['type'].lower() == 'room' and 'bbox' in node]
+        portals = [obj for obj in self.all_obj if obj['modelId'] in door_ids or obj['modelId'] in window_ids]
+        room_rects = np.array([[r['bbox']['min'][0], r['bbox']['min'][2], r['bbox']['max'][0], r['bbox']['max'][2]]
+                               for r in rooms], dtype=np.float32).reshape(-1, 4)
+        portal_boxes = np.array([o['bbox']['min'] + o['bbox']['max'] for o in portals],
+                                dtype=np.float32).reshape(-1, 6)
+        return room_rects, portal_boxes
+
+    def genObstacleMap(self, MetaDataFile, gen_debug_map=True, dest=None, n_row=None):
+        # load all the doors
+        door_ids, window_ids, person_ids = self._loadModelIds(MetaDataFile)
         def is_door(obj):
             if obj['modelId'] in door_ids:
                 return True
-            if (obj['modelId'] in window_ids) and (obj['bbox']['min'][1] < self.carpetHei):
+            if (obj['modelId'] in window_ids) and (obj['bbox']['min'][1] < self.floorHei + self.carpetHei):
                 return True
             return False
 
         solid_obj = [obj for obj in self.all_obj if (not is_door(obj)) and (obj['modelId'] not in person_ids)]  # ignore person
         door_obj = [obj for obj in self.all_obj if is_door(obj)]
-        colide_obj = [obj for obj in solid_obj if obj['bbox']['min'][1] < self.robotHei and obj['bbox']['max'][1] > self.carpetHei]
+        colide_obj = [obj for obj in solid_obj if obj['bbox']['min'][1] < self.floorHei + self.robotHei and
+                      obj['bbox']['max'][1] > self.floorHei + self.carpetHei]
         # generate the map for all the obstacles
         obsMap = dest if dest is not None else self.obsMap
         if n_row is None:
             n_row = obsMap.shape[0] - 1
+        if not (gen_debug_map and (self._debugMap is not None)) and \
+                obsMap.dtype == np.uint8 and obsMap.flags.c_contiguous and obsMap.shape[0] == n_row + 1:
+            level_box = [[self.L_min_coor[0], self.L_min_coor[2], self.L_max_coor[0], self.L_max_coor[2]]]
+            self._native.genObstacleMap(obsMap, level_box,
+                                        _bbox_array(self.all_walls), _bbox_array(door_obj),
+                                        _bbox_array(colide_obj))
+            return
         x1,y1,x2,y2 = self.rescale(self.L_min_coor[0],self.L_min_coor[2],self.L_max_coor[0],self.L_max_coor[2],n_row)  # fill the space of the level
         fill_region(obsMap,x1,y1,x2,y2,0)
         if gen_debug_map and (self._debugMap is not None):
@@ -622,22 +813,24 @@ class House(object):
 
         if approximate:
             self._adjustApproximateRobotMoveMap()
+        self._distOracle = None
 
 
     def _adjustApproximateRobotMoveMap(self):
         # Here we haven't yet accounted for the robot radius, so do some
-        # approximate accommodation
+        # approximate accommodation: unmovable cells are dilated by a disc
         robotGridSize = int(np.rint(self.robotRad * 2 * self.n_row / self.L_det))
         if robotGridSize > 1:
             robotGridRadius = robotGridSize // 2
-            kernel = np.zeros((robotGridSize, robotGridSize), np.uint8)
-            cv2.circle(kernel, (robotGridRadius + 1, robotGridRadius + 1), robotGridRadius, color=1, thickness=-1)
-            filtered_obstacles = (self.moveMap == 0).astype(np.uint8)
-            dilated_obstacles = cv2.dilate(filtered_obstacles, kernel, iterations=1)
-            self.moveMap = (dilated_obstacles == 0).astype(np.uint8)
+            self.moveMap = np.ascontiguousarray(self.moveMap, dtype=np.int8)
+            self._native.adjustApproximateRobotMoveMap(self.moveMap, robotGridRadius)
 
 
     def _updateMovableMap(self, x1, y1, x2, y2):
+        if self.obsMap.flags.c_contiguous and self.moveMap.flags.c_contiguous and \
+                self.obsMap.dtype == np.uint8 and self.moveMap.dtype == np.int8:
+            self._native.genMovableMap(self.obsMap, self.moveMap, x1, y1, x2, y2)
+            return
         for i in range(x1, x2):
             for j in range(y1, y2):
                 if self.obsMap[i,j] == 0:
@@ -726,6 +919,26 @@ class House(object):
                     return False
         return True
 
+    def check_moves(self, starts, ends, num_samples, fast=True):
+        """
+        Check the moves of N agents at once. A move succeeds if all the
+        num_samples points evenly spaced on it (excluding the start) are valid.
+
+        Args:
+            starts, ends: (N, 2) arrays of (x, y) in meters
+            fast (bool): if True, valid points are on cells that canMove and isConnect.
+                Otherwise they are points where check_occupy is True.
+
+        Returns:
+            success: (N,) bool array
+            endpoints: (N, 2) array, the last valid point of each move, or its start
+        """
+        if fast:
+            conn = np.ascontiguousarray(self.connMap, dtype=np.int32)
+            return self._native.checkMoves(self._native_move_map(), conn, starts, ends, num_samples)
+        obs = np.ascontiguousarray(self.obsMap, dtype=np.uint8)
+        return self._native.checkMovesExact(obs, starts, ends, num_samples)
+
     """
     check if an agent can reach grid location (gx, gy)
     """
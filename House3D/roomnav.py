@@ -19,7 +19,7 @@ from .core import Environment, MultiHouseEnv
 from . import objrender
 from .objrender import RenderMode
 
-__all__ = ['RoomNavTask']
+__all__ = ['RoomNavTask', 'VecRoomNavTask']
 
 ###############################################
 # Task related definitions and configurations
@@ -232,18 +232,33 @@ class RoomNavTask(gym.Env):
         # generate state
         x, y = self.house.to_coor(gx, gy, True)
         self.env.reset(x=x, y=y)
-        self.last_obs = self.env.render()
-        if self.joint_visual_signal:
-            self.last_obs = np.concatenate([self.env.render(mode='rgb'), self.last_obs], axis=-1)
+        self.last_obs, dep_sig = self._render_obs()
         ret_obs = self.last_obs
         if self.depth_signal:
-            dep_sig = self.env.render(mode='depth')
-            if dep_sig.shape[-1] > 1:
-                dep_sig = dep_sig[..., 0:1]
             ret_obs = np.concatenate([ret_obs, dep_sig], axis=-1)
         self.last_info = self.info
         return ret_obs
 
+    def _render_obs(self):
+        """
+        Render the visual observation and, if depth_signal is set, the depth
+        signal, with a single pass over the scene.
+
+        Returns:
+            (obs, dep_sig): dep_sig is the 1-channel depth, or None
+        """
+        modes = [self.env.api_mode]
+        if self.joint_visual_signal:
+            modes.insert(0, RenderMode.RGB)
+        if self.depth_signal:
+            modes.append(RenderMode.DEPTH)
+        imgs = self.env.render_multi(modes)
+        dep_sig = None
+        if self.depth_signal:
+            dep_sig = imgs.pop()[..., 0:1]
+        obs = imgs[0] if len(imgs) == 1 else np.concatenate(imgs, axis=-1)
+        return obs, dep_sig
+
     def _apply_action(self, action):
         if self.discrete_action:
             return discrete_actions[action]
@@ -301,9 +316,8 @@ class RoomNavTask(gym.Env):
             if flag_print_debug_info:
                 print('Move Successfully!')
 
-        self.last_obs = obs = self.env.render()
-        if self.joint_visual_signal:
-            self.last_obs = obs = np.concatenate([self.env.render(mode='rgb'), obs], axis=-1)
+        obs, dep_sig = self._render_obs()
+        self.last_obs = obs
         cur_info = self.info
         raw_dist = cur_info['dist']
         orig_raw_dist = self.last_info['dist']
@@ -351,9 +365,6 @@ class RoomNavTask(gym.Env):
                 reward += object_reward
 
         if self.depth_signal:
-            dep_sig = self.env.render(mode='depth')
-            if dep_sig.shape[-1] > 1:
-                dep_sig = dep_sig[..., 0:1]
             obs = np.concatenate([obs, dep_sig], axis=-1)
         self.last_info = cur_info
         return obs, reward, done, cur_info
@@ -425,6 +436,161 @@ class RoomNavTask(gym.Env):
     def debug_show(self):
         return self.env.debug_render()
 
+class VecRoomNavTask(object):
+    def __init__(self, env, num_agents,
+                 seed=None,
+                 reward_type='delta',
+                 hardness=None,
+                 move_sensitivity=None,
+                 segment_input=True,
+                 joint_visual_signal=False,
+                 depth_signal=True,
+                 max_steps=-1,
+                 success_measure='see',
+                 discrete_action=False):
+        """<num_agents> agents of RoomNavTask in the current house of <env>, stepped at once by
+        the native objrender.VecRoomNav, with the api of a vectorized gym environment.
+        Note:
+            all agents share the house of env, which is not changed by reset()
+            agents whose episode is done are reset by step(), and the returned
+            observation is the first one of their new episode
+
+        Args:
+            env: an instance of environment (multi-house or single-house)
+            num_agents (int): number of agents
+            other arguments: the same as RoomNavTask
+        """
+        assert isinstance(env, Environment), '[VecRoomNavTask] env must be an instance of Environment!'
+        assert reward_type in [None, 'none', 'linear', 'indicator', 'delta', 'speed']
+        assert success_measure in ['stay', 'see']
+        self.env = env
+        self.num_agents = num_agents
+        self.resolution = resolution = env.resolution
+        self.hardness = hardness
+        self.discrete_action = discrete_action
+        self.segment_input = segment_input
+        self.success_measure = success_measure
+        if seed is not None:
+            np.random.seed(seed)
+            random.seed(seed)
+
+        cfg = objrender.VecRoomNavConfig()
+        cfg.move_sensitivity = move_sensitivity or default_move_sensitivity
+        cfg.rot_sensitivity = rotation_sensitivity
+        cfg.dist_scale = dist_reward_scale or 1
+        cfg.success_reward = success_reward
+        cfg.inroom_reward = stay_room_reward or 0.2
+        cfg.collision_reward = collision_penalty_reward or 0.02
+        cfg.good_move_reward = correct_move_reward or 0.0
+        cfg.indicator_reward = indicator_reward
+        cfg.time_penalty_reward = time_penalty_reward
+        cfg.delta_reward_coef = delta_reward_coef
+        cfg.speed_reward_coef = speed_reward_coef
+        cfg.pixel_object_reward = pixel_object_reward
+        cfg.reward_type = reward_type or 'none'
+        cfg.success_measure = success_measure
+        cfg.success_stay_time_steps = success_stay_time_steps
+        cfg.success_see_target_time_steps = success_see_target_time_steps
+        if resolution != (120, 90):
+            total_pixel = resolution[0] * resolution[1]
+            cfg.n_pixel_for_object_see = max(int(total_pixel * 0.045), 5)
+            cfg.n_pixel_for_object_sense = max(int(total_pixel * 0.005), 1)
+        else:
+            cfg.n_pixel_for_object_see = n_pixel_for_object_see
+            cfg.n_pixel_for_object_sense = n_pixel_for_object_sense
+        cfg.max_steps = max_steps
+        cfg.segment_input = self.segment_input
+        cfg.joint_visual_signal = joint_visual_signal
+        cfg.depth_signal = depth_signal
+        from .core import FAST_COLLISION_CHECK_SAMPLES
+        cfg.collision_samples = FAST_COLLISION_CHECK_SAMPLES
+        cfg.robot_height = self.house.floorHei + self.house.robotHei
+        cfg.discrete_actions = discrete_actions
+
+        self.room_target_object = dict()
+        if success_measure == 'see':
+            with open(self.env.config['roomTargetFile']) as csvFile:
+                for row in csv.DictReader(csvFile):
+                    c = (row['r'], row['g'], row['b'])
+                    self.room_target_object.setdefault(row['target_room'], []).append(c)
+
+        engine_type = objrender.VecRoomNavThread \
+            if isinstance(env.api, objrender.RenderAPIThread) else objrender.VecRoomNav
+        self.engine = engine_type(env.api, self.house._native, self.house._native_move_map(),
+                                  num_agents, cfg)
+        n_channel = self.engine.numChannels()
+        self.observation_space = spaces.Box(0, 255, shape=(resolution[1], resolution[0], n_channel))
+        if discrete_action:
+            self.action_space = spaces.Discrete(n_discrete_actions)
+        else:
+            self.action_space = spaces.Tuple([spaces.Box(0, 1, shape=(4,)), spaces.Box(0, 1, shape=(2,))])
+
+        self._target_ids = dict()   # room type -> (id of the target in engine, availCoors)
+        self.targets = [None] * num_agents
+
+    @property
+    def house(self):
+        return self.env.house
+
+    def _get_target(self, roomTp):
+        if roomTp not in self._target_ids:
+            house = self.house
+            house.setTargetRoom(roomTp)
+            if self.hardness is None:
+                availCoors = house.connectedCoors
+            else:
+                allowed_dist = house.maxConnDist * self.hardness
+                availCoors = [c for c in house.connectedCoors
+                              if house.connMap[c[0], c[1]] <= allowed_dist]
+            colors = np.array(self.room_target_object.get(roomTp, []), dtype=np.uint8).reshape(-1, 3)
+            _id = self.engine.addTarget(house.connMap, house.maxConnDist, colors)
+            self._target_ids[roomTp] = (_id, availCoors)
+        return self._target_ids[roomTp]
+
+    def reset_agent(self, i, target=None):
+        """
+        start a new episode of agent i towards the target room type <target>, or a random one
+        """
+        if target is None:
+            target = random.choice(self.house.all_desired_roomTypes)
+        else:
+            assert target in self.house.all_desired_roomTypes, '[VecRoomNavTask] desired target <{}> does not exist in the current house!'.format(target)
+        _id, availCoors = self._get_target(target)
+        gx, gy = random.choice(availCoors)
+        x, y = self.house.to_coor(gx, gy, True)
+        self.engine.resetAgent(i, x, y, np.random.rand() * 360 - 180, _id)
+        self.targets[i] = target
+
+    """
+    gym api: reset all agents, and return their (N, h, w, c) observations
+    """
+    def reset(self, targets=None):
+        for i in range(self.num_agents):
+            self.reset_agent(i, None if targets is None else targets[i])
+        return self.engine.observe(list(range(self.num_agents)))
+
+    """
+    gym api: step all agents with a list of N actions
+    return: obs, reward, done, info (a dictionary of arrays of the information of each agent)
+    """
+    def step(self, actions):
+        if self.discrete_action:
+            actions = np.asarray(actions, dtype=np.int64)
+        else:
+            act = np.array([a[0] for a in actions], dtype=np.float64).reshape(-1, 4)
+            rot = np.array([a[1] for a in actions], dtype=np.float64).reshape(-1, 2)
+            actions = np.stack([act[:, 0] - act[:, 1], act[:, 2] - act[:, 3],
+                                rot[:, 0] - rot[:, 1]], axis=1)
+        obs, reward, done, info = self.engine.step(actions)
+        info['target_room'] = list(self.targets)
+        done_ids = np.nonzero(done)[0].tolist()
+        if done_ids:
+            for i in done_ids:
+                self.reset_agent(i)
+            obs[done_ids] = self.engine.observe(done_ids)
+        return obs, reward, done, info
+
+
 if __name__ == '__main__':
     from .common import load_config
 
@@ -40,6 +40,90 @@ void Camera::turn(float dyaw, float dpitch) {
   updateDirection();
 }
 
+CameraBatch::CameraBatch(const std::vector<Camera>& cameras) {
+  resize(cameras.size());
+  for (size_t i = 0; i < cameras.size(); ++i)
+    set(i, cameras[i]);
+  if (cameras.size()) {
+    near = cameras[0].near;
+    far = cameras[0].far;
+    vertical_fov = cameras[0].vertical_fov;
+  }
+}
+
+void CameraBatch::resize(int n) {
+  Camera def{glm::vec3{0.f}};
+  pos.resize(3 * n, 0.f);
+  yaw.resize(n, def.yaw);
+  pitch.resize(n, def.pitch);
+}
+
+Camera CameraBatch::camera(int i) const {
+  Camera ret{position(i), yaw[i], pitch[i]};
+  ret.near = near;
+  ret.far = far;
+  ret.vertical_fov = vertical_fov;
+  return ret;
+}
+
+std::vector<Camera> CameraBatch::cameras() const {
+  std::vector<Camera> ret;
+  for (int i = 0; i < size(); ++i)
+    ret.push_back(camera(i));
+  return ret;
+}
+
+void CameraBatch::set(int i, const Camera& cam) {
+  pos[3 * i] = cam.pos.x;
+  pos[3 * i + 1] = cam.pos.y;
+  pos[3 * i + 2] = cam.pos.z;
+  yaw[i] = cam.yaw;
+  pitch[i] = cam.pitch;
+}
+
+void CameraBatch::matrices(const Geometry& geo, std::vector<glm::mat4>& out) const {
+  int n = size();
+  glm::mat4 projection = glm::perspective(
+      glm::radians(vertical_fov), (float)geo.w / geo.h, near, far);
+  out.resize(n);
+  // the same operations as Camera, so the matrices are exactly the same
+  for (int i = 0; i < n; ++i) {
+    float y = glm::radians(yaw[i]), p = glm::radians(pitch[i]);
+    glm::vec3 front{cos(y) * cos(p), sin(p), sin(y) * cos(p)};
+    front = glm::normalize(front);
+    glm::vec3 eye = position(i);
+    out[i] = projection * glm::lookAt(eye, eye + front, WORLD_UP);
+  }
+}
+
+CameraRig CameraRig::stereo(float baseline, float vertical_fov) {
+  CameraRig ret;
+  ret.views.resize(2);
+  ret.views[0].offset.x = -baseline / 2;
+  ret.views[1].offset.x = baseline / 2;
+  for (auto& v : ret.views)
+    v.vertical_fov = vertical_fov;
+  return ret;
+}
+
+Camera CameraRig::camera(const Camera& cam, int i) const {
+  const View& v = views[i];
+  glm::vec3 up = glm::normalize(glm::cross(cam.right, cam.front));
+  Camera ret = cam;
+  ret.pos = cam.pos + v.offset.x * cam.right + v.offset.y * up + v.offset.z * cam.front;
+  ret.turn(v.yaw, v.pitch);
+  if (v.vertical_fov > 0)
+    ret.vertical_fov = v.vertical_fov;
+  return ret;
+}
+
+std::vector<Camera> CameraRig::cameras(const Camera& cam) const {
+  std::vector<Camera> ret;
+  for (int i = 0; i < size(); ++i)
+    ret.push_back(camera(cam, i));
+  return ret;
+}
+
 CameraController::CameraController(GLFWwindow& window, Camera& cam):
   window_{window}, cam_(cam), keys_(NR_KEYS) {
     using namespace std::placeholders;
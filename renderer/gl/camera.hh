@@ -78,6 +78,60 @@ class Camera {
 
 };
 
+// The poses of n cameras of the same intrinsics, in arrays, so that e.g. the
+// agents of a vectorized environment are moved with one call instead of
+// one Camera at a time. The i-th camera is at (pos[3i], pos[3i+1],
+// pos[3i+2]) with yaw[i] and pitch[i], in degrees as Camera.
+class CameraBatch {
+  public:
+    std::vector<float> pos, yaw, pitch;
+    float near = DEFAULT_NEAR, far = DEFAULT_FAR;
+    float vertical_fov = DEFAULT_VERTICAL_FOV;
+
+    explicit CameraBatch(int n = 0) { resize(n); }
+    // of the poses and intrinsics of cameras[0]
+    explicit CameraBatch(const std::vector<Camera>& cameras);
+
+    int size() const { return yaw.size(); }
+    // new cameras are at the origin, with the default yaw and pitch of Camera
+    void resize(int n);
+
+    Camera camera(int i) const;
+    std::vector<Camera> cameras() const;
+    void set(int i, const Camera& cam);
+
+    // getCameraMatrix(geo) of every camera, with the projection computed once
+    void matrices(const Geometry& geo, std::vector<glm::mat4>& out) const;
+    glm::vec3 position(int i) const { return glm::vec3{pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]}; }
+};
+
+// Views at fixed poses relative to a Camera, e.g. the two eyes of a
+// stereo pair, or wide-angle side cameras. Unlike renderCubeMap(), the
+// orientations are free, and unlike a CameraBatch, the views follow one
+// camera: the rig moves and turns with it.
+class CameraRig {
+  public:
+    struct View {
+      // in meters along the right, up and front of the camera
+      glm::vec3 offset{0.f};
+      // in degrees, added to those of the camera
+      float yaw = 0.f, pitch = 0.f;
+      // in degrees. 0 uses the one of the camera
+      float vertical_fov = 0.f;
+    };
+    std::vector<View> views;
+
+    // Two parallel eyes, baseline apart: the left one first.
+    static CameraRig stereo(float baseline, float vertical_fov = 0.f);
+
+    int size() const { return views.size(); }
+
+    // The camera of views[i], for a rig at cam. cam.front and cam.right
+    // must be up to date, see Camera::updateDirection().
+    Camera camera(const Camera& cam, int i) const;
+    std::vector<Camera> cameras(const Camera& cam) const;
+};
+
 class CameraController {
   public:
     CameraController(GLFWwindow& window, Camera& cam);
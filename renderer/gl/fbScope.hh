@@ -7,11 +7,13 @@
 
 
 #pragma once
+#include <vector>
 #include "api.hh"
 
 #include "lib/geometry.hh"
 #include "lib/debugutils.hh"
 #include "lib/mat.h"
+#include "lib/profiler.hh"
 #include "lib/strutils.hh"
 #include "lib/imgproc.hh"
 
@@ -19,64 +21,151 @@ namespace render {
 
 class Framebuffer {
   public:
-    explicit Framebuffer(Geometry win_size): win_size_{win_size} {
+    // The color attachments are textures, so that they can be sampled
+    // by a post-processing pass (see ResolvePass).
+    // with_depth: whether to attach a depth-stencil buffer.
+    // nr_color: number of color attachments, for multiple render targets.
+    //  Fragment shader output `location = i` is written to attachment i.
+    // color_format: GL_RGBA8, GL_R32F for float outputs, or GL_R32UI for
+    //  integer outputs.
+    // samples: if > 0, the attachments are multisampled, for antialiasing.
+    //  Such a framebuffer can't be sampled or read: blit_to() another one.
+    explicit Framebuffer(Geometry win_size, bool with_depth=true, int nr_color=1,
+        GLenum color_format=GL_RGBA8, int samples=0):
+      win_size_{win_size}, samples_{samples}, tex(nr_color) {
       if (glGenFramebuffers == nullptr)
         error_exit("Pointer to glGenFramebuffers wasn't setup properly!");
+      m_assert(nr_color >= 1);
+      m_assert(color_format == GL_RGBA8 || color_format == GL_R32F ||
+          color_format == GL_R32UI);
+      GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+      if (color_format == GL_R32F) {
+        format = GL_RED;
+        type = GL_FLOAT;
+      } else if (color_format == GL_R32UI) {
+        format = GL_RED_INTEGER;
+        type = GL_UNSIGNED_INT;
+      }
 
       glGenFramebuffers(1, &fbo);
-      glGenRenderbuffers(2, rbo);
-      glBindRenderbuffer(GL_RENDERBUFFER, rbo[0]);
-      glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, win_size_.w, win_size_.h);
-
-      glBindRenderbuffer(GL_RENDERBUFFER, rbo[1]);
-      glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, win_size_.w, win_size_.h);
-
       glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo[0]);
-      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo[1]);
-
-      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+      glGenTextures(nr_color, tex.data());
+      std::vector<GLenum> draw_buffers;
+      GLenum target = samples_ > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+      for (int i = 0; i < nr_color; ++i) {
+        glBindTexture(target, tex[i]);
+        if (samples_ > 0) {
+          glTexImage2DMultisample(target, samples_, color_format,
+              win_size_.w, win_size_.h, GL_TRUE);
+        } else {
+          glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+          glTexImage2D(target, 0, color_format, win_size_.w, win_size_.h, 0,
+              format, type, nullptr);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, target, tex[i], 0);
+        draw_buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+      }
+      glBindTexture(target, 0);
+      glDrawBuffers(nr_color, draw_buffers.data());
+
+      rbo = 0;
+      if (with_depth) {
+        glGenRenderbuffers(1, &rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples_, GL_DEPTH24_STENCIL8,
+            win_size_.w, win_size_.h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+      }
 
       GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
       if (status != GL_FRAMEBUFFER_COMPLETE)
         error_exit(
           ssprintf("ERROR::FRAMEBUFFER: Framebuffer is not complete! ErrorCode=%d\n", status));
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator = (const Framebuffer&) = delete;
+
     void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
 
     void unbind() const { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
 
+    Geometry size() const { return win_size_; }
+
+    // the i-th color attachment
+    GLuint texture(int i=0) const { return tex[i]; }
+
+    int num_color_attachments() const { return tex.size(); }
+
+    int samples() const { return samples_; }
+
+    // Copy the first color attachment into the one of dst, of the same
+    // size, resolving the samples if this framebuffer is multisampled.
+    // flip: flip the rows, e.g. to read back a top-down image of an integer
+    //  attachment, which ResolvePass can't sample.
+    // Leaves no framebuffer bound.
+    void blit_to(const Framebuffer& dst, bool flip=false) const {
+      m_assert(win_size_.w == dst.win_size_.w && win_size_.h == dst.win_size_.h);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.fbo);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      int w = win_size_.w, h = win_size_.h;
+      glBlitFramebuffer(0, 0, w, h, 0, flip ? h : 0, w, flip ? 0 : h,
+          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
     Matuc capture() const {
       Matuc ret{win_size_.h, win_size_.w, 4};
-      glReadBuffer(GL_COLOR_ATTACHMENT0);
-      glReadPixels(0, 0, win_size_.w, win_size_.h,
-          GL_RGBA, GL_UNSIGNED_BYTE, ret.ptr());
-      // opengl returns a vertical-flipped image.
+      read_pixels(ret.ptr());
+      return rgba_to_rgb(ret.ptr(), win_size_);
+    }
 
+    // Issue glReadPixels of the first nr_rows (all rows by default) of the
+    // color attachment into dst, tightly packed.
+    // format: GL_RGBA, GL_RGB, GL_RG or GL_RED.
+    // type: GL_UNSIGNED_BYTE, GL_FLOAT for float attachments, or
+    //  GL_UNSIGNED_INT (with format GL_RED_INTEGER) for integer ones.
+    // If a GL_PIXEL_PACK_BUFFER is bound, dst is an offset into that buffer
+    // and the call returns without waiting for the transfer.
+    void read_pixels(void* dst, GLenum format=GL_RGBA, int nr_rows=-1,
+        GLenum type=GL_UNSIGNED_BYTE) const {
+      PROFILE_ZONE("readback");
+      if (nr_rows < 0)
+        nr_rows = win_size_.h;
+      int channels = format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_RG ? 2 : 1;
+      PROFILE_COUNT("readback_bytes",
+          (int64_t)win_size_.w * nr_rows * channels * (type == GL_UNSIGNED_BYTE ? 1 : 4));
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      glReadPixels(0, 0, win_size_.w, nr_rows,
+          format, type, dst);
+    }
 
-      Matuc ret3{win_size_.h, win_size_.w, 3};
-      for (int i = 0; i < ret3.height(); ++i) {
-        unsigned char* oldptr = ret.ptr(i);
-        unsigned char* newptr = ret3.ptr(win_size_.h - 1 - i);
-        for (int j = 0; j < ret3.width(); ++j) {
-          *(newptr++) = *(oldptr++);
-          *(newptr++) = *(oldptr++);
-          *(newptr++) = *(oldptr++);
-          oldptr ++;
-        }
-      }
+    // Convert the RGBA pixels returned by read_pixels() into a RGB image.
+    static Matuc rgba_to_rgb(const unsigned char* rgba, Geometry size) {
+      // opengl returns a vertical-flipped image.
+      Matuc ret3{size.h, size.w, 3};
+      for (int i = 0; i < ret3.height(); ++i)
+        ::rgba_to_rgb(rgba + (size_t)i * size.w * 4, ret3.ptr(size.h - 1 - i), size.w);
       return ret3;
     }
 
     ~Framebuffer() {
       glDeleteFramebuffers(1, &fbo);
-      glDeleteRenderbuffers(2, rbo);
+      glDeleteTextures(tex.size(), tex.data());
+      if (rbo)
+        glDeleteRenderbuffers(1, &rbo);
     }
 
   protected:
-    GLuint fbo, rbo[2];
+    GLuint fbo, rbo;
     Geometry win_size_;
+    int samples_;
+    std::vector<GLuint> tex;
 };
 
 
@@ -10,7 +10,12 @@
 #undef INCLUDE_GL_CONTEXT_HEADERS
 #include "glContext.hh"
 #include <iostream>
+#include <algorithm>
 #include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #ifdef __linux__
 #include <sys/stat.h>
@@ -28,6 +33,11 @@ namespace {
 std::atomic_int NUM_EGLCONTEXT_ALIVE{0};
 
 #ifdef __linux__
+// Contexts of the same device share one EGLDisplay, which must only be
+// terminated with its last context: eglTerminate() would also destroy the
+// others, and with them the objects they share.
+std::mutex EGL_DISPLAY_MUTEX;
+std::map<EGLDisplay, int> EGL_DISPLAY_REFCOUNT;
 const EGLint EGLconfigAttribs[] = {
   EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
   EGL_BLUE_SIZE, 8,
@@ -54,6 +64,49 @@ bool check_nvidia_readable(int device) {
   return true;
 }
 
+// The EGL devices, enumerated once per process
+struct EGLDevices {
+  std::vector<EGLDeviceEXT> all;
+  std::vector<int> visible;   // indices in all of the devices we can access
+  PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = nullptr;
+  std::string error;          // why there are none, if not empty
+};
+
+const EGLDevices& egl_devices() {
+  static const EGLDevices devs = []() {
+    EGLDevices ret;
+    static const int MAX_DEVICES = 16;
+    EGLDeviceEXT eglDevs[MAX_DEVICES];
+    EGLint numDevices = 0;
+    PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
+      (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    ret.eglGetPlatformDisplayEXT =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!eglQueryDevicesEXT or !ret.eglGetPlatformDisplayEXT) {
+      ret.error = "Failed to get function pointer of eglQueryDevicesEXT/eglGetPlatformDisplayEXT! Maybe EGL extensions are unsupported.";
+      return ret;
+    }
+
+    eglQueryDevicesEXT(MAX_DEVICES, eglDevs, &numDevices);
+    ret.all.assign(eglDevs, eglDevs + numDevices);
+    if (numDevices > 1) {  // we must be using nvidia GPUs
+      // cgroup may block our access to /dev/nvidiaX, but eglQueryDevices can still see them.
+      for (int i = 0; i < numDevices; ++i) {
+        if (check_nvidia_readable(i))
+          ret.visible.push_back(i);
+      }
+    } else if (numDevices == 1) {
+      // TODO we may still be using nvidia GPUs, but there is no way to tell.
+      // But it's very rare that you'll start a docker and hide the only one GPU from it.
+      ret.visible.push_back(0);
+    } else {
+      ret.error = "[EGL] eglQueryDevicesEXT() cannot find any EGL devices!";
+    }
+    return ret;
+  }();
+  return devs;
+}
+
 const int GLXcontextAttribs[] = {
     GLX_CONTEXT_MAJOR_VERSION_ARB, 3,
     GLX_CONTEXT_MINOR_VERSION_ARB, 3,
@@ -84,6 +137,15 @@ CGLPixelFormatAttribute CGLAttribs[4] = {
 
 namespace render {
 
+int numHeadlessDevices() {
+#ifdef __linux__
+  // without EGL, device 0 can still be used with GLX
+  return std::max<int>(egl_devices().visible.size(), 1);
+#else
+  return 1;
+#endif
+}
+
 void GLContext::init() {
   glViewport(0, 0, win_size_.w, win_size_.h);
 }
@@ -129,7 +191,8 @@ GLFWContext::~GLFWContext() {
 
 #ifdef __linux__
 // https://devblogs.nvidia.com/parallelforall/egl-eye-opengl-visualization-without-x-server/
-EGLContext::EGLContext(Geometry win_size, int device): GLContext{win_size} {
+EGLContext::EGLContext(Geometry win_size, int device, const EGLContext* share):
+    GLContext{win_size} {
   NUM_EGLCONTEXT_ALIVE.fetch_add(1);
   auto checkError = [](EGLBoolean succ) {
     EGLint err = eglGetError();
@@ -141,55 +204,40 @@ EGLContext::EGLContext(Geometry win_size, int device): GLContext{win_size} {
 
   // 1. Initialize EGL
   {
-    static const int MAX_DEVICES = 16;
-    EGLDeviceEXT eglDevs[MAX_DEVICES];
-    EGLint numDevices;
-    PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
-      (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
-    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
-      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
-    if (!eglQueryDevicesEXT or !eglGetPlatformDisplayEXT) {
-      error_exit("Failed to get function pointer of eglQueryDevicesEXT/eglGetPlatformDisplayEXT! Maybe EGL extensions are unsupported.");
-    }
-
-    eglQueryDevicesEXT(MAX_DEVICES, eglDevs, &numDevices);
-
-    std::vector<int> visible_devices;
-    if (numDevices > 1) {  // we must be using nvidia GPUs
-      // cgroup may block our access to /dev/nvidiaX, but eglQueryDevices can still see them.
-      for (int i = 0; i < numDevices; ++i) {
-        if (check_nvidia_readable(i))
-          visible_devices.push_back(i);
-      }
-    } else if (numDevices == 1) {
-      // TODO we may still be using nvidia GPUs, but there is no way to tell.
-      // But it's very rare that you'll start a docker and hide the only one GPU from it.
-      visible_devices.push_back(0);
-    } else {
-      error_exit("[EGL] eglQueryDevicesEXT() cannot find any EGL devices!");
+    const EGLDevices& devs = egl_devices();
+    if (devs.error.size())
+      error_exit(devs.error);
+    int num_devices = devs.all.size(), num_visible = devs.visible.size();
+    if (device >= num_visible) {
+      error_exit(ssprintf("[EGL] Request device %d but only found %d devices", device, num_visible));
     }
 
-    if (device >= static_cast<int>(visible_devices.size())) {
-      error_exit(ssprintf("[EGL] Request device %d but only found %lu devices", device, visible_devices.size()));
-    }
-
-    if (static_cast<int>(visible_devices.size()) == numDevices) {
-      cerr << "[EGL] Detected " << numDevices << " devices. Using device " << device << endl;
+    int physical = devs.visible[device];
+    if (num_visible == num_devices) {
+      cerr << "[EGL] Detected " << num_devices << " devices. Using device " << device << endl;
     } else {
-      cerr << "[EGL] " << visible_devices.size() << " out of " << numDevices <<
-          " devices are accessible. Using device " << device << " whose physical id is " << visible_devices[device] << "." << endl;
-      device = visible_devices[device];
+      cerr << "[EGL] " << num_visible << " out of " << num_devices <<
+          " devices are accessible. Using device " << device << " whose physical id is " << physical << "." << endl;
     }
-    eglDpy_ = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[device], 0);
+    eglDpy_ = devs.eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devs.all[physical], 0);
   }
 
   EGLint major, minor;
 
-  EGLBoolean succ = eglInitialize(eglDpy_, &major, &minor);
-  if (!succ) {
-    error_exit("Failed to initialize EGL display!");
+  EGLBoolean succ;
+  {
+    // so that the last context of another thread doesn't terminate the
+    // display between its initialization and its count
+    std::lock_guard<std::mutex> lg(EGL_DISPLAY_MUTEX);
+    succ = eglInitialize(eglDpy_, &major, &minor);
+    if (!succ) {
+      error_exit("Failed to initialize EGL display!");
+    }
+    checkError(succ);
+    EGL_DISPLAY_REFCOUNT[eglDpy_]++;
   }
-  checkError(succ);
+  if (share && share->eglDpy_ != eglDpy_)
+    error_exit("Cannot share objects with an EGL context of another device!");
 
   // 2. Select an appropriate configuration
   EGLint numConfigs;
@@ -213,8 +261,10 @@ EGLContext::EGLContext(Geometry win_size, int device): GLContext{win_size} {
   checkError(succ);
 
   // 5. Create a context and make it current
-  eglCtx_ = eglCreateContext(eglDpy_, eglCfg, (::EGLContext)0, NULL);
-  checkError(succ);
+  eglCtx_ = eglCreateContext(eglDpy_, eglCfg,
+      share ? share->eglCtx_ : (::EGLContext)0, NULL);
+  if (eglCtx_ == (::EGLContext)0)
+    error_exit(ssprintf("Failed to create EGL context! EGL error: %d", eglGetError()));
   succ = eglMakeCurrent(eglDpy_, eglSurf, eglSurf, eglCtx_);
   if (!succ)
     error_exit("Failed to make EGL context current!");
@@ -229,10 +279,18 @@ EGLContext::~EGLContext() {
   // print_debug("Inside ~EGLContext, #alive contexts=%d\n", num_alive);
   // 6. Terminate EGL when finished
   eglDestroyContext(eglDpy_, eglCtx_);
-  eglTerminate(eglDpy_);
+  std::lock_guard<std::mutex> lg(EGL_DISPLAY_MUTEX);
+  if (--EGL_DISPLAY_REFCOUNT[eglDpy_] == 0) {
+    EGL_DISPLAY_REFCOUNT.erase(eglDpy_);
+    eglTerminate(eglDpy_);
+  }
 }
 
-GLXHeadlessContext::GLXHeadlessContext(Geometry win_size): GLContext{win_size} {
+GLXHeadlessContext::GLXHeadlessContext(Geometry win_size, const GLXHeadlessContext* share):
+    GLContext{win_size} {
+  // contexts may be created and used by several threads
+  static std::once_flag xlib_threads;
+  std::call_once(xlib_threads, []() { XInitThreads(); });
   dpy_ = XOpenDisplay(NULL);
   if (dpy_ == nullptr)
     error_exit("Cannot connect to DISPLAY!");
@@ -244,10 +302,15 @@ GLXHeadlessContext::GLXHeadlessContext(Geometry win_size): GLContext{win_size} {
 
   // setup function pointers
   typedef GLXContext (*glXCreateContextAttribsARBProc)(Display*, GLXFBConfig, GLXContext, Bool, const int*);
-  static glXCreateContextAttribsARBProc glXCreateContextAttribsARB = NULL;
-  glXCreateContextAttribsARB = (glXCreateContextAttribsARBProc) glXGetProcAddressARB( (const GLubyte *) "glXCreateContextAttribsARB" );
-
-  context_ = glXCreateContextAttribsARB(dpy_, fbc[0], 0, True, GLXcontextAttribs);
+  glXCreateContextAttribsARBProc glXCreateContextAttribsARB = (glXCreateContextAttribsARBProc)
+    glXGetProcAddressARB( (const GLubyte *) "glXCreateContextAttribsARB" );
+
+  // share is on another connection to the same X server, which is fine for
+  // direct contexts in one process
+  context_ = glXCreateContextAttribsARB(dpy_, fbc[0],
+      share ? share->context_ : 0, True, GLXcontextAttribs);
+  if (context_ == nullptr)
+    error_exit("Cannot create GLX context!");
 
   pbuffer_ = glXCreatePbuffer(dpy_, fbc[0], GLXpbufferAttribs);
 
@@ -269,7 +332,8 @@ GLXHeadlessContext::~GLXHeadlessContext() {
 #endif
 
 #ifdef __APPLE__
-CGLHeadlessContext::CGLHeadlessContext(Geometry win_size): GLContext{win_size} {
+CGLHeadlessContext::CGLHeadlessContext(Geometry win_size, const CGLHeadlessContext* share):
+    GLContext{win_size} {
   auto checkError = [](CGLError err) {
     if (err == CGLError::kCGLNoError)
       return;
@@ -279,7 +343,7 @@ CGLHeadlessContext::CGLHeadlessContext(Geometry win_size): GLContext{win_size} {
   GLint num; // stores the number of possible pixel formats
   CGLError err = CGLChoosePixelFormat(CGLAttribs, &pix, &num);
   checkError(err);
-  err = CGLCreateContext(pix, nullptr, &context_); // second parameter can be another context for object sharing
+  err = CGLCreateContext(pix, share ? share->context_ : nullptr, &context_);
   checkError(err);
   CGLDestroyPixelFormat(pix);
   err = CGLSetCurrentContext(context_);
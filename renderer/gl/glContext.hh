@@ -12,6 +12,8 @@
 #undef INCLUDE_GL_CONTEXT_HEADERS
 
 #include "lib/geometry.hh"
+#include "lib/debugutils.hh"
+#include "lib/strutils.hh"
 
 namespace render {
 
@@ -42,9 +44,12 @@ class GLFWContext : public GLContext {
 
 #ifdef __linux__
 // Context for EGL (server-side OpenGL on some supported GPUs)
+// share: if not null, the new context shares its objects (buffers, textures,
+// programs and sync objects, but not VAOs or framebuffers) with share, which
+// must be an EGLContext of the same device.
 class EGLContext : public GLContext {
   public:
-    EGLContext(Geometry win_size, int device=0);
+    EGLContext(Geometry win_size, int device=0, const EGLContext* share=nullptr);
     ~EGLContext();
 
   protected:
@@ -53,9 +58,10 @@ class EGLContext : public GLContext {
 };
 
 // Context for GLX (OpenGL to X11)
+// share: see EGLContext.
 class GLXHeadlessContext : public GLContext {
   public:
-    GLXHeadlessContext(Geometry win_size);
+    GLXHeadlessContext(Geometry win_size, const GLXHeadlessContext* share=nullptr);
     ~GLXHeadlessContext();
 
   protected:
@@ -69,7 +75,7 @@ class GLXHeadlessContext : public GLContext {
 // Apple use CGL (Core OpenGL to initialize context)
 class CGLHeadlessContext : public GLContext {
   public:
-    CGLHeadlessContext(Geometry win_size);
+    CGLHeadlessContext(Geometry win_size, const CGLHeadlessContext* share=nullptr);
     ~CGLHeadlessContext();
 
   protected:
@@ -77,24 +83,45 @@ class CGLHeadlessContext : public GLContext {
 };
 #endif
 
+// The number of devices that createHeadlessContext() can use, enumerated
+// once per process. At least 1.
+int numHeadlessDevices();
+
 // Create a headless context, either EGLContext, GLXHeadlessContext, or CGLContext,
 // depending on OS, and DISPLAY environment variable
+// share: an existing context created by this function with the same device,
+//  to share objects with, or nullptr.
 // The caller owns the pointer.
-inline GLContext* createHeadlessContext(Geometry win_size, int device=0) {
+inline GLContext* createHeadlessContext(Geometry win_size, int device=0,
+    const GLContext* share=nullptr) {
+  // the type of share has to match the type to create
+  auto share_as = [share](const char* type, const GLContext* ctx) {
+    if (share && !ctx)
+      error_exit(ssprintf("Cannot share objects with a context that is not a %s!", type));
+  };
 #ifdef __APPLE__
   m_assert(device == 0);
-  return new CGLHeadlessContext{win_size};
+  auto cgl_share = dynamic_cast<const CGLHeadlessContext*>(share);
+  share_as("CGLHeadlessContext", cgl_share);
+  return new CGLHeadlessContext{win_size, cgl_share};
 #endif
 #ifdef __linux__
+  auto egl_share = dynamic_cast<const EGLContext*>(share);
 
   char* force_egl = std::getenv("HOUSE3D_FORCE_EGL");
-  if (force_egl != nullptr && std::atoi(force_egl) == 1)
-    return new EGLContext{win_size, device};
+  if (force_egl != nullptr && std::atoi(force_egl) == 1) {
+    share_as("EGLContext", egl_share);
+    return new EGLContext{win_size, device, egl_share};
+  }
 
   // prefer GLX (better compatibility with GPUs) when device=0
-  if (device == 0 and std::getenv("DISPLAY") != nullptr)
-      return new GLXHeadlessContext{win_size};
-  return new EGLContext{win_size, device};
+  if (device == 0 and std::getenv("DISPLAY") != nullptr) {
+    auto glx_share = dynamic_cast<const GLXHeadlessContext*>(share);
+    share_as("GLXHeadlessContext", glx_share);
+    return new GLXHeadlessContext{win_size, glx_share};
+  }
+  share_as("EGLContext", egl_share);
+  return new EGLContext{win_size, device, egl_share};
 #endif
   error_exit("Neither Apple nor Linux!");
 };
@@ -0,0 +1,117 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: gpuTimer.hh
+
+#pragma once
+#include <deque>
+#include <vector>
+
+#include "api.hh"
+
+#include "lib/profiler.hh"
+
+namespace render {
+
+// Time regions of GL commands on the GPU with GL_TIME_ELAPSED queries, and
+// record them as GPU zones of the Profiler. A query is read when its result
+// is available, by a later begin(), so the CPU never waits for the GPU.
+// Does nothing unless the Profiler is enabled.
+//
+// It must be used and destroyed with its context current. Regions can't
+// nest, as a context runs one GL_TIME_ELAPSED query at a time.
+class GpuTimer {
+  public:
+    GpuTimer() {}
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator = (const GpuTimer&) = delete;
+
+    ~GpuTimer() {
+      for (auto& q : pending_)
+        free_.push_back(q.id);
+      if (free_.size())
+        glDeleteQueries(free_.size(), free_.data());
+    }
+
+    // Returns whether the region is timed.
+    bool begin(int zone) {
+      if (active_ || !Profiler::enabled())
+        return false;
+      poll_(pending_.size() >= kMaxPending);
+      GLuint id;
+      if (free_.size()) {
+        id = free_.back();
+        free_.pop_back();
+      } else {
+        glGenQueries(1, &id);
+      }
+      glBeginQuery(GL_TIME_ELAPSED, id);
+      pending_.push_back(Query{id, zone, Profiler::now()});
+      active_ = true;
+      return true;
+    }
+
+    void end() {
+      if (!active_)
+        return;
+      glEndQuery(GL_TIME_ELAPSED);
+      active_ = false;
+    }
+
+  private:
+    // beyond this many, begin() waits for the oldest query
+    static constexpr size_t kMaxPending = 64;
+
+    struct Query {
+      GLuint id;
+      int zone;
+      int64_t issued;   // Profiler::now() at begin()
+    };
+    std::deque<Query> pending_;   // in the order they were issued
+    std::vector<GLuint> free_;
+    bool active_ = false;
+
+    // record the finished queries, and the oldest one anyway if wait
+    void poll_(bool wait) {
+      while (pending_.size()) {
+        auto& q = pending_.front();
+        if (!wait) {
+          GLint available = 0;
+          glGetQueryObjectiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available);
+          if (!available)
+            break;
+        }
+        wait = false;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(q.id, GL_QUERY_RESULT, &ns);
+        Profiler::record_gpu(q.zone, q.issued, ns);
+        free_.push_back(q.id);
+        pending_.pop_front();
+      }
+    }
+};
+
+// A region of GpuTimer from its construction to its destruction
+class GpuZone {
+  public:
+    GpuZone(GpuTimer& timer, int zone): timer_(timer), timed_{timer.begin(zone)} {}
+    ~GpuZone() {
+      if (timed_)
+        timer_.end();
+    }
+    GpuZone(const GpuZone&) = delete;
+    GpuZone& operator = (const GpuZone&) = delete;
+
+  private:
+    GpuTimer& timer_;
+    bool timed_;
+};
+
+// A GpuZone of a string literal name, as PROFILE_ZONE
+#define GPU_ZONE(timer, name) \
+  static const int PROFILE_CAT(_gpu_zone_id_, __LINE__) = ::render::Profiler::zone(name); \
+  ::render::GpuZone PROFILE_CAT(_gpu_zone_, __LINE__){timer, PROFILE_CAT(_gpu_zone_id_, __LINE__)}
+
+} // namespace render
@@ -0,0 +1,100 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: histogram.cc
+
+#include "histogram.hh"
+
+#include <algorithm>
+
+namespace render {
+
+const char* HistogramPass::vShader = R"xxx(
+#version 330 core
+uniform usampler2D src;
+uniform int nr_bin;
+uniform ivec2 bins_size;
+
+void main() {
+  // vertex i is pixel i of src
+  ivec2 size = textureSize(src, 0);
+  ivec2 p = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+  int bin = int(texelFetch(src, p, 0).r);
+  if (bin >= nr_bin) {
+    gl_Position = vec4(2.0f, 2.0f, 0.0f, 1.0f);   // clipped
+    return;
+  }
+  vec2 cell = vec2(bin % bins_size.x, bin / bins_size.x) + 0.5f;
+  gl_Position = vec4(cell / vec2(bins_size) * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+)xxx";
+
+const char* HistogramPass::fShader = R"xxx(
+#version 330 core
+out vec4 fragcolor;
+
+void main() {
+  fragcolor = vec4(1.0f, 0.0f, 0.0f, 1.0f);
+}
+)xxx";
+
+HistogramPass::HistogramPass(): shader_{vShader, fShader} {
+  src_loc_ = shader_.getUniformLocation("src");
+  nr_bin_loc_ = shader_.getUniformLocation("nr_bin");
+  bins_size_loc_ = shader_.getUniformLocation("bins_size");
+  glGenVertexArrays(1, VAO_);
+}
+
+HistogramPass::~HistogramPass() {
+  if (VAO_)
+    glDeleteVertexArrays(1, VAO_);
+}
+
+std::vector<int> HistogramPass::run(const Framebuffer& src, int nr_bin) {
+  m_assert(nr_bin > 0);
+  Geometry size{std::min(nr_bin, kBinsPerRow), (nr_bin + kBinsPerRow - 1) / kBinsPerRow};
+  if (!bins_ || bins_->size().w < size.w || bins_->size().h < size.h)
+    bins_.reset(new Framebuffer{size, false, 1, GL_R32F});
+  size = bins_->size();
+
+  bins_->bind();
+  glViewport(0, 0, size.w, size.h);
+  glClearColor(0.f, 0.f, 0.f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+  GLint blend_func[4];
+  glGetIntegerv(GL_BLEND_SRC_RGB, &blend_func[0]);
+  glGetIntegerv(GL_BLEND_DST_RGB, &blend_func[1]);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &blend_func[2]);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &blend_func[3]);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+
+  shader_.use();
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(src_loc_, 0);
+  glUniform1i(nr_bin_loc_, nr_bin);
+  glUniform2i(bins_size_loc_, size.w, size.h);
+  {
+    TextureGuard TG{src.texture()};
+    VertexArrayGuard VAG{VAO_};
+    glDrawArrays(GL_POINTS, 0, src.size().area());
+  }
+
+  glBlendFuncSeparate(blend_func[0], blend_func[1], blend_func[2], blend_func[3]);
+  if (!blend)
+    glDisable(GL_BLEND);
+  if (depth_test)
+    glEnable(GL_DEPTH_TEST);
+
+  std::vector<float> counts((size_t)size.area());
+  bins_->read_pixels(counts.data(), GL_RED, -1, GL_FLOAT);
+  bins_->unbind();
+  glCheckError("HistogramPass::run");
+  return std::vector<int>(counts.begin(), counts.begin() + nr_bin);
+}
+
+} // namespace render
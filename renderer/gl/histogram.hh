@@ -0,0 +1,51 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: histogram.hh
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "api.hh"
+#include "shader.hh"
+#include "fbScope.hh"
+#include "utils.hh"
+
+namespace render {
+
+// Counts the pixels of each value of an integer image on the GPU, so that
+// only the counts are read back instead of the image.
+//
+// Without compute shaders or atomics in GL 3.3, it draws one point per
+// pixel into the bin of its value, and adds them up with blending into a
+// float framebuffer. The counts are exact up to 2^24 pixels per bin.
+class HistogramPass {
+  public:
+    HistogramPass();
+    ~HistogramPass();
+    HistogramPass(const HistogramPass&) = delete;
+    HistogramPass& operator = (const HistogramPass&) = delete;
+
+    // Returns the number of pixels of each value in [0, nr_bin) of the
+    // first color attachment of src, which must be GL_R32UI. Larger values
+    // are not counted.
+    // Leaves no framebuffer bound, and the viewport changed.
+    std::vector<int> run(const Framebuffer& src, int nr_bin);
+
+  private:
+    // bins are laid out in rows of this many pixels
+    static const int kBinsPerRow = 1024;
+
+    Shader shader_;
+    GLint src_loc_, nr_bin_loc_, bins_size_loc_;
+    GLIntResource<GLuint> VAO_;
+    std::unique_ptr<Framebuffer> bins_;   // GL_R32F, grown on demand
+
+    static const char *vShader, *fShader;
+};
+
+} // namespace render
@@ -0,0 +1,115 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: pixelPack.hh
+
+#pragma once
+#include <vector>
+#include <queue>
+#include <cstring>
+#include <stdexcept>
+
+#include "api.hh"
+#include "fbScope.hh"
+
+#include "lib/debugutils.hh"
+#include "lib/mat.h"
+#include "lib/profiler.hh"
+
+namespace render {
+
+// A ring of pixel-pack buffers to read back a Framebuffer asynchronously.
+// start() queues a glReadPixels into a free buffer and returns immediately;
+// collect() waits for the oldest transfer and returns its image.
+// The framebuffer is expected to hold the final image (see ResolvePass), so
+// the image is returned as read, without any flip or conversion.
+// So the GPU -> CPU copy of frame N overlaps with the drawing of frame N+1.
+class PixelPackRing {
+  public:
+    PixelPackRing(Geometry size, int nr_buffer=2):
+      size_{size}, pbo_(nr_buffer), fence_(nr_buffer, nullptr), channels_(nr_buffer, 0) {
+      GLsizeiptr bytes = (GLsizeiptr)size_.area() * 4;
+      glGenBuffers(nr_buffer, pbo_.data());
+      for (auto b : pbo_) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, b);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    PixelPackRing(const PixelPackRing&) = delete;
+    PixelPackRing& operator = (const PixelPackRing&) = delete;
+
+    ~PixelPackRing() {
+      for (auto f : fence_)
+        if (f)
+          glDeleteSync(f);
+      glDeleteBuffers(pbo_.size(), pbo_.data());
+    }
+
+    int capacity() const { return pbo_.size(); }
+    int pending() const { return pending_.size(); }
+    bool full() const { return pending() == capacity(); }
+
+    // fb must be bound, and have the same size as this ring.
+    // format: one of GL_RGBA, GL_RGB, GL_RG, GL_RED.
+    void start(const Framebuffer& fb, GLenum format) {
+      m_assert(fb.size().w == size_.w && fb.size().h == size_.h);
+      if (full())
+        throw std::runtime_error("PixelPackRing::start(): all pixel-pack buffers are in flight!");
+      int slot = next_;
+      next_ = (next_ + 1) % capacity();
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[slot]);
+      fb.read_pixels(nullptr, format);
+      channels_[slot] = format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_RG ? 2 : 1;
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      fence_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      // make sure the commands reach the GPU, so the fence can signal
+      // while the caller keeps working on the CPU.
+      glFlush();
+      pending_.push(slot);
+    }
+
+    // Block until the oldest transfer finishes, and return its image.
+    Matuc collect() {
+      PROFILE_ZONE("collect");
+      if (pending_.empty())
+        throw std::runtime_error("PixelPackRing::collect(): no pending readback!");
+      int slot = pending_.front();
+      pending_.pop();
+
+      const GLuint64 timeout = 1000000000;  // 1s, in nanoseconds
+      GLenum status;
+      do {
+        status = glClientWaitSync(fence_[slot], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+      } while (status == GL_TIMEOUT_EXPIRED);
+      if (status == GL_WAIT_FAILED)
+        error_exit("PixelPackRing::collect(): glClientWaitSync failed!");
+      glDeleteSync(fence_[slot]);
+      fence_[slot] = nullptr;
+
+      Matuc ret = Matuc::pooled(size_.h, size_.w, channels_[slot]);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[slot]);
+      auto ptr = glMapBufferRange(
+            GL_PIXEL_PACK_BUFFER, 0, ret.elements(), GL_MAP_READ_BIT);
+      if (ptr == nullptr)
+        error_exit("PixelPackRing::collect(): glMapBufferRange failed!");
+      memcpy(ret.ptr(), ptr, ret.elements());
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      return ret;
+    }
+
+  private:
+    Geometry size_;
+    std::vector<GLuint> pbo_;
+    std::vector<GLsync> fence_;
+    std::vector<int> channels_;
+    std::queue<int> pending_;   // slots in flight, oldest first
+    int next_ = 0;
+};
+
+}
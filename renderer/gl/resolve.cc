@@ -0,0 +1,98 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: resolve.cc
+
+#include "resolve.hh"
+
+namespace render {
+
+const char* ResolvePass::vShader = R"xxx(
+#version 330 core
+void main() {
+  // a single triangle covering the viewport
+  vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(p * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+)xxx";
+
+const char* ResolvePass::fShader = R"xxx(
+#version 330 core
+out vec4 fragcolor;
+
+uniform sampler2D src;
+uniform uint packing;
+uniform int scale;  // src is scale times larger than the output
+// 0: rgb
+// 1: depth + infinity mask
+// 2: float, with 0 for infinity
+
+void main() {
+  ivec2 size = textureSize(src, 0) / scale;
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  // opengl is bottom-up. Write row y from row h-1-y so that glReadPixels
+  // returns a top-down image.
+  ivec2 q = ivec2(p.x, size.y - 1 - p.y) * scale;
+  vec4 c = texelFetch(src, q, 0);
+  if (packing == 0u && scale > 1) {
+    // box filter
+    c = vec4(0.0f);
+    for (int i = 0; i < scale; ++i)
+      for (int j = 0; j < scale; ++j)
+        c += texelFetch(src, q + ivec2(i, j), 0);
+    c /= float(scale * scale);
+  }
+  if (packing == 1u) {
+    // depth mode draws the depth into all of r, g, b. Other colors are background.
+    if (c.r == c.g && c.g == c.b)
+      fragcolor = vec4(c.r, 0.0f, 0.0f, 1.0f);
+    else
+      fragcolor = vec4(0.0f, 1.0f, 0.0f, 1.0f);
+  } else if (packing == 2u) {
+    fragcolor = vec4(c.r > 0.0f ? c.r : uintBitsToFloat(0x7F800000u), 0.0f, 0.0f, 1.0f);
+  } else {
+    fragcolor = vec4(c.rgb, 1.0f);
+  }
+}
+)xxx";
+
+ResolvePass::ResolvePass(): shader_{vShader, fShader} {
+  src_loc_ = shader_.getUniformLocation("src");
+  packing_loc_ = shader_.getUniformLocation("packing");
+  scale_loc_ = shader_.getUniformLocation("scale");
+  // core profile needs a VAO bound even if there are no attributes
+  glGenVertexArrays(1, VAO_);
+}
+
+ResolvePass::~ResolvePass() {
+  if (VAO_)
+    glDeleteVertexArrays(1, VAO_);
+}
+
+void ResolvePass::run(const Framebuffer& src, const Framebuffer& dst, Packing packing,
+    int attachment) {
+  int scale = src.size().w / dst.size().w;
+  m_assert(src.size().w == dst.size().w * scale && src.size().h == dst.size().h * scale);
+  dst.bind();
+  glViewport(0, 0, dst.size().w, dst.size().h);
+  GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+  glDisable(GL_DEPTH_TEST);
+
+  shader_.use();
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(src_loc_, 0);
+  glUniform1ui(packing_loc_, static_cast<GLuint>(packing));
+  glUniform1i(scale_loc_, scale);
+  TextureGuard TG{src.texture(attachment)};
+  {
+    VertexArrayGuard VAG{VAO_};
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+  if (depth_test)
+    glEnable(GL_DEPTH_TEST);
+  glCheckError("ResolvePass::run");
+}
+
+} // namespace render
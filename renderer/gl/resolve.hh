@@ -0,0 +1,74 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: resolve.hh
+
+#pragma once
+
+#include "api.hh"
+#include "shader.hh"
+#include "fbScope.hh"
+#include "utils.hh"
+
+namespace render {
+
+// A full-screen pass which copies the color attachment of a Framebuffer into
+// another one, flipped vertically and packed to the output layout, so that
+// glReadPixels on the destination returns the final image without any
+// post-processing on the CPU.
+class ResolvePass {
+  public:
+    enum class Packing : GLuint {
+      RGB = 0,         // 3 channels
+      DEPTH_MASK = 1,  // 2 channels: (depth, infinity mask). See SUNCGRenderAPI::render()
+      // 1 float channel, from a GL_R32F attachment where 0 means nothing
+      // was drawn, which becomes +inf. See SUNCGRenderAPI::renderDepth()
+      FLOAT = 2,
+    };
+
+    ResolvePass();
+    ~ResolvePass();
+    ResolvePass(const ResolvePass&) = delete;
+    ResolvePass& operator = (const ResolvePass&) = delete;
+
+    // Resolve the color attachment `attachment` of src into dst.
+    // src must have the size of dst, or an integer multiple k of it in both
+    // dimensions: each pixel of dst is then the average of a k x k block of
+    // src for Packing::RGB, and its first pixel for the other packings,
+    // whose values can't be averaged.
+    // Leaves dst bound, with the viewport set to its size.
+    void run(const Framebuffer& src, const Framebuffer& dst, Packing packing,
+        int attachment=0);
+
+    static int channels(Packing packing) {
+      switch (packing) {
+        case Packing::RGB: return 3;
+        case Packing::DEPTH_MASK: return 2;
+        default: return 1;
+      }
+    }
+
+    // the glReadPixels format to read the result of run()
+    static GLenum format(Packing packing) {
+      switch (packing) {
+        case Packing::RGB: return GL_RGB;
+        case Packing::DEPTH_MASK: return GL_RG;
+        default: return GL_RED;
+      }
+    }
+
+    // the glReadPixels type to read the result of run()
+    static GLenum type(Packing packing)
+    { return packing == Packing::FLOAT ? GL_FLOAT : GL_UNSIGNED_BYTE; }
+
+  private:
+    Shader shader_;
+    GLint src_loc_, packing_loc_, scale_loc_;
+    GLIntResource<GLuint> VAO_;
+
+    static const char *vShader, *fShader;
+};
+
+} // namespace render
@@ -22,35 +22,25 @@ namespace render {
 class Shader {
   public:
     // Constructor generates the shader on the fly
-    Shader(const char* vertexShader, const char* fragmentShader) {
+    Shader(const char* vertexShader, const char* fragmentShader):
+      Shader{vertexShader, nullptr, fragmentShader} {}
+
+    // geometryShader can be nullptr
+    Shader(const char* vertexShader, const char* geometryShader,
+        const char* fragmentShader) {
       // 2. Compile shaders
+      auto vertex = compile_(GL_VERTEX_SHADER, vertexShader, "VERTEX");
+      GLuint geometry = 0;
+      if (geometryShader)
+        geometry = compile_(GL_GEOMETRY_SHADER, geometryShader, "GEOMETRY");
+      auto fragment = compile_(GL_FRAGMENT_SHADER, fragmentShader, "FRAGMENT");
+      // Shader Program
       GLint success;
       GLchar infoLog[512];
-      // Vertex Shader
-      auto vertex = glCreateShader(GL_VERTEX_SHADER);
-      glShaderSource(vertex, 1, &vertexShader, NULL);
-      glCompileShader(vertex);
-      // Print compile errors if any
-      glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-      if (!success) {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        error_exit(ssprintf(
-              "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s\n", infoLog));
-      }
-      // Fragment Shader
-      auto fragment = glCreateShader(GL_FRAGMENT_SHADER);
-      glShaderSource(fragment, 1, &fragmentShader, NULL);
-      glCompileShader(fragment);
-      // Print compile errors if any
-      glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-      if (!success) {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-        error_exit(ssprintf(
-              "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s\n", infoLog));
-      }
-      // Shader Program
       this->Program = glCreateProgram();
       glAttachShader(this->Program, vertex);
+      if (geometry)
+        glAttachShader(this->Program, geometry);
       glAttachShader(this->Program, fragment);
       glLinkProgram(this->Program);
       // Print linking errors if any
@@ -62,6 +52,8 @@ class Shader {
       }
       // Delete the shaders as they're linked into our program now and no longer necessery
       glDeleteShader(vertex);
+      if (geometry)
+        glDeleteShader(geometry);
       glDeleteShader(fragment);
     }
 
@@ -82,6 +74,23 @@ class Shader {
 
   protected:
     GLuint Program;
+
+  private:
+    static GLuint compile_(GLenum type, const char* source, const char* name) {
+      GLint success;
+      GLchar infoLog[512];
+      auto shader = glCreateShader(type);
+      glShaderSource(shader, 1, &source, NULL);
+      glCompileShader(shader);
+      // Print compile errors if any
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+      if (!success) {
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        error_exit(ssprintf(
+              "ERROR::SHADER::%s::COMPILATION_FAILED\n%s\n", name, infoLog));
+      }
+      return shader;
+    }
 };
 
 } // namespace
@@ -0,0 +1,96 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bitgrid.cc
+
+#include "bitgrid.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "debugutils.hh"
+
+using namespace std;
+
+namespace render {
+
+BitGrid BitGrid::dilate(const vector<Run>& kernel, bool outside) const {
+  BitGrid ret(rows_, cols_);
+  if (rows_ == 0 || cols_ == 0 || kernel.empty())
+    return ret;
+  const uint64_t fill = outside ? ~uint64_t(0) : 0;
+
+  // the runs of different (lo, hi), and the guard words a row needs on each
+  // side so that shifting by any lo..hi stays in its buffer
+  vector<pair<int, int>> spans;
+  int reach = 0;
+  for (auto& r : kernel) {
+    m_assert(r.lo <= r.hi);
+    auto span = make_pair(r.lo, r.hi);
+    if (find(spans.begin(), spans.end(), span) == spans.end())
+      spans.push_back(span);
+    reach = max(reach, max(abs(r.lo), abs(r.hi)));
+  }
+  const int guard = reach / 64 + 1;
+  const int padded = stride_ + 2 * guard;
+
+  // horizontal pass: hor[s] is the dilation of each row by spans[s]
+  vector<vector<uint64_t>> hor(spans.size(), vector<uint64_t>((size_t)rows_ * stride_));
+  vector<uint64_t> buf(padded);
+  const int tail = cols_ & 63;
+  for (int x = 0; x < rows_; ++x) {
+    fill_n(buf.begin(), guard, fill);
+    copy(row(x), row(x) + stride_, buf.begin() + guard);
+    fill_n(buf.begin() + guard + stride_, guard, fill);
+    if (tail)
+      buf[guard + stride_ - 1] |= fill << tail;
+    // the 64 bits from bit pos of the row on
+    auto bits_at = [&](int pos) {
+      int q = (pos >> 6) + guard, s = pos & 63;
+      return s ? (buf[q] >> s) | (buf[q + 1] << (64 - s)) : buf[q];
+    };
+    for (size_t s = 0; s < spans.size(); ++s) {
+      uint64_t* dst = hor[s].data() + (size_t)x * stride_;
+      for (int w = 0; w < stride_; ++w) {
+        uint64_t v = 0;
+        for (int k = spans[s].first; k <= spans[s].second; ++k)
+          v |= bits_at(w * 64 + k);
+        dst[w] = v;
+      }
+    }
+  }
+
+  // vertical pass: or the rows of each run
+  for (int x = 0; x < rows_; ++x) {
+    uint64_t* dst = ret.bits_.data() + (size_t)x * stride_;
+    for (auto& r : kernel) {
+      int src = x + r.dx;
+      if (src < 0 || src >= rows_) {
+        if (outside)
+          fill_n(dst, stride_, fill);
+        continue;
+      }
+      size_t s = find(spans.begin(), spans.end(), make_pair(r.lo, r.hi)) - spans.begin();
+      const uint64_t* h = hor[s].data() + (size_t)src * stride_;
+      for (int w = 0; w < stride_; ++w)
+        dst[w] |= h[w];
+    }
+    if (tail)
+      dst[stride_ - 1] &= (uint64_t(1) << tail) - 1;
+  }
+  return ret;
+}
+
+vector<BitGrid::Run> BitGrid::disc(int radius) {
+  vector<Run> ret;
+  for (int dx = -radius; dx <= radius; ++dx) {
+    int hi = (int)floor(sqrt((double)radius * radius - dx * dx) + 1e-9);
+    ret.push_back(Run{dx, -hi, hi});
+  }
+  return ret;
+}
+
+}
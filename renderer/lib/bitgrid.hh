@@ -0,0 +1,55 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bitgrid.hh
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace render {
+
+// A 2D grid of bits, indexed by (x, y) with y the fastest. Each row is
+// packed to 64 cells per word, so morphology runs on 64 cells at a time.
+class BitGrid {
+  public:
+    // A row of a structuring element: the cells (dx, lo..hi) around the origin.
+    struct Run { int dx, lo, hi; };
+
+    BitGrid() = default;
+    BitGrid(int rows, int cols):
+      rows_{rows}, cols_{cols}, stride_{(cols + 63) / 64},
+      bits_((size_t)rows * stride_, 0) {}
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    bool get(int x, int y) const {
+      return (bits_[(size_t)x * stride_ + (y >> 6)] >> (y & 63)) & 1;
+    }
+    void set(int x, int y) { bits_[(size_t)x * stride_ + (y >> 6)] |= uint64_t(1) << (y & 63); }
+
+    // the words of row x. Bits after cols() in the last word are 0.
+    const uint64_t* row(int x) const { return bits_.data() + (size_t)x * stride_; }
+    int words_per_row() const { return stride_; }
+
+    size_t bytes() const { return bits_.size() * sizeof(uint64_t); }
+
+    // The dilation by kernel: ret(x, y) is set if any of the cells
+    // (x + dx, y + lo..hi) of a run is set, where cells outside the grid are
+    // outside. The runs of kernel take distinct rows.
+    BitGrid dilate(const std::vector<Run>& kernel, bool outside) const;
+
+    // The cells (dx, dy) with dx^2 + dy^2 <= radius^2.
+    static std::vector<Run> disc(int radius);
+
+  private:
+    int rows_ = 0, cols_ = 0, stride_ = 0;
+    std::vector<uint64_t> bits_;
+};
+
+}
@@ -0,0 +1,58 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bufpool.cc
+
+#include "bufpool.hh"
+
+#include <new>
+
+namespace render {
+
+BufferPool& BufferPool::global() {
+  static BufferPool* pool = new BufferPool;
+  return *pool;
+}
+
+BufferPool::~BufferPool() {
+  for (auto& pair : free_)
+    for (void* p : pair.second)
+      ::operator delete(p);
+}
+
+void* BufferPool::acquire(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lg(mutex_);
+    auto itr = free_.find(bytes);
+    if (itr != free_.end() && itr->second.size()) {
+      void* ret = itr->second.back();
+      itr->second.pop_back();
+      stats_.free_bytes -= bytes;
+      stats_.hits++;
+      return ret;
+    }
+    stats_.misses++;
+  }
+  return ::operator new(bytes);
+}
+
+void BufferPool::release(void* ptr, size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lg(mutex_);
+    if (stats_.free_bytes + bytes <= kMaxFreeBytes) {
+      auto itr = free_.find(bytes);
+      if (itr == free_.end())
+        itr = free_.emplace(bytes, std::vector<void*>{}).first;
+      if ((int)itr->second.size() < kMaxFreePerSize) {
+        itr->second.push_back(ptr);
+        stats_.free_bytes += bytes;
+        return;
+      }
+    }
+  }
+  ::operator delete(ptr);
+}
+
+} // namespace render
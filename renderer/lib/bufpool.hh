@@ -0,0 +1,62 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bufpool.hh
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace render {
+
+// A thread-safe pool of memory blocks by size, so that buffers of the same
+// size allocated over and over (e.g. one image per rendered frame) reuse
+// the memory of the ones freed before, instead of going to the heap.
+// Only the frames read back by the renderers use it (see Mat::pooled()):
+// other images, e.g. textures, are allocated once and would only pin
+// memory in the pool.
+//
+// Blocks are bucketed by their exact size, as frames come in a few fixed
+// sizes. At most kMaxFreePerSize free blocks of each size, and
+// kMaxFreeBytes in total, are kept; the others are freed to the heap.
+class BufferPool {
+  public:
+    // The pool of Mat::pooled(). Never destroyed, so that Mats may be
+    // freed during static destruction.
+    static BufferPool& global();
+
+    BufferPool() {}
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator = (const BufferPool&) = delete;
+
+    // a block of `bytes` bytes, aligned for any type
+    void* acquire(size_t bytes);
+    // give back a block from acquire(bytes)
+    void release(void* ptr, size_t bytes);
+
+    struct Stats {
+      size_t hits = 0, misses = 0;  // of acquire()
+      size_t free_bytes = 0;    // currently kept in the pool
+    };
+    Stats stats() const {
+      std::lock_guard<std::mutex> lg(mutex_);
+      return stats_;
+    }
+
+    // small, as every process of a multi-process setup has its own pool
+    static const int kMaxFreePerSize = 4;
+    static const size_t kMaxFreeBytes = 32UL << 20;
+
+  private:
+    mutable std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<void*>> free_;   // by size
+    Stats stats_;
+};
+
+} // namespace render
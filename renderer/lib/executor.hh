@@ -7,19 +7,28 @@
 
 #pragma once
 
-#include <queue>
 #include <mutex>
 #include <atomic>
-#include <future>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <new>
 #include <thread>
-#include <iostream>
+#include <utility>
+#include <vector>
 #include "lib/debugutils.hh"
+#include "lib/mpscqueue.hh"
 
 
 namespace render {
 
 
 // Run something (rendering) in a dedicated thread
+//
+// Jobs are passed through a lock-free queue. Both the thread waiting for
+// jobs and the callers of execute_sync() spin for a while before sleeping
+// on a condition variable, so that a job submitted right after the last one
+// is handed over without waking up a thread.
 class ExecutorInThread {
   public:
     ExecutorInThread() {
@@ -29,78 +38,150 @@ class ExecutorInThread {
     ~ExecutorInThread() { stop(); }
 
     // Run job in the dedicated thread and return the result.
-    template <typename T>
-    T execute_sync(std::function<T()>&& job) {
-      std::packaged_task<T()> task(job);
-      auto res = task.get_future();
-      execute_async([&task]() { task(); });
-      auto r = res.get();
-      return r;
+    // Exceptions of job are rethrown in the caller.
+    template <typename T, typename F>
+    T execute_sync(F&& job) {
+      Result<T> res;
+      SyncCall call{[&]() { new (res.buf) T(job()); res.has = true; }};
+      run_sync_(call);
+      return std::move(*res.ptr());
     }
 
-    void execute_sync(std::function<void()>&& job) {
-      std::packaged_task<void()> task(job);
-      auto res = task.get_future();
-      execute_async([&task]() { task(); });
-      res.wait();
+    template <typename F>
+    void execute_sync(F&& job) {
+      SyncCall call{[&]() { job(); }};
+      run_sync_(call);
+    }
+
+    // Run jobs in order in the dedicated thread, with a single handoff, and
+    // wait for them. Stops at the first job that throws, and rethrows it.
+    void execute_batch(const std::vector<std::function<void()>>& jobs) {
+      execute_sync([&]() {
+          for (auto& job : jobs)
+            job();
+        });
     }
 
     // push job to the queue for future execution in the dedicated thread
     void execute_async(std::function<void()>&& job) {
-      std::lock_guard<std::mutex> lg(mutex_);
-      jobs_.emplace(job);
-      cv.notify_one();
+      jobs_.push(std::move(job));
+      // pairs with the fence in work(), so that either the worker sees the
+      // job, or we see it sleeping
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleeping_.load()) {
+        std::lock_guard<std::mutex> lg(mutex_);
+        cv_.notify_one();
+      }
     }
 
     void work() {
-      std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
-      while (!stopped.load()) {
-        lk.lock();
-        if (! jobs_.empty()) {
-          //print_debug("Not Empty\n");
-          auto job = jobs_.front();
-          jobs_.pop();
-          lk.unlock();
+      std::function<void()> job;
+      while (true) {
+        if (jobs_.pop(job)) {
           job();
-          //print_debug("Finsih Run Job\n");
-        } else {  // just wait on cv
-          //print_debug("Empty, watiing\n");
-          cv.wait(lk);
-          lk.unlock();
-          //print_debug("Done watining\n");
+          job = nullptr;
+          continue;
         }
-      }
-
-      //print_debug("Clean up job queue \n");
-      std::lock_guard<std::mutex> lg(mutex_);
-      while (jobs_.size()) {
-        auto job = jobs_.front();
-        jobs_.pop();
-        job();
+        if (stopped_.load())
+          break;
+        if (spin_until_([this]() { return !this->jobs_.empty(); }))
+          continue;
+        std::unique_lock<std::mutex> lk(mutex_);
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_.wait(lk, [this]() { return !this->jobs_.empty() || this->stopped_.load(); });
+        sleeping_.store(false);
       }
     }
 
     void stop() {
-      //print_debug("Stopping ...\n");
-      stopped.store(true);
+      stopped_.store(true);
       {
         std::lock_guard<std::mutex> lg(mutex_);
-        cv.notify_one();
+        cv_.notify_one();
       }
       if (th_.joinable())
         th_.join();
     }
 
   private:
+    // up to about a hundred microseconds: longer than the gap between the
+    // jobs of a busy caller, shorter than a frame
+    static constexpr int kSpinIters = 4096;
+
+    // storage for the result of execute_sync(), which needn't be default-constructible
+    template <typename T>
+    struct Result {
+      alignas(T) unsigned char buf[sizeof(T)];
+      bool has = false;
+      T* ptr() { return reinterpret_cast<T*>(buf); }
+      ~Result() { if (has) ptr()->~T(); }
+    };
+
+    // a job of execute_sync(), on the stack of the caller
+    struct SyncCall {
+      explicit SyncCall(std::function<void()> job): job{std::move(job)} {}
+      std::function<void()> job;
+      std::exception_ptr error;
+      std::atomic_bool done{false};
+    };
+
     std::thread th_;
 
+    MPSCQueue<std::function<void()>> jobs_;
+    std::atomic_bool stopped_{false};
+    std::atomic_bool sleeping_{false};   // the worker waits on cv_
     std::mutex mutex_;
+    std::condition_variable cv_;
+
+    // callers of execute_sync() sleeping until their call is done
+    std::atomic<int> nr_waiting_{0};
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      asm volatile("yield");
+#endif
+    }
 
-    std::atomic_bool stopped{false};
-
-    std::condition_variable cv;
-    std::queue<std::function<void()>> jobs_;
+    template <typename P>
+    static bool spin_until_(P pred) {
+      for (int i = 0; i < kSpinIters; ++i) {
+        if (pred())
+          return true;
+        cpu_relax();
+      }
+      return false;
+    }
 
+    void run_sync_(SyncCall& call) {
+      SyncCall* c = &call;
+      // captures a single pointer, so std::function doesn't allocate
+      execute_async([this, c]() {
+          try {
+            c->job();
+          } catch (...) {
+            c->error = std::current_exception();
+          }
+          // c may be gone as soon as done is set
+          c->done.store(true);
+          if (this->nr_waiting_.load()) {
+            std::lock_guard<std::mutex> lg(this->done_mutex_);
+            this->done_cv_.notify_all();
+          }
+        });
+      if (!spin_until_([c]() { return c->done.load(std::memory_order_acquire); })) {
+        std::unique_lock<std::mutex> lk(done_mutex_);
+        nr_waiting_.fetch_add(1);
+        done_cv_.wait(lk, [c]() { return c->done.load(); });
+        nr_waiting_.fetch_sub(1);
+      }
+      if (call.error)
+        std::rethrow_exception(call.error);
+    }
 };
 
 
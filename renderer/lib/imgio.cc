@@ -30,14 +30,20 @@ Matuc read_img(const char* fname) {
 	Matuc mat(img.height(), img.width(), (channel == 1 ? 3: channel));
 	m_assert(mat.rows() > 1 && mat.cols() > 1);
 
-  REP(i, mat.rows())
-    REP(j, mat.cols())
-		  if (channel == 1)
-				REP(k, 3)
-					mat.at(i, j, k) = img(j, i, 0);
-			else
-	      REP(k, channel)
-	        mat.at(i, j, k) = img(j, i, k);
+	// CImg stores each channel as a separate plane
+	int nr_plane = channel == 1 ? 1 : channel, nc = mat.channels();
+	const unsigned char* planes[4];
+	REP(k, nc)
+		planes[k] = img.data(0, 0, 0, k < nr_plane ? k : 0);
+	REP(i, mat.rows()) {
+		unsigned char* dst = mat.ptr(i);
+		size_t offset = (size_t)i * mat.cols();
+		REP(k, nc) {
+			const unsigned char* src = planes[k] + offset;
+			REP(j, mat.cols())
+				dst[j * nc + k] = src[j];
+		}
+	}
 	return mat;
 }
 
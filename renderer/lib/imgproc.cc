@@ -8,9 +8,18 @@
 
 #include "imgproc.hh"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define IMGPROC_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "utils.hh"
 #include "debugutils.hh"
 #include "timer.hh"
@@ -19,6 +28,136 @@ using namespace std;
 
 namespace {
 
+// SIMD kernels, with the scalar versions for the tails and other CPUs.
+// On x86 the widest one the CPU supports is picked at runtime, since the
+// binaries may be built without -mavx2.
+
+void rgba_to_rgb_scalar(const unsigned char* src, unsigned char* dst, int n) {
+	for (int i = 0; i < n; ++i) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		src += 4;
+		dst += 3;
+	}
+}
+
+void f2uc_scalar(const float* src, unsigned char* dst, int n) {
+	for (int i = 0; i < n; ++i)
+		dst[i] = src[i] * 255.0f;
+}
+
+#ifdef IMGPROC_X86
+__attribute__((target("ssse3")))
+void rgba_to_rgb_ssse3(const unsigned char* src, unsigned char* dst, int n) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i = 0;
+	// 4 pixels per step; each 16-byte store writes 4 bytes past the 12 of
+	// the step, so stop while they still fit in dst
+	for (; i + 6 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		_mm_storeu_si128((__m128i*)(dst + i * 3), _mm_shuffle_epi8(v, shuffle));
+	}
+	rgba_to_rgb_scalar(src + i * 4, dst + i * 3, n - i);
+}
+
+__attribute__((target("avx2")))
+void rgba_to_rgb_avx2(const unsigned char* src, unsigned char* dst, int n) {
+	const __m256i shuffle = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	// the 12 bytes of each lane, next to each other
+	const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	int i = 0;
+	// 8 pixels per step, writing 8 bytes past the 24 of the step
+	for (; i + 11 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuffle), compact);
+		_mm256_storeu_si256((__m256i*)(dst + i * 3), v);
+	}
+	rgba_to_rgb_ssse3(src + i * 4, dst + i * 3, n - i);
+}
+
+void f2uc_sse2(const float* src, unsigned char* dst, int n) {
+	const __m128 scale = _mm_set1_ps(255.0f);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+		__m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+		__m128i c = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 8), scale));
+		__m128i d = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 12), scale));
+		__m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+	}
+	f2uc_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void f2uc_avx2(const float* src, unsigned char* dst, int n) {
+	const __m256 scale = _mm256_set1_ps(255.0f);
+	// the packs work within 128-bit lanes: put the 4-byte groups back in order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale));
+		__m256i b = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale));
+		__m256i c = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 16), scale));
+		__m256i d = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 24), scale));
+		__m256i v = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permutevar8x32_epi32(v, order));
+	}
+	f2uc_sse2(src + i, dst + i, n - i);
+}
+#elif defined(__ARM_NEON)
+void rgba_to_rgb_neon(const unsigned char* src, unsigned char* dst, int n) {
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x4_t v = vld4q_u8(src + i * 4);
+		uint8x16x3_t rgb = {{v.val[0], v.val[1], v.val[2]}};
+		vst3q_u8(dst + i * 3, rgb);
+	}
+	rgba_to_rgb_scalar(src + i * 4, dst + i * 3, n - i);
+}
+
+void f2uc_neon(const float* src, unsigned char* dst, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint32x4_t a = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src + i), 255.0f));
+		uint32x4_t b = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 255.0f));
+		uint16x8_t v = vcombine_u16(vqmovn_u32(a), vqmovn_u32(b));
+		vst1_u8(dst + i, vqmovn_u16(v));
+	}
+	f2uc_scalar(src + i, dst + i, n - i);
+}
+#endif
+
+using rgba_to_rgb_fn = void (*)(const unsigned char*, unsigned char*, int);
+using f2uc_fn = void (*)(const float*, unsigned char*, int);
+
+rgba_to_rgb_fn pick_rgba_to_rgb() {
+#ifdef IMGPROC_X86
+	if (__builtin_cpu_supports("avx2"))
+		return rgba_to_rgb_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return rgba_to_rgb_ssse3;
+#elif defined(__ARM_NEON)
+	return rgba_to_rgb_neon;
+#endif
+	return rgba_to_rgb_scalar;
+}
+
+f2uc_fn pick_f2uc() {
+#ifdef IMGPROC_X86
+	if (__builtin_cpu_supports("avx2"))
+		return f2uc_avx2;
+	return f2uc_sse2;
+#elif defined(__ARM_NEON)
+	return f2uc_neon;
+#else
+	return f2uc_scalar;
+#endif
+}
+
 void resize_bilinear(const Mat32f &src, Mat32f &dst) {
 	vector<int> tabsx(dst.rows());
 	vector<int> tabsy(dst.cols());
@@ -104,31 +243,35 @@ void resize<float>(const Mat32f &src, Mat32f &dst) {
 	return resize_bilinear(src, dst);
 }
 
+void rgba_to_rgb(const unsigned char* rgba, unsigned char* rgb, int n) {
+	static const rgba_to_rgb_fn fn = pick_rgba_to_rgb();
+	fn(rgba, rgb, n);
+}
+
 Matuc cvt_f2uc(const Mat32f& mat) {
 	m_assert(mat.channels() == 3);
+	static const f2uc_fn fn = pick_f2uc();
 	Matuc ret(mat.rows(), mat.cols(), 3);
-	auto ps = mat.ptr();
-	auto pt = ret.ptr();
-	int n = mat.pixels() * 3;
-	REP(i, n)
-		*(pt++) = *(ps++) * 255.0;
+	fn(mat.ptr(), ret.ptr(), mat.elements());
 	return ret;
 }
 
 void vflip(Matuc& mat) {
-  int len = mat.cols() * mat.channels() * sizeof(Matuc::value_type);
-  char* buf = new char[len];
+  // swap the rows through a small buffer, in chunks that stay in L1
+  const size_t kChunk = 4096;
+  unsigned char buf[kChunk];
+  size_t len = mat.cols() * mat.channels() * sizeof(Matuc::value_type);
   int H = mat.rows();
-  for (int h = 0; h < H; ++h) {
-    int hh = H - 1 - h;
-    if (h >= hh) break;
+  for (int h = 0; h < H / 2; ++h) {
     auto ptr1 = mat.ptr(h),
-         ptr2 = mat.ptr(hh);
-    memcpy(buf, ptr1, len);
-    memcpy(ptr1, ptr2, len);
-    memcpy(ptr2, buf, len);
+         ptr2 = mat.ptr(H - 1 - h);
+    for (size_t k = 0; k < len; k += kChunk) {
+      size_t n = std::min(kChunk, len - k);
+      memcpy(buf, ptr1 + k, n);
+      memcpy(ptr1 + k, ptr2 + k, n);
+      memcpy(ptr2 + k, buf, n);
+    }
   }
-  delete[] buf;
 }
 
 Matuc hconcat(std::vector<Matuc>& srcs) {
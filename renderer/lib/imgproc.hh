@@ -8,6 +8,7 @@
 
 
 #pragma once
+#include <algorithm>
 #include <list>
 #include <vector>
 #include "mat.h"
@@ -23,19 +24,19 @@ Mat32f rgb2grey(const Mat32f& mat);
 
 template <typename T>
 void fill(Mat<T>& mat, T c) {
-	T* ptr = mat.ptr();
-	int n = mat.elements();
-	REP(i, n) {
-		*ptr = c;
-		ptr ++;
-	}
+	std::fill_n(mat.ptr(), mat.elements(), c);
 }
 
 template <typename T>
 void resize(const Mat<T> &src, Mat<T> &dst);
 
+// with SIMD if available, like rgba_to_rgb()
 Matuc cvt_f2uc(const Mat32f& mat);
 
+// Drop the alpha of n RGBA pixels into RGB. Uses SSSE3/AVX2 or NEON,
+// picked at runtime on x86.
+void rgba_to_rgb(const unsigned char* rgba, unsigned char* rgb, int n);
+
 // in-place vertical flip
 void vflip(Matuc& mat);
 
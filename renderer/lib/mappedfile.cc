@@ -0,0 +1,43 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: mappedfile.cc
+
+#include "mappedfile.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace render {
+
+MappedFile::MappedFile(const std::string& fname) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    good_ = true;
+    if (st.st_size > 0) {
+      void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        good_ = false;
+      } else {
+        data_ = static_cast<const char*>(ptr);
+        size_ = st.st_size;
+        madvise(ptr, size_, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+}
@@ -0,0 +1,37 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: mappedfile.hh
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace render {
+
+// A read-only memory mapping of a whole file, for files that are read
+// once from start to end.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& fname);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Whether the file could be opened and mapped. An empty file is good,
+    // with a null data().
+    bool good() const { return good_; }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool good_ = false;
+};
+
+}
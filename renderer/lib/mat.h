@@ -7,7 +7,9 @@
 
 #include <memory>
 #include <cstring>
+#include <type_traits>
 #include "lib/debugutils.hh"
+#include "lib/bufpool.hh"
 
 template <typename T>
 class Mat {
@@ -16,9 +18,16 @@ class Mat {
 				Mat(){}
 				Mat(int rows, int cols, int channels):
 					m_rows(rows), m_cols(cols), m_channels(channels),
-					m_data{new T[rows * cols * channels], std::default_delete<T[]>() }
+					m_data{new T[(size_t)rows * cols * channels], std::default_delete<T[]>() }
 				{ }
 
+				// A Mat whose data is from BufferPool::global(), and goes back to
+				// it when the last copy is destroyed. For the frames read back
+				// over and over, in a few fixed sizes.
+				static Mat<T> pooled(int rows, int cols, int channels) {
+					return Mat<T>(rows, cols, channels, allocate_((size_t)rows * cols * channels));
+				}
+
 				virtual ~Mat(){}
 
 				T &at(int r, int c, int ch = 0) {
@@ -58,10 +67,24 @@ class Mat {
 				int elements() const { return m_rows * m_cols * m_channels; }
 
 		protected:
+				static_assert(std::is_trivial<T>::value, "Mat is for pixels of trivial types");
+
+				Mat(int rows, int cols, int channels, std::shared_ptr<T> data):
+					m_rows(rows), m_cols(cols), m_channels(channels), m_data{std::move(data)}
+				{ }
+
+				static std::shared_ptr<T> allocate_(size_t n) {
+					size_t bytes = n * sizeof(T);
+					return std::shared_ptr<T>{
+						static_cast<T*>(render::BufferPool::global().acquire(bytes)),
+						[bytes](T* p) { render::BufferPool::global().release(p, bytes); }};
+				}
+
 				int m_rows, m_cols;
 				int m_channels;
 				std::shared_ptr<T> m_data;
 };
 
 using Mat32f = Mat<float>;
+using Mat32u = Mat<unsigned int>;
 using Matuc = Mat<unsigned char>;
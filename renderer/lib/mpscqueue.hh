@@ -0,0 +1,79 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: mpscqueue.hh
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace render {
+
+// An unbounded queue with many producers and one consumer, without lock.
+// push() is wait-free: an atomic exchange and a store. pop() must only be
+// called from one thread at a time.
+//
+// It is a linked list with a dummy node, where producers append to head
+// and the consumer removes from tail. A push is visible to pop() once its
+// second step (linking the node) is done, so pop() may see the queue empty
+// for a moment while a push is in progress.
+template <typename T>
+class MPSCQueue {
+  public:
+    MPSCQueue() {
+      Node* stub = new Node;
+      head_.store(stub);
+      tail_ = stub;
+    }
+
+    ~MPSCQueue() {
+      T v;
+      while (pop(v)) {}
+      delete tail_;
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator = (const MPSCQueue&) = delete;
+
+    void push(T v) {
+      Node* node = new Node;
+      node->value = std::move(v);
+      Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    // Returns false if the queue is empty.
+    bool pop(T& v) {
+      Node* tail = tail_;
+      Node* next = tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+      v = std::move(next->value);
+      // next becomes the dummy node
+      tail_ = next;
+      delete tail;
+      return true;
+    }
+
+    // Only meaningful in the consumer thread.
+    bool empty() const {
+      return tail_->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+  private:
+    struct Node {
+      std::atomic<Node*> next{nullptr};
+      T value;
+    };
+
+    // head_ and tail_ are on different cache lines, as they are written by
+    // different threads
+    std::atomic<Node*> head_;  // the last pushed node
+    char pad_[64];
+    Node* tail_;               // the dummy node before the first one
+};
+
+}
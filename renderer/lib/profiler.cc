@@ -0,0 +1,270 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: profiler.cc
+
+#include "profiler.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace {
+
+struct Event {
+  int32_t zone;
+  int64_t start, duration;
+};
+
+struct ZoneTotal {
+  int64_t count = 0, total = 0, self = 0, max = 0;
+};
+
+// The records of a thread. Only the thread writes them, but stats() and
+// reset() of other threads read and clear them.
+struct ThreadData {
+  int tid;
+  mutex mu;   // guards the fields below
+  vector<ZoneTotal> zones;    // by zone id
+  vector<int64_t> counters;   // by counter id
+  vector<Event> events;
+  int64_t dropped = 0;
+
+  void add(int zone, int64_t start, int64_t duration, int64_t children) {
+    lock_guard<mutex> lg(mu);
+    if ((size_t)zone >= zones.size())
+      zones.resize(zone + 1);
+    auto& z = zones[zone];
+    z.count++;
+    z.total += duration;
+    z.self += duration - children;
+    z.max = max(z.max, duration);
+    if (events.size() < render::Profiler::kMaxEvents)
+      events.push_back(Event{zone, start, duration});
+    else
+      dropped++;
+  }
+
+  void clear() {
+    lock_guard<mutex> lg(mu);
+    zones.clear();
+    counters.clear();
+    vector<Event>().swap(events);
+    dropped = 0;
+  }
+};
+
+struct Registry {
+  mutex mu;   // guards the fields below
+  vector<string> zone_names, counter_names;
+  unordered_map<string, int> zone_ids, counter_ids;
+  vector<shared_ptr<ThreadData>> threads;
+
+  ThreadData gpu;
+  chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+  int intern(const string& name, vector<string>& names, unordered_map<string, int>& ids) {
+    lock_guard<mutex> lg(mu);
+    auto itr = ids.find(name);
+    if (itr != ids.end())
+      return itr->second;
+    names.push_back(name);
+    return ids[name] = names.size() - 1;
+  }
+};
+
+// never deleted, so that the zones of static destructors can be recorded
+Registry& registry() {
+  static Registry* r = new Registry;
+  return *r;
+}
+
+// The zones open on this thread. Only the thread uses it.
+struct OpenZone {
+  int zone;
+  int64_t start, children;
+};
+
+struct ThisThread {
+  shared_ptr<ThreadData> data;
+  vector<OpenZone> stack;
+
+  ThisThread(): data{make_shared<ThreadData>()} {
+    auto& r = registry();
+    lock_guard<mutex> lg(r.mu);
+    data->tid = r.threads.size();
+    r.threads.push_back(data);
+  }
+};
+
+ThisThread& this_thread_data() {
+  thread_local ThisThread t;
+  return t;
+}
+
+string json_string(const string& s) {
+  string ret = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      ret += '\\';
+    if ((unsigned char)c < 0x20)
+      ret += ssprintf("\\u%04x", c);
+    else
+      ret += c;
+  }
+  return ret + "\"";
+}
+
+} // namespace
+
+namespace render {
+
+atomic<bool> Profiler::enabled_{false};
+const size_t Profiler::kMaxEvents;
+
+int Profiler::zone(const string& name) {
+  auto& r = registry();
+  return r.intern(name, r.zone_names, r.zone_ids);
+}
+
+int Profiler::counter(const string& name) {
+  auto& r = registry();
+  return r.intern(name, r.counter_names, r.counter_ids);
+}
+
+int64_t Profiler::now() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now() - registry().epoch).count();
+}
+
+void Profiler::begin(int zone) {
+  this_thread_data().stack.push_back(OpenZone{zone, now(), 0});
+}
+
+void Profiler::end() {
+  int64_t stop = now();
+  auto& t = this_thread_data();
+  if (t.stack.empty())
+    return;
+  OpenZone z = t.stack.back();
+  t.stack.pop_back();
+  int64_t duration = stop - z.start;
+  if (t.stack.size())
+    t.stack.back().children += duration;
+  t.data->add(z.zone, z.start, duration, z.children);
+}
+
+void Profiler::count(int counter, int64_t value) {
+  auto& data = *this_thread_data().data;
+  lock_guard<mutex> lg(data.mu);
+  if ((size_t)counter >= data.counters.size())
+    data.counters.resize(counter + 1, 0);
+  data.counters[counter] += value;
+}
+
+void Profiler::record_gpu(int zone, int64_t start, int64_t duration) {
+  registry().gpu.add(zone, start, duration, 0);
+}
+
+Profiler::Stats Profiler::stats() {
+  auto& r = registry();
+  vector<shared_ptr<ThreadData>> threads;
+  vector<string> zone_names, counter_names;
+  {
+    lock_guard<mutex> lg(r.mu);
+    threads = r.threads;
+    zone_names = r.zone_names;
+    counter_names = r.counter_names;
+  }
+  vector<ZoneTotal> zones(zone_names.size());
+  vector<int64_t> counters(counter_names.size(), 0);
+  Stats ret;
+  ret.dropped_events = 0;
+  // the names registered after the copy have no records before it
+  auto merge = [&](ThreadData& t) {
+    lock_guard<mutex> lg(t.mu);
+    for (size_t i = 0; i < min(t.zones.size(), zones.size()); ++i) {
+      zones[i].count += t.zones[i].count;
+      zones[i].total += t.zones[i].total;
+      zones[i].self += t.zones[i].self;
+      zones[i].max = max(zones[i].max, t.zones[i].max);
+    }
+    for (size_t i = 0; i < min(t.counters.size(), counters.size()); ++i)
+      counters[i] += t.counters[i];
+    ret.dropped_events += t.dropped;
+  };
+  for (auto& t : threads)
+    merge(*t);
+  merge(r.gpu);
+
+  for (size_t i = 0; i < zones.size(); ++i)
+    if (zones[i].count)
+      ret.zones.push_back(ZoneStats{zone_names[i], zones[i].count,
+          zones[i].total * 1e-9, zones[i].self * 1e-9, zones[i].max * 1e-9});
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i])
+      ret.counters.emplace_back(counter_names[i], counters[i]);
+  return ret;
+}
+
+void Profiler::reset() {
+  auto& r = registry();
+  vector<shared_ptr<ThreadData>> threads;
+  {
+    lock_guard<mutex> lg(r.mu);
+    threads = r.threads;
+  }
+  for (auto& t : threads)
+    t->clear();
+  r.gpu.clear();
+}
+
+void Profiler::save_trace(const string& fname) {
+  auto& r = registry();
+  vector<shared_ptr<ThreadData>> threads;
+  vector<string> zone_names;
+  {
+    lock_guard<mutex> lg(r.mu);
+    threads = r.threads;
+    zone_names = r.zone_names;
+  }
+  ofstream os(fname);
+  if (!os.good())
+    throw std::runtime_error(ssprintf("Profiler: cannot write %s", fname.c_str()));
+  os << "{\"traceEvents\":[\n";
+  bool first = true;
+  // complete events of a thread, in microseconds
+  auto write = [&](ThreadData& t, int tid, const string& thread_name) {
+    os << (first ? "" : ",\n")
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+      << ",\"args\":{\"name\":" << json_string(thread_name) << "}}";
+    first = false;
+    lock_guard<mutex> lg(t.mu);
+    for (auto& e : t.events) {
+      if ((size_t)e.zone >= zone_names.size())
+        continue;
+      os << ",\n{\"name\":" << json_string(zone_names[e.zone])
+        << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+        << ",\"ts\":" << ssprintf("%.3f", e.start * 1e-3)
+        << ",\"dur\":" << ssprintf("%.3f", e.duration * 1e-3) << "}";
+    }
+  };
+  for (auto& t : threads)
+    write(*t, t->tid, ssprintf("thread %d", t->tid));
+  write(r.gpu, threads.size(), "GPU");
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  if (!os.good())
+    throw std::runtime_error(ssprintf("Profiler: cannot write %s", fname.c_str()));
+}
+
+} // namespace render
@@ -0,0 +1,113 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: profiler.hh
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace render {
+
+// Where the time of the renderer goes: nested zones of code timed per
+// thread, GPU zones (see GpuTimer), and counters of work such as draw calls.
+//
+// Each thread records into its own buffers, so zones of different threads
+// don't contend. It records nothing unless enabled, and then a zone costs
+// two clock reads. Use the macros below with string literals, whose ids are
+// looked up once per call site:
+//
+//   void f() {
+//     PROFILE_ZONE("f");
+//     PROFILE_COUNT("triangles", n);
+//   }
+class Profiler {
+  public:
+    // in seconds. self excludes the nested zones of the same thread.
+    struct ZoneStats {
+      std::string name;
+      int64_t count;
+      double total, self, max;
+    };
+    struct Stats {
+      std::vector<ZoneStats> zones;
+      std::vector<std::pair<std::string, int64_t>> counters;
+      int64_t dropped_events;   // zones not kept for save_trace()
+    };
+
+    // at most this many zones per thread are kept for save_trace()
+    static const size_t kMaxEvents = 1 << 18;
+
+    static void enable(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // The id of a zone or counter name.
+    static int zone(const std::string& name);
+    static int counter(const std::string& name);
+
+    // nanoseconds since the first call
+    static int64_t now();
+
+    // Open and close a zone on this thread, even if the profiler is not
+    // enabled. Zones close in the reverse order they open.
+    static void begin(int zone);
+    static void end();
+
+    static void count(int counter, int64_t value);
+
+    // a zone of duration ns on the GPU, issued at start
+    static void record_gpu(int zone, int64_t start, int64_t duration);
+
+    // the zones and counters recorded by all threads since the last reset()
+    static Stats stats();
+    static void reset();
+
+    // Write the zones since the last reset() to fname in the Chrome trace
+    // format, for chrome://tracing. Throws std::runtime_error on failure.
+    static void save_trace(const std::string& fname);
+
+  private:
+    static std::atomic<bool> enabled_;
+};
+
+// A zone from its construction to its destruction, if the profiler is
+// enabled at its construction.
+class ProfileZone {
+  public:
+    explicit ProfileZone(int zone): active_{Profiler::enabled()} {
+      if (active_)
+        Profiler::begin(zone);
+    }
+    ~ProfileZone() {
+      if (active_)
+        Profiler::end();
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator = (const ProfileZone&) = delete;
+
+  private:
+    bool active_;
+};
+
+#define PROFILE_CAT_(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+
+#define PROFILE_ZONE(name) \
+  static const int PROFILE_CAT(_profile_zone_id_, __LINE__) = ::render::Profiler::zone(name); \
+  ::render::ProfileZone PROFILE_CAT(_profile_zone_, __LINE__){PROFILE_CAT(_profile_zone_id_, __LINE__)}
+
+#define PROFILE_COUNT(name, value) \
+  do { \
+    if (::render::Profiler::enabled()) { \
+      static const int _profile_counter_id = ::render::Profiler::counter(name); \
+      ::render::Profiler::count(_profile_counter_id, value); \
+    } \
+  } while (0)
+
+} // namespace render
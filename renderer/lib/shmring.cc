@@ -0,0 +1,170 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: shmring.cc
+
+#include "shmring.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace {
+
+const char kMagic[8] = "H3DRING";
+
+// Wait until ready() returns true, or timeout_ms milliseconds have passed.
+// Spin for a while first, as the other side is usually about to finish.
+template <typename F>
+bool wait_until(F ready, int timeout_ms) {
+  auto start = chrono::steady_clock::now();
+  for (int iter = 0; ; ++iter) {
+    if (ready())
+      return true;
+    if (timeout_ms >= 0 && chrono::steady_clock::now() - start >= chrono::milliseconds(timeout_ms))
+      return false;
+    if (iter < 1000)
+      this_thread::yield();
+    else
+      this_thread::sleep_for(chrono::microseconds(50));
+  }
+}
+
+// round up to a multiple of the cache line size
+size_t align64(size_t n) { return (n + 63) / 64 * 64; }
+
+}
+
+namespace render {
+
+ShmRing::ShmRing(const string& name, int nr_slot, int rows, int cols, int channels):
+  name_{name}, owner_{true} {
+  if (nr_slot <= 0 || rows <= 0 || cols <= 0 || channels <= 0)
+    throw std::invalid_argument("ShmRing: the ring and its slots must not be empty");
+  size_t slot_bytes = align64((size_t)rows * cols * channels);
+  bytes_ = align64(sizeof(Header)) + slot_bytes * nr_slot;
+
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    throw std::runtime_error(ssprintf("ShmRing: cannot create %s: %s", name.c_str(), strerror(errno)));
+  if (ftruncate(fd, bytes_) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error(ssprintf("ShmRing: cannot allocate %zu bytes for %s", bytes_, name.c_str()));
+  }
+  map_(fd, true);
+
+  header_ = new (header_) Header;
+  header_->nr_slot = nr_slot;
+  header_->rows = rows;
+  header_->cols = cols;
+  header_->channels = channels;
+  header_->slot_bytes = slot_bytes;
+  header_->head.store(0);
+  header_->tail.store(0);
+  // the reader checks the magic last
+  atomic_thread_fence(memory_order_release);
+  memcpy(header_->magic, kMagic, sizeof(kMagic));
+}
+
+ShmRing::ShmRing(const string& name):
+  name_{name}, owner_{false} {
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0)
+    throw std::runtime_error(ssprintf("ShmRing: cannot open %s: %s", name.c_str(), strerror(errno)));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error(ssprintf("ShmRing: %s is not a ring", name.c_str()));
+  }
+  bytes_ = st.st_size;
+  map_(fd, false);
+  if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 ||
+      bytes_ < align64(sizeof(Header)) + header_->slot_bytes * header_->nr_slot) {
+    munmap(header_, bytes_);
+    throw std::runtime_error(ssprintf("ShmRing: %s is not a ring", name.c_str()));
+  }
+  atomic_thread_fence(memory_order_acquire);
+}
+
+void ShmRing::map_(int fd, bool create) {
+  void* ptr = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    if (create)
+      shm_unlink(name_.c_str());
+    throw std::runtime_error(ssprintf("ShmRing: cannot map %s: %s", name_.c_str(), strerror(errno)));
+  }
+  header_ = static_cast<Header*>(ptr);
+  slots_ = static_cast<uint8_t*>(ptr) + align64(sizeof(Header));
+}
+
+ShmRing::~ShmRing() {
+  munmap(header_, bytes_);
+  if (owner_)
+    unlink();
+}
+
+void ShmRing::unlink() {
+  shm_unlink(name_.c_str());
+}
+
+uint8_t* ShmRing::acquire_write(int timeout_ms) {
+  // only the writer changes head
+  uint64_t head = header_->head.load(memory_order_relaxed);
+  bool ok = wait_until([&]() {
+      return head - header_->tail.load(memory_order_acquire) < header_->nr_slot;
+    }, timeout_ms);
+  if (!ok)
+    return nullptr;
+  writing_ = true;
+  return slot_(head);
+}
+
+void ShmRing::commit_write() {
+  if (!writing_)
+    throw std::runtime_error(ssprintf("ShmRing: %s has no slot acquired for writing", name_.c_str()));
+  writing_ = false;
+  uint64_t head = header_->head.load(memory_order_relaxed);
+  header_->head.store(head + 1, memory_order_release);
+}
+
+const uint8_t* ShmRing::acquire_read(int timeout_ms) {
+  // only the reader changes tail
+  uint64_t tail = header_->tail.load(memory_order_relaxed);
+  bool ok = wait_until([&]() {
+      return header_->head.load(memory_order_acquire) != tail;
+    }, timeout_ms);
+  if (!ok)
+    return nullptr;
+  reading_ = true;
+  return slot_(tail);
+}
+
+void ShmRing::release_read() {
+  if (!reading_)
+    throw std::runtime_error(ssprintf("ShmRing: %s has no frame acquired for reading", name_.c_str()));
+  reading_ = false;
+  uint64_t tail = header_->tail.load(memory_order_relaxed);
+  header_->tail.store(tail + 1, memory_order_release);
+}
+
+int ShmRing::size() const {
+  return header_->head.load(memory_order_acquire) - header_->tail.load(memory_order_acquire);
+}
+
+}
@@ -0,0 +1,98 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: shmring.hh
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace render {
+
+// A ring of fixed-size slots in POSIX shared memory, to pass frames from
+// one process to another without pickling or copying them through a pipe.
+//
+// It has one writer and one reader, possibly in different processes, and
+// no lock: the writer fills the slot at head and publishes it by advancing
+// head, and the reader reads the slot at tail and gives it back by
+// advancing tail. A slot is never written while the reader holds it.
+//
+// Every slot holds a rows x cols x channels uint8 image, e.g. the output of
+// SUNCGRenderAPI::renderInto().
+class ShmRing {
+  public:
+    // Create the shared memory object `name` (e.g. "/house3d-0"), replacing
+    // any existing one with the same name.
+    ShmRing(const std::string& name, int nr_slot, int rows, int cols, int channels);
+
+    // Open the ring created by another process under `name`.
+    explicit ShmRing(const std::string& name);
+
+    ~ShmRing();
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator = (const ShmRing&) = delete;
+
+    // The slot to write the next frame into, or nullptr if all slots are in
+    // use after waiting timeout_ms milliseconds (forever if negative).
+    // The frame becomes visible to the reader at commit_write(), which
+    // throws std::runtime_error if no slot is acquired.
+    uint8_t* acquire_write(int timeout_ms = -1);
+    void commit_write();
+
+    // The oldest frame, or nullptr if none is written after waiting
+    // timeout_ms milliseconds (forever if negative).
+    // It stays valid until release_read(), which throws std::runtime_error
+    // if no frame is acquired.
+    const uint8_t* acquire_read(int timeout_ms = -1);
+    void release_read();
+
+    // Number of frames written and not released by the reader.
+    int size() const;
+
+    const std::string& name() const { return name_; }
+    int capacity() const { return header_->nr_slot; }
+    int rows() const { return header_->rows; }
+    int cols() const { return header_->cols; }
+    int channels() const { return header_->channels; }
+    size_t slot_bytes() const { return header_->slot_bytes; }
+
+    // Remove the name of the ring, so it is freed once every process has
+    // closed it. The creator does this in its destructor.
+    void unlink();
+
+  private:
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+        "ShmRing needs lock-free 64-bit atomics to share them between processes");
+
+    // Lives at the beginning of the shared memory, followed by the slots.
+    // head and tail are on their own cache lines, as each is written by
+    // one side only.
+    struct Header {
+      char magic[8];
+      uint32_t nr_slot, rows, cols, channels;
+      uint64_t slot_bytes;
+      alignas(64) std::atomic<uint64_t> head;  // number of frames written
+      alignas(64) std::atomic<uint64_t> tail;  // number of frames released
+    };
+
+    std::string name_;
+    bool owner_;
+    size_t bytes_ = 0;
+    Header* header_ = nullptr;
+    uint8_t* slots_ = nullptr;
+    // whether this side holds a slot of acquire_write() / acquire_read()
+    bool writing_ = false, reading_ = false;
+
+    uint8_t* slot_(uint64_t idx) const {
+      return slots_ + (idx % header_->nr_slot) * header_->slot_bytes;
+    }
+
+    void map_(int fd, bool create);
+};
+
+}
@@ -0,0 +1,124 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: videowriter.cc
+
+#include "videowriter.hh"
+
+#include <sys/wait.h>
+#include <cstring>
+#include <stdexcept>
+
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace {
+
+// s as one word of a sh command line
+string shell_quote(const string& s) {
+  string ret = "'";
+  for (char c : s) {
+    if (c == '\'')
+      ret += "'\\''";
+    else
+      ret += c;
+  }
+  return ret + "'";
+}
+
+bool ends_with(const string& s, const string& suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+namespace render {
+
+const int VideoWriter::kMaxPending;
+
+VideoWriter::VideoWriter(const string& fname, int w, int h, int fps, const string& codec):
+  w_{w}, h_{h}, fname_{fname} {
+    if (w <= 0 || h <= 0 || fps <= 0)
+      throw invalid_argument("VideoWriter: w, h and fps must be positive!");
+    string cmd = ssprintf("ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgb24 -s %dx%d -r %d -i -", w, h, fps);
+    if (ends_with(codec, "_vaapi"))
+      cmd += " -vaapi_device /dev/dri/renderD128 -vf format=nv12,hwupload";
+    else
+      cmd += " -pix_fmt yuv420p";
+    cmd += " -c:v " + shell_quote(codec) + " " + shell_quote(fname);
+    pipe_ = popen(cmd.c_str(), "w");
+    if (!pipe_)
+      throw runtime_error(ssprintf("VideoWriter: cannot run ffmpeg: %s", strerror(errno)));
+    ring_.resize(kMaxPending, vector<unsigned char>(frame_bytes()));
+    thread_ = thread([this]() { this->write_loop_(); });
+  }
+
+VideoWriter::~VideoWriter() {
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+unsigned char* VideoWriter::next_frame() {
+  unique_lock<mutex> lk(mutex_);
+  if (closing_)
+    throw runtime_error("VideoWriter: already closed!");
+  cv_.wait(lk, [this]() { return nr_committed_ - nr_written_ < kMaxPending || failed_; });
+  if (failed_)
+    throw runtime_error(ssprintf("VideoWriter: cannot write %s", fname_.c_str()));
+  return ring_[nr_committed_ % kMaxPending].data();
+}
+
+void VideoWriter::commit() {
+  lock_guard<mutex> lg(mutex_);
+  nr_committed_++;
+  cv_.notify_all();
+}
+
+void VideoWriter::write(const unsigned char* rgb) {
+  memcpy(next_frame(), rgb, frame_bytes());
+  commit();
+}
+
+int VideoWriter::nr_frames() const {
+  lock_guard<mutex> lg(mutex_);
+  return nr_committed_;
+}
+
+void VideoWriter::write_loop_() {
+  unique_lock<mutex> lk(mutex_);
+  while (true) {
+    cv_.wait(lk, [this]() { return nr_written_ < nr_committed_ || closing_; });
+    if (nr_written_ == nr_committed_)
+      break;
+    // the producer doesn't touch this slot until nr_written_ moves on
+    const unsigned char* frame = ring_[nr_written_ % kMaxPending].data();
+    lk.unlock();
+    bool ok = failed_ || fwrite(frame, 1, frame_bytes(), pipe_) == frame_bytes();
+    lk.lock();
+    failed_ = failed_ || !ok;
+    nr_written_++;
+    cv_.notify_all();
+  }
+}
+
+void VideoWriter::close() {
+  {
+    lock_guard<mutex> lg(mutex_);
+    if (closing_)
+      return;
+    closing_ = true;
+    cv_.notify_all();
+  }
+  thread_.join();
+  int status = pclose(pipe_);
+  if (failed_ || status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    throw runtime_error(ssprintf("VideoWriter: ffmpeg failed to write %s", fname_.c_str()));
+}
+
+} // namespace render
@@ -0,0 +1,77 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: videowriter.hh
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace render {
+
+// Encode a stream of w x h RGB frames into a video file, by piping them to
+// an ffmpeg process, instead of writing an image per frame and stitching
+// them afterwards.
+//
+// codec is an ffmpeg encoder: libx264 and libx265 on the CPU, or
+// h264_nvenc, hevc_nvenc (NVIDIA) and h264_vaapi, hevc_vaapi (VAAPI, on
+// /dev/dri/renderD128) to encode on the GPU, if the ffmpeg in PATH has them.
+//
+// Frames are written to the pipe by a thread of the writer, from a ring of
+// kMaxPending frames, so rendering goes on while ffmpeg encodes. Frames are
+// written into the ring in place, e.g. by SUNCGRenderAPI::renderInto(),
+// without other copies.
+class VideoWriter {
+  public:
+    // Throws std::runtime_error if ffmpeg can't be started.
+    VideoWriter(const std::string& fname, int w, int h, int fps = 30,
+        const std::string& codec = "libx264");
+    ~VideoWriter();
+    VideoWriter(const VideoWriter&) = delete;
+    VideoWriter& operator = (const VideoWriter&) = delete;
+
+    int width() const { return w_; }
+    int height() const { return h_; }
+    size_t frame_bytes() const { return (size_t)w_ * h_ * 3; }
+
+    // The buffer of frame_bytes() for the next frame, in row-major (h, w, 3)
+    // order, to be queued by commit(). Waits while kMaxPending frames are
+    // queued.
+    unsigned char* next_frame();
+    void commit();
+
+    // next_frame() and commit() of a copy of rgb
+    void write(const unsigned char* rgb);
+
+    int nr_frames() const;
+
+    // Write the queued frames, and wait for ffmpeg to finish the file.
+    // Throws std::runtime_error if a frame or the file couldn't be written.
+    void close();
+
+    static const int kMaxPending = 4;
+
+  private:
+    int w_, h_;
+    std::string fname_;
+    FILE* pipe_;
+
+    std::vector<std::vector<unsigned char>> ring_;
+    mutable std::mutex mutex_;   // guards the fields below
+    std::condition_variable cv_;
+    int64_t nr_committed_ = 0, nr_written_ = 0;
+    bool closing_ = false, failed_ = false;
+
+    std::thread thread_;
+    void write_loop_();
+};
+
+} // namespace render
@@ -0,0 +1,326 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bvh.cc
+
+#include "bvh.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+using render::AABB;
+
+const int kNumPlanes = 6;
+const int kAllPlanes = (1 << kNumPlanes) - 1;
+
+// The planes of the frustum as (a, b, c, d) with ax + by + cz + d >= 0
+// inside, from the rows of the matrix (Gribb & Hartmann).
+void frustum_planes(const glm::mat4& m, glm::vec4* planes) {
+  // glm is column-major: m[col][row]
+  glm::vec4 row[4];
+  for (int i = 0; i < 4; ++i)
+    row[i] = glm::vec4{m[0][i], m[1][i], m[2][i], m[3][i]};
+  for (int i = 0; i < 3; ++i) {
+    planes[2 * i] = row[3] + row[i];
+    planes[2 * i + 1] = row[3] - row[i];
+  }
+}
+
+// Möller-Trumbore: t of the hit of origin + t * dir with triangle abc, or
+// -1 if it misses. det > 0 if abc is counterclockwise as seen from origin.
+float intersect(const glm::vec3& origin, const glm::vec3& dir,
+    const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, bool back_faces) {
+  glm::vec3 e1 = b - a, e2 = c - a;
+  glm::vec3 p = glm::cross(dir, e2);
+  float det = glm::dot(e1, p);
+  if (back_faces ? fabs(det) < 1e-12f : det < 1e-12f)
+    return -1.f;
+  float inv = 1.f / det;
+  glm::vec3 s = origin - a;
+  float u = glm::dot(s, p) * inv;
+  if (u < 0.f || u > 1.f)
+    return -1.f;
+  glm::vec3 q = glm::cross(s, e1);
+  float v = glm::dot(dir, q) * inv;
+  if (v < 0.f || u + v > 1.f)
+    return -1.f;
+  return glm::dot(e2, q) * inv;
+}
+
+// The t where origin + t * dir enters box, or inf if it misses it before max_t.
+// inv_dir: 1 / dir
+float enter(const AABB& box, const glm::vec3& origin, const glm::vec3& inv_dir, float max_t) {
+  float t0 = 0.f, t1 = max_t;
+  for (int a = 0; a < 3; ++a) {
+    float n = (box.min[a] - origin[a]) * inv_dir[a],
+          f = (box.max[a] - origin[a]) * inv_dir[a];
+    if (n > f)
+      swap(n, f);
+    // NaN (a ray in the plane of a face) doesn't narrow the range
+    t0 = n > t0 ? n : t0;
+    t1 = f < t1 ? f : t1;
+    if (t0 > t1)
+      return numeric_limits<float>::infinity();
+  }
+  return t0;
+}
+
+bool overlap(const AABB& a, const AABB& b) {
+  for (int k = 0; k < 3; ++k)
+    if (a.min[k] > b.max[k] || b.min[k] > a.max[k])
+      return false;
+  return true;
+}
+
+// Whether triangle abc intersects box, by the separating axis test of
+// Akenine-Möller.
+bool intersect(const AABB& box, glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+  glm::vec3 center = (box.min + box.max) * 0.5f, half = (box.max - box.min) * 0.5f;
+  a -= center; b -= center; c -= center;
+  auto separated = [&](const glm::vec3& axis) {
+    float pa = glm::dot(a, axis), pb = glm::dot(b, axis), pc = glm::dot(c, axis);
+    float r = half.x * fabs(axis.x) + half.y * fabs(axis.y) + half.z * fabs(axis.z);
+    return min({pa, pb, pc}) > r || max({pa, pb, pc}) < -r;
+  };
+  for (int k = 0; k < 3; ++k) {
+    glm::vec3 axis{0.f};
+    axis[k] = 1.f;
+    if (separated(axis))
+      return false;
+  }
+  glm::vec3 edges[3] = {b - a, c - b, a - c};
+  if (separated(glm::cross(edges[0], edges[1])))
+    return false;
+  for (auto& e : edges)
+    for (int k = 0; k < 3; ++k) {
+      glm::vec3 axis{0.f};
+      axis[k] = 1.f;
+      if (separated(glm::cross(e, axis)))
+        return false;
+    }
+  return true;
+}
+
+}
+
+namespace render {
+
+void BVH::build(const vector<AABB>& boxes) {
+  nr_box_ = boxes.size();
+  nodes_.clear();
+  box_ids_.resize(nr_box_);
+  for (int i = 0; i < nr_box_; ++i)
+    box_ids_[i] = i;
+  if (nr_box_ == 0)
+    return;
+  vector<glm::vec3> centers(nr_box_);
+  for (int i = 0; i < nr_box_; ++i)
+    centers[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+  nodes_.reserve(2 * (nr_box_ / kLeafSize + 1));
+  build_(boxes, centers, 0, nr_box_);
+}
+
+int BVH::build_(const vector<AABB>& boxes, vector<glm::vec3>& centers,
+    int begin, int end) {
+  int idx = nodes_.size();
+  nodes_.emplace_back();
+  float inf = numeric_limits<float>::max();
+  AABB box{glm::vec3{inf}, glm::vec3{-inf}};
+  glm::vec3 cmin{inf}, cmax{-inf};
+  for (int k = begin; k < end; ++k) {
+    int i = box_ids_[k];
+    box.min = glm::min(box.min, boxes[i].min);
+    box.max = glm::max(box.max, boxes[i].max);
+    cmin = glm::min(cmin, centers[i]);
+    cmax = glm::max(cmax, centers[i]);
+  }
+  nodes_[idx] = Node{box, begin, end - begin, -1};
+  if (end - begin <= kLeafSize)
+    return idx;
+
+  // split at the median center along the longest axis of the centers
+  glm::vec3 extent = cmax - cmin;
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+  int mid = (begin + end) / 2;
+  nth_element(box_ids_.begin() + begin, box_ids_.begin() + mid, box_ids_.begin() + end,
+      [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+  build_(boxes, centers, begin, mid);
+  int right = build_(boxes, centers, mid, end);
+  nodes_[idx].right = right;
+  return idx;
+}
+
+void BVH::cull(const glm::mat4& camera_matrix, vector<uint8_t>& visible) const {
+  visible.assign(nr_box_, 0);
+  if (nodes_.empty())
+    return;
+  glm::vec4 planes[kNumPlanes];
+  frustum_planes(camera_matrix, planes);
+
+  auto mark = [&](const Node& node) {
+    for (int k = node.begin; k < node.begin + node.count; ++k)
+      visible[box_ids_[k]] = 1;
+  };
+
+  // (node, planes the node is not known to be inside of yet)
+  vector<pair<int, int>> stack{{0, kAllPlanes}};
+  while (stack.size()) {
+    int idx = stack.back().first, mask = stack.back().second;
+    stack.pop_back();
+    const Node& node = nodes_[idx];
+    bool outside = false;
+    for (int p = 0; p < kNumPlanes && !outside; ++p) {
+      if (!(mask & (1 << p)))
+        continue;
+      const glm::vec4& plane = planes[p];
+      // the corners of the box furthest along and against the normal
+      float hi = plane.w, lo = plane.w;
+      for (int a = 0; a < 3; ++a) {
+        bool positive = plane[a] > 0;
+        hi += plane[a] * (positive ? node.box.max[a] : node.box.min[a]);
+        lo += plane[a] * (positive ? node.box.min[a] : node.box.max[a]);
+      }
+      if (hi < 0)
+        outside = true;
+      else if (lo >= 0)
+        mask &= ~(1 << p);
+    }
+    if (outside)
+      continue;
+    if (node.right < 0 || mask == 0) {
+      // a leaf, or all of the subtree is inside
+      mark(node);
+      continue;
+    }
+    stack.emplace_back(node.right, mask);
+    stack.emplace_back(idx + 1, mask);
+  }
+}
+
+void TriangleBVH::build(vector<glm::vec3>&& corners) {
+  int nr_tri = corners.size() / 3;
+  nodes_.clear();
+  tri_ids_.resize(nr_tri);
+  for (int i = 0; i < nr_tri; ++i)
+    tri_ids_[i] = i;
+  built_ = true;
+  corners_.clear();
+  if (nr_tri == 0)
+    return;
+  vector<glm::vec3> centers(nr_tri);
+  for (int i = 0; i < nr_tri; ++i)
+    centers[i] = (corners[3 * i] + corners[3 * i + 1] + corners[3 * i + 2]) * (1.f / 3);
+  nodes_.reserve(2 * (nr_tri / kLeafSize + 1));
+  build_(corners, centers, 0, nr_tri);
+
+  // store the corners in the order of the leaves, so each is read at once
+  corners_.resize(corners.size());
+  for (int k = 0; k < nr_tri; ++k)
+    for (int c = 0; c < 3; ++c)
+      corners_[3 * k + c] = corners[3 * tri_ids_[k] + c];
+  vector<glm::vec3>().swap(corners);
+}
+
+int TriangleBVH::build_(const vector<glm::vec3>& corners, vector<glm::vec3>& centers,
+    int begin, int end) {
+  int idx = nodes_.size();
+  nodes_.emplace_back();
+  float inf = numeric_limits<float>::max();
+  AABB box{glm::vec3{inf}, glm::vec3{-inf}};
+  glm::vec3 cmin{inf}, cmax{-inf};
+  for (int k = begin; k < end; ++k) {
+    int i = tri_ids_[k];
+    for (int c = 0; c < 3; ++c) {
+      box.min = glm::min(box.min, corners[3 * i + c]);
+      box.max = glm::max(box.max, corners[3 * i + c]);
+    }
+    cmin = glm::min(cmin, centers[i]);
+    cmax = glm::max(cmax, centers[i]);
+  }
+  nodes_[idx] = Node{box, begin, end - begin, -1};
+  if (end - begin <= kLeafSize)
+    return idx;
+
+  // split at the median center along the longest axis of the centers
+  glm::vec3 extent = cmax - cmin;
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+  int mid = (begin + end) / 2;
+  nth_element(tri_ids_.begin() + begin, tri_ids_.begin() + mid, tri_ids_.begin() + end,
+      [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+  build_(corners, centers, begin, mid);
+  int right = build_(corners, centers, mid, end);
+  nodes_[idx].right = right;
+  return idx;
+}
+
+TriangleBVH::Hit TriangleBVH::raycast(const glm::vec3& origin, const glm::vec3& dir,
+    float max_t, bool back_faces) const {
+  Hit ret{numeric_limits<float>::infinity(), -1};
+  if (nodes_.empty())
+    return ret;
+  glm::vec3 inv_dir{1.f / dir.x, 1.f / dir.y, 1.f / dir.z};
+  float best = max_t;
+  // (node, t where the ray enters it)
+  vector<pair<int, float>> stack{{0, enter(nodes_[0].box, origin, inv_dir, best)}};
+  while (stack.size()) {
+    int idx = stack.back().first;
+    float t = stack.back().second;
+    stack.pop_back();
+    if (t > best)
+      continue;
+    const Node& node = nodes_[idx];
+    if (node.right < 0) {
+      for (int k = node.begin; k < node.begin + node.count; ++k) {
+        float h = intersect(origin, dir, corners_[3 * k], corners_[3 * k + 1], corners_[3 * k + 2],
+            back_faces);
+        if (h >= 0.f && h <= best) {
+          best = h;
+          ret = Hit{h, tri_ids_[k]};
+        }
+      }
+      continue;
+    }
+    // visit the nearer child first
+    float tl = enter(nodes_[idx + 1].box, origin, inv_dir, best),
+          tr = enter(nodes_[node.right].box, origin, inv_dir, best);
+    if (tl <= tr) {
+      stack.emplace_back(node.right, tr);
+      stack.emplace_back(idx + 1, tl);
+    } else {
+      stack.emplace_back(idx + 1, tl);
+      stack.emplace_back(node.right, tr);
+    }
+  }
+  return ret;
+}
+
+void TriangleBVH::query(const AABB& box, vector<int>& triangles) const {
+  if (nodes_.empty())
+    return;
+  vector<int> stack{0};
+  while (stack.size()) {
+    int idx = stack.back();
+    stack.pop_back();
+    const Node& node = nodes_[idx];
+    if (!overlap(node.box, box))
+      continue;
+    if (node.right >= 0) {
+      stack.push_back(node.right);
+      stack.push_back(idx + 1);
+      continue;
+    }
+    for (int k = node.begin; k < node.begin + node.count; ++k)
+      if (intersect(box, corners_[3 * k], corners_[3 * k + 1], corners_[3 * k + 2]))
+        triangles.push_back(tri_ids_[k]);
+  }
+}
+
+}
@@ -0,0 +1,112 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: bvh.hh
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace render {
+
+struct AABB {
+  glm::vec3 min, max;
+};
+
+// A bounding volume hierarchy over a fixed set of boxes (e.g. one per mesh
+// of a scene), to find the ones a camera may see without testing them all.
+class BVH {
+  public:
+    BVH() {}
+
+    // Build the hierarchy over boxes. Box i is reported as i by cull().
+    void build(const std::vector<AABB>& boxes);
+
+    int size() const { return nr_box_; }
+    bool empty() const { return nr_box_ == 0; }
+
+    // Set visible[i] to 1 if box i intersects the view frustum of
+    // camera_matrix (projection * view), and to 0 otherwise.
+    // It is conservative: a box near a corner of the frustum but outside
+    // may still be reported.
+    void cull(const glm::mat4& camera_matrix, std::vector<uint8_t>& visible) const;
+
+  private:
+    // Nodes are stored in depth-first order: the left child of an inner
+    // node follows it, and `right` is the index of the right child.
+    struct Node {
+      AABB box;
+      int begin, count;   // the boxes of the subtree are box_ids_[begin, begin + count)
+      int right;          // -1 for leaves
+    };
+    static const int kLeafSize = 4;
+
+    int nr_box_ = 0;
+    std::vector<Node> nodes_;
+    std::vector<int> box_ids_;
+
+    // build the subtree of box_ids_[begin, end), returns its index
+    int build_(const std::vector<AABB>& boxes, std::vector<glm::vec3>& centers,
+        int begin, int end);
+};
+
+// A bounding volume hierarchy over triangles, for ray casts and box queries
+// on the CPU.
+class TriangleBVH {
+  public:
+    TriangleBVH() {}
+
+    // Build the hierarchy over the triangles of corners, three per
+    // triangle. Triangle k (of corners 3k, 3k + 1, 3k + 2) is reported as k.
+    void build(std::vector<glm::vec3>&& corners);
+
+    int size() const { return tri_ids_.size(); }
+    bool empty() const { return tri_ids_.empty(); }
+    bool built() const { return built_; }
+
+    // bytes of host memory used
+    size_t bytes() const {
+      return corners_.size() * sizeof(glm::vec3) + tri_ids_.size() * sizeof(int) +
+        nodes_.size() * sizeof(Node);
+    }
+
+    struct Hit {
+      float t;        // origin + t * dir is the hit point
+      int triangle;   // -1 if nothing is hit
+    };
+
+    // The closest triangle hit by origin + t * dir, 0 <= t <= max_t.
+    // back_faces: whether triangles are also hit from the back, i.e. where
+    //  their corners are clockwise as seen from origin
+    Hit raycast(const glm::vec3& origin, const glm::vec3& dir,
+        float max_t = std::numeric_limits<float>::infinity(), bool back_faces = true) const;
+
+    // Append to triangles each triangle that intersects box.
+    void query(const AABB& box, std::vector<int>& triangles) const;
+
+  private:
+    // as in BVH
+    struct Node {
+      AABB box;
+      int begin, count;
+      int right;
+    };
+    static const int kLeafSize = 4;
+
+    bool built_ = false;
+    std::vector<Node> nodes_;
+    // corners of the triangles in the order of the leaves, and their ids
+    std::vector<glm::vec3> corners_;
+    std::vector<int> tri_ids_;
+
+    // build the subtree of tri_ids_[begin, end), returns its index
+    int build_(const std::vector<glm::vec3>& corners, std::vector<glm::vec3>& centers,
+        int begin, int end);
+};
+
+}
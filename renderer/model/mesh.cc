@@ -8,9 +8,56 @@
 #include "gl/api.hh"
 #include "mesh.hh"
 #include "gl/utils.hh"
+#include "lib/debugutils.hh"
+#include "lib/profiler.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <glm/gtc/packing.hpp>
 
 using namespace std;
 
+namespace {
+
+// compare vertices bitwise, to find the duplicates in a triangle soup
+struct VertexHash {
+  size_t operator()(const render::Vertex& v) const {
+    static_assert(sizeof(render::Vertex) == 8 * sizeof(float), "Vertex has padding!");
+    const uint32_t* p = reinterpret_cast<const uint32_t*>(&v);
+    size_t h = 0;
+    for (int i = 0; i < 8; ++i)
+      h = h * 1000003 ^ p[i];
+    return h;
+  }
+};
+
+struct VertexEqual {
+  bool operator()(const render::Vertex& a, const render::Vertex& b) const {
+    return memcmp(&a, &b, sizeof(render::Vertex)) == 0;
+  }
+};
+
+// for GL_INT_2_10_10_10_REV, normalized
+uint32_t pack_snorm_2_10_10_10(glm::vec3 v) {
+  auto pack = [](float f) -> uint32_t {
+    int i = (int)std::round(glm::clamp(f, -1.f, 1.f) * 511.f);
+    return (uint32_t)i & 0x3ff;
+  };
+  return pack(v.x) | (pack(v.y) << 10) | (pack(v.z) << 20);
+}
+
+void delete_buffers(render::MeshBatch::Buffers& buf) {
+  for (GLuint* b : {&buf.pos, &buf.attr, &buf.meshid, &buf.EBO})
+    if (*b)
+      glDeleteBuffers(1, b);
+}
+
+} // namespace
+
 namespace render {
 
 void Mesh::activate() {
@@ -47,9 +94,261 @@ void Mesh::deactivate() {
 
 void Mesh::draw() {
   VertexArrayGuard VAG{VAO};
+  PROFILE_COUNT("draw_calls", 1);
+  PROFILE_COUNT("triangles", vertices.size() / 3);
   glDrawArrays(GL_TRIANGLES, 0, vertices.size());
   glCheckError("Mesh::draw::glDrawArrays");
 }
 
+MeshBatch::MeshBatch(MeshBatch&& r):
+  vertices_(move(r.vertices_)), indices_(move(r.indices_)),
+  first_(move(r.first_)), first_vertex_(move(r.first_vertex_)), layout_(r.layout_),
+  VAO(move(r.VAO)), posVAO(move(r.posVAO)), buffers_(r.buffers_),
+  pool_(r.pool_), pool_key_(move(r.pool_key_)), active_key_(move(r.active_key_)) {
+  r.buffers_ = Buffers{};
+  r.active_key_.clear();
+}
+
+int MeshBatch::add(const vector<Vertex>& mesh_vertices) {
+  // Vertices are not shared across meshes, since they carry the mesh index.
+  unordered_map<Vertex, GLuint, VertexHash, VertexEqual> index;
+  index.reserve(mesh_vertices.size());
+  for (auto& v : mesh_vertices) {
+    auto itr = index.emplace(v, (GLuint)vertices_.size());
+    if (itr.second)
+      vertices_.push_back(v);
+    indices_.push_back(itr.first->second);
+  }
+  first_.push_back(indices_.size());
+  first_vertex_.push_back(vertices_.size());
+  return size() - 1;
+}
+
+bool MeshBatch::assign(vector<Vertex>&& vertices, vector<GLuint>&& indices,
+    vector<GLint>&& first_indices, vector<GLint>&& first_vertices) {
+  auto check = [](const vector<GLint>& first, size_t total) {
+    if (first.empty() || first.front() != 0 || (size_t)first.back() != total)
+      return false;
+    for (size_t i = 1; i < first.size(); ++i)
+      if (first[i] < first[i - 1])
+        return false;
+    return true;
+  };
+  bool ok = first_indices.size() == first_vertices.size() &&
+    check(first_indices, indices.size()) && check(first_vertices, vertices.size());
+  for (size_t i = 0; ok && i + 1 < first_indices.size(); ++i)
+    for (GLint k = first_indices[i]; k < first_indices[i + 1]; ++k)
+      if (indices[k] < (GLuint)first_vertices[i] || indices[k] >= (GLuint)first_vertices[i + 1]) {
+        ok = false;
+        break;
+      }
+  if (!ok) {
+    vertices_.clear();
+    indices_.clear();
+    first_ = first_vertex_ = {0};
+    return false;
+  }
+  vertices_ = std::move(vertices);
+  indices_ = std::move(indices);
+  first_ = std::move(first_indices);
+  first_vertex_ = std::move(first_vertices);
+  return true;
+}
+
+MeshBatch::Buffers MeshBatch::upload_buffers_() const {
+  Buffers buf;
+  glGenBuffers(1, &buf.pos);
+  glGenBuffers(1, &buf.attr);
+  glGenBuffers(1, &buf.meshid);
+  glGenBuffers(1, &buf.EBO);
+  size_t nr_vtx = vertices_.size();
+
+  // positions, in their own buffer so that posVAO only reads them
+  vector<glm::vec3> pos(nr_vtx);
+  for (size_t i = 0; i < nr_vtx; ++i)
+    pos[i] = vertices_[i].pos;
+  glBindBuffer(GL_ARRAY_BUFFER, buf.pos);
+  glBufferData(GL_ARRAY_BUFFER, nr_vtx * sizeof(glm::vec3), pos.data(), GL_STATIC_DRAW);
+
+  // normals and texcoords
+  glBindBuffer(GL_ARRAY_BUFFER, buf.attr);
+  if (layout_ == VertexLayout::COMPACT) {
+    vector<CompactAttr> attr(nr_vtx);
+    for (size_t i = 0; i < nr_vtx; ++i) {
+      attr[i].normal = pack_snorm_2_10_10_10(vertices_[i].normal);
+      attr[i].texcoord[0] = glm::packHalf1x16(vertices_[i].texcoord.x);
+      attr[i].texcoord[1] = glm::packHalf1x16(vertices_[i].texcoord.y);
+    }
+    glBufferData(GL_ARRAY_BUFFER, nr_vtx * sizeof(CompactAttr), attr.data(), GL_STATIC_DRAW);
+  } else {
+    vector<FullAttr> attr(nr_vtx);
+    for (size_t i = 0; i < nr_vtx; ++i) {
+      attr[i].normal = vertices_[i].normal;
+      attr[i].texcoord = vertices_[i].texcoord;
+    }
+    glBufferData(GL_ARRAY_BUFFER, nr_vtx * sizeof(FullAttr), attr.data(), GL_STATIC_DRAW);
+  }
+
+  // mesh index of each vertex
+  vector<GLint> meshid(nr_vtx);
+  for (int i = 0; i < size(); ++i)
+    std::fill(meshid.begin() + first_vertex_[i], meshid.begin() + first_vertex_[i + 1], i);
+  glBindBuffer(GL_ARRAY_BUFFER, buf.meshid);
+  glBufferData(GL_ARRAY_BUFFER, meshid.size() * sizeof(GLint),
+      meshid.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf.EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(GLuint),
+      indices_.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  return buf;
 }
 
+void MeshBatch::activate() {
+  if (pool_) {
+    // the key also depends on how the batch is uploaded
+    active_key_ = pool_key_ + (layout_ == VertexLayout::COMPACT ? ":compact" : ":full");
+    buffers_ = pool_->acquire(active_key_, *this);
+  } else {
+    buffers_ = upload_buffers_();
+  }
+
+  // VAOs are never shared between contexts: set the vertex attribute
+  // pointers of both in this one.
+  // Location 0: position, 1: normal, 2: texcoord, 3: mesh index
+  glGenVertexArrays(1, VAO);
+  glGenVertexArrays(1, posVAO);
+  for (GLuint vao : {VAO.obj, posVAO.obj}) {
+    VertexArrayGuard VAG{vao};
+    glBindBuffer(GL_ARRAY_BUFFER, buffers_.pos);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers_.meshid);
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, 1, GL_INT, sizeof(GLint), (GLvoid*)0);
+    if (vao == VAO.obj) {
+      glBindBuffer(GL_ARRAY_BUFFER, buffers_.attr);
+      glEnableVertexAttribArray(1);
+      glEnableVertexAttribArray(2);
+      if (layout_ == VertexLayout::COMPACT) {
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactAttr),
+            (GLvoid*)offsetof(CompactAttr, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactAttr),
+            (GLvoid*)offsetof(CompactAttr, texcoord));
+      } else {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(FullAttr),
+            (GLvoid*)offsetof(FullAttr, normal));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(FullAttr),
+            (GLvoid*)offsetof(FullAttr, texcoord));
+      }
+    }
+    // the element buffer binding is part of the VAO state
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers_.EBO);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshBatch::deactivate() {
+  for (auto vao : {&VAO, &posVAO})
+    if (*vao)
+      glDeleteVertexArrays(1, *vao);
+  VAO.obj = posVAO.obj = 0;
+  if (!active_key_.empty()) {
+    pool_->release(active_key_);
+    active_key_.clear();
+  } else {
+    delete_buffers(buffers_);
+  }
+  buffers_ = Buffers{};
+}
+
+size_t MeshBatch::gpu_bytes() const {
+  if (!VAO)
+    return 0;
+  size_t attr = layout_ == VertexLayout::COMPACT ? sizeof(CompactAttr) : sizeof(FullAttr);
+  return vertices_.size() * (sizeof(glm::vec3) + attr + sizeof(GLint)) +
+    indices_.size() * sizeof(GLuint);
+}
+
+void MeshBatch::draw(int begin, int end, bool position_only) {
+  if (begin >= end)
+    return;
+  VertexArrayGuard VAG{position_only ? posVAO : VAO};
+  PROFILE_COUNT("draw_calls", 1);
+  PROFILE_COUNT("triangles", (first_[end] - first_[begin]) / 3);
+  glDrawElements(GL_TRIANGLES, first_[end] - first_[begin], GL_UNSIGNED_INT,
+      (GLvoid*)(first_[begin] * sizeof(GLuint)));
+  glCheckError("MeshBatch::draw::glDrawElements");
+}
+
+void MeshBatch::draw(int begin, int end, const vector<uint8_t>& visible, bool position_only) {
+  // one range per run of consecutive visible meshes
+  draw_counts_.clear();
+  draw_offsets_.clear();
+  for (int i = begin; i < end; ) {
+    if (!visible[i]) {
+      ++i;
+      continue;
+    }
+    int run_end = i + 1;
+    while (run_end < end && visible[run_end])
+      ++run_end;
+    draw_counts_.push_back(first_[run_end] - first_[i]);
+    draw_offsets_.push_back((GLvoid*)(first_[i] * sizeof(GLuint)));
+    i = run_end;
+  }
+  if (draw_counts_.empty())
+    return;
+  VertexArrayGuard VAG{position_only ? posVAO : VAO};
+  PROFILE_COUNT("draw_calls", 1);
+  PROFILE_COUNT("triangles", accumulate(draw_counts_.begin(), draw_counts_.end(), (int64_t)0) / 3);
+  glMultiDrawElements(GL_TRIANGLES, draw_counts_.data(), GL_UNSIGNED_INT,
+      draw_offsets_.data(), draw_counts_.size());
+  glCheckError("MeshBatch::draw::glMultiDrawElements");
+}
+
+vector<AABB> MeshBatch::bounding_boxes() const {
+  vector<AABB> ret(size(), AABB{glm::vec3{0}, glm::vec3{0}});
+  for (int i = 0; i < size(); ++i) {
+    AABB& box = ret[i];
+    if (first_vertex_[i] == first_vertex_[i + 1])
+      continue;   // nothing to draw anyway
+    box.min = box.max = vertices_[first_vertex_[i]].pos;
+    for (int v = first_vertex_[i] + 1; v < first_vertex_[i + 1]; ++v) {
+      box.min = glm::min(box.min, vertices_[v].pos);
+      box.max = glm::max(box.max, vertices_[v].pos);
+    }
+  }
+  return ret;
+}
+
+
+MeshBatch::Buffers MeshBufferPool::acquire(const string& key, const MeshBatch& batch) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = buffers_.find(key);
+  if (itr == buffers_.end()) {
+    auto buf = batch.upload_buffers_();
+    // see TexturePool::acquire()
+    GLsync uploaded = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    itr = buffers_.emplace(key, Entry{buf, 0, uploaded}).first;
+  } else {
+    glWaitSync(itr->second.uploaded, 0, GL_TIMEOUT_IGNORED);
+  }
+  itr->second.refcount++;
+  return itr->second.buffers;
+}
+
+void MeshBufferPool::release(const string& key) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = buffers_.find(key);
+  m_assert(itr != buffers_.end());
+  if (--itr->second.refcount == 0) {
+    delete_buffers(itr->second.buffers);
+    glDeleteSync(itr->second.uploaded);
+    buffers_.erase(itr);
+  }
+}
+
+}
@@ -8,12 +8,19 @@
 #pragma once
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include "gl/geometry.hh"
 #include "gl/utils.hh"
+#include "bvh.hh"
 
 namespace render {
 
+class MeshBufferPool;
+
 // Mesh is a bunch of vertices (usaully triangles)
 class Mesh {
   public:
@@ -30,9 +37,159 @@ class Mesh {
     void activate();
     void deactivate();
     void draw();
+
+    size_t cpu_bytes() const { return vertices.size() * sizeof(Vertex); }
+    size_t gpu_bytes() const { return VBO ? cpu_bytes() : 0; }
   protected:
     GLIntResource<GLuint> VAO, VBO;
 };
 
+// Many meshes packed into one indexed vertex buffer, so that any contiguous
+// range of them is drawn with a single call.
+// Identical vertices of a mesh are stored once and referenced by a 32-bit
+// index buffer.
+// Each vertex also carries the index of its mesh as an integer attribute
+// (location 3), so that shaders can look up per-mesh data.
+class MeshBatch {
+  public:
+    // How normals and texcoords are stored on the GPU. Positions are always
+    // 3 floats.
+    enum class VertexLayout {
+      FULL,     // floats, 20 bytes
+      COMPACT   // normal as GL_INT_2_10_10_10_REV, texcoord as half floats, 8 bytes
+    };
+
+    MeshBatch() {}
+    MeshBatch(const MeshBatch&) = delete;
+    MeshBatch& operator = (const MeshBatch&) = delete;
+    MeshBatch(MeshBatch&& r);
+
+    ~MeshBatch() { deactivate(); }
+
+    // Append a mesh given as a triangle soup. Returns its index.
+    int add(const std::vector<Vertex>& mesh_vertices);
+
+    int size() const { return first_.size() - 1; }
+
+    // the unique vertices, and the triangles as indices into them
+    const std::vector<Vertex>& vertices() const { return vertices_; }
+    const std::vector<GLuint>& indices() const { return indices_; }
+    // where each mesh starts in indices() and vertices(), plus the total size
+    const std::vector<GLint>& first_indices() const { return first_; }
+    const std::vector<GLint>& first_vertices() const { return first_vertex_; }
+
+    // the bounding box of each mesh
+    std::vector<AABB> bounding_boxes() const;
+
+    // Replace the content with arrays in the format returned above.
+    // Returns false (and leaves the batch empty) if they are inconsistent.
+    bool assign(std::vector<Vertex>&& vertices, std::vector<GLuint>&& indices,
+        std::vector<GLint>&& first_indices, std::vector<GLint>&& first_vertices);
+
+    // bytes of the vertex and index arrays kept in host memory
+    size_t cpu_bytes() const {
+      return vertices_.size() * sizeof(Vertex) + indices_.size() * sizeof(GLuint);
+    }
+    // bytes of the GL buffers, if activated
+    size_t gpu_bytes() const;
+
+    // Takes effect at the next activate()
+    void set_layout(VertexLayout layout) { layout_ = layout; }
+
+    // The GL buffers of a batch. Unlike its VAOs, they can be used by any
+    // context in the share group that created them.
+    struct Buffers {
+      GLuint pos = 0, attr = 0, meshid = 0, EBO = 0;
+    };
+
+    // Get the buffers from pool when activated, where key identifies the
+    // content of the batch, instead of uploading it again for every batch.
+    // Takes effect at the next activate(). The pool must outlive the activation.
+    void set_pool(MeshBufferPool* pool, std::string key) {
+      pool_ = pool;
+      pool_key_ = std::move(key);
+    }
+
+    // setup GL buffers for rendering
+    void activate();
+    void deactivate();
+
+    // draw meshes [begin, end)
+    // position_only: only feed the positions and the mesh index to the
+    //  shader, for passes that don't use normals or texcoords.
+    void draw(int begin, int end, bool position_only=false);
+    void draw() { draw(0, size()); }
+    void draw_positions() { draw(0, size(), true); }
+
+    // draw the meshes i in [begin, end) with visible[i] != 0, in order,
+    // with a single call
+    void draw(int begin, int end, const std::vector<uint8_t>& visible,
+        bool position_only=false);
+
+  protected:
+    std::vector<Vertex> vertices_;
+    std::vector<GLuint> indices_;
+    // indices of mesh i are [first_[i], first_[i+1])
+    std::vector<GLint> first_{0};
+    // vertices of mesh i are [first_vertex_[i], first_vertex_[i+1])
+    std::vector<GLint> first_vertex_{0};
+    VertexLayout layout_ = VertexLayout::FULL;
+
+    struct FullAttr {
+      glm::vec3 normal;
+      glm::vec2 texcoord;
+    };
+    struct CompactAttr {
+      uint32_t normal;
+      uint16_t texcoord[2];
+    };
+
+    GLIntResource<GLuint> VAO, posVAO;    // all attributes, or positions only
+    Buffers buffers_;
+
+    MeshBufferPool* pool_ = nullptr;   // not owned
+    std::string pool_key_;
+    std::string active_key_;   // the key of buffers_ in pool_, if they are from it
+
+    // scratch space of the draw() of visible meshes
+    std::vector<GLsizei> draw_counts_;
+    std::vector<const GLvoid*> draw_offsets_;
+
+    friend class MeshBufferPool;
+    // upload the batch into new buffers
+    Buffers upload_buffers_() const;
+};
+
+
+// The GL buffers of batches with the same content, e.g. of one scene
+// activated by several APIs whose contexts are in a share group. Like
+// TexturePool, they are uploaded by the first batch that activates them,
+// and deleted when the last one is deactivated. Thread-safe.
+class MeshBufferPool {
+  public:
+    MeshBufferPool() {}
+    MeshBufferPool(const MeshBufferPool&) = delete;
+    MeshBufferPool& operator = (const MeshBufferPool&) = delete;
+
+    // Returns the buffers of key, uploading batch if it's not in the pool.
+    MeshBatch::Buffers acquire(const std::string& key, const MeshBatch& batch);
+    // Every acquire() has to be paired with a release().
+    void release(const std::string& key);
+
+    int size() const {
+      std::lock_guard<std::mutex> lg(mutex_);
+      return buffers_.size();
+    }
+
+  private:
+    struct Entry {
+      MeshBatch::Buffers buffers;
+      int refcount;
+      GLsync uploaded;  // other contexts wait for it before using the buffers
+    };
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> buffers_;
+};
+
 } // namespace render
 
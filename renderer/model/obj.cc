@@ -6,23 +6,124 @@
 //File: obj.cc
 
 #include "obj.hh"
+#include "objparse.hh"
 
 #include <iostream>
 #include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <exception>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "lib/debugutils.hh"
 #include "lib/strutils.hh"
 #include "lib/utils.hh"
+#include "lib/profiler.hh"
 #include "lib/timer.hh"
 #include "lib/imgproc.hh"
+#include "gl/utils.hh"
 
 using namespace std;
 
 namespace {
 
+// Decoded images of all scenes in the process, by canonical path.
+mutex image_cache_mutex;
+unordered_map<string, weak_ptr<const Matuc>> image_cache;
+
+shared_ptr<const Matuc> load_shared_image(const string& path) {
+  {
+    lock_guard<mutex> lg(image_cache_mutex);
+    auto ptr = image_cache[path].lock();
+    if (ptr)
+      return ptr;
+  }
+  // decode without holding the lock, so images are decoded in parallel
+  Matuc image = read_img(path.c_str());
+  vflip(image);
+  m_assert(image.channels() >= 3);
+
+  lock_guard<mutex> lg(image_cache_mutex);
+  auto& entry = image_cache[path];
+  auto ptr = entry.lock();    // if another thread decoded it meanwhile
+  if (!ptr) {
+    ptr = make_shared<const Matuc>(move(image));
+    entry = ptr;
+  }
+  return ptr;
+}
+
+// number of mip levels dropped from a w x h image, so that its largest side
+// is at most max_size. None if max_size is 0.
+int nr_dropped_levels(int w, int h, int max_size) {
+  int ret = 0;
+  while (max_size > 0 && std::max(w, h) > max_size) {
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+    ++ret;
+  }
+  return ret;
+}
+
+// estimated bytes of a texture with mipmaps: RGBA texels, or 8 or 16 bytes
+// per 4x4 block if compressed
+size_t texture_bytes(int w, int h, int channels, bool compressed) {
+  size_t texels = (size_t)w * h;
+  if (!compressed)
+    return texels * 4 * 4 / 3;
+  return texels / (channels == 3 ? 2 : 1) * 4 / 3;
+}
+
+// the next mip level: the average of each 2x2 block
+Matuc halve_image(const Matuc& image) {
+  int W = image.width(), H = image.height(), C = image.channels();
+  int w = std::max(W / 2, 1), h = std::max(H / 2, 1);
+  Matuc ret(h, w, C);
+  for (int y = 0; y < h; ++y) {
+    const unsigned char* row0 = image.ptr(std::min(2 * y, H - 1)),
+                       * row1 = image.ptr(std::min(2 * y + 1, H - 1));
+    unsigned char* dst = ret.ptr(y);
+    for (int x = 0; x < w; ++x) {
+      int x0 = std::min(2 * x, W - 1) * C, x1 = std::min(2 * x + 1, W - 1) * C;
+      for (int c = 0; c < C; ++c)
+        dst[x * C + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+    }
+  }
+  return ret;
+}
+
+GLuint upload_texture(const Matuc& full_image, bool compressed, int max_size) {
+  Matuc downsampled;
+  const Matuc* src = &full_image;
+  for (int i = nr_dropped_levels(full_image.width(), full_image.height(), max_size); i > 0; --i) {
+    downsampled = halve_image(*src);
+    src = &downsampled;
+  }
+  const Matuc& image = *src;
+
+  GLenum rgb_format = compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB,
+         rgba_format = compressed ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_RGBA;
+  // rows of the images are tightly packed
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  GLuint tid;
+  glGenTextures(1, &tid);
+  glBindTexture(GL_TEXTURE_2D, tid);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  if (image.channels() == 3)
+    glTexImage2D(GL_TEXTURE_2D, 0, rgb_format, image.width(), image.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, image.ptr());
+  else
+    glTexImage2D(GL_TEXTURE_2D, 0, rgba_format, image.width(), image.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, image.ptr());
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return tid;
+}
+
 string getBaseDir(const string &filepath) {
   if (filepath.find_last_of("/\\") != std::string::npos)
     return filepath.substr(0, filepath.find_last_of("/\\"));
@@ -34,7 +135,7 @@ string getBaseDir(const string &filepath) {
 namespace render {
 
 bool ObjLoader::load(string fname) {
-  //TotalTimer tm("ObjLoader::load");
+  PROFILE_ZONE("ObjLoader::load");
   base_dir = getBaseDir(fname);
 #ifdef _WIN32
   base_dir += "\\";
@@ -42,23 +143,7 @@ bool ObjLoader::load(string fname) {
   base_dir += "/";
 #endif
 
-  string err;
-  vector<tinyobj::shape_t> tmp_shapes;
-  bool ret = tinyobj::LoadObj(&attrib, &tmp_shapes, &materials, &err, fname.c_str(), base_dir.c_str());
-  if (not ret)
-    error_exit(err);
-  // if (not err.empty()) {
-  //   cerr << "Warnings from tinyobj:" << endl;
-  //   cerr << err << endl;
-  // }
-
-  original_num_shapes = tmp_shapes.size();
-  shapes.reserve(tmp_shapes.size());
-  for (size_t i = 0; i < tmp_shapes.size(); i++) {
-    auto& shp = tmp_shapes[i];
-    shapes.emplace_back(Shape{
-        std::move(shp.mesh), std::move(shp.name), static_cast<int>(i)});
-  }
+  original_num_shapes = parse_obj(fname, base_dir, attrib, shapes, materials);
 
   // validate material ids
   int num_material = materials.size();
@@ -135,6 +220,11 @@ void ObjLoader::split_shapes_by_material() {
     m_assert((int)matids.size() == nr_face);
 
     if (nr_face == 0) continue;
+    // parse_obj() has split them already
+    if (all_of(matids.begin(), matids.end(), [&](int id) { return id == matids[0]; })) {
+      new_shapes.emplace_back(std::move(shp));
+      continue;
+    }
 
     // mesh needs to be grouped by their material id
     // material id -> shape id in new_shapes
@@ -186,6 +276,15 @@ void ObjLoader::sort_by_transparent(const TextureRegistry& tex) {
           is_b = is_transparent_material(b.mesh.material_ids[0]);
         if (is_a != is_b)
           return is_b;
+        if (!is_a) {
+          // opaque shapes can be drawn in any order: group them by texture,
+          // so that renderers can draw each texture with one call
+          auto& ta = this->materials[a.mesh.material_ids[0]].diffuse_texname;
+          auto& tb = this->materials[b.mesh.material_ids[0]].diffuse_texname;
+          int cmp = ta.compare(tb);
+          if (cmp != 0)
+            return cmp < 0;
+        }
         return a.name.compare(b.name) < 0;
   });
 }
@@ -193,22 +292,55 @@ void ObjLoader::sort_by_transparent(const TextureRegistry& tex) {
 TextureRegistry::TextureRegistry(
     const vector<tinyobj::material_t>& materials,
     string base_dir): base_dir_(base_dir) {
+  vector<string> texnames;
+  unordered_set<string> seen;
   for (size_t i = 0; i < materials.size(); i++) {
     auto& m = materials[i];
     string texname = m.diffuse_texname;
     if (texname.empty()) continue;
-    if (get(texname) == 0)
-      loadTexture(texname);
+    if (seen.insert(texname).second)
+      texnames.push_back(texname);
 
     if (m.specular_texname.length() or m.normal_texname.length()
         or m.specular_highlight_texname.length() or m.ambient_texname.length()) {
       print_debug("Material %s has unsupported texture!\n", m.name.c_str());
     }
   }
+
+  // decode the images in parallel, each thread taking the next one
+  vector<Image> images(texnames.size());
+  atomic<size_t> next{0};
+  // the first error of any thread, rethrown here after they are joined
+  exception_ptr error;
+  mutex error_mutex;
+  auto work = [&]() {
+    try {
+      for (size_t k; (k = next++) < texnames.size(); )
+        images[k] = decodeTexture(texnames[k]);
+    } catch (...) {
+      lock_guard<mutex> lg(error_mutex);
+      if (!error)
+        error = current_exception();
+      next = texnames.size();   // the others stop at their next image
+    }
+  };
+  int nr_thread = min<int>({kNumDecodeThreads, (int)texnames.size(),
+      max<int>(thread::hardware_concurrency(), 1)});
+  vector<thread> threads;
+  for (int i = 1; i < nr_thread; ++i)
+    threads.emplace_back(work);
+  work();
+  for (auto& th : threads)
+    th.join();
+  if (error)
+    rethrow_exception(error);
+
+  for (size_t k = 0; k < texnames.size(); ++k)
+    texture_images_[texnames[k]] = std::move(images[k]);
 }
 
 
-void TextureRegistry::loadTexture(const string& texname) {
+TextureRegistry::Image TextureRegistry::decodeTexture(const string& texname) const {
   string filename = squeeze_path(texname);
   if (!exists_file(texname.c_str())) {
     // Append base dir.
@@ -217,40 +349,115 @@ void TextureRegistry::loadTexture(const string& texname) {
       error_exit(ssprintf("Cannot find texture %s\n", texname.c_str()));
   }
 
-  Matuc image = read_img(filename.c_str());
-  vflip(image);
-  m_assert(image.channels() >= 3);
-  texture_images_[texname] = std::move(image);
+  return Image{load_shared_image(filename), filename};
+}
+
+size_t TextureRegistry::cpu_bytes() const {
+  size_t ret = 0;
+  for (auto& itr : texture_images_)
+    ret += itr.second.mat->elements();
+  return ret;
+}
+
+int TextureRegistry::full_size() const {
+  int ret = 0;
+  for (auto& itr : texture_images_)
+    ret = std::max({ret, itr.second.mat->width(), itr.second.mat->height()});
+  return ret;
+}
+
+size_t TextureRegistry::gpu_bytes() const {
+  if (!activated_)
+    return 0;
+  return gpu_bytes(max_size_active_);
+}
+
+size_t TextureRegistry::gpu_bytes(int max_size) const {
+  // before activation, assume compression is available if requested
+  bool compressed = activated_ ? compressed_active_ : compressed_;
+  size_t ret = 0;
+  for (auto& itr : texture_images_) {
+    auto& image = *itr.second.mat;
+    int w = image.width(), h = image.height();
+    int levels = nr_dropped_levels(w, h, max_size);
+    ret += texture_bytes(std::max(w >> levels, 1), std::max(h >> levels, 1),
+        image.channels(), compressed);
+  }
+  return ret;
+}
+
+string TextureRegistry::pool_key_(const Image& image) const {
+  string ret = compressed_active_ ? image.path + ":dxt" : image.path;
+  // images that fit max_size share the texture of the full image
+  int levels = nr_dropped_levels(image.mat->width(), image.mat->height(), max_size_active_);
+  if (levels)
+    ret += ":mip" + to_string(levels);
+  return ret;
 }
 
 void TextureRegistry::activate() {
   m_assert(!activated_);
-  //TotalTimer tmmm("loadTexture::activate");
+  PROFILE_ZONE("TextureRegistry::activate");
+  compressed_active_ = compressed_ && !texture_images_.empty() &&
+    checkExtension("GL_EXT_texture_compression_s3tc");
+  max_size_active_ = max_size_;
 
   for (auto& itr : texture_images_) {
     auto& image = itr.second;
-    GLuint tid;
-    glGenTextures(1, &tid);
-    glBindTexture(GL_TEXTURE_2D, tid);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    if (image.channels() == 3)
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width(), image.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, image.ptr());
+    if (pool_)
+      map_[itr.first] = pool_->acquire(pool_key_(image), *image.mat,
+          compressed_active_, max_size_active_);
     else
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width(), image.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, image.ptr());
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    map_[itr.first] = tid;
+      map_[itr.first] = upload_texture(*image.mat, compressed_active_, max_size_active_);
   }
   activated_ = true;
 }
 
 void TextureRegistry::deactivate() {
   activated_ = false;
-  for (auto& item: map_)
-    glDeleteTextures(1, &item.second);
+  for (auto& item: map_) {
+    if (pool_)
+      pool_->release(pool_key_(texture_images_[item.first]));
+    else
+      glDeleteTextures(1, &item.second);
+  }
   map_.clear();
 }
 
+GLuint TexturePool::acquire(const string& key, const Matuc& image, bool compressed,
+    int max_size) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = textures_.find(key);
+  if (itr == textures_.end()) {
+    GLuint tex = upload_texture(image, compressed, max_size);
+    // flush, so that another context never waits for a fence that isn't sent
+    GLsync uploaded = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    int w = image.width(), h = image.height();
+    int levels = nr_dropped_levels(w, h, max_size);
+    size_t bytes = texture_bytes(std::max(w >> levels, 1), std::max(h >> levels, 1),
+        image.channels(), compressed);
+    bytes_ += bytes;
+    itr = textures_.emplace(key, Entry{tex, 0, uploaded, bytes}).first;
+  } else {
+    // the upload may come from another context. A no-op once it's done.
+    glWaitSync(itr->second.uploaded, 0, GL_TIMEOUT_IGNORED);
+  }
+  itr->second.refcount++;
+  return itr->second.texture;
+}
+
+void TexturePool::release(const string& key) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = textures_.find(key);
+  m_assert(itr != textures_.end());
+  if (--itr->second.refcount == 0) {
+    glDeleteTextures(1, &itr->second.texture);
+    glDeleteSync(itr->second.uploaded);
+    bytes_ -= itr->second.bytes;
+    textures_.erase(itr);
+  }
+}
+
 
 } // namespace render
@@ -9,6 +9,9 @@
 
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
 #include "gl/api.hh"
 #include <tiny_obj_loader.h>
 
@@ -45,6 +48,9 @@ class ObjLoader {
 
     ObjLoader(std::string fname) { load(fname); }
 
+    // An empty loader, for scenes that fill in materials themselves.
+    ObjLoader(): original_num_shapes{0} {}
+
     void printInfo() const;
 
     // convert the faceid_th face in the mesh, to a TriangleFace
@@ -52,7 +58,7 @@ class ObjLoader {
 
     void split_shapes_by_material();
 
-    // sort shapes by transparency. Put opaque objects first.
+    // sort shapes by transparency. Put opaque objects first, grouped by texture.
     void sort_by_transparent(const TextureRegistry& tex);
 
   private:
@@ -61,6 +67,48 @@ class ObjLoader {
 };
 
 
+// OpenGL textures shared by the TextureRegistry of several scenes, keyed by
+// the canonical path of the image file. A texture is uploaded by the first
+// registry that activates it, and deleted when the last one is deactivated.
+// The scenes may be in different contexts of one share group, activated
+// from different threads.
+class TexturePool {
+  public:
+    TexturePool() {}
+    TexturePool(const TexturePool&) = delete;
+    TexturePool& operator = (const TexturePool&) = delete;
+
+    // Returns the texture of key, uploading image if it's not in the pool.
+    // See TextureRegistry::set_max_size() for max_size.
+    GLuint acquire(const std::string& key, const Matuc& image, bool compressed,
+        int max_size = 0);
+    // Every acquire() has to be paired with a release().
+    void release(const std::string& key);
+
+    int size() const {
+      std::lock_guard<std::mutex> lg(mutex_);
+      return textures_.size();
+    }
+
+    // estimated bytes of the textures in GPU memory, counting each once
+    size_t bytes() const {
+      std::lock_guard<std::mutex> lg(mutex_);
+      return bytes_;
+    }
+
+  private:
+    struct Entry {
+      GLuint texture;
+      int refcount;
+      GLsync uploaded;  // other contexts wait for it before using the texture
+      size_t bytes;
+    };
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> textures_;
+    size_t bytes_ = 0;
+};
+
+
 // maintain mapping from texture name to registered OpenGL texture id
 class TextureRegistry {
   public:
@@ -82,20 +130,72 @@ class TextureRegistry {
     bool is_transparent(std::string texname) const {
       auto itr = texture_images_.find(texname);
       if (itr == texture_images_.end()) return false;
-      return itr->second.channels() == 4;
+      return itr->second.mat->channels() == 4;
     }
 
+    // Get the textures from pool when activated, instead of uploading them
+    // again for every registry. The pool must outlive the activation.
+    void set_pool(TexturePool* pool) { m_assert(!activated_); pool_ = pool; }
+
+    // Store the textures activated from now on compressed in GPU memory
+    // (DXT1, or DXT5 for images with alpha), if GL_EXT_texture_compression_s3tc
+    // is available. This takes 1/8 or 1/4 of the memory, at the cost of some
+    // blocky artifacts and a slower activate().
+    void set_compressed(bool compressed) { compressed_ = compressed; }
+
+    // Upload the textures activated from now on downsampled by whole mip
+    // levels, until their largest side is at most max_size, or 0 for the
+    // full images. The levels above are never used by a render whose pixels
+    // cover more than a texel each, so this saves their memory and upload.
+    // The images in host memory stay in full, to upload more levels later.
+    void set_max_size(int max_size) { m_assert(max_size >= 0); max_size_ = max_size; }
+    int max_size() const { return max_size_; }
+    // max_size() of the activated textures
+    int max_size_active() const { return max_size_active_; }
+
+    // the largest side of the images
+    int full_size() const;
+
     // populate map_ by texture_images_
     void activate();
     void deactivate();
 
+    bool activated() const { return activated_; }
+
+    // bytes of the decoded images kept in host memory
+    size_t cpu_bytes() const;
+    // estimated bytes of the textures in GPU memory, if activated:
+    // RGBA texels plus mipmaps
+    // Both count images shared with other registries in full.
+    size_t gpu_bytes() const;
+    // the same, if the textures were activated with set_max_size(max_size)
+    size_t gpu_bytes(int max_size) const;
+
   private:
     bool activated_ = false;
-    // load a texture to OpenGL and return its texture id
-    void loadTexture(const std::string& texname);
+    bool compressed_ = false;
+    bool compressed_active_ = false;  // whether the activated textures are compressed
+    int max_size_ = 0;
+    int max_size_active_ = 0;
+
+    // maximum number of threads to decode the images with
+    static const int kNumDecodeThreads = 8;
+
+    struct Image {
+      // flipped for OpenGL. Shared by all registries using the same file.
+      std::shared_ptr<const Matuc> mat;
+      std::string path;   // canonical path of the file
+    };
+
+    // read a texture image, or share it if it's loaded already. Thread-safe.
+    Image decodeTexture(const std::string& texname) const;
+
+    std::string pool_key_(const Image& image) const;
+
+    TexturePool* pool_ = nullptr;   // not owned
 
     // texname -> image, loaded and cached at the beginning
-    std::unordered_map<std::string, Matuc> texture_images_;
+    std::unordered_map<std::string, Image> texture_images_;
     // texname -> opengl resource id
     std::unordered_map<std::string, GLuint> map_;
     std::string base_dir_;
@@ -0,0 +1,510 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: objparse.cc
+
+#include "objparse.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "lib/debugutils.hh"
+#include "lib/mappedfile.hh"
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace {
+
+// maximum number of threads to parse the chunks with
+const int kNumParseThreads = 8;
+// chunks smaller than this are not worth a thread
+const size_t kMinChunkBytes = 1 << 20;
+
+// material slots of a chunk, besides the usemtl names it has seen
+const int kNoMaterial = -1;
+const int kInherited = -2;    // the last material of the previous chunks
+
+inline bool is_space(char c) { return c == ' ' || c == '\t'; }
+inline bool is_digit(char c) { return static_cast<unsigned>(c - '0') < 10u; }
+
+inline const char* skip_space(const char* p, const char* end) {
+  while (p < end && is_space(*p))
+    ++p;
+  return p;
+}
+
+inline const char* parse_float(const char* p, const char* end, float& ret) {
+  double v;
+  p = render::parse_real(p, end, v);
+  ret = static_cast<float>(v);
+  return p;
+}
+
+// Parse a face index at p, made zero-based. Relative (negative) indices
+// index into the count items seen so far. Returns nullptr if there's none,
+// or it's zero.
+const char* parse_index(const char* p, const char* end, int count,
+    int& ret, bool& relative) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  if (p == end || !is_digit(*p))
+    return nullptr;
+  int v = 0;
+  for (; p < end && is_digit(*p); ++p)
+    v = v * 10 + (*p - '0');
+  if (v == 0)
+    return nullptr;
+  relative = negative;
+  ret = negative ? count - v : v - 1;
+  return p;
+}
+
+// faces of one material in a Block
+struct Group {
+  int material;   // slot in the chunk
+  vector<tinyobj::index_t> indices;   // three per triangle
+};
+
+// the faces after a `g` or `o` line
+struct Block {
+  string name;
+  vector<Group> groups;
+};
+
+// An index of a relative vertex, normal or texcoord, which is local to the
+// chunk until the items of the previous chunks are counted.
+struct Fixup {
+  int block, group;
+  size_t index;
+  int component;    // 0: vertex, 1: normal, 2: texcoord
+};
+
+// A range of lines of the file, which starts at a `g` or `o` line unless
+// it's the first one.
+class Chunk {
+  public:
+    const char *begin, *end;
+    vector<float> v, vn, vt;
+    vector<Block> blocks;
+    vector<Fixup> fixups;
+    vector<string> material_names;    // of the slots
+    vector<string> mtllibs;
+    int last_material = kInherited;   // slot
+    string err;
+
+    // id: the index of the chunk in the file
+    void parse(int id);
+
+  private:
+    unordered_map<string, int> slot_of_;
+    int material_ = kInherited;
+    int group_ = -1;    // of material_ in the last block, if any
+    // the vertices of the face being parsed, and which of their indices
+    // are relative (a bit for each Fixup::component)
+    vector<tinyobj::index_t> face_;
+    vector<uint8_t> face_relative_;
+
+    void parse_face_(const char* p, const char* end);
+};
+
+void Chunk::parse(int id) {
+  material_ = id == 0 ? kNoMaterial : kInherited;
+  blocks.emplace_back();
+  for (const char* line = begin; line < end; ) {
+    const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!eol)
+      eol = end;
+    const char* next = eol + (eol < end);
+    if (eol > line && eol[-1] == '\r')
+      --eol;
+    const char* p = skip_space(line, eol);
+    line = next;
+    if (eol - p < 2)
+      continue;
+
+    if (p[0] == 'v') {
+      vector<float>* dst = nullptr;
+      int n = 3;
+      if (is_space(p[1])) {
+        dst = &v; p += 2;
+      } else if (eol - p > 2 && is_space(p[2]) && p[1] == 'n') {
+        dst = &vn; p += 3;
+      } else if (eol - p > 2 && is_space(p[2]) && p[1] == 't') {
+        dst = &vt; p += 3; n = 2;
+      }
+      if (dst)
+        for (int k = 0; k < n; ++k) {
+          float x;
+          p = parse_float(skip_space(p, eol), eol, x);
+          dst->push_back(x);
+        }
+      continue;
+    }
+
+    if (p[0] == 'f' && is_space(p[1])) {
+      parse_face_(p + 2, eol);
+      if (!err.empty())
+        return;
+      continue;
+    }
+
+    if ((p[0] == 'g' || p[0] == 'o') && is_space(p[1])) {
+      Block b;
+      if (p[0] == 'g') {
+        // the first name of the group
+        const char* s = skip_space(p + 2, eol);
+        const char* e = s;
+        while (e < eol && !is_space(*e))
+          ++e;
+        b.name.assign(s, e);
+      } else {
+        b.name.assign(p + 2, eol);
+      }
+      blocks.emplace_back(move(b));
+      group_ = -1;
+      continue;
+    }
+
+    if (eol - p > 6 && is_space(p[6])) {
+      if (strncmp(p, "usemtl", 6) == 0) {
+        string name(p + 7, eol);
+        auto itr = slot_of_.find(name);
+        if (itr == slot_of_.end()) {
+          itr = slot_of_.emplace(name, material_names.size()).first;
+          material_names.emplace_back(move(name));
+        }
+        if (itr->second != material_) {
+          material_ = itr->second;
+          group_ = -1;
+        }
+      } else if (strncmp(p, "mtllib", 6) == 0) {
+        mtllibs.emplace_back(p + 7, eol);
+      }
+    }
+  }
+  last_material = material_;
+}
+
+void Chunk::parse_face_(const char* p, const char* end) {
+  int nr_v = v.size() / 3, nr_vn = vn.size() / 3, nr_vt = vt.size() / 2;
+  face_.clear();
+  face_relative_.clear();
+  for (p = skip_space(p, end); p < end; p = skip_space(p, end)) {
+    tinyobj::index_t idx;
+    idx.vertex_index = idx.normal_index = idx.texcoord_index = -1;
+    bool rel[3] = {false, false, false};
+    p = parse_index(p, end, nr_v, idx.vertex_index, rel[0]);
+    if (p && p < end && *p == '/') {
+      ++p;
+      if (p < end && *p != '/')
+        p = parse_index(p, end, nr_vt, idx.texcoord_index, rel[2]);
+      if (p && p < end && *p == '/')
+        p = parse_index(p + 1, end, nr_vn, idx.normal_index, rel[1]);
+    }
+    if (!p) {
+      err = "Failed parse `f' line(e.g. zero value for face index).";
+      return;
+    }
+    face_.push_back(idx);
+    face_relative_.push_back(rel[0] | rel[1] << 1 | rel[2] << 2);
+  }
+  if (face_.size() < 3)
+    return;
+
+  Block& b = blocks.back();
+  if (group_ < 0) {
+    for (size_t k = 0; k < b.groups.size() && group_ < 0; ++k)
+      if (b.groups[k].material == material_)
+        group_ = k;
+    if (group_ < 0) {
+      group_ = b.groups.size();
+      b.groups.emplace_back(Group{material_, {}});
+    }
+  }
+  auto& indices = b.groups[group_].indices;
+  // a polygon becomes a triangle fan
+  for (size_t k = 2; k < face_.size(); ++k)
+    for (size_t i : {(size_t)0, k - 1, k}) {
+      indices.push_back(face_[i]);
+      for (int c = 0; c < 3; ++c)
+        if (face_relative_[i] >> c & 1)
+          fixups.push_back(Fixup{(int)blocks.size() - 1, group_, indices.size() - 1, c});
+    }
+}
+
+// The beginnings of the chunks of the file: at the first `g` or `o` line
+// at least step bytes after the previous one.
+vector<const char*> find_chunks(const char* data, size_t size, size_t step) {
+  const char* end = data + size;
+  vector<const char*> ret{data};
+  for (const char* p = data + step; p < end; ) {
+    p = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!p)
+      break;
+    ++p;
+    if (end - p >= 2 && (p[0] == 'g' || p[0] == 'o') && is_space(p[1])) {
+      ret.push_back(p);
+      p += step;
+    }
+  }
+  return ret;
+}
+
+// Load the materials of the mtllib lines like tinyobj::LoadObj: from the
+// first file of each line that can be read.
+void load_materials(const vector<string>& mtllibs, const string& base_dir,
+    vector<tinyobj::material_t>& materials, map<string, int>& material_map) {
+  tinyobj::MaterialFileReader reader(base_dir);
+  for (auto& line : mtllibs) {
+    vector<string> filenames;
+    for (size_t b = 0, e; b < line.size(); b = e + 1) {
+      e = min(line.find(' ', b), line.size());
+      filenames.emplace_back(line.substr(b, e - b));
+    }
+    for (auto& fname : filenames) {
+      string err;
+      if (reader(fname, &materials, &material_map, &err))
+        break;
+    }
+  }
+}
+
+} // namespace
+
+namespace render {
+
+int parse_obj(const string& fname, const string& base_dir,
+    tinyobj::attrib_t& attrib, vector<ObjLoader::Shape>& shapes,
+    vector<tinyobj::material_t>& materials) {
+  MappedFile file{fname};
+  if (!file.good())
+    throw std::runtime_error(ssprintf("Cannot open file [%s]", fname.c_str()));
+  int max_thread = min<int>(kNumParseThreads, max<int>(thread::hardware_concurrency(), 1));
+  auto starts = find_chunks(file.data(), file.size(),
+      max(kMinChunkBytes, file.size() / (max_thread * 4)));
+  vector<Chunk> chunks(starts.size());
+  for (size_t k = 0; k < starts.size(); ++k) {
+    chunks[k].begin = starts[k];
+    chunks[k].end = k + 1 < starts.size() ? starts[k + 1] : file.data() + file.size();
+  }
+
+  // each thread takes the next chunk
+  atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t k; (k = next++) < chunks.size(); )
+      chunks[k].parse(k);
+  };
+  int nr_thread = min<int>(max_thread, chunks.size());
+  vector<thread> threads;
+  for (int i = 1; i < nr_thread; ++i)
+    threads.emplace_back(work);
+  work();
+  for (auto& th : threads)
+    th.join();
+  for (auto& c : chunks)
+    if (!c.err.empty())
+      throw std::runtime_error(c.err);
+
+  vector<string> mtllibs;
+  for (auto& c : chunks)
+    mtllibs.insert(mtllibs.end(), c.mtllibs.begin(), c.mtllibs.end());
+  map<string, int> material_map;
+  load_materials(mtllibs, base_dir, materials, material_map);
+
+  size_t nr_v = 0, nr_vn = 0, nr_vt = 0;
+  for (auto& c : chunks) {
+    nr_v += c.v.size(); nr_vn += c.vn.size(); nr_vt += c.vt.size();
+  }
+  attrib.vertices.clear(); attrib.normals.clear(); attrib.texcoords.clear();
+  attrib.vertices.reserve(nr_v);
+  attrib.normals.reserve(nr_vn);
+  attrib.texcoords.reserve(nr_vt);
+
+  shapes.clear();
+  int nr_shape = 0;
+  int material = kNoMaterial;   // at the end of the previous chunks
+  for (auto& c : chunks) {
+    int base[3] = {(int)attrib.vertices.size() / 3, (int)attrib.normals.size() / 3,
+                   (int)attrib.texcoords.size() / 2};
+    for (auto& f : c.fixups) {
+      auto& idx = c.blocks[f.block].groups[f.group].indices[f.index];
+      int* dst[3] = {&idx.vertex_index, &idx.normal_index, &idx.texcoord_index};
+      *dst[f.component] += base[f.component];
+    }
+    attrib.vertices.insert(attrib.vertices.end(), c.v.begin(), c.v.end());
+    attrib.normals.insert(attrib.normals.end(), c.vn.begin(), c.vn.end());
+    attrib.texcoords.insert(attrib.texcoords.end(), c.vt.begin(), c.vt.end());
+    vector<float>().swap(c.v); vector<float>().swap(c.vn); vector<float>().swap(c.vt);
+
+    // slot -> material id. A usemtl of an unknown material uses none,
+    // which ObjLoader rejects.
+    vector<int> material_of(c.material_names.size());
+    for (size_t k = 0; k < material_of.size(); ++k) {
+      auto itr = material_map.find(c.material_names[k]);
+      material_of[k] = itr == material_map.end() ? kNoMaterial : itr->second;
+    }
+    auto resolve = [&](int slot) {
+      return slot == kInherited ? material : (slot == kNoMaterial ? kNoMaterial : material_of[slot]);
+    };
+
+    for (auto& b : c.blocks) {
+      if (b.groups.empty())
+        continue;
+      // slots may resolve to the same material: keep one shape for each
+      size_t first = shapes.size();
+      for (auto& g : b.groups) {
+        int id = resolve(g.material);
+        size_t k = first;
+        while (k < shapes.size() && shapes[k].mesh.material_ids[0] != id)
+          ++k;
+        if (k == shapes.size())
+          shapes.emplace_back(ObjLoader::Shape{{}, b.name, nr_shape});
+        auto& mesh = shapes[k].mesh;
+        if (mesh.indices.empty())
+          mesh.indices.swap(g.indices);
+        else
+          mesh.indices.insert(mesh.indices.end(), g.indices.begin(), g.indices.end());
+        mesh.num_face_vertices.assign(mesh.indices.size() / 3, 3);
+        mesh.material_ids.assign(mesh.indices.size() / 3, id);
+      }
+      nr_shape++;
+    }
+    if (c.last_material != kInherited)
+      material = resolve(c.last_material);
+  }
+  return nr_shape;
+}
+
+const char* parse_real(const char* p, const char* end, double& ret) {
+  static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char* begin = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  // the digits after the 19th significant one only scale the result
+  uint64_t mantissa = 0;
+  int nr_digit = 0, exponent = 0;
+  bool any = false;
+  for (; p < end && is_digit(*p); ++p, any = true) {
+    if (nr_digit < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      nr_digit += mantissa > 0;
+    } else {
+      exponent++;
+    }
+  }
+  if (p < end && *p == '.')
+    for (++p; p < end && is_digit(*p); ++p, any = true)
+      if (nr_digit < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        nr_digit += mantissa > 0;
+        exponent--;
+      }
+  if (!any) {
+    // e.g. nan or inf
+    char buf[32];
+    size_t len = min<size_t>(end - begin, sizeof(buf) - 1);
+    memcpy(buf, begin, len);
+    buf[len] = 0;
+    char* stop;
+    ret = strtod(buf, &stop);
+    return begin + (stop - buf);
+  }
+  if (p + 1 < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negative_exp = false;
+    if (*q == '-' || *q == '+')
+      negative_exp = *q++ == '-';
+    if (q < end && is_digit(*q)) {
+      int e = 0;
+      for (; q < end && is_digit(*q); ++q)
+        e = min(e * 10 + (*q - '0'), 10000);
+      exponent += negative_exp ? -e : e;
+      p = q;
+    }
+  }
+  // exact when both the mantissa and the power of 10 are
+  double v = static_cast<double>(mantissa);
+  if (mantissa != 0 && exponent != 0) {
+    if (exponent > 0 && exponent <= 22)
+      v *= kPow10[exponent];
+    else if (exponent < 0 && exponent >= -22)
+      v /= kPow10[-exponent];
+    else
+      v *= pow(10.0, exponent);
+  }
+  ret = negative ? -v : v;
+  return p;
+}
+
+vector<ObjGroupBox> scan_group_boxes(const string& fname, const string& pattern) {
+  MappedFile file{fname};
+  if (!file.good())
+    throw std::runtime_error(ssprintf("Cannot open file [%s]", fname.c_str()));
+  const char *p = file.data(), *end = p + file.size();
+  vector<ObjGroupBox> ret;
+  bool in_group = false;
+  int nr_vertex = 0;
+  auto flush = [&]() {
+    if (in_group && nr_vertex == 0)
+      ret.pop_back();
+  };
+  while (p < end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!eol)
+      eol = end;
+    const char* line = p;
+    p = eol + (eol < end);
+    if (eol == line)
+      continue;
+    // a bare `g` starts a group as well, without a name
+    if (line[0] == 'g') {
+      flush();
+      in_group = search(line, eol, pattern.begin(), pattern.end()) != eol;
+      nr_vertex = 0;
+      if (in_group) {
+        ObjGroupBox box;
+        const char* s = skip_space(line + 1, eol);
+        const char* e = s;
+        while (e < eol && !isspace(*e))
+          ++e;
+        box.name.assign(s, e);
+        for (int k = 0; k < 3; ++k) {
+          box.min[k] = numeric_limits<double>::max();
+          box.max[k] = numeric_limits<double>::lowest();
+        }
+        ret.emplace_back(move(box));
+      }
+    } else if (in_group && eol - line >= 2 && line[0] == 'v' && line[1] == ' ') {
+      auto& box = ret.back();
+      const char* q = line + 2;
+      for (int k = 0; k < 3; ++k) {
+        double x;
+        q = parse_real(skip_space(q, eol), eol, x);
+        box.min[k] = min(box.min[k], x);
+        box.max[k] = max(box.max[k], x);
+      }
+      nr_vertex++;
+    }
+  }
+  flush();
+  return ret;
+}
+
+} // namespace render
@@ -0,0 +1,49 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: objparse.hh
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <tiny_obj_loader.h>
+
+#include "obj.hh"
+
+namespace render {
+
+// Parse the Wavefront OBJ file fname, with the material libraries it uses
+// from base_dir, into the outputs of ObjLoader. Returns the number of
+// shapes (non-empty `g` or `o` groups) in the file.
+//
+// It reads what tinyobj::LoadObj reads of the file, minus the `t` tags, but
+// the shapes come out already split by material (in the order the materials
+// are first used in each), with triangulated faces.
+//
+// The file is memory-mapped and cut into chunks at `g` and `o` lines, which
+// are parsed in parallel. Throws std::runtime_error if the file cannot be
+// read or parsed.
+int parse_obj(const std::string& fname, const std::string& base_dir,
+    tinyobj::attrib_t& attrib, std::vector<ObjLoader::Shape>& shapes,
+    std::vector<tinyobj::material_t>& materials);
+
+// Parse a decimal number at p, or 0 if there's none. Returns the end of it.
+// Numbers of up to 15 significant digits, and small exponents, are
+// correctly rounded.
+const char* parse_real(const char* p, const char* end, double& ret);
+
+// The bounding box of the vertices after a `g` line, until the next one.
+struct ObjGroupBox {
+  std::string name;
+  double min[3], max[3];
+};
+
+// Scan the OBJ file fname for the bounding boxes of the groups whose `g`
+// line contains pattern, without loading the file. Groups without vertices
+// are skipped. Throws std::runtime_error if the file cannot be read.
+std::vector<ObjGroupBox> scan_group_boxes(const std::string& fname, const std::string& pattern);
+
+} // namespace render
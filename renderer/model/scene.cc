@@ -59,6 +59,20 @@ void SimpleObjScene::deactivate() {
   textures_.deactivate();
 }
 
+size_t SimpleObjScene::cpu_bytes() const {
+  size_t ret = textures_.cpu_bytes();
+  for (auto& m : mesh_)
+    ret += m.cpu_bytes();
+  return ret;
+}
+
+size_t SimpleObjScene::gpu_bytes() const {
+  size_t ret = textures_.gpu_bytes();
+  for (auto& m : mesh_)
+    ret += m.gpu_bytes();
+  return ret;
+}
+
 void SimpleObjScene::parse_scene() {
   float x = std::numeric_limits<float>::max();
   boxmin_ = {x, x, x};
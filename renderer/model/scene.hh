@@ -34,6 +34,11 @@ class ObjSceneBase {
     virtual void deactivate() = 0;
     virtual Shader* get_shader() = 0;
 
+    // Approximate memory used by the scene, for the budget of SceneCache.
+    // gpu_bytes() is 0 when the scene is deactivated.
+    virtual size_t cpu_bytes() const = 0;
+    virtual size_t gpu_bytes() const = 0;
+
     glm::vec3 get_range() const
     { return boxmax_ - boxmin_; }
 
@@ -58,6 +63,9 @@ class SimpleObjScene : public ObjSceneBase {
     void deactivate() override;
     Shader* get_shader() override { return &shader_; }
 
+    size_t cpu_bytes() const override;
+    size_t gpu_bytes() const override;
+
   protected:
     void parse_scene();
 
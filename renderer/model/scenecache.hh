@@ -9,57 +9,161 @@
 
 #include <unordered_map>
 #include <string>
+#include <list>
+#include <limits>
+#include <utility>
+#include <vector>
 
 #include "scene.hh"
+#include "lib/debugutils.hh"
 
 namespace render {
 
 // Manage cache scenes, as well as the activating scenes.
+//
+// Scenes are kept in least-recently-used order, under two memory budgets:
+// 1. GPU: besides the current scene, recently used scenes stay activated
+//    while their total gpu_bytes() fits in the GPU budget, so switching back
+//    to them doesn't upload anything. Others are deactivated, keeping only
+//    their CPU copy.
+// 2. CPU: when the total cpu_bytes() of all cached scenes exceeds the CPU
+//    budget, the least recently used scenes are deleted.
+// The current scene is never evicted.
+// By default only the current scene is activated, and nothing is deleted.
 class SceneCache {
   public:
+    struct Stats {
+      int hits = 0, misses = 0;
+      int gpu_evictions = 0;  // scenes deactivated due to the GPU budget
+      int cpu_evictions = 0;  // scenes deleted due to the CPU budget
+      int num_scenes = 0, num_activated = 0;
+      size_t cpu_bytes = 0, gpu_bytes = 0;
+    };
+
     SceneCache() {}
     ~SceneCache() {
       for (auto& pair: cached_scenes_)
-        delete pair.second;
+        delete pair.second.scene;
     }
     SceneCache(const SceneCache&) = delete;
     SceneCache& operator =(const SceneCache&) = delete;
 
+    // Budgets in bytes. Scenes are evicted right away if needed.
+    void set_budget(size_t gpu_bytes, size_t cpu_bytes) {
+      gpu_budget_ = gpu_bytes;
+      cpu_budget_ = cpu_bytes;
+      enforce_budget_();
+    }
 
-    // will deactivate current scene, activate new scene
+    // will activate the scene if needed, and make it the current scene.
     // Caller doesn't own the return pointer.
     ObjSceneBase* get(const std::string& name) {
       auto itr = cached_scenes_.find(name);
-      if (itr != cached_scenes_.end()) {
-        ObjSceneBase* new_scene = itr->second;
-        if (new_scene != scene_) {
-          scene_->deactivate();
-          new_scene->activate();
-          scene_ = new_scene;
-        }
-        return scene_;
+      if (itr == cached_scenes_.end()) {
+        stats_.misses++;
+        return nullptr;
+      }
+      stats_.hits++;
+      Entry& entry = itr->second;
+      if (!entry.activated) {
+        entry.scene->activate();
+        entry.activated = true;
       }
-      return nullptr;
+      lru_.splice(lru_.begin(), lru_, entry.lru_pos);
+      scene_ = entry.scene;
+      enforce_budget_();
+      return scene_;
     }
 
-    // ptr must be activated already.
-    // This will deactivate old scene, put the pair into cache
+    // Whether the scene is cached, without making it the current scene.
+    bool contains(const std::string& name) const {
+      return cached_scenes_.find(name) != cached_scenes_.end();
+    }
+
+    // ptr must be activated already. It becomes the current scene.
     // The caller transfer ownership to SceneCache.
     void put(const std::string& name, ObjSceneBase* ptr) {
-      if (scene_)
-        scene_->deactivate();
+      m_assert(cached_scenes_.find(name) == cached_scenes_.end());
+      lru_.push_front(name);
+      cached_scenes_[name] = Entry{ptr, lru_.begin(), true};
       scene_ = ptr;
-      cached_scenes_[name] = ptr;
+      enforce_budget_();
+    }
+
+    Stats stats() const {
+      Stats ret = stats_;
+      ret.num_scenes = cached_scenes_.size();
+      for (auto& pair : cached_scenes_) {
+        ret.num_activated += pair.second.activated;
+        ret.cpu_bytes += pair.second.scene->cpu_bytes();
+        ret.gpu_bytes += pair.second.scene->gpu_bytes();
+      }
+      return ret;
+    }
+
+    // The name and gpu_bytes() of each activated scene
+    std::vector<std::pair<std::string, size_t>> activated() const {
+      std::vector<std::pair<std::string, size_t>> ret;
+      for (auto& pair : cached_scenes_)
+        if (pair.second.activated)
+          ret.emplace_back(pair.first, pair.second.scene->gpu_bytes());
+      return ret;
     }
 
   private:
+    struct Entry {
+      ObjSceneBase* scene;  // owned
+      std::list<std::string>::iterator lru_pos;
+      bool activated;
+    };
+
+    void enforce_budget_() {
+      // the current scene doesn't count: it has to stay
+      size_t gpu_total = 0, cpu_total = 0;
+      for (auto& name : lru_) {
+        Entry& entry = cached_scenes_[name];
+        cpu_total += entry.scene->cpu_bytes();
+        if (entry.scene == scene_)
+          continue;
+        if (entry.activated) {
+          size_t bytes = entry.scene->gpu_bytes();
+          if (gpu_total + bytes <= gpu_budget_) {
+            gpu_total += bytes;
+          } else {
+            entry.scene->deactivate();
+            entry.activated = false;
+            stats_.gpu_evictions++;
+          }
+        }
+      }
+
+      auto itr = lru_.end();
+      while (cpu_total > cpu_budget_ && itr != lru_.begin()) {
+        --itr;
+        auto entry_itr = cached_scenes_.find(*itr);
+        ObjSceneBase* scene = entry_itr->second.scene;
+        if (scene == scene_)
+          continue;
+        cpu_total -= scene->cpu_bytes();
+        delete scene;
+        cached_scenes_.erase(entry_itr);
+        itr = lru_.erase(itr);
+        stats_.cpu_evictions++;
+      }
+    }
+
     // cache previously loaded scenes
     // This hash owns all the pointers.
-    std::unordered_map<std::string, ObjSceneBase*> cached_scenes_;
+    std::unordered_map<std::string, Entry> cached_scenes_;
+    // names of the cached scenes, most recently used first
+    std::list<std::string> lru_;
+
+    size_t gpu_budget_ = 0,
+           cpu_budget_ = std::numeric_limits<size_t>::max();
+    Stats stats_;
 
     // The current scene
-    ObjSceneBase* scene_ = nullptr;  // doesn't own this pointer. Only this scene should be activated.
+    ObjSceneBase* scene_ = nullptr;  // doesn't own this pointer. Always activated.
 };
 
 }
-
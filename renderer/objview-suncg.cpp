@@ -52,6 +52,7 @@ int main(int argc, char* argv[]) {
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   SUNCGScene scene(argv[1], argv[2], argv[3]);
+  scene.activate();
   auto& shader = *scene.get_shader();
   shader.use();
 
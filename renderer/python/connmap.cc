@@ -0,0 +1,192 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "connmap.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "lib/strutils.hh"
+
+namespace py = pybind11;
+using namespace std;
+
+namespace {
+
+// The file of ConnMap::save(): the header, then n * n uint16 distances,
+// padded to 4 bytes, then nr_target float in-room distances.
+const char kConnMagic[8] = {'H', '3', 'D', 'C', 'O', 'N', 'N', '\0'};
+const uint32_t kConnVersion = 1;
+
+struct ConnHeader {
+  char magic[8];
+  uint32_t version, n;
+  uint64_t move_hash;
+  int32_t max_dist;
+  uint32_t nr_target;
+};
+
+inline size_t dist_bytes(size_t n) { return (n * n * sizeof(uint16_t) + 3) / 4 * 4; }
+
+}
+
+namespace render {
+
+const uint16_t ConnMap::kUnreachable;
+
+ConnMap::ConnMap(nparray<int32_t> conn, nparray<float> inroom_dist,
+    int max_dist, uint64_t move_hash):
+  max_dist_{max_dist}, move_hash_{move_hash} {
+  if (conn.ndim() != 2 || conn.shape(0) != conn.shape(1) || inroom_dist.ndim() != 2 ||
+      inroom_dist.shape(0) != conn.shape(0) || inroom_dist.shape(1) != conn.shape(1))
+    throw std::invalid_argument("ConnMap: connMap and inroomDist must be square maps of the same shape");
+  if (max_dist >= kUnreachable)
+    throw std::invalid_argument(ssprintf("ConnMap: distance %d does not fit uint16", max_dist));
+  n_ = conn.shape(0);
+  const int32_t* d = conn.data();
+  const float* r = inroom_dist.data();
+  dist_.resize(conn.size());
+  for (size_t i = 0; i < dist_.size(); ++i) {
+    dist_[i] = d[i] < 0 ? kUnreachable : (uint16_t)d[i];
+    if (d[i] == 0)
+      inroom_.push_back(r[i]);
+  }
+  use_memory_();
+}
+
+ConnMap::ConnMap(int n, vector<uint16_t> dist, vector<float> inroom_dist,
+    int max_dist, uint64_t move_hash):
+  n_{n}, max_dist_{max_dist}, move_hash_{move_hash},
+  dist_(move(dist)), inroom_(move(inroom_dist)) {
+  if (dist_.size() != (size_t)n * n)
+    throw std::invalid_argument("ConnMap: dist must have n * n cells");
+  use_memory_();
+}
+
+void ConnMap::use_memory_() {
+  dist_ptr_ = dist_.data();
+  inroom_ptr_ = inroom_.data();
+  nr_target_ = inroom_.size();
+}
+
+unique_ptr<ConnMap> ConnMap::load(const string& fname, uint64_t move_hash) {
+  unique_ptr<MappedFile> file{new MappedFile{fname}};
+  ConnHeader header;
+  if (!file->good() || file->size() < sizeof(header))
+    return nullptr;
+  memcpy(&header, file->data(), sizeof(header));
+  if (memcmp(header.magic, kConnMagic, sizeof(kConnMagic)) != 0 ||
+      header.version != kConnVersion || header.move_hash != move_hash)
+    return nullptr;
+  size_t expected = sizeof(header) + dist_bytes(header.n) + header.nr_target * sizeof(float);
+  if (file->size() != expected)
+    throw std::runtime_error(ssprintf("ConnMap: %s is truncated", fname.c_str()));
+
+  unique_ptr<ConnMap> ret{new ConnMap};
+  ret->n_ = header.n;
+  ret->max_dist_ = header.max_dist;
+  ret->move_hash_ = header.move_hash;
+  ret->nr_target_ = header.nr_target;
+  const char* p = file->data() + sizeof(header);
+  ret->dist_ptr_ = reinterpret_cast<const uint16_t*>(p);
+  ret->inroom_ptr_ = reinterpret_cast<const float*>(p + dist_bytes(header.n));
+  ret->file_ = move(file);
+  ret->fname_ = fname;
+  return ret;
+}
+
+void ConnMap::save(const string& fname) {
+  // write a temporary file and rename it, so readers never see a partial
+  // one, and processes saving the same map don't write the same file
+  string tmp = ssprintf("%s.tmp%d", fname.c_str(), (int)getpid());
+  {
+    ofstream os(tmp, ios::binary);
+    ConnHeader header;
+    memcpy(header.magic, kConnMagic, sizeof(kConnMagic));
+    header.version = kConnVersion;
+    header.n = n_;
+    header.move_hash = move_hash_;
+    header.max_dist = max_dist_;
+    header.nr_target = nr_target_;
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    size_t nr_byte = (size_t)n_ * n_ * sizeof(uint16_t);
+    os.write(reinterpret_cast<const char*>(dist_ptr_), nr_byte);
+    const char pad[4] = {0};
+    os.write(pad, dist_bytes(n_) - nr_byte);
+    os.write(reinterpret_cast<const char*>(inroom_ptr_), nr_target_ * sizeof(float));
+    if (!os.good())
+      throw std::runtime_error(ssprintf("ConnMap: cannot write %s", tmp.c_str()));
+  }
+  if (rename(tmp.c_str(), fname.c_str()) != 0)
+    throw std::runtime_error(ssprintf("ConnMap: cannot write %s", fname.c_str()));
+
+  auto loaded = load(fname, move_hash_);
+  if (!loaded)
+    throw std::runtime_error(ssprintf("ConnMap: cannot read %s", fname.c_str()));
+  // drop the memory for the mapping
+  dist_ptr_ = loaded->dist_ptr_;
+  inroom_ptr_ = loaded->inroom_ptr_;
+  file_ = move(loaded->file_);
+  fname_ = fname;
+  vector<uint16_t>().swap(dist_);
+  vector<float>().swap(inroom_);
+}
+
+uint64_t ConnMap::hashMoveMap(nparray<int8_t> move) {
+  if (move.ndim() != 2)
+    throw std::invalid_argument("move must be a 2D array");
+  // FNV-1a of the shape and of whether each cell is movable
+  uint64_t h = 14695981039346656037ull;
+  auto add = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+  add(move.shape(0));
+  add(move.shape(1));
+  const int8_t* p = move.data();
+  for (ssize_t i = 0; i < move.size(); ++i)
+    add(p[i] > 0);
+  return h;
+}
+
+py::array_t<int32_t> ConnMap::connMap() const {
+  py::array_t<int32_t> ret({(ssize_t)n_, (ssize_t)n_});
+  int32_t* d = ret.mutable_data();
+  for (size_t i = 0; i < (size_t)n_ * n_; ++i)
+    d[i] = dist_ptr_[i] == kUnreachable ? -1 : dist_ptr_[i];
+  return ret;
+}
+
+py::array_t<float> ConnMap::inroomDist() const {
+  py::array_t<float> ret({(ssize_t)n_, (ssize_t)n_});
+  float* d = ret.mutable_data();
+  size_t k = 0;
+  for (size_t i = 0; i < (size_t)n_ * n_; ++i)
+    d[i] = dist_ptr_[i] == 0 ? inroom_ptr_[k++] : -1.f;
+  return ret;
+}
+
+py::array_t<int32_t> ConnMap::connectedCoors() const {
+  // a counting sort of the cells by distance
+  size_t nr_cell = (size_t)n_ * n_;
+  vector<size_t> start(max_dist_ + 2, 0);
+  for (size_t i = 0; i < nr_cell; ++i)
+    if (dist_ptr_[i] != kUnreachable)
+      start[dist_ptr_[i] + 1]++;
+  for (size_t d = 1; d < start.size(); ++d)
+    start[d] += start[d - 1];
+  py::array_t<int32_t> ret({(ssize_t)start.back(), (ssize_t)2});
+  int32_t* p = ret.mutable_data();
+  for (size_t i = 0; i < nr_cell; ++i)
+    if (dist_ptr_[i] != kUnreachable) {
+      int32_t* c = p + 2 * start[dist_ptr_[i]]++;
+      c[0] = i / n_;
+      c[1] = i % n_;
+    }
+  return ret;
+}
+
+}
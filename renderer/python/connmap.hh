@@ -0,0 +1,93 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pybind11/numpy.h>
+
+#include "lib/mappedfile.hh"
+
+namespace render {
+
+// The distances to a target room of House.setTargetRoom, stored compactly:
+// uint16 distances, and the in-room distances of the target cells only.
+//
+// A ConnMap is either in memory, or a mapping of the file written by
+// save(). The processes that load the same file share its pages, e.g. the
+// workers of MultiHouseEnv, so each (house, target) is in RAM once.
+class ConnMap {
+  template <typename T>
+  using nparray = pybind11::array_t<T, pybind11::array::c_style>;
+
+  public:
+    // distance of the cells not connected to the target
+    static const uint16_t kUnreachable = 65535;
+
+    // From the (connMap, inroomDist, maxConnDist) of a target of
+    // House::genConnMaps(). move_hash is hashMoveMap() of their movability map.
+    ConnMap(nparray<int32_t> conn, nparray<float> inroom_dist, int max_dist, uint64_t move_hash);
+
+    // An in-memory ConnMap of n x n cells.
+    ConnMap(int n, std::vector<uint16_t> dist, std::vector<float> inroom_dist,
+        int max_dist, uint64_t move_hash);
+
+    ConnMap(const ConnMap&) = delete;
+    ConnMap& operator = (const ConnMap&) = delete;
+
+    // Map fname, written by save(). Returns null if it does not exist, is
+    // not such a file, or is computed on a map of another move_hash.
+    // Throws std::runtime_error if it is truncated.
+    static std::unique_ptr<ConnMap> load(const std::string& fname, uint64_t move_hash);
+
+    // Write to fname, replacing it atomically, and map it from now on.
+    void save(const std::string& fname);
+
+    // A hash of the movable cells of move, to tell whether a file matches.
+    static uint64_t hashMoveMap(nparray<int8_t> move);
+
+    // The maps of House::genConnMaps(): connMap, with -1 for unreachable
+    // cells, and inroomDist, -1 outside of the target
+    pybind11::array_t<int32_t> connMap() const;
+    pybind11::array_t<float> inroomDist() const;
+
+    // (k, 2) int32 array of the reachable cells, by increasing distance.
+    pybind11::array_t<int32_t> connectedCoors() const;
+
+    int maxConnDist() const { return max_dist_; }
+    int size() const { return n_; }
+    uint64_t moveHash() const { return move_hash_; }
+
+    // the file it is mapped from, or empty if it is in memory
+    const std::string& fname() const { return fname_; }
+
+    // the uint16 distances and the in-room distances of the
+    // nr_target() cells at distance 0, in row-major order
+    const uint16_t* dist() const { return dist_ptr_; }
+    const float* targetDist() const { return inroom_ptr_; }
+    size_t nr_target() const { return nr_target_; }
+
+  private:
+    int n_, max_dist_;
+    uint64_t move_hash_;
+    size_t nr_target_;
+    const uint16_t* dist_ptr_;
+    const float* inroom_ptr_;
+
+    // either in memory, or in file_
+    std::vector<uint16_t> dist_;
+    std::vector<float> inroom_;
+    std::unique_ptr<MappedFile> file_;
+    std::string fname_;
+
+    ConnMap() = default;
+    void use_memory_();
+};
+
+}
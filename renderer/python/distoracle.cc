@@ -0,0 +1,343 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "distoracle.hh"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+namespace py = pybind11;
+using namespace std;
+
+namespace render {
+
+const uint16_t DistanceOracle::kUnreachable;
+
+DistanceOracle::DistanceOracle(nparray<int8_t> move_map, int nr_landmarks):
+  nr_landmarks_requested_{nr_landmarks} {
+  if (move_map.ndim() != 2)
+    throw std::invalid_argument("move must be a 2D array");
+  rows_ = move_map.shape(0);
+  cols_ = move_map.shape(1);
+  stride_ = cols_ + 2;
+  const int8_t* p = move_map.data();
+  id_.assign((size_t)(rows_ + 2) * stride_, -1);
+  for (int x = 0; x < rows_; ++x)
+    for (int y = 0; y < cols_; ++y)
+      if (p[(size_t)x * cols_ + y] > 0) {
+        int c = (x + 1) * stride_ + y + 1;
+        id_[c] = cell_.size();
+        cell_.push_back(c);
+      }
+  int nr_id = cell_.size();
+
+  // label the components, and find the largest one
+  comp_.assign(nr_id, -1);
+  int nr_comp = 0, largest_size = 0, largest_first = -1;
+  for (int s = 0; s < nr_id; ++s) {
+    if (comp_[s] >= 0)
+      continue;
+    vector<int32_t> que{s};
+    comp_[s] = nr_comp;
+    for (size_t ptr = 0; ptr < que.size(); ++ptr) {
+      int c = cell_[que[ptr]];
+      for (int n : {c + 1, c + stride_, c - stride_, c - 1}) {
+        int u = id_[n];
+        if (u >= 0 && comp_[u] < 0) {
+          comp_[u] = nr_comp;
+          que.push_back(u);
+        }
+      }
+    }
+    if ((int)que.size() > largest_size) {
+      largest_ = nr_comp;
+      largest_size = que.size();
+      largest_first = s;
+    }
+    nr_comp++;
+  }
+  if (largest_ < 0 || nr_landmarks <= 0)
+    return;
+
+  // farthest point sampling of the landmarks, starting from the cell of the
+  // component farthest from one of its cells
+  auto farthest = [&](const vector<int32_t>& dist) {
+    int ret = largest_first;
+    for (int v = 0; v < nr_id; ++v)
+      if (dist[v] > dist[ret] && comp_[v] == largest_)
+        ret = v;
+    return ret;
+  };
+  vector<int32_t> min_dist = bfs_(largest_first);
+  int next = farthest(min_dist);
+  for (auto& d : min_dist)
+    d = d < 0 ? -1 : INT_MAX;
+  vector<vector<int32_t>> dists;
+  while ((int)dists.size() < nr_landmarks) {
+    auto dist = bfs_(next);
+    if (*max_element(dist.begin(), dist.end()) >= kUnreachable)
+      break;    // too far for uint16
+    landmarks_.push_back(next);
+    for (int v = 0; v < nr_id; ++v)
+      min_dist[v] = min(min_dist[v], dist[v]);
+    dists.emplace_back(move(dist));
+    next = farthest(min_dist);
+    if (min_dist[next] == 0)
+      break;    // every cell is a landmark
+  }
+  size_t nr_landmark = landmarks_.size();
+  ldist_.resize(nr_id * nr_landmark);
+  for (int v = 0; v < nr_id; ++v)
+    for (size_t l = 0; l < nr_landmark; ++l)
+      ldist_[v * nr_landmark + l] = max(dists[l][v], 0);
+}
+
+DistanceOracle::~DistanceOracle() {}
+
+vector<int32_t> DistanceOracle::bfs_(int src) const {
+  vector<int32_t> dist(cell_.size(), -1);
+  vector<int32_t> que{src};
+  que.reserve(cell_.size());
+  dist[src] = 0;
+  for (size_t ptr = 0; ptr < que.size(); ++ptr) {
+    int v = que[ptr], c = cell_[v], d = dist[v] + 1;
+    for (int n : {c + 1, c + stride_, c - stride_, c - 1}) {
+      int u = id_[n];
+      if (u >= 0 && dist[u] < 0) {
+        dist[u] = d;
+        que.push_back(u);
+      }
+    }
+  }
+  return dist;
+}
+
+unique_ptr<DistanceOracle::Workspace> DistanceOracle::acquire_() const {
+  unique_ptr<Workspace> ret;
+  {
+    lock_guard<mutex> lg(pool_mutex_);
+    if (pool_.size()) {
+      ret = move(pool_.back());
+      pool_.pop_back();
+    }
+  }
+  if (!ret) {
+    ret.reset(new Workspace);
+    ret->stamp.assign(cell_.size() * 2, 0);
+    ret->g.resize(cell_.size());
+    ret->parent.resize(cell_.size());
+  }
+  return ret;
+}
+
+void DistanceOracle::release_(unique_ptr<Workspace> ws) const {
+  lock_guard<mutex> lg(pool_mutex_);
+  pool_.emplace_back(move(ws));
+}
+
+pair<int, int> DistanceOracle::bounds_(int a, int b) const {
+  int lower = abs(x_of_(a) - x_of_(b)) + abs(y_of_(a) - y_of_(b)), upper = INT_MAX;
+  if (comp_[a] != largest_)
+    return {lower, upper};
+  size_t nr_landmark = landmarks_.size();
+  const uint16_t *da = ldist_.data() + a * nr_landmark, *db = ldist_.data() + b * nr_landmark;
+  for (size_t l = 0; l < nr_landmark; ++l) {
+    lower = max(lower, abs(da[l] - db[l]));
+    upper = min(upper, da[l] + db[l]);
+  }
+  return {lower, upper};
+}
+
+int DistanceOracle::search_(Workspace& ws, int a, int b) const {
+  // The lower bound of the distance to b: the largest of the bounds of the
+  // landmarks, 0 if a and b are not in largest_, and of the distance
+  // without obstacles. Each is consistent, so the search is exact.
+  size_t nr_landmark = landmarks_.size();
+  const uint16_t* db = ldist_.data() + b * nr_landmark;
+  int bx = cell_[b] / stride_, by = cell_[b] % stride_;
+  auto h = [&](int v) {
+    const uint16_t* dv = ldist_.data() + v * nr_landmark;
+    int ret = abs(cell_[v] / stride_ - bx) + abs(cell_[v] % stride_ - by);
+    for (size_t l = 0; l < nr_landmark; ++l)
+      ret = max(ret, abs(dv[l] - db[l]));
+    return ret;
+  };
+
+  // stamp[2v] is whether v is seen, stamp[2v + 1] whether it is expanded
+  if (ws.cur >= UINT32_MAX - 1) {
+    fill(ws.stamp.begin(), ws.stamp.end(), 0);
+    ws.cur = 0;
+  }
+  uint32_t cur = ++ws.cur;
+  auto& buckets = ws.buckets;
+  // A* with a queue of buckets by f - f(a), since f never decreases. The
+  // last cell pushed to a bucket is expanded first.
+  int f0 = h(a), ret = -1;
+  auto push = [&](int v, int g, int parent) {
+    ws.stamp[2 * v] = cur;
+    ws.g[v] = g;
+    ws.parent[v] = parent;
+    size_t f = g + h(v) - f0;
+    if (buckets.size() <= f)
+      buckets.resize(f + 1);
+    buckets[f].push_back(v);
+  };
+  push(a, 0, -1);
+  for (size_t f = 0; f < buckets.size() && ret < 0; ++f) {
+    while (buckets[f].size()) {
+      int v = buckets[f].back();
+      buckets[f].pop_back();
+      if (ws.stamp[2 * v + 1] == cur)
+        continue;   // an entry of a longer path to v
+      ws.stamp[2 * v + 1] = cur;
+      if (v == b) {
+        ret = ws.g[v];
+        break;
+      }
+      int c = cell_[v], g = ws.g[v] + 1;
+      for (int n : {c + 1, c + stride_, c - stride_, c - 1}) {
+        int u = id_[n];
+        if (u >= 0 && (ws.stamp[2 * u] != cur || g < ws.g[u]))
+          push(u, g, v);
+      }
+    }
+  }
+  for (auto& bucket : buckets)
+    bucket.clear();
+  return ret;
+}
+
+shared_ptr<const DistanceOracle::TargetDist> DistanceOracle::cached_(int a, int b) const {
+  {
+    lock_guard<mutex> lg(cache_mutex_);
+    for (size_t i = 0; i < target_cache_.size(); ++i)
+      if (target_cache_[i]->target == a || target_cache_[i]->target == b) {
+        auto ret = target_cache_[i];
+        rotate(target_cache_.begin(), target_cache_.begin() + i, target_cache_.begin() + i + 1);
+        return ret;
+      }
+    if (nr_query_.size() > 1024)   // forget the cells queried once in a while
+      nr_query_.clear();
+    if (++nr_query_[b] < kHotTarget)
+      return nullptr;
+    nr_query_.erase(b);
+  }
+  auto dist = bfs_(b);
+  shared_ptr<TargetDist> ret{new TargetDist{b, vector<uint16_t>(dist.size())}};
+  for (size_t i = 0; i < dist.size(); ++i) {
+    if (dist[i] >= kUnreachable)
+      return nullptr;   // too far for uint16
+    ret->dist[i] = dist[i] < 0 ? kUnreachable : dist[i];
+  }
+  lock_guard<mutex> lg(cache_mutex_);
+  target_cache_.insert(target_cache_.begin(), ret);
+  if (target_cache_.size() > kNrTargetCache)
+    target_cache_.pop_back();
+  return ret;
+}
+
+int DistanceOracle::geodesic_(Workspace& ws, int a, int b) const {
+  if (a < 0 || b < 0 || comp_[a] != comp_[b])
+    return -1;
+  if (a == b)
+    return 0;
+  auto bound = bounds_(a, b);
+  if (bound.first == bound.second)
+    return bound.first;
+  auto cached = cached_(a, b);
+  if (cached)
+    return cached->dist[cached->target == a ? b : a];
+  return search_(ws, a, b);
+}
+
+int DistanceOracle::geodesic(int x1, int y1, int x2, int y2) const {
+  auto ws = acquire_();
+  int ret = geodesic_(*ws, id_of_(x1, y1), id_of_(x2, y2));
+  release_(move(ws));
+  return ret;
+}
+
+py::array_t<int32_t> DistanceOracle::geodesics(coorarray starts, coorarray ends) const {
+  if (starts.ndim() != 2 || starts.shape(1) != 2 || ends.ndim() != 2 ||
+      ends.shape(1) != 2 || starts.shape(0) != ends.shape(0))
+    throw std::invalid_argument("starts and ends must be arrays of shape (N, 2)");
+  ssize_t n = starts.shape(0);
+  py::array_t<int32_t> ret(n);
+  const int32_t *s = starts.data(), *e = ends.data();
+  int32_t* out = ret.mutable_data();
+  {
+    py::gil_scoped_release release;
+    // each thread takes every nr_thread-th pair, and has its own Workspace
+    int nr_thread = min<ssize_t>(max<int>(thread::hardware_concurrency(), 1), (n + 255) / 256);
+    auto work = [&](int tid) {
+      auto ws = acquire_();
+      for (ssize_t i = tid; i < n; i += nr_thread)
+        out[i] = geodesic_(*ws, id_of_(s[2 * i], s[2 * i + 1]), id_of_(e[2 * i], e[2 * i + 1]));
+      release_(move(ws));
+    };
+    vector<thread> threads;
+    for (int t = 1; t < nr_thread; ++t)
+      threads.emplace_back(work, t);
+    if (nr_thread > 0)
+      work(0);
+    for (auto& th : threads)
+      th.join();
+  }
+  return ret;
+}
+
+py::array_t<int32_t> DistanceOracle::path(int x1, int y1, int x2, int y2) const {
+  int a = id_of_(x1, y1), b = id_of_(x2, y2);
+  vector<int32_t> ids;
+  if (a >= 0 && b >= 0 && comp_[a] == comp_[b]) {
+    auto ws = acquire_();
+    if (search_(*ws, a, b) >= 0)
+      for (int v = b; v >= 0; v = ws->parent[v])
+        ids.push_back(v);
+    release_(move(ws));
+  }
+  py::array_t<int32_t> ret({(ssize_t)ids.size(), (ssize_t)2});
+  int32_t* p = ret.mutable_data();
+  for (size_t i = 0; i < ids.size(); ++i) {
+    int v = ids[ids.size() - 1 - i];
+    p[2 * i] = x_of_(v);
+    p[2 * i + 1] = y_of_(v);
+  }
+  return ret;
+}
+
+pair<int, int> DistanceOracle::bounds(int x1, int y1, int x2, int y2) const {
+  int a = id_of_(x1, y1), b = id_of_(x2, y2);
+  if (a < 0 || b < 0 || comp_[a] != comp_[b])
+    return {-1, -1};
+  if (a == b)
+    return {0, 0};
+  return bounds_(a, b);
+}
+
+py::array_t<int32_t> DistanceOracle::landmarks() const {
+  py::array_t<int32_t> ret({(ssize_t)landmarks_.size(), (ssize_t)2});
+  int32_t* p = ret.mutable_data();
+  for (size_t i = 0; i < landmarks_.size(); ++i) {
+    p[2 * i] = x_of_(landmarks_[i]);
+    p[2 * i + 1] = y_of_(landmarks_[i]);
+  }
+  return ret;
+}
+
+py::array_t<int8_t> DistanceOracle::moveMap() const {
+  py::array_t<int8_t> ret({(ssize_t)rows_, (ssize_t)cols_});
+  int8_t* p = ret.mutable_data();
+  fill(p, p + (size_t)rows_ * cols_, 0);
+  for (int v = 0; v < (int)cell_.size(); ++v)
+    p[(size_t)x_of_(v) * cols_ + y_of_(v)] = 1;
+  return ret;
+}
+
+}
@@ -0,0 +1,141 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <pybind11/numpy.h>
+
+namespace render {
+
+// Exact geodesic distances between the movable cells of a movability map,
+// in moves between 4-connected cells, as the distances of House::genConnMaps.
+//
+// It keeps the distances of every movable cell to a few landmarks, spread
+// over the largest connected component by farthest point sampling. They
+// bound the distance between any two cells of the component. A query is
+// answered by the bounds when they meet, and otherwise by an A* search that
+// the lower bound, or the distance without obstacles, guides. The distances
+// to the cells queried most often, e.g. the goal of an episode, are also
+// kept, to answer their queries in constant time.
+//
+// It takes 2 * nr_landmarks bytes per movable cell. The methods are
+// thread-safe.
+class DistanceOracle {
+  template <typename T>
+  using nparray = pybind11::array_t<T, pybind11::array::c_style>;
+  using coorarray = pybind11::array_t<int32_t, pybind11::array::c_style | pybind11::array::forcecast>;
+
+  public:
+    // cells where move > 0 are movable
+    explicit DistanceOracle(nparray<int8_t> move, int nr_landmarks = 16);
+    ~DistanceOracle();
+    DistanceOracle(const DistanceOracle&) = delete;
+    DistanceOracle& operator = (const DistanceOracle&) = delete;
+
+    // The distance from grid cell (x1, y1) to (x2, y2), or -1 if one of
+    // them is not movable, or they are not connected.
+    int geodesic(int x1, int y1, int x2, int y2) const;
+
+    // The geodesic() of each pair of rows of starts and ends, (N, 2) arrays
+    // of cells, as a (N,) int32 array. The pairs are computed in parallel.
+    pybind11::array_t<int32_t> geodesics(coorarray starts, coorarray ends) const;
+
+    // The cells of a shortest path from (x1, y1) to (x2, y2), both included,
+    // as a (k, 2) int32 array. Empty if geodesic() is -1.
+    pybind11::array_t<int32_t> path(int x1, int y1, int x2, int y2) const;
+
+    // (lower, upper) bounds of geodesic() given by the landmarks and the
+    // distance without obstacles, or (-1, -1) as geodesic(). The upper bound
+    // is INT_MAX if no landmark reaches the cells.
+    std::pair<int, int> bounds(int x1, int y1, int x2, int y2) const;
+
+    // The landmarks, as a (k, 2) int32 array of cells.
+    pybind11::array_t<int32_t> landmarks() const;
+
+    // The movability map it is built from, as an int8 array of 0 and 1.
+    pybind11::array_t<int8_t> moveMap() const;
+
+    int nr_landmarks_requested() const { return nr_landmarks_requested_; }
+
+  private:
+    static const uint16_t kUnreachable = 65535;
+
+    // number of distance maps of the cells queried most often, and number
+    // of queries to a cell before its map is computed
+    static const int kNrTargetCache = 4;
+    static const int kHotTarget = 32;
+
+    int rows_, cols_, nr_landmarks_requested_;
+    // Cells are indexed in the map padded by a border of unmovable cells,
+    // so the neighbors of cell c are c +- 1 and c +- stride_.
+    int stride_;
+    std::vector<int32_t> id_;       // of each padded cell, or -1 if it is not movable
+    std::vector<int32_t> cell_;     // padded cell of each id
+    std::vector<int32_t> comp_;     // the connected component of each id
+    int largest_ = -1;              // the component with the landmarks
+    std::vector<int32_t> landmarks_;
+    // the distances of each id to every landmark, id-major. 0 outside of
+    // largest_, so that the bounds are trivial there.
+    std::vector<uint16_t> ldist_;
+
+    // The state of a search, reused across searches. A cell is seen by the
+    // current search if its stamp is the search's.
+    struct Workspace {
+      std::vector<uint32_t> stamp;
+      std::vector<int32_t> g;
+      std::vector<int32_t> parent;
+      std::vector<std::vector<int32_t>> buckets;
+      uint32_t cur = 0;
+    };
+    mutable std::mutex pool_mutex_;
+    mutable std::vector<std::unique_ptr<Workspace>> pool_;
+
+    // the distances of all ids to a target id, kUnreachable if not connected
+    struct TargetDist {
+      int target;
+      std::vector<uint16_t> dist;
+    };
+    mutable std::mutex cache_mutex_;
+    // most recently used first
+    mutable std::vector<std::shared_ptr<const TargetDist>> target_cache_;
+    mutable std::unordered_map<int, int> nr_query_;
+
+    std::unique_ptr<Workspace> acquire_() const;
+    void release_(std::unique_ptr<Workspace> ws) const;
+
+    // id of cell (x, y), or -1 if it is outside or not movable
+    int id_of_(int x, int y) const {
+      if (x < 0 || y < 0 || x >= rows_ || y >= cols_)
+        return -1;
+      return id_[(size_t)(x + 1) * stride_ + y + 1];
+    }
+    // (x, y) of an id
+    int x_of_(int id) const { return cell_[id] / stride_ - 1; }
+    int y_of_(int id) const { return cell_[id] % stride_ - 1; }
+
+    // BFS distances of all ids from src, -1 where unreachable
+    std::vector<int32_t> bfs_(int src) const;
+
+    std::pair<int, int> bounds_(int a, int b) const;
+
+    // A* from id a to id b of the same component. Fills ws.parent.
+    int search_(Workspace& ws, int a, int b) const;
+
+    // The distances to a or b if they are cached, possibly computing the
+    // distances to b if it is queried often. Null otherwise.
+    std::shared_ptr<const TargetDist> cached_(int a, int b) const;
+
+    // geodesic() of two ids, possibly -1
+    int geodesic_(Workspace& ws, int a, int b) const;
+};
+
+}
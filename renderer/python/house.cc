@@ -6,12 +6,668 @@
 
 #include "house.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <pybind11/stl.h>
+
+#include "model/objparse.hh"
+#include "lib/bitgrid.hh"
+#include "lib/mappedfile.hh"
+#include "lib/strutils.hh"
+
 namespace py = pybind11;
+using namespace std;
+
+namespace {
+
+// A 2D view of a map, with the indexing rules of numpy
+template <typename T>
+struct GridView {
+  T* data;
+  int rows, cols;
+
+  T& operator()(int x, int y) const { return data[(size_t)x * cols + y]; }
+
+  // map[x1:(x2 + 1), y1:(y2 + 1)] = c, as fill_region() in house.py,
+  // including the wrapping of negative indices of numpy slices
+  void fill(int x1, int y1, int x2, int y2, T c) const {
+    int xb, xe, yb, ye;
+    slice_(x1, x2 + 1, rows, xb, xe);
+    slice_(y1, y2 + 1, cols, yb, ye);
+    for (int x = xb; x < xe; ++x)
+      std::fill(&(*this)(x, yb), &(*this)(x, yb) + max(ye - yb, 0), c);
+  }
+
+  // map[x, y], wrapping negative indices. Out of range indices are 0.
+  T at_or_zero(int x, int y) const {
+    if (x < 0) x += rows;
+    if (y < 0) y += cols;
+    if (x < 0 || x >= rows || y < 0 || y >= cols)
+      return 0;
+    return (*this)(x, y);
+  }
+
+  static void slice_(int start, int stop, int n, int& b, int& e) {
+    auto clamp = [n](int i) {
+      if (i < 0) i += n;
+      return min(max(i, 0), n);
+    };
+    b = clamp(start);
+    e = clamp(stop);
+  }
+};
+
+template <typename T>
+GridView<T> grid_view(py::array_t<T, py::array::c_style>& arr, const char* name) {
+  if (arr.ndim() != 2)
+    throw std::invalid_argument(std::string(name) + " must be a 2D array");
+  return GridView<T>{arr.mutable_data(), (int)arr.shape(0), (int)arr.shape(1)};
+}
+
+// rows of an (k, 4) box array
+const double* boxes(py::array_t<double, py::array::c_style | py::array::forcecast>& arr,
+    const char* name, size_t& nr_box) {
+  if (arr.size() == 0) {
+    nr_box = 0;
+    return nullptr;
+  }
+  if (arr.ndim() != 2 || arr.shape(1) != 4)
+    throw std::invalid_argument(std::string(name) + " must be an array of shape (k, 4)");
+  nr_box = arr.shape(0);
+  return arr.data();
+}
+
+// The file of House::saveMaps():
+//  kMapsMagic, then kMapsVersion and the number of levels as uint32,
+//  then for each level its rows and cols as uint32, and the bits of obs
+//  and move, each in words_of(rows * cols) uint64 words, where cell i is
+//  bit i % 64 of word i / 64.
+// Everything after the magic is 8-byte aligned.
+const char kMapsMagic[8] = {'H', '3', 'D', 'M', 'A', 'P', 'S', '\0'};
+const uint32_t kMapsVersion = 1;
+
+size_t words_of(size_t nr_bits) { return (nr_bits + 63) / 64; }
+
+void pack_bits(const uint8_t* src, size_t n, vector<uint64_t>& dst) {
+  dst.assign(words_of(n), 0);
+  for (size_t i = 0; i < n; ++i)
+    if (src[i])
+      dst[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+template <typename T>
+void unpack_bits(const uint64_t* src, size_t n, T* dst) {
+  for (size_t w = 0; w < words_of(n); ++w) {
+    uint64_t word = src[w];
+    size_t end = min(n - w * 64, (size_t)64);
+    for (size_t b = 0; b < end; ++b)
+      dst[w * 64 + b] = (word >> b) & 1;
+  }
+}
+
+} // namespace
 
 namespace render {
 
-void House::f(const std::vector<py::array>& numpy_arrays) {
-  printf("%lu\n", numpy_arrays[0].size());
+py::list House::parseWalls(const string& obj_file, double lower_bound) {
+  vector<ObjGroupBox> groups;
+  {
+    py::gil_scoped_release release;
+    groups = scan_group_boxes(obj_file, "Wall");
+  }
+  return wallList(groups, lower_bound);
+}
+
+py::list House::wallList(const vector<ObjGroupBox>& groups, double lower_bound) {
+  py::list ret;
+  for (auto& g : groups) {
+    if (g.min[1] >= lower_bound)
+      continue;
+    py::dict bbox, wall;
+    bbox["min"] = py::cast(vector<double>(g.min, g.min + 3));
+    bbox["max"] = py::cast(vector<double>(g.max, g.max + 3));
+    wall["name"] = py::cast(g.name);
+    wall["bbox"] = bbox;
+    ret.append(wall);
+  }
+  return ret;
+}
+
+void House::saveMaps(const string& fname, py::list maps) {
+  using bytearray = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>;
+  // write a temporary file and rename it, so readers never see a partial one
+  string tmp = fname + ".tmp";
+  {
+    ofstream os(tmp, ios::binary);
+    auto write = [&](const void* p, size_t n) { os.write(static_cast<const char*>(p), n); };
+    uint32_t header[2] = {kMapsVersion, (uint32_t)maps.size()};
+    write(kMapsMagic, sizeof(kMapsMagic));
+    write(header, sizeof(header));
+    vector<uint64_t> bits;
+    for (auto item : maps) {
+      auto level = item.cast<py::tuple>();
+      if (level.size() != 2)
+        throw std::invalid_argument("saveMaps: maps must be a list of (obs, move)");
+      auto obs = level[0].cast<bytearray>(), move = level[1].cast<bytearray>();
+      if (obs.ndim() != 2 || move.ndim() != 2 || obs.shape(0) != move.shape(0) ||
+          obs.shape(1) != move.shape(1))
+        throw std::invalid_argument("saveMaps: obs and move must be 2D arrays of the same shape");
+      uint32_t shape[2] = {(uint32_t)obs.shape(0), (uint32_t)obs.shape(1)};
+      write(shape, sizeof(shape));
+      pack_bits(obs.data(), obs.size(), bits);
+      write(bits.data(), bits.size() * sizeof(uint64_t));
+      pack_bits(move.data(), move.size(), bits);
+      write(bits.data(), bits.size() * sizeof(uint64_t));
+    }
+    if (!os.good())
+      throw std::runtime_error(ssprintf("saveMaps: cannot write %s", tmp.c_str()));
+  }
+  if (rename(tmp.c_str(), fname.c_str()) != 0)
+    throw std::runtime_error(ssprintf("saveMaps: cannot write %s", fname.c_str()));
+}
+
+py::object House::loadMaps(const string& fname) {
+  vector<PackedMaps> levels;
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    ok = readMaps(fname, levels);
+  }
+  if (!ok)
+    return py::none();
+  return unpackMaps(levels);
+}
+
+bool House::readMaps(const string& fname, vector<PackedMaps>& ret) {
+  MappedFile file{fname};
+  if (!file.good())
+    throw std::runtime_error(ssprintf("loadMaps: cannot open %s", fname.c_str()));
+  const char *p = file.data(), *end = p + file.size();
+  uint32_t header[2];
+  if (file.size() < sizeof(kMapsMagic) + sizeof(header) ||
+      memcmp(p, kMapsMagic, sizeof(kMapsMagic)) != 0)
+    return false;
+  memcpy(header, p + sizeof(kMapsMagic), sizeof(header));
+  if (header[0] != kMapsVersion)
+    return false;
+  p += sizeof(kMapsMagic) + sizeof(header);
+
+  auto corrupted = std::runtime_error(ssprintf("loadMaps: %s is corrupted", fname.c_str()));
+  ret.clear();
+  for (uint32_t k = 0; k < header[1]; ++k) {
+    PackedMaps level;
+    if (end - p < (ptrdiff_t)(2 * sizeof(uint32_t)))
+      throw corrupted;
+    memcpy(&level.rows, p, sizeof(uint32_t));
+    memcpy(&level.cols, p + sizeof(uint32_t), sizeof(uint32_t));
+    p += 2 * sizeof(uint32_t);
+    size_t nr_word = words_of((size_t)level.rows * level.cols);
+    if ((size_t)(end - p) < 2 * nr_word * sizeof(uint64_t))
+      throw corrupted;
+    // mmap is page aligned, and the words are 8-byte aligned in the file
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(p);
+    level.obs.assign(words, words + nr_word);
+    level.move.assign(words + nr_word, words + 2 * nr_word);
+    p += 2 * nr_word * sizeof(uint64_t);
+    ret.emplace_back(move(level));
+  }
+  return true;
+}
+
+py::list House::unpackMaps(const vector<PackedMaps>& levels) {
+  py::list ret;
+  for (auto& level : levels) {
+    size_t n = (size_t)level.rows * level.cols;
+    py::array_t<uint8_t> obs({(ssize_t)level.rows, (ssize_t)level.cols});
+    py::array_t<int8_t> move({(ssize_t)level.rows, (ssize_t)level.cols});
+    unpack_bits(level.obs.data(), n, obs.mutable_data());
+    unpack_bits(level.move.data(), n, move.mutable_data());
+    ret.append(py::make_tuple(obs, move));
+  }
+  return ret;
+}
+
+void House::genObstacleMap(
+    nparray<uint8_t> obs, boxarray level,
+    boxarray walls, boxarray doors, boxarray objects) const {
+  auto map = grid_view(obs, "obs");
+  int n_row = map.rows - 1;
+  auto rescale = [&](const double* box, int& x1, int& y1, int& x2, int& y2) {
+    x1 = to_grid(box[0], n_row); y1 = to_grid(box[1], n_row);
+    x2 = to_grid(box[2], n_row); y2 = to_grid(box[3], n_row);
+  };
+  size_t nr_box, nr_wall, nr_door, nr_object;
+  int x1, y1, x2, y2;
+  const double* level_box = boxes(level, "level", nr_box);
+  if (nr_box != 1)
+    throw std::invalid_argument("level must be a single box");
+  const double* wall_box = boxes(walls, "walls", nr_wall);
+  const double* door_box = boxes(doors, "doors", nr_door);
+  const double* object_box = boxes(objects, "objects", nr_object);
+  py::gil_scoped_release release;
+
+  // fill the space of the level
+  rescale(level_box, x1, y1, x2, y2);
+  map.fill(x1, y1, x2, y2, 0);
+
+  // fill boundary of rooms
+  vector<uint8_t> mask_data(map.rows * map.cols, 0);
+  GridView<uint8_t> mask_room{mask_data.data(), map.rows, map.cols};
+  const double* box = wall_box;
+  for (size_t i = 0; i < nr_wall; ++i, box += 4) {
+    rescale(box, x1, y1, x2, y2);
+    map.fill(x1, y1, x2, y2, 1);
+    mask_room.fill(x1, y1, x2, y2, 1);
+  }
+
+  // remove all the doors, expanded along the walls they are in
+  box = door_box;
+  for (size_t i = 0; i < nr_door; ++i, box += 4) {
+    rescale(box, x1, y1, x2, y2);
+    int cx = (x1 + x2) / 2, cy = (y1 + y2) / 2;
+    if (x2 - x1 < y2 - y1) {
+      while (x1 - 1 >= 0 && mask_room.at_or_zero(x1 - 1, cy) > 0)
+        x1--;
+      while (x2 + 1 < mask_room.rows && mask_room.at_or_zero(x2 + 1, cy) > 0)
+        x2++;
+    } else {
+      while (y1 - 1 >= 0 && mask_room.at_or_zero(cx, y1 - 1) > 0)
+        y1--;
+      while (y2 + 1 < mask_room.cols && mask_room.at_or_zero(cx, y2 + 1) > 0)
+        y2++;
+    }
+    map.fill(x1, y1, x2, y2, 0);
+  }
+
+  // mark all the objects obstacle
+  box = object_box;
+  for (size_t i = 0; i < nr_object; ++i, box += 4) {
+    rescale(box, x1, y1, x2, y2);
+    map.fill(x1, y1, x2, y2, 1);
+  }
+}
+
+bool House::check_occupy_(const uint8_t* obs, int n_row, double cx, double cy) const {
+  double det = L_det_ / n_row, r2 = robot_radius_ * robot_radius_;
+  int x1 = to_grid(cx - robot_radius_, n_row), y1 = to_grid(cy - robot_radius_, n_row),
+      x2 = to_grid(cx + robot_radius_, n_row), y2 = to_grid(cy + robot_radius_, n_row);
+  for (int xx = x1; xx <= x2; ++xx)
+    for (int yy = y1; yy <= y2; ++yy) {
+      bool inside = xx >= 0 && yy >= 0 && xx <= n_row && yy <= n_row;
+      if (inside && obs[(size_t)xx * (n_row + 1) + yy] != 1)
+        continue;
+      // whether any corner of the cell is within the robot
+      for (int x = xx; x < xx + 2; ++x)
+        for (int y = yy; y < yy + 2; ++y) {
+          double rx = x * det + L_lo_ - cx, ry = y * det + L_lo_ - cy;
+          if (rx * rx + ry * ry <= r2)
+            return false;
+        }
+    }
+  return true;
+}
+
+bool House::check_occupy(nparray<uint8_t> obs, double cx, double cy) const {
+  auto map = grid_view(obs, "obs");
+  if (map.rows != map.cols)
+    throw std::invalid_argument("obs must be square");
+  return check_occupy_(map.data, map.rows - 1, cx, cy);
+}
+
+vector<BitGrid::Run> House::robot_kernel_(int n_row) const {
+  // Cell (x + dx, y + dy) touches a robot at the center of cell (x, y) if
+  // one of its corners is within robot_radius. The nearest corners are
+  // |dx| - 0.5 cells away, or 0.5 for dx = 0, as in check_occupy_().
+  double r = robot_radius_ / (L_det_ / n_row), r2 = r * r;
+  auto nearest = [](int d) { return d == 0 ? 0.5 : abs(d) - 0.5; };
+  vector<BitGrid::Run> ret;
+  int reach = (int)ceil(r + 0.5);
+  for (int dx = -reach; dx <= reach; ++dx) {
+    double ex = nearest(dx);
+    int hi = -1;
+    while (hi < reach && ex * ex + nearest(hi + 1) * nearest(hi + 1) <= r2)
+      ++hi;
+    if (hi >= 0)
+      ret.push_back(BitGrid::Run{dx, -hi, hi});
+  }
+  return ret;
+}
+
+void House::genMovableMap(
+    nparray<uint8_t> obs, nparray<int8_t> move,
+    int x1, int y1, int x2, int y2) const {
+  auto obs_map = grid_view(obs, "obs");
+  auto move_map = grid_view(move, "move");
+  if (obs_map.rows != obs_map.cols || move_map.rows != obs_map.rows ||
+      move_map.cols != obs_map.cols)
+    throw std::invalid_argument("obs and move must be square maps of the same shape");
+  int n_row = obs_map.rows - 1;
+  x1 = max(x1, 0); y1 = max(y1, 0);
+  x2 = min(x2, obs_map.rows); y2 = min(y2, obs_map.cols);
+  if (x1 >= x2 || y1 >= y2)
+    return;
+  py::gil_scoped_release release;
+
+  // the cells the robot can't be centered at: obstacles dilated by the
+  // robot, where the outside of the map is an obstacle
+  BitGrid obstacles(obs_map.rows, obs_map.cols);
+  for (int i = 0; i < obs_map.rows; ++i)
+    for (int j = 0; j < obs_map.cols; ++j)
+      if (obs_map(i, j) == 1)
+        obstacles.set(i, j);
+  BitGrid blocked = obstacles.dilate(robot_kernel_(n_row), true);
+  for (int i = x1; i < x2; ++i)
+    for (int j = y1; j < y2; ++j)
+      if (obs_map(i, j) == 0 && !blocked.get(i, j))
+        move_map(i, j) = 1;
+}
+
+void House::adjustApproximateRobotMoveMap(nparray<int8_t> move, int grid_radius) const {
+  auto move_map = grid_view(move, "move");
+  py::gil_scoped_release release;
+  BitGrid unmovable(move_map.rows, move_map.cols);
+  for (int i = 0; i < move_map.rows; ++i)
+    for (int j = 0; j < move_map.cols; ++j)
+      if (move_map(i, j) == 0)
+        unmovable.set(i, j);
+  BitGrid blocked = unmovable.dilate(BitGrid::disc(grid_radius), false);
+  for (int i = 0; i < move_map.rows; ++i)
+    for (int j = 0; j < move_map.cols; ++j)
+      move_map(i, j) = !blocked.get(i, j);
+}
+
+namespace {
+
+const int kDirs[4][2] = {{0, 1}, {1, 0}, {-1, 0}, {0, -1}};
+
+// (k, 2) int32 array of cells
+template <typename Coor>
+py::array_t<int32_t> coor_array(const vector<Coor>& coors) {
+  py::array_t<int32_t> ret({(ssize_t)coors.size(), (ssize_t)2});
+  static_assert(sizeof(Coor) == 2 * sizeof(int32_t), "Coor must be two int32!");
+  if (coors.size())
+    memcpy(ret.mutable_data(), coors.data(), coors.size() * sizeof(Coor));
+  return ret;
+}
+
+} // namespace
+
+vector<vector<House::Coor>> House::components_(
+    const int8_t* move, int n_row, Region r,
+    bool return_largest, bool return_open, bool* no_open) const {
+  if (no_open)
+    *no_open = false;
+  auto can_move = [=](int x, int y) {
+    return x >= 0 && y >= 0 && x <= n_row && y <= n_row &&
+      move[(size_t)x * (n_row + 1) + y] > 0;
+  };
+  int w = r.y2 - r.y1 + 1;
+  vector<vector<Coor>> comps;
+  if (r.x2 < r.x1 || w <= 0)
+    return comps;
+  vector<bool> visit((size_t)(r.x2 - r.x1 + 1) * w, false);
+  auto visited = [&](int x, int y) { return visit[(size_t)(x - r.x1) * w + (y - r.y1)]; };
+  auto set_visited = [&](int x, int y) { visit[(size_t)(x - r.x1) * w + (y - r.y1)] = true; };
+  vector<int> open_comps;
+
+  for (int x = r.x1; x <= r.x2; ++x)
+    for (int y = r.y1; y <= r.y2; ++y) {
+      if (!can_move(x, y) || visited(x, y))
+        continue;
+      vector<Coor> que{{x, y}};
+      set_visited(x, y);
+      bool is_open = false;
+      for (size_t ptr = 0; ptr < que.size(); ++ptr) {
+        Coor c = que[ptr];
+        for (auto& d : kDirs) {
+          int tx = c.x + d[0], ty = c.y + d[1];
+          if (!can_move(tx, ty))
+            continue;
+          if (tx < r.x1 || tx > r.x2 || ty < r.y1 || ty > r.y2) {
+            is_open = true;
+            continue;
+          }
+          if (!visited(tx, ty)) {
+            set_visited(tx, ty);
+            que.push_back({tx, ty});
+          }
+        }
+      }
+      if (is_open)
+        open_comps.push_back(comps.size());
+      comps.emplace_back(std::move(que));
+    }
+  if (comps.empty())
+    return comps;
+
+  if (return_open) {
+    if (open_comps.empty()) {
+      if (no_open)
+        *no_open = true;
+      return_largest = true;
+    } else {
+      vector<vector<Coor>> ret;
+      for (int i : open_comps)
+        ret.emplace_back(std::move(comps[i]));
+      comps = std::move(ret);
+    }
+  }
+  if (return_largest) {
+    size_t best = 0;
+    for (size_t i = 1; i < comps.size(); ++i)
+      if (comps[i].size() > comps[best].size())
+        best = i;
+    vector<vector<Coor>> ret;
+    ret.emplace_back(std::move(comps[best]));
+    comps = std::move(ret);
+  }
+  return comps;
+}
+
+py::object House::findComponents(
+    nparray<int8_t> move, int x1, int y1, int x2, int y2,
+    bool return_largest, bool return_open) const {
+  auto map = grid_view(move, "move");
+  if (map.rows != map.cols)
+    throw std::invalid_argument("move must be square");
+  vector<vector<Coor>> comps;
+  bool no_open;
+  {
+    py::gil_scoped_release release;
+    comps = components_(map.data, map.rows - 1, Region{x1, y1, x2, y2, 0, 0},
+        return_largest, return_open, &no_open);
+  }
+  if (comps.empty())
+    return py::list();
+  if (return_largest || no_open)
+    return coor_array(comps[0]);
+  py::list ret;
+  for (auto& c : comps)
+    ret.append(coor_array(c));
+  return ret;
+}
+
+House::ConnMap House::conn_map_(const int8_t* move, int n_row,
+    const vector<Region>& regions, bool retry_closed) const {
+  size_t nr_cell = (size_t)(n_row + 1) * (n_row + 1);
+  double det = L_det_ / n_row;
+  ConnMap ret;
+  ret.dist.assign(nr_cell, -1);
+  ret.inroom_dist.assign(nr_cell, -1.f);
+  auto& que = ret.coors;
+
+  for (bool open : {true, false}) {
+    if (!open) {
+      if (!retry_closed)
+        break;
+      ret.closed = true;
+    }
+    ret.empty.clear();
+    for (size_t k = 0; k < regions.size(); ++k) {
+      auto& r = regions[k];
+      auto comps = components_(move, n_row, r, false, open);
+      if (comps.empty()) {
+        ret.empty.push_back(k);
+        continue;
+      }
+      double min_dist = 1e50;
+      size_t begin = que.size();
+      for (auto& comp : comps)
+        for (Coor c : comp) {
+          size_t idx = (size_t)c.x * (n_row + 1) + c.y;
+          ret.dist[idx] = 0;
+          que.push_back(c);
+          double tx = c.x * det + L_lo_ - r.cx, ty = c.y * det + L_lo_ - r.cy;
+          double tdist = sqrt(tx * tx + ty * ty);
+          min_dist = min(min_dist, tdist);
+          ret.inroom_dist[idx] = tdist;
+        }
+      for (size_t i = begin; i < que.size(); ++i) {
+        size_t idx = (size_t)que[i].x * (n_row + 1) + que[i].y;
+        ret.inroom_dist[idx] = ret.inroom_dist[idx] - min_dist;
+      }
+    }
+    if (que.size())
+      break;
+  }
+
+  // BFS from all the cells in the targets
+  for (size_t ptr = 0; ptr < que.size(); ++ptr) {
+    Coor c = que[ptr];
+    int cur_dist = ret.dist[(size_t)c.x * (n_row + 1) + c.y];
+    for (auto& d : kDirs) {
+      int tx = c.x + d[0], ty = c.y + d[1];
+      if (tx < 0 || ty < 0 || tx > n_row || ty > n_row)
+        continue;
+      size_t idx = (size_t)tx * (n_row + 1) + ty;
+      if (move[idx] > 0 && ret.dist[idx] == -1) {
+        que.push_back({tx, ty});
+        ret.dist[idx] = cur_dist + 1;
+        ret.max_dist = max(ret.max_dist, cur_dist + 1);
+      }
+    }
+  }
+  return ret;
+}
+
+py::list House::genConnMaps(
+    nparray<int8_t> move, const vector<boxarray>& targets,
+    bool retry_closed) const {
+  auto map = grid_view(move, "move");
+  if (map.rows != map.cols)
+    throw std::invalid_argument("move must be square");
+  int n_row = map.rows - 1;
+
+  vector<vector<Region>> regions(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    auto& t = targets[i];
+    if (t.size() == 0)
+      continue;
+    if (t.ndim() != 2 || t.shape(1) != 6)
+      throw std::invalid_argument("targets must be arrays of shape (k, 6)");
+    const double* p = t.data();
+    for (ssize_t k = 0; k < t.shape(0); ++k, p += 6)
+      regions[i].push_back(Region{(int)p[0], (int)p[1], (int)p[2], (int)p[3], p[4], p[5]});
+  }
+
+  vector<ConnMap> results(targets.size());
+  {
+    py::gil_scoped_release release;
+    // each thread takes the next target not taken yet
+    atomic<size_t> next{0};
+    auto work = [&]() {
+      for (size_t i; (i = next++) < targets.size(); )
+        results[i] = conn_map_(map.data, n_row, regions[i], retry_closed);
+    };
+    int nr_thread = min<int>(targets.size(), max<int>(thread::hardware_concurrency(), 1));
+    vector<thread> threads;
+    for (int t = 1; t < nr_thread; ++t)
+      threads.emplace_back(work);
+    work();
+    for (auto& th : threads)
+      th.join();
+  }
+
+  py::list ret;
+  for (auto& r : results) {
+    py::array_t<int32_t> dist({(ssize_t)map.rows, (ssize_t)map.cols});
+    py::array_t<float> inroom_dist({(ssize_t)map.rows, (ssize_t)map.cols});
+    memcpy(dist.mutable_data(), r.dist.data(), r.dist.size() * sizeof(int32_t));
+    memcpy(inroom_dist.mutable_data(), r.inroom_dist.data(), r.inroom_dist.size() * sizeof(float));
+    py::list empty;
+    for (int k : r.empty)
+      empty.append(k);
+    ret.append(py::make_tuple(dist, coor_array(r.coors), inroom_dist,
+          r.max_dist, r.closed, empty));
+  }
+  return ret;
+}
+
+template <typename Valid>
+py::tuple House::check_moves_(
+    boxarray& starts, boxarray& ends, int num_samples, Valid valid) const {
+  if (starts.ndim() != 2 || starts.shape(1) != 2 || ends.ndim() != 2 ||
+      ends.shape(1) != 2 || starts.shape(0) != ends.shape(0))
+    throw std::invalid_argument("starts and ends must be arrays of the same shape (N, 2)");
+  if (num_samples <= 0)
+    throw std::invalid_argument("num_samples must be positive");
+  ssize_t n = starts.shape(0);
+  py::array_t<bool> success(n);
+  py::array_t<double> endpoints({n, (ssize_t)2});
+  const double *pa = starts.data(), *pb = ends.data();
+  bool* ok = success.mutable_data();
+  double* out = endpoints.mutable_data();
+  {
+    py::gil_scoped_release release;
+    double ratio = 1.0 / num_samples;
+    for (ssize_t k = 0; k < n; ++k, pa += 2, pb += 2, out += 2) {
+      ok[k] = true;
+      out[0] = pa[0], out[1] = pa[1];
+      for (int i = 0; i < num_samples; ++i) {
+        double x = (pb[0] - pa[0]) * (i + 1) * ratio + pa[0],
+               y = (pb[1] - pa[1]) * (i + 1) * ratio + pa[1];
+        if (!valid(x, y)) {
+          ok[k] = false;
+          break;
+        }
+        out[0] = x, out[1] = y;
+      }
+    }
+  }
+  return py::make_tuple(success, endpoints);
+}
+
+py::tuple House::checkMoves(
+    nparray<int8_t> move, nparray<int32_t> conn,
+    boxarray starts, boxarray ends, int num_samples) const {
+  auto move_map = grid_view(move, "move");
+  auto conn_map = grid_view(conn, "conn");
+  if (move_map.rows != move_map.cols || conn_map.rows != move_map.rows ||
+      conn_map.cols != move_map.cols)
+    throw std::invalid_argument("move and conn must be square maps of the same shape");
+  int n_row = move_map.rows - 1;
+  return check_moves_(starts, ends, num_samples, [&](double x, double y) {
+      int gx = to_grid(x, n_row), gy = to_grid(y, n_row);
+      return gx >= 0 && gy >= 0 && gx <= n_row && gy <= n_row &&
+        move_map(gx, gy) > 0 && conn_map(gx, gy) != -1;
+  });
+}
+
+py::tuple House::checkMovesExact(
+    nparray<uint8_t> obs, boxarray starts, boxarray ends, int num_samples) const {
+  auto map = grid_view(obs, "obs");
+  if (map.rows != map.cols)
+    throw std::invalid_argument("obs must be square");
+  int n_row = map.rows - 1;
+  return check_moves_(starts, ends, num_samples, [&](double x, double y) {
+      return check_occupy_(map.data, n_row, x, y);
+  });
 }
 
 }
@@ -6,18 +6,178 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
 #include <pybind11/numpy.h>
 
+#include "lib/bitgrid.hh"
+#include "model/objparse.hh"
+
 
 namespace render {
 
-// Implement some methods about houses that are too slow to do in python
+// Implement some methods about houses that are too slow to do in python.
+// Each method matches the method of the same name of House in house.py.
+//
+// Maps are indexed by (x, y), with (n_row + 1) x (n_row + 1) cells, where
+// cell (x, y) starts at L_lo + (x, y) * L_det / n_row in meters.
+// Boxes are (k, 4) arrays of (x1, y1, x2, y2) in meters, i.e. the x and z
+// components of the bbox in house.json.
+// The methods that read files or compute maps release the GIL while they
+// do, so several threads can build their houses at once.
 class House {
-  typedef pybind11::array nparray;
+  template <typename T>
+  using nparray = pybind11::array_t<T, pybind11::array::c_style>;
+  using boxarray = pybind11::array_t<double, pybind11::array::c_style | pybind11::array::forcecast>;
+
   public:
-    void f(const std::vector<nparray>& numpy_arrays);
+    House(double L_lo, double L_det, double robot_radius):
+      L_lo_{L_lo}, L_det_{L_det}, robot_radius_{robot_radius} {}
+
+    double L_lo() const { return L_lo_; }
+    double L_det() const { return L_det_; }
+    double robot_radius() const { return robot_radius_; }
+
+    // grid coordinate of x in meters, as House.to_grid
+    int to_grid(double x, int n_row) const {
+      const double tiny = 1e-9;
+      return (int)std::floor((x - L_lo_) / L_det_ * n_row + tiny);
+    }
+
+    // The walls of the house obj_file that reach below lower_bound, as
+    // parse_walls in house.py: a list of {'name': str, 'bbox': {'min': [x, y, z],
+    // 'max': [x, y, z]}} of the vertices of each group with "Wall" in its name.
+    // The file is scanned without building meshes.
+    static pybind11::list parseWalls(const std::string& obj_file, double lower_bound);
+
+    // The walls of parseWalls() among the groups of an obj file.
+    static pybind11::list wallList(const std::vector<ObjGroupBox>& groups, double lower_bound);
+
+    // Write the obstacle and movability maps of the levels of a house to
+    // fname, packed to 1 bit per cell, for loadMaps().
+    // maps: a list of (obs, move) of each level, where nonzero cells are set.
+    static void saveMaps(const std::string& fname, pybind11::list maps);
+
+    // The list of (obs, move) written by saveMaps(), as uint8 and int8
+    // arrays, or None if fname is not such a file, e.g. a pickled cache.
+    // The file is memory-mapped and unpacked, without parsing.
+    static pybind11::object loadMaps(const std::string& fname);
+
+    // The maps of a level of a file of saveMaps(), still packed, where cell
+    // i is bit i % 64 of word i / 64.
+    struct PackedMaps {
+      uint32_t rows, cols;
+      std::vector<uint64_t> obs, move;
+    };
+
+    // Read the levels of fname into ret, without the GIL. Returns false if
+    // it's not a file of saveMaps(). Throws std::runtime_error if it can't
+    // be read or is corrupted.
+    static bool readMaps(const std::string& fname, std::vector<PackedMaps>& ret);
+
+    // The list of (obs, move) of loadMaps() of the levels of readMaps().
+    static pybind11::list unpackMaps(const std::vector<PackedMaps>& levels);
+
+    // Fill the obstacle map obs of n_row = obs.shape[0] - 1 in place:
+    // level is free, walls are obstacles, except where the doors are,
+    // and objects are obstacles.
+    // level: (1, 4) box of the level.
+    void genObstacleMap(
+        nparray<uint8_t> obs, boxarray level,
+        boxarray walls, boxarray doors, boxarray objects) const;
 
+    // Set move[x, y] = 1 for every free cell of obs in [x1, x2) x [y1, y2),
+    // where a robot of robot_radius centered in the cell touches no obstacle.
+    // The obstacles are dilated by the robot on a bit-packed grid.
+    void genMovableMap(
+        nparray<uint8_t> obs, nparray<int8_t> move,
+        int x1, int y1, int x2, int y2) const;
+
+    // Set move[x, y] = 0 for every cell within grid_radius cells of a cell
+    // where move is 0, and 1 for the others, as
+    // House._adjustApproximateRobotMoveMap. Cells outside the map are movable.
+    void adjustApproximateRobotMoveMap(nparray<int8_t> move, int grid_radius) const;
+
+    // whether a robot at (cx, cy) in meters touches no obstacle of obs
+    bool check_occupy(nparray<uint8_t> obs, double cx, double cy) const;
+
+    // The 4-connected components of movable cells of move in the grid region
+    // [x1, x2] x [y1, y2], as House._find_components.
+    // Returns a list of (k, 2) int32 arrays of cells, in BFS order, or the
+    // largest one if return_largest. If return_open and no component is
+    // open, returns the largest one, as return_largest.
+    pybind11::object findComponents(
+        nparray<int8_t> move, int x1, int y1, int x2, int y2,
+        bool return_largest, bool return_open) const;
+
+    // Distances to targets, as House.setTargetRoom and setTargetPoint.
+    // Each target is a (k, 6) array of regions (x1, y1, x2, y2, cx, cy):
+    // the open components of the grid region (x1, y1, x2, y2) are at
+    // distance 0, and inroomDist is their distance in meters to (cx, cy),
+    // minus the smallest one. If no region of a target has movable cells
+    // and retry_closed, closed components are used instead.
+    // The targets are computed in parallel. Returns a list of, for each
+    // target, a tuple of
+    //  (connMap, connectedCoors, inroomDist, maxConnDist, closed, empty)
+    // where connectedCoors is a (k, 2) int32 array of cells in BFS order,
+    // closed is whether closed components were used, and empty is the
+    // list of regions without any movable cell.
+    pybind11::list genConnMaps(
+        nparray<int8_t> move, const std::vector<boxarray>& targets,
+        bool retry_closed) const;
+
+    // Check the moves of N agents from starts to ends, (N, 2) arrays of
+    // (x, y) in meters, as Environment._check_collision: a move succeeds if
+    // all of num_samples points evenly spaced on it, after the start, are
+    // valid. Valid points are movable and connected cells (conn != -1), as
+    // in _check_collision_fast.
+    // Returns (success, endpoints): a (N,) bool array, and a (N, 2) array of
+    // the last valid point of each move, or its start if none is.
+    pybind11::tuple checkMoves(
+        nparray<int8_t> move, nparray<int32_t> conn,
+        boxarray starts, boxarray ends, int num_samples) const;
+
+    // Same as checkMoves, but valid points are those where the robot
+    // touches no obstacle of obs, i.e. House.check_occupy.
+    pybind11::tuple checkMovesExact(
+        nparray<uint8_t> obs, boxarray starts, boxarray ends, int num_samples) const;
+
+  private:
+    double L_lo_, L_det_, robot_radius_;
+
+    // valid(x, y) for meters x, y decides whether a point is valid
+    template <typename Valid>
+    pybind11::tuple check_moves_(
+        boxarray& starts, boxarray& ends, int num_samples, Valid valid) const;
+
+    // obs: (n_row + 1) x (n_row + 1) map
+    bool check_occupy_(const uint8_t* obs, int n_row, double cx, double cy) const;
+
+    // The cells that a robot at the center of cell (0, 0) touches, on a
+    // map of n_row, as check_occupy_()
+    std::vector<BitGrid::Run> robot_kernel_(int n_row) const;
+
+    struct Coor { int32_t x, y; };
+    struct Region { int x1, y1, x2, y2; double cx, cy; };
+    struct ConnMap {
+      std::vector<int32_t> dist;
+      std::vector<float> inroom_dist;
+      std::vector<Coor> coors;
+      int max_dist = 1;
+      bool closed = false;
+      std::vector<int> empty;
+    };
+
+    // move: (n_row + 1) x (n_row + 1) map
+    // If return_open finds no open component, returns the largest one
+    // instead and sets *no_open.
+    std::vector<std::vector<Coor>> components_(
+        const int8_t* move, int n_row, Region r,
+        bool return_largest, bool return_open, bool* no_open = nullptr) const;
+    ConnMap conn_map_(const int8_t* move, int n_row,
+        const std::vector<Region>& regions, bool retry_closed) const;
 };
 
 }
-
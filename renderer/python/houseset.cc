@@ -0,0 +1,74 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "houseset.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+#include "lib/strutils.hh"
+
+namespace py = pybind11;
+using namespace std;
+
+namespace render {
+
+HouseSet::HouseSet(const vector<string>& obj_files,
+    const vector<string>& map_files, int nr_threads) {
+  if (obj_files.size() != map_files.size())
+    throw std::invalid_argument("HouseSet: obj_files and map_files must have the same size");
+  houses_.resize(obj_files.size());
+  if (nr_threads <= 0)
+    nr_threads = max(thread::hardware_concurrency(), 1u);
+  nr_threads = min<size_t>(nr_threads, houses_.size());
+
+  // the error of each house, reported after all the threads are done
+  vector<string> errors(houses_.size());
+  {
+    py::gil_scoped_release release;
+    atomic<size_t> next{0};
+    auto work = [&]() {
+      for (size_t i; (i = next++) < houses_.size(); ) {
+        try {
+          houses_[i].walls = scan_group_boxes(obj_files[i], "Wall");
+          if (map_files[i].size())
+            houses_[i].has_maps = House::readMaps(map_files[i], houses_[i].maps);
+        } catch (const std::exception& e) {
+          errors[i] = e.what();
+        }
+      }
+    };
+    vector<thread> threads;
+    for (int k = 0; k < nr_threads; ++k)
+      threads.emplace_back(work);
+    for (auto& th : threads)
+      th.join();
+  }
+  for (auto& e : errors)
+    if (e.size())
+      throw std::runtime_error(e);
+}
+
+const HouseSet::Files& HouseSet::house_(int i) const {
+  if (i < 0 || (size_t)i >= houses_.size())
+    throw std::out_of_range(ssprintf("HouseSet: house %d out of range", i));
+  return houses_[i];
+}
+
+py::list HouseSet::walls(int i, double lower_bound) const {
+  return House::wallList(house_(i).walls, lower_bound);
+}
+
+py::object HouseSet::maps(int i) const {
+  auto& h = house_(i);
+  if (!h.has_maps)
+    return py::none();
+  return House::unpackMaps(h.maps);
+}
+
+}
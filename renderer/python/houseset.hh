@@ -0,0 +1,52 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <pybind11/pybind11.h>
+
+#include "house.hh"
+#include "model/objparse.hh"
+
+namespace render {
+
+// The files of many houses, read at once by a pool of threads without the
+// GIL, for MultiHouseEnv to build its Houses in one process.
+//
+// It keeps the walls of the obj file and the packed maps of the cache file
+// of each house in native memory. House reads them from here, given the
+// handle (house_set, i), instead of from the files.
+class HouseSet {
+  public:
+    // map_files[i] is the cache file of the house of obj_files[i], or empty
+    // if it has none. nr_threads <= 0 uses every core.
+    // Throws std::runtime_error if a file can't be read.
+    HouseSet(const std::vector<std::string>& obj_files,
+        const std::vector<std::string>& map_files, int nr_threads = 0);
+
+    size_t size() const { return houses_.size(); }
+
+    // House::parseWalls() of the obj file of house i
+    pybind11::list walls(int i, double lower_bound) const;
+
+    // House::loadMaps() of the cache file of house i, or None if it has
+    // none, or it's not a file of saveMaps(), e.g. a pickled cache.
+    pybind11::object maps(int i) const;
+
+  private:
+    struct Files {
+      std::vector<ObjGroupBox> walls;
+      bool has_maps = false;
+      std::vector<House::PackedMaps> maps;
+    };
+    std::vector<Files> houses_;
+
+    const Files& house_(int i) const;
+};
+
+}
@@ -7,13 +7,30 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/operators.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
 
 
 #include "suncg/render.hh"
+#include "suncg/server.hh"
+#include "suncg/cpurender.hh"
+#include "suncg/trajectory.hh"
 #include "lib/mat.h"
+#include "lib/bufpool.hh"
+#include "lib/profiler.hh"
 #include "lib/timer.hh"
+#include "lib/shmring.hh"
+#include "lib/videowriter.hh"
 
 #include "house.hh"
+#include "connmap.hh"
+#include "distoracle.hh"
+#include "houseset.hh"
+#include "vecnav.hh"
 
 using namespace std;
 using namespace render;
@@ -21,40 +38,416 @@ namespace py = pybind11;
 
 namespace {
 //TotalTimerGlobalGuard TGGG;
+
+// View a (N*h) x w x c image of N vertically stacked views as a N x h x w x c
+// array. The array shares memory with (and keeps alive) the Mat.
+py::array mat_to_batch_array(Matuc&& mat, int n) {
+  ssize_t h = mat.rows() / n, w = mat.cols(), c = mat.channels();
+  py::object base = py::cast(std::move(mat));
+  Matuc& m = base.cast<Matuc&>();
+  return py::array_t<unsigned char>(
+      {(ssize_t)n, h, w, c},
+      {h * w * c, w * c, c, (ssize_t)1},
+      m.ptr(), base);
+}
+
+// cameras: a vector<Camera> or a CameraBatch
+template <typename API, typename Cameras = std::vector<Camera>>
+py::array render_batch(API& api, const Cameras& cameras) {
+  Matuc mat;
+  {
+    py::gil_scoped_release release;
+    mat = api.renderBatch(cameras);
+  }
+  return mat_to_batch_array(std::move(mat), cameras.size());
+}
+
+// Render into a preallocated uint8 array of shape (h, w, c), e.g. a slot of
+// a replay buffer, so no image is allocated or copied per frame.
+template <typename API>
+void render_into(API& api, py::array out) {
+  Geometry geo = api.resolution();
+  int c = api.numChannels();
+  if (!out.dtype().is(py::dtype::of<unsigned char>()))
+    throw std::invalid_argument("renderInto: the array must have dtype uint8!");
+  if (out.ndim() != 3 || out.shape(0) != geo.h || out.shape(1) != geo.w ||
+      out.shape(2) != c)
+    throw std::invalid_argument(ssprintf(
+          "renderInto: the array must have shape (%d, %d, %d)!", geo.h, geo.w, c));
+  if (!(out.flags() & py::array::c_style))
+    throw std::invalid_argument("renderInto: the array must be C-contiguous!");
+  if (!out.writeable())
+    throw std::invalid_argument("renderInto: the array must be writeable!");
+  unsigned char* dst = static_cast<unsigned char*>(out.mutable_data());
+  py::gil_scoped_release release;
+  api.renderInto(dst);
+}
+
+// Render into the next slot of a ShmRing, for a reader in another process.
+// Returns false if no slot is free after timeout_ms.
+template <typename API>
+bool render_into_ring(API& api, ShmRing& ring, int timeout_ms) {
+  Geometry geo = api.resolution();
+  if (ring.rows() != geo.h || ring.cols() != geo.w || ring.channels() != api.numChannels())
+    throw std::invalid_argument(ssprintf(
+          "renderIntoRing: the slots of the ring must have shape (%d, %d, %d)!",
+          geo.h, geo.w, api.numChannels()));
+  py::gil_scoped_release release;
+  uint8_t* slot = ring.acquire_write(timeout_ms);
+  if (!slot)
+    return false;
+  api.renderInto(slot);
+  ring.commit_write();
+  return true;
+}
+
+// Render the next frame of a VideoWriter in place, and queue it for encoding.
+template <typename API>
+void record_frame(API& api, VideoWriter& video) {
+  Geometry geo = api.resolution();
+  if (api.numChannels() != 3)
+    throw std::invalid_argument("recordFrame: only modes of 3 channels can be recorded!");
+  if (video.height() != geo.h || video.width() != geo.w)
+    throw std::invalid_argument(ssprintf(
+          "recordFrame: the video must have resolution %dx%d!", geo.w, geo.h));
+  py::gil_scoped_release release;
+  unsigned char* dst = video.next_frame();
+  api.renderInto(dst);
+  video.commit();
+}
+
+template <typename API>
+py::array render_rig(API& api, const CameraRig& rig) {
+  if (rig.size() == 0)
+    throw std::invalid_argument("renderRig: the rig has no views!");
+  Matuc mat;
+  {
+    py::gil_scoped_release release;
+    mat = api.renderRig(rig);
+  }
+  return mat_to_batch_array(std::move(mat), rig.size());
+}
+
+// transform: a (4, 4) model matrix, acting on column vectors (x, y, z, 1)
+template <typename API>
+void set_object_transform(API& api, int instance,
+    py::array_t<float, py::array::c_style | py::array::forcecast> transform) {
+  if (transform.ndim() != 2 || transform.shape(0) != 4 || transform.shape(1) != 4)
+    throw std::invalid_argument("setObjectTransform: transform must have shape (4, 4)!");
+  const float* t = transform.data();
+  glm::mat4 m;
+  for (int r = 0; r < 4; ++r)
+    for (int c = 0; c < 4; ++c)
+      m[c][r] = t[r * 4 + c];   // glm is column-major
+  py::gil_scoped_release release;
+  api.setObjectTransform(instance, m);
+}
+
+template <typename API>
+py::array get_object_transform(API& api, int instance) {
+  glm::mat4 m = api.getObjectTransform(instance);
+  py::array_t<float> ret({(ssize_t)4, (ssize_t)4});
+  float* t = ret.mutable_data();
+  for (int r = 0; r < 4; ++r)
+    for (int c = 0; c < 4; ++c)
+      t[r * 4 + c] = m[c][r];
+  return ret;
+}
+
+// rooms: (k, 4) floor rectangles (x1, z1, x2, z2)
+// portals: (m, 6) boxes (x1, y1, z1, x2, y2, z2) of the doors and windows
+template <typename API>
+void set_rooms(API& api,
+    py::array_t<float, py::array::c_style | py::array::forcecast> rooms,
+    py::array_t<float, py::array::c_style | py::array::forcecast> portals) {
+  if (rooms.ndim() != 2 || rooms.shape(1) != 4)
+    throw std::invalid_argument("setRooms: rooms must have shape (k, 4)!");
+  if (portals.ndim() != 2 || portals.shape(1) != 6)
+    throw std::invalid_argument("setRooms: portals must have shape (m, 6)!");
+  std::vector<glm::vec4> room_rects(rooms.shape(0));
+  auto r = rooms.unchecked<2>();
+  for (size_t i = 0; i < room_rects.size(); ++i)
+    room_rects[i] = glm::vec4{r(i, 0), r(i, 1), r(i, 2), r(i, 3)};
+  std::vector<AABB> portal_boxes(portals.shape(0));
+  auto p = portals.unchecked<2>();
+  for (size_t i = 0; i < portal_boxes.size(); ++i)
+    portal_boxes[i] = AABB{glm::vec3{p(i, 0), p(i, 1), p(i, 2)},
+                           glm::vec3{p(i, 3), p(i, 4), p(i, 5)}};
+  api.setRooms(room_rects, portal_boxes);
+}
+
+using farray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+// rows of a (N, 3) array
+std::vector<glm::vec3> vec3_rows(farray& arr, const char* what) {
+  if (arr.ndim() != 2 || arr.shape(1) != 3)
+    throw std::invalid_argument(ssprintf("%s must have shape (N, 3)!", what));
+  std::vector<glm::vec3> ret(arr.shape(0));
+  auto a = arr.unchecked<2>();
+  for (size_t i = 0; i < ret.size(); ++i)
+    ret[i] = glm::vec3{a(i, 0), a(i, 1), a(i, 2)};
+  return ret;
+}
+
+// origins, dirs: (N, 3) rays, see SUNCGScene::raycast()
+// Returns (distance, instance): (N,) float32 and int32 arrays.
+template <typename API>
+py::tuple raycast(API& api, farray origins, farray dirs) {
+  auto o = vec3_rows(origins, "raycast: origins"), d = vec3_rows(dirs, "raycast: dirs");
+  if (o.size() != d.size())
+    throw std::invalid_argument("raycast: origins and dirs must have the same shape!");
+  std::vector<SUNCGScene::RayHit> hits;
+  {
+    py::gil_scoped_release release;
+    hits = api.raycast(o, d);
+  }
+  py::array_t<float> distance(hits.size());
+  py::array_t<int32_t> instance(hits.size());
+  float* pd = distance.mutable_data();
+  int32_t* pi = instance.mutable_data();
+  for (size_t i = 0; i < hits.size(); ++i) {
+    pd[i] = hits[i].distance;
+    pi[i] = hits[i].instance;
+  }
+  return py::make_tuple(distance, instance);
+}
+
+// box: (x1, y1, z1, x2, y2, z2)
+template <typename API>
+std::vector<int> query_aabb(API& api, farray box) {
+  if (box.size() != 6)
+    throw std::invalid_argument("queryAABB: box must have 6 elements!");
+  const float* b = box.data();
+  AABB aabb{glm::vec3{b[0], b[1], b[2]}, glm::vec3{b[3], b[4], b[5]}};
+  py::gil_scoped_release release;
+  return api.queryAABB(aabb);
+}
+
+template <typename API>
+void bind_vec_room_nav(py::module& m, const char* name) {
+  using namespace pybind11::literals;
+  using VecNav = VecRoomNav<API>;
+  py::class_<VecNav>(m, name)
+    .def(py::init<API&, const House&, py::array_t<int8_t, py::array::c_style | py::array::forcecast>,
+          int, VecRoomNavConfig>(),
+        "api"_a, "house"_a, "move"_a, "num_agents"_a, "config"_a,
+        py::keep_alive<1, 2>())
+    .def("addTarget", &VecNav::addTarget, "conn"_a, "max_conn_dist"_a, "colors"_a)
+    .def("resetAgent", &VecNav::resetAgent, "i"_a, "x"_a, "y"_a, "yaw"_a, "target"_a)
+    .def("step", &VecNav::step, "actions"_a)
+    .def("observe", &VecNav::observe, "agents"_a)
+    .def("numAgents", &VecNav::numAgents)
+    .def("numChannels", &VecNav::numChannels)
+    .def("getCamera", &VecNav::getCamera, py::return_value_policy::reference_internal);
+}
 }
 
 using namespace pybind11::literals;
 PYBIND11_MODULE(objrender, m) {
   py::class_<SUNCGRenderAPI>(m, "RenderAPI")
-    // device defaults to 0
-    .def(py::init<int, int, int>(), "Initialize", "w"_a, "h"_a, "device"_a=0)
+    // device defaults to 0. -1 picks the least loaded device.
+    .def(py::init<int, int, int, bool>(), "Initialize", "w"_a, "h"_a, "device"_a=0, "share"_a=false,
+        py::call_guard<py::gil_scoped_release>())
+    .def("device", &SUNCGRenderAPI::device)
     .def("printContextInfo", &SUNCGRenderAPI::printContextInfo)
     .def("getCamera", &SUNCGRenderAPI::getCamera, py::return_value_policy::reference)
     .def("setMode", &SUNCGRenderAPI::setMode)
-    .def("loadSceneSUNCG", &SUNCGRenderAPI::loadScene)
-    .def("loadScene", &SUNCGRenderAPI::loadScene)
+    .def("getMode", &SUNCGRenderAPI::getMode)
+    .def("setCompactVertexLayout", &SUNCGRenderAPI::setCompactVertexLayout, "compact"_a)
+    .def("setCompressedTextures", &SUNCGRenderAPI::setCompressedTextures, "compressed"_a)
+    .def("setTextureStreaming", &SUNCGRenderAPI::setTextureStreaming, "enabled"_a)
+    .def("setTextureBudget", &SUNCGRenderAPI::setTextureBudget, "bytes"_a)
+    .def("setDepthPrepass", &SUNCGRenderAPI::setDepthPrepass, "enabled"_a)
+    .def("setSceneCacheBudget", &SUNCGRenderAPI::setSceneCacheBudget, "gpu_bytes"_a, "cpu_bytes"_a)
+    .def("getSceneCacheStats", &SUNCGRenderAPI::getSceneCacheStats)
+    .def("loadSceneSUNCG", &SUNCGRenderAPI::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("loadScene", &SUNCGRenderAPI::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("prefetchScene", &SUNCGRenderAPI::prefetchScene, py::call_guard<py::gil_scoped_release>())
     .def("resolution", &SUNCGRenderAPI::resolution)
-    .def("render", &SUNCGRenderAPI::render)
-    .def("renderCubeMap", &SUNCGRenderAPI::renderCubeMap)
+    .def("setResolution", &SUNCGRenderAPI::setResolution, "w"_a, "h"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("setAntialiasing", &SUNCGRenderAPI::setAntialiasing, "samples"_a, "supersampling"_a=1,
+        py::call_guard<py::gil_scoped_release>())
+    .def("render", &SUNCGRenderAPI::render, py::call_guard<py::gil_scoped_release>())
+    .def("setRooms", &set_rooms<SUNCGRenderAPI>, "rooms"_a, "portals"_a)
+    .def("renderInto", &render_into<SUNCGRenderAPI>, "out"_a)
+    .def("renderIntoRing", &render_into_ring<SUNCGRenderAPI>, "ring"_a, "timeout_ms"_a=-1)
+    .def("recordFrame", &record_frame<SUNCGRenderAPI>, "video"_a)
+    .def("numChannels", &SUNCGRenderAPI::numChannels)
+    .def("renderMulti", &SUNCGRenderAPI::renderMulti, "modes"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("renderDepth", &SUNCGRenderAPI::renderDepth, py::call_guard<py::gil_scoped_release>())
+    .def("renderInstanceIds", &SUNCGRenderAPI::renderInstanceIds,
+        py::call_guard<py::gil_scoped_release>())
+    .def("renderCubeMap", &SUNCGRenderAPI::renderCubeMap, py::call_guard<py::gil_scoped_release>())
+    .def("renderBatch", &render_batch<SUNCGRenderAPI>, "cameras"_a)
+    .def("renderBatch", &render_batch<SUNCGRenderAPI, CameraBatch>, "cameras"_a)
+    .def("renderRig", &render_rig<SUNCGRenderAPI>, "rig"_a)
+    .def("renderAsync", &SUNCGRenderAPI::renderAsync, py::call_guard<py::gil_scoped_release>())
+    .def("collect", &SUNCGRenderAPI::collect, py::call_guard<py::gil_scoped_release>())
+    .def("numPendingFrames", &SUNCGRenderAPI::numPendingFrames)
+    .def("countInstancePixels", &SUNCGRenderAPI::countInstancePixels,
+        py::call_guard<py::gil_scoped_release>())
+    .def("raycast", &raycast<SUNCGRenderAPI>, "origins"_a, "dirs"_a)
+    .def("queryAABB", &query_aabb<SUNCGRenderAPI>, "box"_a)
+    .def("setObjectTransform", &set_object_transform<SUNCGRenderAPI>, "instance"_a, "transform"_a)
+    .def("getObjectTransform", &get_object_transform<SUNCGRenderAPI>, "instance"_a)
+    .def("setObjectVisible", &SUNCGRenderAPI::setObjectVisible, "instance"_a, "visible"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("isObjectVisible", &SUNCGRenderAPI::isObjectVisible, "instance"_a)
+    .def("getInstanceNames", &SUNCGRenderAPI::getInstanceNames)
     .def("getNameFromInstanceColor", &SUNCGRenderAPI::getNameFromInstanceColor)
       ;
 
 
   py::class_<SUNCGRenderAPIThread>(m, "RenderAPIThread")
-    // device defaults to 0
-    .def(py::init<int, int, int>(), "Initialize", "w"_a, "h"_a, "device"_a=0)
+    // device defaults to 0. -1 picks the least loaded device.
+    .def(py::init<int, int, int, bool>(), "Initialize", "w"_a, "h"_a, "device"_a=0, "share"_a=false,
+        py::call_guard<py::gil_scoped_release>())
+    .def("device", &SUNCGRenderAPIThread::device)
     .def("getCamera", &SUNCGRenderAPIThread::getCamera, py::return_value_policy::reference)
     .def("printContextInfo", &SUNCGRenderAPIThread::printContextInfo)
     .def("setMode", &SUNCGRenderAPIThread::setMode)
-    .def("loadSceneSUNCG", &SUNCGRenderAPIThread::loadScene)
-    .def("loadScene", &SUNCGRenderAPIThread::loadScene)
+    .def("getMode", &SUNCGRenderAPIThread::getMode)
+    .def("setCompactVertexLayout", &SUNCGRenderAPIThread::setCompactVertexLayout, "compact"_a)
+    .def("setCompressedTextures", &SUNCGRenderAPIThread::setCompressedTextures, "compressed"_a)
+    .def("setTextureStreaming", &SUNCGRenderAPIThread::setTextureStreaming, "enabled"_a)
+    .def("setTextureBudget", &SUNCGRenderAPIThread::setTextureBudget, "bytes"_a)
+    .def("setDepthPrepass", &SUNCGRenderAPIThread::setDepthPrepass, "enabled"_a)
+    .def("setSceneCacheBudget", &SUNCGRenderAPIThread::setSceneCacheBudget, "gpu_bytes"_a, "cpu_bytes"_a)
+    .def("getSceneCacheStats", &SUNCGRenderAPIThread::getSceneCacheStats)
+    .def("loadSceneSUNCG", &SUNCGRenderAPIThread::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("loadScene", &SUNCGRenderAPIThread::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("prefetchScene", &SUNCGRenderAPIThread::prefetchScene,
+        py::call_guard<py::gil_scoped_release>())
     .def("resolution", &SUNCGRenderAPIThread::resolution)
-    .def("render", &SUNCGRenderAPIThread::render)
-    .def("renderCubeMap", &SUNCGRenderAPIThread::renderCubeMap)
+    .def("setResolution", &SUNCGRenderAPIThread::setResolution, "w"_a, "h"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("setAntialiasing", &SUNCGRenderAPIThread::setAntialiasing, "samples"_a, "supersampling"_a=1,
+        py::call_guard<py::gil_scoped_release>())
+    .def("render", &SUNCGRenderAPIThread::render, py::call_guard<py::gil_scoped_release>())
+    .def("setRooms", &set_rooms<SUNCGRenderAPIThread>, "rooms"_a, "portals"_a)
+    .def("renderInto", &render_into<SUNCGRenderAPIThread>, "out"_a)
+    .def("renderIntoRing", &render_into_ring<SUNCGRenderAPIThread>, "ring"_a, "timeout_ms"_a=-1)
+    .def("recordFrame", &record_frame<SUNCGRenderAPIThread>, "video"_a)
+    .def("numChannels", &SUNCGRenderAPIThread::numChannels)
+    .def("renderMulti", &SUNCGRenderAPIThread::renderMulti, "modes"_a,
+        py::call_guard<py::gil_scoped_release>())
+    // [(mode, camera), ...] -> a list of images, rendered with one handoff
+    .def("renderViews", &SUNCGRenderAPIThread::renderViews, "views"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("renderDepth", &SUNCGRenderAPIThread::renderDepth, py::call_guard<py::gil_scoped_release>())
+    .def("renderInstanceIds", &SUNCGRenderAPIThread::renderInstanceIds,
+        py::call_guard<py::gil_scoped_release>())
+    .def("renderCubeMap", &SUNCGRenderAPIThread::renderCubeMap,
+        py::call_guard<py::gil_scoped_release>())
+    .def("renderBatch", &render_batch<SUNCGRenderAPIThread>, "cameras"_a)
+    .def("renderBatch", &render_batch<SUNCGRenderAPIThread, CameraBatch>, "cameras"_a)
+    .def("renderRig", &render_rig<SUNCGRenderAPIThread>, "rig"_a)
+    // returns a MatFuture. Call its get() to obtain the image.
+    .def("renderAsync", &SUNCGRenderAPIThread::renderAsync, py::call_guard<py::gil_scoped_release>())
+    .def("countInstancePixels", &SUNCGRenderAPIThread::countInstancePixels,
+        py::call_guard<py::gil_scoped_release>())
+    .def("raycast", &raycast<SUNCGRenderAPIThread>, "origins"_a, "dirs"_a)
+    .def("queryAABB", &query_aabb<SUNCGRenderAPIThread>, "box"_a)
+    .def("setObjectTransform", &set_object_transform<SUNCGRenderAPIThread>, "instance"_a, "transform"_a)
+    .def("getObjectTransform", &get_object_transform<SUNCGRenderAPIThread>, "instance"_a)
+    .def("setObjectVisible", &SUNCGRenderAPIThread::setObjectVisible, "instance"_a, "visible"_a,
+        py::call_guard<py::gil_scoped_release>())
+    .def("isObjectVisible", &SUNCGRenderAPIThread::isObjectVisible, "instance"_a)
+    .def("getInstanceNames", &SUNCGRenderAPIThread::getInstanceNames)
     .def("getNameFromInstanceColor", &SUNCGRenderAPIThread::getNameFromInstanceColor)
       ;
 
+  py::class_<RenderServer>(m, "RenderServer")
+    // contexts_per_device rendering contexts on each device (all of them if
+    // devices is empty), shared by all the RenderClients of this server
+    .def(py::init<int, int, const std::vector<int>&, int>(), "w"_a, "h"_a,
+        "devices"_a=std::vector<int>{0}, "contexts_per_device"_a=1)
+    .def("resolution", &RenderServer::resolution)
+    .def("numContexts", &RenderServer::numContexts)
+    .def("setSceneCacheBudget", &RenderServer::setSceneCacheBudget, "gpu_bytes"_a, "cpu_bytes"_a,
+        py::call_guard<py::gil_scoped_release>());
+
+  // Has the methods of RenderAPI used by Environment, so it can replace it.
+  py::class_<RenderClient>(m, "RenderClient")
+    .def(py::init<RenderServer&>(), "server"_a, py::keep_alive<1, 2>())
+    .def("getCamera", &RenderClient::getCamera, py::return_value_policy::reference_internal)
+    .def("printContextInfo", &RenderClient::printContextInfo)
+    .def("setMode", &RenderClient::setMode)
+    .def("getMode", &RenderClient::getMode)
+    .def("loadSceneSUNCG", &RenderClient::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("loadScene", &RenderClient::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("prefetchScene", &RenderClient::prefetchScene)
+    .def("resolution", &RenderClient::resolution)
+    .def("render", &RenderClient::render, py::call_guard<py::gil_scoped_release>())
+    .def("setRooms", &set_rooms<RenderClient>, "rooms"_a, "portals"_a)
+    .def("renderInto", &render_into<RenderClient>, "out"_a)
+    .def("renderIntoRing", &render_into_ring<RenderClient>, "ring"_a, "timeout_ms"_a=-1)
+    .def("recordFrame", &record_frame<RenderClient>, "video"_a)
+    .def("numChannels", &RenderClient::numChannels)
+    .def("renderMulti", &RenderClient::renderMulti, "modes"_a, py::call_guard<py::gil_scoped_release>())
+    .def("renderDepth", &RenderClient::renderDepth, py::call_guard<py::gil_scoped_release>())
+    .def("renderInstanceIds", &RenderClient::renderInstanceIds, py::call_guard<py::gil_scoped_release>())
+    .def("renderCubeMap", &RenderClient::renderCubeMap, py::call_guard<py::gil_scoped_release>())
+    .def("renderBatch", &render_batch<RenderClient>, "cameras"_a)
+    .def("renderBatch", &render_batch<RenderClient, CameraBatch>, "cameras"_a)
+    .def("renderRig", &render_rig<RenderClient>, "rig"_a)
+    // returns a MatFuture. Call its get() to obtain the image.
+    .def("renderAsync", &RenderClient::renderAsync)
+    .def("countInstancePixels", &RenderClient::countInstancePixels, py::call_guard<py::gil_scoped_release>())
+    .def("raycast", &raycast<RenderClient>, "origins"_a, "dirs"_a)
+    .def("queryAABB", &query_aabb<RenderClient>, "box"_a)
+    .def("getInstanceNames", &RenderClient::getInstanceNames, py::call_guard<py::gil_scoped_release>())
+    .def("getNameFromInstanceColor", &RenderClient::getNameFromInstanceColor,
+        py::call_guard<py::gil_scoped_release>())
+      ;
+
+  // Renders without OpenGL, and so without RGB mode. Has the methods of
+  // RenderAPI used by Environment, so it can replace it.
+  py::class_<SUNCGCPURenderAPI>(m, "CPURenderAPI")
+    .def(py::init<int, int, int>(), "w"_a, "h"_a, "nr_threads"_a=0)
+    .def("getCamera", &SUNCGCPURenderAPI::getCamera, py::return_value_policy::reference)
+    .def("printContextInfo", &SUNCGCPURenderAPI::printContextInfo)
+    .def("setMode", &SUNCGCPURenderAPI::setMode)
+    .def("getMode", &SUNCGCPURenderAPI::getMode)
+    .def("loadSceneSUNCG", &SUNCGCPURenderAPI::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("loadScene", &SUNCGCPURenderAPI::loadScene, py::call_guard<py::gil_scoped_release>())
+    .def("prefetchScene", &SUNCGCPURenderAPI::prefetchScene)
+    .def("resolution", &SUNCGCPURenderAPI::resolution)
+    .def("setResolution", &SUNCGCPURenderAPI::setResolution, "w"_a, "h"_a)
+    .def("numThreads", &SUNCGCPURenderAPI::numThreads)
+    .def("render", &SUNCGCPURenderAPI::render, py::call_guard<py::gil_scoped_release>())
+    .def("setRooms", &set_rooms<SUNCGCPURenderAPI>, "rooms"_a, "portals"_a)
+    .def("renderInto", &render_into<SUNCGCPURenderAPI>, "out"_a)
+    .def("numChannels", &SUNCGCPURenderAPI::numChannels)
+    .def("renderDepth", &SUNCGCPURenderAPI::renderDepth, py::call_guard<py::gil_scoped_release>())
+    .def("renderInstanceIds", &SUNCGCPURenderAPI::renderInstanceIds,
+        py::call_guard<py::gil_scoped_release>())
+    .def("countInstancePixels", &SUNCGCPURenderAPI::countInstancePixels,
+        py::call_guard<py::gil_scoped_release>())
+    // a (nr_beams,) float32 array of ranges
+    .def("lidarScan", [](SUNCGCPURenderAPI& api, int nr_beams, float fov, float max_range) {
+        std::vector<float> ranges;
+        {
+          py::gil_scoped_release release;
+          ranges = api.lidarScan(nr_beams, fov, max_range);
+        }
+        return py::array_t<float>((ssize_t)ranges.size(), ranges.data());
+      }, "nr_beams"_a, "fov"_a=360.f, "max_range"_a=std::numeric_limits<float>::infinity())
+    .def("raycast", &raycast<SUNCGCPURenderAPI>, "origins"_a, "dirs"_a)
+    .def("queryAABB", &query_aabb<SUNCGCPURenderAPI>, "box"_a)
+    .def("getInstanceNames", &SUNCGCPURenderAPI::getInstanceNames)
+    .def("getNameFromInstanceColor", &SUNCGCPURenderAPI::getNameFromInstanceColor)
+      ;
+
+  py::class_<std::future<Matuc>>(m, "MatFuture")
+    .def("get", &std::future<Matuc>::get, py::call_guard<py::gil_scoped_release>())
+    .def("valid", &std::future<Matuc>::valid);
+
   auto camera = py::class_<Camera>(m, "Camera")
+    .def(py::init<glm::vec3, float, float>(), "pos"_a, "yaw"_a=-90.f, "pitch"_a=0.f)
+    .def(py::init<const Camera&>())   // copy of the state, e.g. of api.getCamera()
     .def("shift", &Camera::shift)
     .def("turn", &Camera::turn)
     .def("updateDirection", &Camera::updateDirection)
@@ -68,6 +461,109 @@ PYBIND11_MODULE(objrender, m) {
     .def_readonly("right", &Camera::right)
     .def_readonly("up", &Camera::up);
 
+  // The poses of many cameras, set and read as arrays in one call, e.g.
+  //   batch.setPoses(pos, yaw)   # (n, 3) and (n,) arrays
+  //   api.renderBatch(batch)
+  using floatarray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+  py::class_<CameraBatch>(m, "CameraBatch")
+    .def(py::init<int>(), "n"_a = 0)
+    .def(py::init<const std::vector<Camera>&>(), "cameras"_a)
+    .def("__len__", &CameraBatch::size)
+    .def("resize", &CameraBatch::resize, "n"_a)
+    .def("camera", [](const CameraBatch& b, int i) {
+          if (i < 0 || i >= b.size())
+            throw std::out_of_range("CameraBatch.camera: index out of range!");
+          return b.camera(i);
+        }, "i"_a)
+    .def("cameras", &CameraBatch::cameras)
+    // Set the poses of all the cameras, resized to len(yaw). pitch defaults to 0.
+    .def("setPoses", [](CameraBatch& b, floatarray pos, floatarray yaw, py::object pitch) {
+          ssize_t n = yaw.size();
+          if (yaw.ndim() != 1 || pos.ndim() != 2 || pos.shape(0) != n || pos.shape(1) != 3)
+            throw std::invalid_argument("CameraBatch.setPoses: pos must be (n, 3) and yaw (n,)!");
+          floatarray pitch_arr;
+          if (!pitch.is_none()) {
+            pitch_arr = pitch.cast<floatarray>();
+            if (pitch_arr.ndim() != 1 || pitch_arr.size() != n)
+              throw std::invalid_argument("CameraBatch.setPoses: pitch must be (n,)!");
+          }
+          b.resize(n);
+          std::memcpy(b.pos.data(), pos.data(), n * 3 * sizeof(float));
+          std::memcpy(b.yaw.data(), yaw.data(), n * sizeof(float));
+          if (pitch.is_none())
+            std::fill(b.pitch.begin(), b.pitch.end(), 0.f);
+          else
+            std::memcpy(b.pitch.data(), pitch_arr.data(), n * sizeof(float));
+        }, "pos"_a, "yaw"_a, "pitch"_a = py::none())
+    .def("getPositions", [](const CameraBatch& b) {
+          py::array_t<float> ret({(ssize_t)b.size(), (ssize_t)3});
+          std::memcpy(ret.mutable_data(), b.pos.data(), b.pos.size() * sizeof(float));
+          return ret;
+        })
+    .def("getYaw", [](const CameraBatch& b) {
+          py::array_t<float> ret(b.size());
+          std::memcpy(ret.mutable_data(), b.yaw.data(), b.yaw.size() * sizeof(float));
+          return ret;
+        })
+    .def("getPitch", [](const CameraBatch& b) {
+          py::array_t<float> ret(b.size());
+          std::memcpy(ret.mutable_data(), b.pitch.data(), b.pitch.size() * sizeof(float));
+          return ret;
+        })
+    .def_readwrite("near", &CameraBatch::near)
+    .def_readwrite("far", &CameraBatch::far)
+    .def_readwrite("vertical_fov", &CameraBatch::vertical_fov);
+
+  // e.g. a stereo pair with a wide-angle camera on each side:
+  //   rig = CameraRig.stereo(0.065)
+  //   rig.addView((-0.1, 0, 0), yaw=-90, vertical_fov=90)
+  //   rig.addView((0.1, 0, 0), yaw=90, vertical_fov=90)
+  //   imgs = api.renderRig(rig)   # (4, h, w, c), following api.getCamera()
+  py::class_<CameraRig>(m, "CameraRig")
+    .def(py::init<>())
+    .def_static("stereo", &CameraRig::stereo, "baseline"_a, "vertical_fov"_a = 0.f)
+    // offset: (right, up, forward) in meters from the camera. yaw and pitch
+    // are added to the camera's, in degrees. vertical_fov 0 keeps the camera's.
+    .def("addView", [](CameraRig& rig, std::array<float, 3> offset, float yaw, float pitch,
+          float vertical_fov) {
+          CameraRig::View v;
+          v.offset = glm::vec3{offset[0], offset[1], offset[2]};
+          v.yaw = yaw;
+          v.pitch = pitch;
+          v.vertical_fov = vertical_fov;
+          rig.views.push_back(v);
+        }, "offset"_a, "yaw"_a = 0.f, "pitch"_a = 0.f, "vertical_fov"_a = 0.f)
+    .def("__len__", &CameraRig::size)
+    // the cameras of the views, for a rig at camera
+    .def("cameras", &CameraRig::cameras, "camera"_a);
+
+  py::class_<SceneCache::Stats>(m, "SceneCacheStats")
+    .def_readonly("hits", &SceneCache::Stats::hits)
+    .def_readonly("misses", &SceneCache::Stats::misses)
+    .def_readonly("gpu_evictions", &SceneCache::Stats::gpu_evictions)
+    .def_readonly("cpu_evictions", &SceneCache::Stats::cpu_evictions)
+    .def_readonly("num_scenes", &SceneCache::Stats::num_scenes)
+    .def_readonly("num_activated", &SceneCache::Stats::num_activated)
+    .def_readonly("cpu_bytes", &SceneCache::Stats::cpu_bytes)
+    .def_readonly("gpu_bytes", &SceneCache::Stats::gpu_bytes);
+
+  py::class_<BufferPool::Stats>(m, "BufferPoolStats")
+    .def_readonly("hits", &BufferPool::Stats::hits)
+    .def_readonly("misses", &BufferPool::Stats::misses)
+    .def_readonly("free_bytes", &BufferPool::Stats::free_bytes);
+
+  py::class_<Profiler::ZoneStats>(m, "ZoneStats")
+    .def_readonly("name", &Profiler::ZoneStats::name)
+    .def_readonly("count", &Profiler::ZoneStats::count)
+    .def_readonly("total", &Profiler::ZoneStats::total)   // in seconds
+    .def_readonly("self", &Profiler::ZoneStats::self)
+    .def_readonly("max", &Profiler::ZoneStats::max);
+
+  py::class_<Profiler::Stats>(m, "ProfilerStats")
+    .def_readonly("zones", &Profiler::Stats::zones)
+    .def_readonly("counters", &Profiler::Stats::counters)   // (name, value) pairs
+    .def_readonly("dropped_events", &Profiler::Stats::dropped_events);
+
   py::class_<Geometry>(m, "Geometry")
     .def_readonly("w", &Geometry::w)
     .def_readonly("h", &Geometry::h);
@@ -90,7 +586,268 @@ PYBIND11_MODULE(objrender, m) {
     .export_values();
 
   py::class_<House>(m, "_House")
-    .def("f", &House::f);
+    .def(py::init<double, double, double>(), "L_lo"_a, "L_det"_a, "robot_radius"_a)
+    // houses are pickled by the multiprocessing pool of MultiHouseEnv
+    .def(py::pickle(
+        [](const House& h) { return py::make_tuple(h.L_lo(), h.L_det(), h.robot_radius()); },
+        [](py::tuple t) {
+          if (t.size() != 3)
+            throw std::runtime_error("Invalid state of _House!");
+          return House{t[0].cast<double>(), t[1].cast<double>(), t[2].cast<double>()};
+        }))
+    .def_static("parseWalls", &House::parseWalls, "obj_file"_a, "lower_bound"_a)
+    .def_static("saveMaps", &House::saveMaps, "fname"_a, "maps"_a)
+    .def_static("loadMaps", &House::loadMaps, "fname"_a)
+    .def("genObstacleMap", &House::genObstacleMap,
+        "obs"_a, "level"_a, "walls"_a, "doors"_a, "objects"_a)
+    .def("genMovableMap", &House::genMovableMap,
+        "obs"_a, "move"_a, "x1"_a, "y1"_a, "x2"_a, "y2"_a)
+    .def("adjustApproximateRobotMoveMap", &House::adjustApproximateRobotMoveMap,
+        "move"_a, "grid_radius"_a)
+    .def("check_occupy", &House::check_occupy, "obs"_a, "cx"_a, "cy"_a)
+    .def("findComponents", &House::findComponents,
+        "move"_a, "x1"_a, "y1"_a, "x2"_a, "y2"_a,
+        "return_largest"_a = false, "return_open"_a = false)
+    .def("genConnMaps", &House::genConnMaps, "move"_a, "targets"_a, "retry_closed"_a)
+    .def("checkMoves", &House::checkMoves,
+        "move"_a, "conn"_a, "starts"_a, "ends"_a, "num_samples"_a)
+    .def("checkMovesExact", &House::checkMovesExact,
+        "obs"_a, "starts"_a, "ends"_a, "num_samples"_a);
+
+  py::class_<HouseSet>(m, "_HouseSet")
+    .def(py::init<const std::vector<std::string>&, const std::vector<std::string>&, int>(),
+        "obj_files"_a, "map_files"_a, "nr_threads"_a = 0)
+    .def("__len__", &HouseSet::size)
+    .def("walls", &HouseSet::walls, "i"_a, "lower_bound"_a)
+    .def("maps", &HouseSet::maps, "i"_a);
+
+  py::class_<ConnMap>(m, "_ConnMap")
+    .def(py::init<py::array_t<int32_t, py::array::c_style>,
+        py::array_t<float, py::array::c_style>, int, uint64_t>(),
+        "connMap"_a, "inroomDist"_a, "maxConnDist"_a, "move_hash"_a)
+    // a mapped ConnMap is pickled as its file, which the unpickled one maps again
+    .def(py::pickle(
+        [](const ConnMap& c) {
+          if (c.fname().size())
+            return py::make_tuple(c.fname(), c.moveHash(), py::none(), py::none());
+          py::array_t<uint16_t> dist({(ssize_t)c.size(), (ssize_t)c.size()});
+          py::array_t<float> target_dist((ssize_t)c.nr_target());
+          memcpy(dist.mutable_data(), c.dist(), dist.size() * sizeof(uint16_t));
+          memcpy(target_dist.mutable_data(), c.targetDist(), c.nr_target() * sizeof(float));
+          return py::make_tuple(c.maxConnDist(), c.moveHash(), dist, target_dist);
+        },
+        [](py::tuple t) {
+          if (t.size() != 4)
+            throw std::runtime_error("Invalid state of _ConnMap!");
+          uint64_t move_hash = t[1].cast<uint64_t>();
+          if (t[2].is_none()) {
+            auto fname = t[0].cast<std::string>();
+            auto ret = ConnMap::load(fname, move_hash);
+            if (!ret)
+              throw std::runtime_error("_ConnMap: cannot load " + fname);
+            return ret;
+          }
+          auto dist = t[2].cast<py::array_t<uint16_t, py::array::c_style>>();
+          auto target_dist = t[3].cast<py::array_t<float, py::array::c_style>>();
+          return std::unique_ptr<ConnMap>{new ConnMap{(int)dist.shape(0),
+              std::vector<uint16_t>(dist.data(), dist.data() + dist.size()),
+              std::vector<float>(target_dist.data(), target_dist.data() + target_dist.size()),
+              t[0].cast<int>(), move_hash}};
+        }))
+    .def_static("load", &ConnMap::load, "fname"_a, "move_hash"_a)
+    .def_static("hashMoveMap", &ConnMap::hashMoveMap, "move"_a)
+    .def("save", &ConnMap::save, "fname"_a)
+    .def("connMap", &ConnMap::connMap)
+    .def("inroomDist", &ConnMap::inroomDist)
+    .def("connectedCoors", &ConnMap::connectedCoors)
+    .def_property_readonly("maxConnDist", &ConnMap::maxConnDist)
+    .def_property_readonly("fname", &ConnMap::fname);
+
+  py::class_<DistanceOracle>(m, "_DistanceOracle")
+    .def(py::init<py::array_t<int8_t, py::array::c_style>, int>(),
+        "move"_a, "nr_landmarks"_a = 16)
+    // rebuilt from the movability map when unpickled
+    .def(py::pickle(
+        [](const DistanceOracle& o) {
+          return py::make_tuple(o.moveMap(), o.nr_landmarks_requested());
+        },
+        [](py::tuple t) {
+          if (t.size() != 2)
+            throw std::runtime_error("Invalid state of _DistanceOracle!");
+          return std::unique_ptr<DistanceOracle>{new DistanceOracle{
+              t[0].cast<py::array_t<int8_t, py::array::c_style>>(), t[1].cast<int>()}};
+        }))
+    .def("geodesic", &DistanceOracle::geodesic, "x1"_a, "y1"_a, "x2"_a, "y2"_a)
+    .def("geodesics", &DistanceOracle::geodesics, "starts"_a, "ends"_a)
+    .def("path", &DistanceOracle::path, "x1"_a, "y1"_a, "x2"_a, "y2"_a)
+    .def("bounds", &DistanceOracle::bounds, "x1"_a, "y1"_a, "x2"_a, "y2"_a)
+    .def("landmarks", &DistanceOracle::landmarks)
+    .def("moveMap", &DistanceOracle::moveMap);
+
+  py::class_<VideoWriter>(m, "VideoWriter")
+    // codec is an ffmpeg encoder, e.g. libx264, h264_nvenc or h264_vaapi
+    .def(py::init<std::string, int, int, int, std::string>(),
+        "fname"_a, "w"_a, "h"_a, "fps"_a=30, "codec"_a="libx264")
+    // queue a copy of a (h, w, 3) uint8 array
+    .def("write", [](VideoWriter& video, py::array_t<uint8_t, py::array::c_style | py::array::forcecast> arr) {
+        if (arr.ndim() != 3 || arr.shape(0) != video.height() || arr.shape(1) != video.width() ||
+            arr.shape(2) != 3)
+          throw std::invalid_argument(ssprintf(
+                "VideoWriter.write: the array must have shape (%d, %d, 3)!", video.height(), video.width()));
+        const uint8_t* src = arr.data();
+        py::gil_scoped_release release;
+        video.write(src);
+      }, "arr"_a)
+    .def("close", &VideoWriter::close, py::call_guard<py::gil_scoped_release>())
+    .def("numFrames", &VideoWriter::nr_frames)
+    .def("__enter__", [](py::object self) { return self; })
+    .def("__exit__", [](VideoWriter& video, py::object, py::object, py::object) {
+        py::gil_scoped_release release;
+        video.close();
+      })
+    ;
+
+  py::class_<ShmRing>(m, "ShmRing")
+    // create a ring, replacing any ring with the same name
+    .def(py::init<std::string, int, int, int, int>(),
+        "name"_a, "nr_slot"_a, "rows"_a, "cols"_a, "channels"_a)
+    // open a ring created by another process
+    .def(py::init<std::string>(), "name"_a)
+    // copy a (rows, cols, channels) uint8 array into the next slot
+    .def("write", [](ShmRing& ring, py::array_t<uint8_t, py::array::c_style | py::array::forcecast> arr,
+          int timeout_ms) {
+        if ((size_t)arr.size() != (size_t)ring.rows() * ring.cols() * ring.channels())
+          throw std::invalid_argument("ShmRing.write: the array must have the shape of a slot!");
+        const uint8_t* src = arr.data();
+        py::gil_scoped_release release;
+        uint8_t* slot = ring.acquire_write(timeout_ms);
+        if (!slot)
+          return false;
+        memcpy(slot, src, arr.size());
+        ring.commit_write();
+        return true;
+      }, "arr"_a, "timeout_ms"_a=-1)
+    // a (rows, cols, channels) view of the oldest frame, valid until release(),
+    // or None on timeout
+    .def("read", [](py::object self, int timeout_ms) -> py::object {
+        ShmRing& ring = self.cast<ShmRing&>();
+        const uint8_t* slot;
+        {
+          py::gil_scoped_release release;
+          slot = ring.acquire_read(timeout_ms);
+        }
+        if (!slot)
+          return py::none();
+        return py::array_t<uint8_t>(
+            {(ssize_t)ring.rows(), (ssize_t)ring.cols(), (ssize_t)ring.channels()},
+            slot, self);
+      }, "timeout_ms"_a=-1)
+    .def("release", &ShmRing::release_read)
+    .def("size", &ShmRing::size)
+    .def("capacity", &ShmRing::capacity)
+    .def("unlink", &ShmRing::unlink)
+    .def_property_readonly("name", &ShmRing::name);
+
+  py::class_<VecRoomNavConfig>(m, "VecRoomNavConfig")
+    .def(py::init<>())
+    .def_readwrite("move_sensitivity", &VecRoomNavConfig::move_sensitivity)
+    .def_readwrite("rot_sensitivity", &VecRoomNavConfig::rot_sensitivity)
+    .def_readwrite("dist_scale", &VecRoomNavConfig::dist_scale)
+    .def_readwrite("success_reward", &VecRoomNavConfig::success_reward)
+    .def_readwrite("inroom_reward", &VecRoomNavConfig::inroom_reward)
+    .def_readwrite("collision_reward", &VecRoomNavConfig::collision_reward)
+    .def_readwrite("good_move_reward", &VecRoomNavConfig::good_move_reward)
+    .def_readwrite("indicator_reward", &VecRoomNavConfig::indicator_reward)
+    .def_readwrite("time_penalty_reward", &VecRoomNavConfig::time_penalty_reward)
+    .def_readwrite("delta_reward_coef", &VecRoomNavConfig::delta_reward_coef)
+    .def_readwrite("speed_reward_coef", &VecRoomNavConfig::speed_reward_coef)
+    .def_readwrite("pixel_object_reward", &VecRoomNavConfig::pixel_object_reward)
+    .def_readwrite("reward_type", &VecRoomNavConfig::reward_type)
+    .def_readwrite("success_measure", &VecRoomNavConfig::success_measure)
+    .def_readwrite("success_stay_time_steps", &VecRoomNavConfig::success_stay_time_steps)
+    .def_readwrite("success_see_target_time_steps", &VecRoomNavConfig::success_see_target_time_steps)
+    .def_readwrite("n_pixel_for_object_see", &VecRoomNavConfig::n_pixel_for_object_see)
+    .def_readwrite("n_pixel_for_object_sense", &VecRoomNavConfig::n_pixel_for_object_sense)
+    .def_readwrite("max_steps", &VecRoomNavConfig::max_steps)
+    .def_readwrite("segment_input", &VecRoomNavConfig::segment_input)
+    .def_readwrite("joint_visual_signal", &VecRoomNavConfig::joint_visual_signal)
+    .def_readwrite("depth_signal", &VecRoomNavConfig::depth_signal)
+    .def_readwrite("collision_samples", &VecRoomNavConfig::collision_samples)
+    .def_readwrite("robot_height", &VecRoomNavConfig::robot_height)
+    .def_readwrite("discrete_actions", &VecRoomNavConfig::discrete_actions);
+
+  bind_vec_room_nav<SUNCGRenderAPI>(m, "VecRoomNav");
+  bind_vec_room_nav<SUNCGRenderAPIThread>(m, "VecRoomNavThread");
+
+  py::class_<DeviceManager::DeviceLoad>(m, "DeviceLoad")
+    .def_readonly("device", &DeviceManager::DeviceLoad::device)
+    .def_readonly("contexts", &DeviceManager::DeviceLoad::contexts)
+    .def_readonly("scenes", &DeviceManager::DeviceLoad::scenes)
+    .def_readonly("scene_bytes", &DeviceManager::DeviceLoad::scene_bytes)
+    .def_readonly("expected_scenes", &DeviceManager::DeviceLoad::expected_scenes);
+
+  m.def("numDevices", []() { return DeviceManager::get().num_devices(); },
+      "The number of devices the render APIs can use");
+  m.def("getDeviceLoad", []() { return DeviceManager::get().load(); },
+      "The contexts and activated scenes of each device, in this process");
+  m.def("pickDevice", [](const std::string& obj_file) {
+        return DeviceManager::get().pick(obj_file);
+      }, "obj_file"_a = "",
+      "The device that has obj_file activated, or else the least loaded one");
+
+  // houses: (obj_file, poses, out_dir) of each house, with poses a (n, 4)
+  // or (n, 5) array of x, y, z, yaw, [pitch]. See TrajectoryRenderer for
+  // the files written. Returns the number of images.
+  m.def("renderTrajectories", [](SUNCGRenderAPI& api,
+        const std::vector<std::tuple<std::string, floatarray, std::string>>& houses,
+        std::string model_category_file, std::string semantic_label_file,
+        std::vector<SUNCGScene::RenderMode> modes, bool cube_map,
+        const std::string& format, int nr_writers, int batch) {
+        TrajectoryRenderer::Options options;
+        options.modes = modes;
+        options.cube_map = cube_map;
+        if (format == "png")
+          options.format = TrajectoryRenderer::Format::PNG;
+        else if (format == "jpg")
+          options.format = TrajectoryRenderer::Format::JPEG;
+        else if (format == "raw")
+          options.format = TrajectoryRenderer::Format::RAW;
+        else
+          throw std::invalid_argument("renderTrajectories: format must be png, jpg or raw!");
+        options.nr_writers = nr_writers;
+        options.batch = batch;
+
+        std::vector<TrajectoryRenderer::House> hs;
+        for (auto& t : houses) {
+          TrajectoryRenderer::House h;
+          h.obj_file = std::get<0>(t);
+          h.out_dir = std::get<2>(t);
+          auto& poses = std::get<1>(t);
+          if (poses.ndim() != 2 || (poses.shape(1) != 4 && poses.shape(1) != 5))
+            throw std::invalid_argument("renderTrajectories: poses must be (n, 4) or (n, 5)!");
+          int nc = poses.shape(1);
+          const float* p = poses.data();
+          for (ssize_t i = 0; i < poses.shape(0); ++i, p += nc)
+            h.poses.push_back(TrajectoryPose{p[0], p[1], p[2], p[3], nc == 5 ? p[4] : 0.f});
+          hs.push_back(std::move(h));
+        }
+        py::gil_scoped_release release;
+        TrajectoryRenderer renderer{api, model_category_file, semantic_label_file, options};
+        return renderer.run(std::move(hs));
+      }, "api"_a, "houses"_a, "model_category_file"_a, "semantic_label_file"_a,
+      "modes"_a = std::vector<SUNCGScene::RenderMode>{SUNCGScene::RenderMode::RGB},
+      "cube_map"_a = false, "format"_a = "png", "nr_writers"_a = 4, "batch"_a = 32);
+
+  m.def("enableProfiler", &Profiler::enable, "enabled"_a = true,
+      "Record where the time of the renderer goes, on the CPU and GPU");
+  m.def("resetStats", &Profiler::reset);
+  m.def("getStats", &Profiler::stats,
+      "The zones and counters recorded since the last resetStats()");
+  m.def("saveTrace", &Profiler::save_trace, "fname"_a,
+      "Write the zones since the last resetStats() as a trace of chrome://tracing");
+  m.def("getBufferPoolStats", []() { return BufferPool::global().stats(); },
+      "The reuse of the memory of the images returned by the renderers");
+  m.attr("BUFFER_POOL_MAX_FREE_BYTES") = py::int_(BufferPool::kMaxFreeBytes);
 
   py::class_<glm::vec3>(m, "Vec3")
     .def(py::init<float, float, float>())
@@ -121,4 +878,26 @@ PYBIND11_MODULE(objrender, m) {
           {sizeof(unsigned char) * m.cols() * m.channels(),
           sizeof(unsigned char) * m.channels(), sizeof(unsigned char)});
       });
+
+  py::class_<Mat32u>(m, "MatUInt", py::buffer_protocol()).def_buffer([](Mat32u &m) -> py::buffer_info {
+      return py::buffer_info(m.ptr(),
+          sizeof(unsigned int),
+          py::format_descriptor<unsigned int>::format(),
+          3,
+          {(unsigned long)m.rows(), (unsigned long)m.cols(),
+          (unsigned long)m.channels()},
+          {sizeof(unsigned int) * m.cols() * m.channels(),
+          sizeof(unsigned int) * m.channels(), sizeof(unsigned int)});
+      });
+
+  py::class_<Mat32f>(m, "MatFloat", py::buffer_protocol()).def_buffer([](Mat32f &m) -> py::buffer_info {
+      return py::buffer_info(m.ptr(),
+          sizeof(float),
+          py::format_descriptor<float>::format(),
+          3,
+          {(unsigned long)m.rows(), (unsigned long)m.cols(),
+          (unsigned long)m.channels()},
+          {sizeof(float) * m.cols() * m.channels(),
+          sizeof(float) * m.channels(), sizeof(float)});
+      });
 }
@@ -0,0 +1,389 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "vecnav.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <pybind11/stl.h>
+
+#include "lib/strutils.hh"
+
+namespace py = pybind11;
+using namespace std;
+
+namespace {
+
+double clip(double v, double lo, double hi) { return min(max(v, lo), hi); }
+
+double sign(double v) { return (v > 0) - (v < 0); }
+
+// restores the render mode of api, also when a render throws
+template <typename API>
+struct ModeGuard {
+  ModeGuard(API& api): api{api}, mode{api.getMode()} {}
+  ~ModeGuard() { api.setMode(mode); }
+  API& api;
+  render::SUNCGScene::RenderMode mode;
+};
+
+}
+
+namespace render {
+
+using RenderMode = SUNCGScene::RenderMode;
+
+template <typename API>
+VecRoomNav<API>::VecRoomNav(API& api, const House& house, nparray<int8_t> move,
+    int num_agents, Config config):
+  api_{api}, house_{house}, config_{std::move(config)} {
+  if (move.ndim() != 2 || move.shape(0) != move.shape(1))
+    throw std::invalid_argument("move must be a square map");
+  if (num_agents <= 0)
+    throw std::invalid_argument("num_agents must be positive");
+  auto& rt = config_.reward_type;
+  if (rt != "" && rt != "none" && rt != "linear" && rt != "indicator" &&
+      rt != "delta" && rt != "speed")
+    throw std::invalid_argument(ssprintf("Unknown reward_type %s!", rt.c_str()));
+  if (config_.success_measure != "see" && config_.success_measure != "stay")
+    throw std::invalid_argument(ssprintf(
+          "Unknown success_measure %s!", config_.success_measure.c_str()));
+  if (config_.success_measure == "see" &&
+      config_.n_pixel_for_object_see <= config_.n_pixel_for_object_sense)
+    throw std::invalid_argument("n_pixel_for_object_see must be larger than n_pixel_for_object_sense");
+  if (config_.collision_samples <= 0)
+    throw std::invalid_argument("collision_samples must be positive");
+
+  n_row_ = move.shape(0) - 1;
+  move_ = move.data();
+  move_holder_ = std::move(move);
+  // the agents see through the same lens as the camera of api
+  Camera cam = *api_.getCamera();
+  cameras_.resize(num_agents, cam);
+  agents_.resize(num_agents);
+}
+
+template <typename API>
+int VecRoomNav<API>::addTarget(
+    nparray<int32_t> conn, int max_conn_dist, nparray<uint8_t> colors) {
+  if (conn.ndim() != 2 || conn.shape(0) != n_row_ + 1 || conn.shape(1) != n_row_ + 1)
+    throw std::invalid_argument("conn must have the shape of move");
+  if (colors.ndim() != 2 || colors.shape(1) != 3)
+    throw std::invalid_argument("colors must be a (k, 3) array");
+  if (max_conn_dist <= 0)
+    throw std::invalid_argument("max_conn_dist must be positive");
+  Target t;
+  t.conn = conn.data();
+  t.conn_holder = std::move(conn);
+  t.max_dist = max_conn_dist;
+  const uint8_t* c = colors.data();
+  for (ssize_t k = 0; k < colors.shape(0); ++k, c += 3)
+    t.colors.push_back({{c[0], c[1], c[2]}});
+  targets_.emplace_back(std::move(t));
+  return targets_.size() - 1;
+}
+
+template <typename API>
+void VecRoomNav<API>::resetAgent(int i, double x, double y, double yaw, int target) {
+  if (i < 0 || i >= numAgents())
+    throw std::out_of_range(ssprintf("Agent %d doesn't exist!", i));
+  if (target < 0 || target >= (int)targets_.size())
+    throw std::out_of_range(ssprintf("Target %d doesn't exist!", target));
+  Camera& cam = cameras_[i];
+  cam.pos = glm::vec3{x, config_.robot_height, y};
+  cam.yaw = yaw;
+  cam.updateDirection();
+  Agent& a = agents_[i];
+  a = Agent{};
+  a.target = target;
+  a.last_dist = dist_(targets_[target], cam.pos.x, cam.pos.z);
+  a.last_x = cam.pos.x;
+  a.last_y = cam.pos.z;
+}
+
+template <typename API>
+int VecRoomNav<API>::numChannels() const {
+  return 3 + 3 * config_.joint_visual_signal + config_.depth_signal;
+}
+
+template <typename API>
+int VecRoomNav<API>::dist_(const Target& t, double x, double y) const {
+  int gx = house_.to_grid(x, n_row_), gy = house_.to_grid(y, n_row_);
+  if (gx < 0 || gy < 0 || gx > n_row_ || gy > n_row_)
+    return -1;
+  return t.conn[(size_t)gx * (n_row_ + 1) + gy];
+}
+
+template <typename API>
+bool VecRoomNav<API>::move_agent_(int i, double fwd, double hor, double rot) {
+  Camera& cam = cameras_[i];
+  cam.yaw += rot * config_.rot_sensitivity;
+  cam.updateDirection();
+  glm::vec3 dst = cam.pos +
+    cam.front * (float)(fwd * config_.move_sensitivity) +
+    cam.right * (float)(hor * config_.move_sensitivity);
+
+  // as Environment._check_collision_fast
+  const int32_t* conn = targets_[agents_[i].target].conn;
+  double ax = cam.pos.x, ay = cam.pos.z, bx = dst.x, by = dst.z;
+  double ratio = 1.0 / config_.collision_samples;
+  for (int k = 0; k < config_.collision_samples; ++k) {
+    double x = (bx - ax) * (k + 1) * ratio + ax,
+           y = (by - ay) * (k + 1) * ratio + ay;
+    int gx = house_.to_grid(x, n_row_), gy = house_.to_grid(y, n_row_);
+    if (gx < 0 || gy < 0 || gx > n_row_ || gy > n_row_)
+      return false;
+    size_t idx = (size_t)gx * (n_row_ + 1) + gy;
+    if (move_[idx] <= 0 || conn[idx] == -1)
+      return false;
+  }
+  cam.pos.x = dst.x;
+  cam.pos.z = dst.z;
+  return true;
+}
+
+template <typename API>
+vector<RenderMode> VecRoomNav<API>::obs_modes_() const {
+  vector<RenderMode> modes;
+  if (config_.joint_visual_signal)
+    modes.push_back(RenderMode::RGB);
+  modes.push_back(config_.segment_input ? RenderMode::SEMANTIC : RenderMode::RGB);
+  if (config_.depth_signal)
+    modes.push_back(RenderMode::DEPTH);
+  return modes;
+}
+
+template <typename API>
+void VecRoomNav<API>::render_obs_(
+    const vector<Camera>& cams, uint8_t* dst, Matuc* semantic) {
+  Geometry geo = api_.resolution();
+  size_t nr_pixel = (size_t)cams.size() * geo.w * geo.h;
+  int c = numChannels(), offset = 0;
+  ModeGuard<API> guard{api_};
+  for (auto mode : obs_modes_()) {
+    api_.setMode(mode);
+    Matuc img = api_.renderBatch(cams);
+    // depth only keeps its first channel, as RoomNavTask._render_obs
+    int nc = mode == RenderMode::DEPTH ? 1 : 3, src_c = img.channels();
+    const uint8_t* src = img.ptr();
+    for (size_t p = 0; p < nr_pixel; ++p)
+      for (int k = 0; k < nc; ++k)
+        dst[p * c + offset + k] = src[p * src_c + k];
+    if (semantic && mode == RenderMode::SEMANTIC)
+      *semantic = img;
+    offset += nc;
+  }
+}
+
+template <typename API>
+int VecRoomNav<API>::count_object_pixels_(
+    const Target& t, const uint8_t* img, int nr_pixel) const {
+  int nr_color = t.colors.size();
+  vector<int> cnt(nr_color, 0);
+  for (int p = 0; p < nr_pixel; ++p, img += 3)
+    for (int k = 0; k < nr_color; ++k)
+      cnt[k] += img[0] == t.colors[k][0] && img[1] == t.colors[k][1] &&
+        img[2] == t.colors[k][2];
+  int total = 0;
+  for (int k = 0; k < nr_color; ++k) {
+    total += cnt[k];
+    if (total >= config_.n_pixel_for_object_see)
+      break;
+  }
+  return total;
+}
+
+template <typename API>
+py::array VecRoomNav<API>::observe(const vector<int>& agents) {
+  Geometry geo = api_.resolution();
+  vector<Camera> cams;
+  for (int i : agents) {
+    if (i < 0 || i >= numAgents())
+      throw std::out_of_range(ssprintf("Agent %d doesn't exist!", i));
+    cams.push_back(cameras_[i]);
+  }
+  py::array_t<uint8_t> obs({(ssize_t)cams.size(), (ssize_t)geo.h,
+      (ssize_t)geo.w, (ssize_t)numChannels()});
+  if (cams.size()) {
+    uint8_t* dst = obs.mutable_data();
+    py::gil_scoped_release release;
+    render_obs_(cams, dst, nullptr);
+  }
+  return obs;
+}
+
+template <typename API>
+py::tuple VecRoomNav<API>::step(py::array actions) {
+  ssize_t n = numAgents();
+  for (auto& a : agents_)
+    if (a.target < 0)
+      throw std::runtime_error("All agents must be reset before step()!");
+
+  vector<array<double, 3>> acts(n);
+  if (actions.dtype().kind() == 'i' || actions.dtype().kind() == 'u') {
+    auto discrete = actions.cast<nparray<int64_t>>();
+    if (discrete.ndim() != 1 || discrete.shape(0) != n)
+      throw std::invalid_argument("Discrete actions must be a (N,) array");
+    int nr_action = config_.discrete_actions.size();
+    for (ssize_t i = 0; i < n; ++i) {
+      int64_t k = discrete.data()[i];
+      if (k < 0 || k >= nr_action)
+        throw std::out_of_range(ssprintf("Unknown discrete action %ld!", (long)k));
+      acts[i] = config_.discrete_actions[k];
+    }
+  } else {
+    auto continuous = actions.cast<nparray<double>>();
+    if (continuous.ndim() != 2 || continuous.shape(0) != n || continuous.shape(1) != 3)
+      throw std::invalid_argument("Continuous actions must be a (N, 3) array");
+    const double* p = continuous.data();
+    for (ssize_t i = 0; i < n; ++i, p += 3)
+      acts[i] = {{p[0], p[1], p[2]}};
+  }
+
+  Geometry geo = api_.resolution();
+  py::array_t<uint8_t> obs({n, (ssize_t)geo.h, (ssize_t)geo.w, (ssize_t)numChannels()});
+  py::array_t<double> reward(n), scaled_dist(n), yaw(n), loc({n, (ssize_t)2});
+  py::array_t<bool> done(n), collision(n);
+  py::array_t<int32_t> dist(n), optsteps(n);
+  uint8_t* obs_ptr = obs.mutable_data();
+  double *reward_ptr = reward.mutable_data(), *scaled_ptr = scaled_dist.mutable_data(),
+         *yaw_ptr = yaw.mutable_data(), *loc_ptr = loc.mutable_data();
+  bool *done_ptr = done.mutable_data(), *collision_ptr = collision.mutable_data();
+  int32_t *dist_ptr = dist.mutable_data(), *optsteps_ptr = optsteps.mutable_data();
+
+  {
+    py::gil_scoped_release release;
+    const Config& cfg = config_;
+    bool see = cfg.success_measure == "see";
+    int nr_pixel = geo.w * geo.h;
+    for (ssize_t i = 0; i < n; ++i)
+      agents_[i].collision = !move_agent_(i, acts[i][0], acts[i][1], acts[i][2]);
+    for (ssize_t i = 0; i < n; ++i)
+      dist_ptr[i] = dist_(targets_[agents_[i].target], cameras_[i].pos.x, cameras_[i].pos.z);
+
+    // semantic images of the agents that may see their target
+    Matuc semantic;
+    vector<int> semantic_row(n, -1);
+    if (see) {
+      if (cfg.segment_input) {
+        render_obs_(cameras_, obs_ptr, &semantic);
+        for (ssize_t i = 0; i < n; ++i)
+          semantic_row[i] = i;
+      } else {
+        render_obs_(cameras_, obs_ptr, nullptr);
+        vector<Camera> cams;
+        for (ssize_t i = 0; i < n; ++i)
+          if (dist_ptr[i] <= 0) {
+            semantic_row[i] = cams.size();
+            cams.push_back(cameras_[i]);
+          }
+        if (cams.size()) {
+          ModeGuard<API> guard{api_};
+          api_.setMode(RenderMode::SEMANTIC);
+          semantic = api_.renderBatch(cams);
+        }
+      }
+    } else {
+      render_obs_(cameras_, obs_ptr, nullptr);
+    }
+
+    double ratio = cfg.move_sensitivity / (house_.L_det() / n_row_);
+    for (ssize_t i = 0; i < n; ++i) {
+      Agent& a = agents_[i];
+      const Target& t = targets_[a.target];
+      const Camera& cam = cameras_[i];
+      int d = dist_ptr[i], orig = a.last_dist;
+      double r = 0;
+      if (a.collision)
+        r -= cfg.collision_reward;
+      if (d < orig)
+        r += cfg.good_move_reward;
+      if (d == 0)
+        r += cfg.inroom_reward;
+      double scaled = d < 0 ? d : (double)d / t.max_dist;
+
+      // as RoomNavTask._is_success
+      bool success;
+      if (d > 0) {
+        a.stay_cnt = 0;
+        success = false;
+      } else if (!see) {
+        success = ++a.stay_cnt >= cfg.success_stay_time_steps;
+      } else {
+        const uint8_t* img = semantic.ptr(semantic_row[i] * geo.h);
+        if (semantic.channels() != 3)
+          throw std::runtime_error("Semantic images must have 3 channels!");
+        a.object_cnt = count_object_pixels_(t, img, nr_pixel);
+        if (a.object_cnt >= cfg.n_pixel_for_object_see)
+          a.stay_cnt++;
+        else
+          a.stay_cnt = 0;
+        success = a.stay_cnt >= cfg.success_see_target_time_steps;
+      }
+      bool is_done = false;
+      if (success) {
+        r += cfg.success_reward;
+        is_done = true;
+      }
+      a.steps++;
+      if (cfg.max_steps > 0 && a.steps >= cfg.max_steps)
+        is_done = true;
+
+      // reward shaping
+      auto& rt = cfg.reward_type;
+      if (rt == "linear") {
+        r -= scaled * cfg.dist_scale;
+      } else if (rt == "indicator") {
+        if (d != orig)
+          r += d < orig ? cfg.indicator_reward : -cfg.indicator_reward;
+        if (d >= orig) r -= cfg.time_penalty_reward;
+      } else if (rt == "delta") {
+        double delta = (orig - d) / ratio * cfg.delta_reward_coef;
+        r += clip(delta, -cfg.indicator_reward, cfg.indicator_reward);
+        if (d >= orig) r -= cfg.time_penalty_reward;
+      } else if (rt == "speed") {
+        double movement = hypot(a.last_x - cam.pos.x, a.last_y - cam.pos.z);
+        double det = movement * sign(orig - d) * cfg.speed_reward_coef;
+        r += clip(det, -cfg.indicator_reward, cfg.indicator_reward);
+        if (d >= orig) r -= cfg.time_penalty_reward;
+      }
+
+      // object seen reward
+      if (d == 0 && see && !is_done) {
+        double range = cfg.n_pixel_for_object_see - cfg.n_pixel_for_object_sense;
+        r += clip((a.object_cnt - cfg.n_pixel_for_object_sense) / range, 0., 1.) *
+          cfg.pixel_object_reward;
+      }
+
+      reward_ptr[i] = r;
+      done_ptr[i] = is_done;
+      collision_ptr[i] = a.collision;
+      scaled_ptr[i] = scaled;
+      optsteps_ptr[i] = (int)(d / ratio + 0.5);
+      yaw_ptr[i] = cam.yaw;
+      loc_ptr[2 * i] = cam.pos.x;
+      loc_ptr[2 * i + 1] = cam.pos.z;
+      a.last_dist = d;
+      a.last_x = cam.pos.x;
+      a.last_y = cam.pos.z;
+    }
+  }
+
+  py::dict info;
+  info["dist"] = dist;
+  info["scaled_dist"] = scaled_dist;
+  info["optsteps"] = optsteps;
+  info["collision"] = collision;
+  info["loc"] = loc;
+  info["yaw"] = yaw;
+  return py::make_tuple(obs, reward, done, info);
+}
+
+template class VecRoomNav<SUNCGRenderAPI>;
+template class VecRoomNav<SUNCGRenderAPIThread>;
+
+}
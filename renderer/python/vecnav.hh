@@ -0,0 +1,136 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <pybind11/numpy.h>
+
+#include "suncg/render.hh"
+#include "house.hh"
+
+
+namespace render {
+
+// The settings of RoomNavTask. The defaults are those of roomnav.py.
+struct VecRoomNavConfig {
+  double move_sensitivity = 0.5, rot_sensitivity = 30;
+  double dist_scale = 1;
+  double success_reward = 10, inroom_reward = 0.1,
+         collision_reward = 0.3, good_move_reward = 0;
+  double indicator_reward = 0.5, time_penalty_reward = 0.1;
+  double delta_reward_coef = 0.5, speed_reward_coef = 1;
+  double pixel_object_reward = 0.4;
+  std::string reward_type = "delta";    // none, linear, indicator, delta or speed
+  std::string success_measure = "see";  // see or stay
+  int success_stay_time_steps = 5, success_see_target_time_steps = 2;
+  int n_pixel_for_object_see = 450, n_pixel_for_object_sense = 50;
+  int max_steps = -1;
+  bool segment_input = true, joint_visual_signal = false, depth_signal = true;
+  int collision_samples = 10;     // as FAST_COLLISION_CHECK_SAMPLES in core.py
+  double robot_height = 1.0;
+  // (fwd, hor, rot) of each discrete action
+  std::vector<std::array<double, 3>> discrete_actions;
+};
+
+// N agents of the RoomNav task in the same house, stepped at once as
+// RoomNavTask.step in roomnav.py: actions, collisions, observations and
+// rewards of all agents are computed here, and each render mode is drawn
+// with a single renderBatch() of all the cameras.
+//
+// Targets (a connMap of the house and the colors of the objects to see) are
+// registered by addTarget(). Episodes are started from python by
+// resetAgent(), e.g. when step() says they are done.
+//
+// Maps follow the conventions of House in house.hh.
+// API is SUNCGRenderAPI or SUNCGRenderAPIThread, which must outlive this.
+template <typename API>
+class VecRoomNav {
+  template <typename T>
+  using nparray = pybind11::array_t<T, pybind11::array::c_style | pybind11::array::forcecast>;
+
+  public:
+    using Config = VecRoomNavConfig;
+
+    // move: the moveMap of house
+    VecRoomNav(API& api, const House& house, nparray<int8_t> move,
+        int num_agents, Config config);
+
+    // Register a target and return its id.
+    // conn, max_conn_dist: connMap and maxConnDist of the target room type.
+    // colors: (k, 3) uint8 array of the object colors whose pixels in the
+    //  semantic image count as seeing the target.
+    int addTarget(nparray<int32_t> conn, int max_conn_dist, nparray<uint8_t> colors);
+
+    // Start a new episode of agent i at (x, y) in meters, towards target.
+    void resetAgent(int i, double x, double y, double yaw, int target);
+
+    // Step all agents. actions is either a (N,) int array of discrete
+    // actions, or a (N, 3) array of (fwd, hor, rot) in [-1, 1].
+    // Returns (obs, reward, done, info), where obs is a (N, h, w, c) uint8
+    // array, and info a dict of (N,) arrays: dist, scaled_dist, optsteps,
+    // collision, yaw, and the (N, 2) array loc.
+    pybind11::tuple step(pybind11::array actions);
+
+    // The (len(agents), h, w, c) observations of the given agents.
+    pybind11::array observe(const std::vector<int>& agents);
+
+    int numAgents() const { return cameras_.size(); }
+    int numChannels() const;
+    const Config& config() const { return config_; }
+    const Camera& getCamera(int i) const { return cameras_.at(i); }
+
+  private:
+    struct Target {
+      pybind11::object conn_holder;   // keeps conn alive
+      const int32_t* conn;
+      int max_dist;
+      std::vector<std::array<uint8_t, 3>> colors;
+    };
+
+    struct Agent {
+      int target = -1;
+      int last_dist = -1;
+      int steps = 0;
+      int stay_cnt = 0;
+      int object_cnt = 0;
+      bool collision = false;
+      double last_x = 0, last_y = 0;
+    };
+
+    API& api_;
+    House house_;
+    Config config_;
+    pybind11::object move_holder_;  // keeps move_ alive
+    const int8_t* move_;
+    int n_row_;
+    std::vector<Target> targets_;
+    std::vector<Camera> cameras_;
+    std::vector<Agent> agents_;
+
+    // connMap of the target at (x, y) in meters, or -1 outside of the map
+    int dist_(const Target& t, double x, double y) const;
+
+    // rotate and move agent i as Environment.rotate and move_forward.
+    // Returns false on collision.
+    bool move_agent_(int i, double fwd, double hor, double rot);
+
+    // the modes of an observation, in the order of their channels
+    std::vector<SUNCGScene::RenderMode> obs_modes_() const;
+
+    // render the observations of cams into dst, a (len(cams), h, w, c) array.
+    // If semantic is not null, also return the semantic images of the cams.
+    void render_obs_(const std::vector<Camera>& cams, uint8_t* dst, Matuc* semantic);
+
+    // count the pixels of the colors of t in a (h, w, 3) semantic image,
+    // stopping at n_pixel_for_object_see, as RoomNavTask._is_success
+    int count_object_pixels_(const Target& t, const uint8_t* img, int nr_pixel) const;
+};
+
+}
@@ -0,0 +1,39 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: suncg-bake.cpp
+
+// Parse SUNCG houses once, and write them in the binary format that
+// SUNCGRenderAPI::loadScene() loads without parsing.
+// Usage: ./suncg-bake.bin ModelCategoryMapping.csv colormap_coarse.csv house.obj [house.obj ...]
+// Each house.obj gets a house.bake next to it.
+
+#include <iostream>
+
+#include "lib/timer.hh"
+#include "suncg/scene.hh"
+
+using namespace render;
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0]
+      << " ModelCategoryMapping.csv colormap.csv house.obj [house.obj ...]" << endl;
+    return 1;
+  }
+  string model_category_file = argv[1], semantic_label_file = argv[2];
+
+  // parsing doesn't use OpenGL, so no context is needed
+  for (int i = 3; i < argc; ++i) {
+    string obj_file = argv[i];
+    string out = baked_scene_file(obj_file);
+    Timer timer;
+    SUNCGScene scene{obj_file, model_category_file, semantic_label_file};
+    scene.save_baked(out, obj_file, model_category_file, semantic_label_file);
+    cout << out << ": " << timer.duration() << " seconds." << endl;
+  }
+  return 0;
+}
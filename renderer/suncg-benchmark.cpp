@@ -0,0 +1,205 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: suncg-benchmark.cpp
+
+// Benchmark SUNCGRenderAPI on SUNCG houses, and print the results as JSON.
+// Usage: ./suncg-benchmark.bin [-w width] [-h height] [-d device] [-n frames] [-o out.json]
+//            ModelCategoryMapping.csv colormap_coarse.csv house.obj [house.obj ...]
+//
+// For each house, it measures:
+// 1. cold loadScene(): parse (or load the baked scene) and upload, and warm
+//    loadScene(): switch back to the scene from the scene cache, after all
+//    houses are loaded.
+// 2. the latency of render() in each mode, and of renderCubeMap(), with the
+//    camera turning between frames. The zones of the Profiler split it into
+//    drawing, GPU time and readback (capture).
+// 3. the memory of the scene cache after the house is loaded.
+// Times are in milliseconds. Compare the output of two builds to catch
+// regressions, e.g. with `make benchmark BENCHMARK_ARGS="..."`.
+
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gl/api.hh"
+#include "lib/profiler.hh"
+#include "lib/strutils.hh"
+#include "lib/timer.hh"
+#include "suncg/render.hh"
+
+using namespace render;
+using namespace std;
+
+namespace {
+
+// frames rendered before measuring a mode, to warm up shaders and caches
+constexpr int kWarmupFrames = 5;
+
+struct Mode {
+  const char* name;
+  SUNCGScene::RenderMode mode;
+};
+const Mode kModes[] = {
+  {"rgb", SUNCGScene::RenderMode::RGB},
+  {"semantic", SUNCGScene::RenderMode::SEMANTIC},
+  {"instance", SUNCGScene::RenderMode::INSTANCE},
+  {"depth", SUNCGScene::RenderMode::DEPTH},
+  {"invdepth", SUNCGScene::RenderMode::INVDEPTH},
+};
+
+string json_string(const string& s) {
+  ostringstream os;
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if ((unsigned char)c < 0x20)
+      os << ssprintf("\\u%04x", c);
+    else
+      os << c;
+  }
+  os << '"';
+  return os.str();
+}
+
+// Summary of the latencies of a function, in milliseconds, with the mean
+// time of each profiler zone during the calls.
+string measure(int nr_frames, function<void(void)> func) {
+  for (int i = 0; i < kWarmupFrames; ++i)
+    func();
+  glFinish();
+
+  vector<double> ms;
+  Profiler::reset();
+  Profiler::enable(true);
+  for (int i = 0; i < nr_frames; ++i) {
+    Timer timer;
+    func();
+    ms.push_back(timer.duration() * 1e3);
+  }
+  Profiler::enable(false);
+  auto stats = Profiler::stats();
+
+  sort(ms.begin(), ms.end());
+  double mean = 0;
+  for (double t : ms)
+    mean += t;
+  mean /= ms.size();
+  // nearest-rank percentile
+  auto pct = [&](double p) {
+    size_t k = max((size_t)ceil(p / 100. * ms.size()), (size_t)1);
+    return ms[min(k, ms.size()) - 1];
+  };
+
+  ostringstream os;
+  os << ssprintf("{\"frames\": %d, \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, "
+      "\"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f",
+      nr_frames, mean, ms.front(), pct(50), pct(90), pct(99), ms.back());
+  os << ", \"zones\": {";
+  bool first = true;
+  for (auto& z : stats.zones) {
+    os << (first ? "" : ", ") << json_string(z.name)
+      << ssprintf(": {\"count\": %ld, \"mean\": %.4f, \"self\": %.4f}",
+          (long)z.count, z.total * 1e3 / z.count, z.self * 1e3 / z.count);
+    first = false;
+  }
+  os << "}}";
+  return os.str();
+}
+
+string cache_json(const SceneCache::Stats& s) {
+  return ssprintf("{\"num_scenes\": %d, \"num_activated\": %d, "
+      "\"cpu_bytes\": %zu, \"gpu_bytes\": %zu}",
+      s.num_scenes, s.num_activated, s.cpu_bytes, s.gpu_bytes);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  int w = 120, h = 90, device = 0, nr_frames = 200;
+  string out_file;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:h:d:n:o:")) != -1) {
+    switch (opt) {
+      case 'w': w = atoi(optarg); break;
+      case 'h': h = atoi(optarg); break;
+      case 'd': device = atoi(optarg); break;
+      case 'n': nr_frames = atoi(optarg); break;
+      case 'o': out_file = optarg; break;
+      default: argc = 0;
+    }
+  }
+  if (argc - optind < 3 || w <= 0 || h <= 0 || nr_frames <= 0) {
+    cerr << "Usage: " << argv[0]
+      << " [-w width] [-h height] [-d device] [-n frames] [-o out.json]"
+      << " ModelCategoryMapping.csv colormap.csv house.obj [house.obj ...]" << endl;
+    return 1;
+  }
+  string model_category_file = argv[optind], semantic_label_file = argv[optind + 1];
+  vector<string> houses(argv + optind + 2, argv + argc);
+
+  SUNCGRenderAPI api{w, h, device};
+  vector<string> results;
+  for (auto& obj_file : houses) {
+    cerr << "Benchmarking " << obj_file << " ..." << endl;
+    ostringstream os;
+    os << "{\"house\": " << json_string(obj_file);
+
+    Timer timer;
+    api.loadScene(obj_file, model_category_file, semantic_label_file);
+    glFinish();
+    os << ssprintf(", \"cold_load\": %.4f", timer.duration() * 1e3);
+    os << ", \"scene_cache\": " << cache_json(api.getSceneCacheStats());
+
+    Camera* camera = api.getCamera();
+    float dyaw = 360.f / nr_frames;
+    os << ", \"render\": {";
+    for (auto& m : kModes) {
+      api.setMode(m.mode);
+      os << (&m == kModes ? "" : ", ") << json_string(m.name) << ": "
+        << measure(nr_frames, [&]() { camera->turn(dyaw, 0); api.render(); });
+    }
+    os << "}";
+
+    api.setMode(SUNCGScene::RenderMode::RGB);
+    os << ", \"cube_map\": "
+      << measure(nr_frames, [&]() { camera->turn(dyaw, 0); api.renderCubeMap(); });
+    results.push_back(os.str());
+  }
+
+  // all houses are in the scene cache now
+  for (size_t i = 0; i < houses.size(); ++i) {
+    Timer timer;
+    api.loadScene(houses[i], model_category_file, semantic_label_file);
+    glFinish();
+    results[i] += ssprintf(", \"warm_load\": %.4f}", timer.duration() * 1e3);
+  }
+
+  ostringstream os;
+  os << ssprintf("{\"width\": %d, \"height\": %d, \"frames\": %d, \"houses\": [\n",
+      w, h, nr_frames);
+  for (size_t i = 0; i < results.size(); ++i)
+    os << (i ? ",\n" : "") << results[i];
+  os << "\n], \"scene_cache\": " << cache_json(api.getSceneCacheStats()) << "}\n";
+
+  if (out_file.empty()) {
+    cout << os.str();
+  } else {
+    ofstream fout(out_file);
+    fout << os.str();
+    if (!fout.good()) {
+      cerr << "Cannot write " << out_file << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: suncg-trajectory.cpp
+
+// Render recorded trajectories of SUNCG houses into a dataset of images.
+// Usage: ./suncg-trajectory.bin [-w width] [-h height] [-d device] [-m rgb,semantic,...]
+//            [-c] [-f png|jpg|raw] [-j writers] [-b batch] -o out_dir
+//            ModelCategoryMapping.csv colormap_coarse.csv house.obj poses.txt [house.obj poses.txt ...]
+//
+// poses.txt has one camera pose "x y z yaw [pitch]" per line, see
+// read_trajectory(). The images of house xx/house.obj are written to
+// out_dir/xx, see TrajectoryRenderer. -c renders cube maps instead of views.
+
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lib/strutils.hh"
+#include "lib/timer.hh"
+#include "suncg/trajectory.hh"
+
+using namespace render;
+using namespace std;
+
+namespace {
+
+SUNCGScene::RenderMode parse_mode(const string& name) {
+  for (auto mode : {SUNCGScene::RenderMode::RGB, SUNCGScene::RenderMode::SEMANTIC,
+      SUNCGScene::RenderMode::INSTANCE, SUNCGScene::RenderMode::DEPTH,
+      SUNCGScene::RenderMode::INVDEPTH})
+    if (name == TrajectoryRenderer::mode_name(mode))
+      return mode;
+  error_exit(ssprintf("Unknown mode %s!", name.c_str()));
+}
+
+// "xx" of "path/xx/house.obj"
+string house_id(const string& obj_file) {
+  size_t end = obj_file.rfind('/');
+  if (end == string::npos || end == 0)
+    return "house";
+  size_t start = obj_file.rfind('/', end - 1);
+  start = start == string::npos ? 0 : start + 1;
+  return obj_file.substr(start, end - start);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  int w = 256, h = 256, device = 0;
+  string out_dir;
+  TrajectoryRenderer::Options options;
+  options.modes.clear();
+  int opt;
+  bool bad = false;
+  while ((opt = getopt(argc, argv, "w:h:d:m:cf:j:b:o:")) != -1) {
+    switch (opt) {
+      case 'w': w = atoi(optarg); break;
+      case 'h': h = atoi(optarg); break;
+      case 'd': device = atoi(optarg); break;
+      case 'm':
+        for (auto& name : strsplit(optarg, ","))
+          options.modes.push_back(parse_mode(name));
+        break;
+      case 'c': options.cube_map = true; break;
+      case 'f':
+        if (string(optarg) == "png")
+          options.format = TrajectoryRenderer::Format::PNG;
+        else if (string(optarg) == "jpg")
+          options.format = TrajectoryRenderer::Format::JPEG;
+        else if (string(optarg) == "raw")
+          options.format = TrajectoryRenderer::Format::RAW;
+        else
+          bad = true;
+        break;
+      case 'j': options.nr_writers = atoi(optarg); break;
+      case 'b': options.batch = atoi(optarg); break;
+      case 'o': out_dir = optarg; break;
+      default: bad = true;
+    }
+  }
+  int nr_args = argc - optind;
+  if (bad || out_dir.empty() || nr_args < 4 || nr_args % 2 != 0 || w <= 0 || h <= 0) {
+    cerr << "Usage: " << argv[0]
+      << " [-w width] [-h height] [-d device] [-m rgb,semantic,instance,depth,invdepth]"
+      << " [-c] [-f png|jpg|raw] [-j writers] [-b batch] -o out_dir"
+      << " ModelCategoryMapping.csv colormap.csv house.obj poses.txt [house.obj poses.txt ...]" << endl;
+    return 1;
+  }
+  if (options.modes.empty())
+    options.modes.push_back(SUNCGScene::RenderMode::RGB);
+  string model_category_file = argv[optind], semantic_label_file = argv[optind + 1];
+
+  vector<TrajectoryRenderer::House> houses;
+  size_t nr_poses = 0;
+  try {
+    for (int i = optind + 2; i < argc; i += 2) {
+      TrajectoryRenderer::House house;
+      house.obj_file = argv[i];
+      house.poses = read_trajectory(argv[i + 1]);
+      house.out_dir = out_dir + "/" + house_id(house.obj_file);
+      nr_poses += house.poses.size();
+      houses.push_back(move(house));
+    }
+
+    SUNCGRenderAPI api{w, h, device};
+    // each house is loaded once, so keep no other scene
+    api.setSceneCacheBudget(0, 0);
+    Timer timer;
+    size_t nr_images;
+    {
+      TrajectoryRenderer renderer{api, model_category_file, semantic_label_file, options};
+      nr_images = renderer.run(move(houses));
+    }
+    cout << "Wrote " << nr_images << " images of " << nr_poses << " poses in "
+      << timer.duration() << " seconds." << endl;
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,324 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: baked.cc
+
+// A binary format of a parsed SUNCGScene. All integers are 32 bits, in host
+// byte order, and strings are a uint32 length followed by the bytes.
+//
+//  char[8] magic "H3DBAKE", uint32 version
+//  FileStamp of the obj, its mtl, the model category file and the
+//    semantic label file, which the scene was parsed from
+//  vec3 boxmin, boxmax, background color
+//  uint32 nr_mesh, then for each mesh:
+//    MeshRecord, string diffuse texture name
+//  uint32 nr_vertex, Vertex[nr_vertex]
+//  uint32 nr_index, uint32[nr_index]
+//  int32[nr_mesh + 1] first index of each mesh
+//  int32[nr_mesh + 1] first vertex of each mesh
+//  uint32 nr_instance, then for each instance:
+//    int32 instance color key, string shape name
+//
+// A FileStamp is a string basename, then int64 size and int64 mtime in
+// seconds, both -1 if the file does not exist. A baked file whose stamps
+// differ from the files of load_baked() is stale, and not loaded.
+//
+// Texture names are relative to the obj file, so the baked file must be in
+// the same directory as the obj it was made from.
+
+#include "scene.hh"
+
+#include <fstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const char kMagic[8] = "H3DBAKE";
+const uint32_t kVersion = 2;
+
+struct MeshRecord {
+  float Kd[3], Ka[3], dissolve;
+  float label_color[3], instance_color[3];
+};
+
+string basename(const string& path) {
+  auto pos = path.find_last_of("/\\");
+  return pos == string::npos ? path : path.substr(pos + 1);
+}
+
+string dirname_with_slash(const string& path) {
+  auto pos = path.find_last_of("/\\");
+  return pos == string::npos ? "./" : path.substr(0, pos + 1);
+}
+
+// Identifies the version of a source file of a baked scene.
+struct FileStamp {
+  string name;
+  int64_t size = -1, mtime = -1;
+
+  explicit FileStamp(const string& path = ""): name{basename(path)} {
+    struct stat st;
+    if (!path.empty() && stat(path.c_str(), &st) == 0) {
+      size = st.st_size;
+      mtime = st.st_mtime;
+    }
+  }
+
+  bool operator == (const FileStamp& r) const {
+    return name == r.name && size == r.size && mtime == r.mtime;
+  }
+};
+
+// The files a scene of obj_file is parsed from. The mtl is assumed to be
+// next to the obj, with the same name, as in SUNCG.
+vector<FileStamp> source_stamps(const string& obj_file,
+    const string& model_category_file, const string& semantic_label_file) {
+  auto dot = obj_file.find_last_of('.');
+  string mtl_file = obj_file.substr(0, dot == string::npos ? obj_file.size() : dot) + ".mtl";
+  return {FileStamp{obj_file}, FileStamp{mtl_file},
+    FileStamp{model_category_file}, FileStamp{semantic_label_file}};
+}
+
+class Writer {
+  public:
+    explicit Writer(const string& fname): os_{fname, ios::binary} {
+      if (!os_)
+        error_exit(ssprintf("Cannot open %s for writing!", fname.c_str()));
+    }
+
+    template <typename T>
+    void write(const T& v) { write(&v, 1); }
+
+    template <typename T>
+    void write(const T* v, size_t n) {
+      os_.write(reinterpret_cast<const char*>(v), sizeof(T) * n);
+    }
+
+    void write_string(const string& s) {
+      write((uint32_t)s.size());
+      write(s.data(), s.size());
+    }
+
+    void write_stamp(const FileStamp& f) {
+      write_string(f.name);
+      write(f.size);
+      write(f.mtime);
+    }
+
+    bool good() const { return os_.good(); }
+
+  private:
+    ofstream os_;
+};
+
+// Reads a memory-mapped file. Every read fails once the end is passed.
+class Reader {
+  public:
+    explicit Reader(const string& fname) {
+      int fd = open(fname.c_str(), O_RDONLY);
+      if (fd < 0)
+        return;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+          data_ = static_cast<const char*>(ptr);
+          size_ = st.st_size;
+          madvise(ptr, size_, MADV_SEQUENTIAL);
+        }
+      }
+      close(fd);
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator = (const Reader&) = delete;
+
+    ~Reader() {
+      if (data_)
+        munmap(const_cast<char*>(data_), size_);
+    }
+
+    template <typename T>
+    bool read(T& v) { return read(&v, 1); }
+
+    template <typename T>
+    bool read(T* v, size_t n) {
+      if (!data_ || n > (size_ - pos_) / sizeof(T))
+        return false;
+      memcpy(v, data_ + pos_, sizeof(T) * n);
+      pos_ += sizeof(T) * n;
+      return true;
+    }
+
+    template <typename T>
+    bool read_vector(vector<T>& v, size_t n) {
+      if (!data_ || n > (size_ - pos_) / sizeof(T))
+        return false;
+      v.resize(n);
+      return read(v.data(), n);
+    }
+
+    bool read_string(string& s) {
+      uint32_t len;
+      if (!read(len) || len > size_ - pos_)
+        return false;
+      s.assign(data_ + pos_, len);
+      pos_ += len;
+      return true;
+    }
+
+    bool read_stamp(FileStamp& f) {
+      return read_string(f.name) && read(f.size) && read(f.mtime);
+    }
+
+  private:
+    const char* data_ = nullptr;
+    size_t size_ = 0, pos_ = 0;
+};
+
+} // namespace
+
+namespace render {
+
+struct SUNCGScene::Baked {
+  ObjLoader obj;    // only contains base_dir and one material per mesh
+  glm::vec3 boxmin, boxmax, background_color;
+  MeshBatch mesh;
+  vector<glm::vec3> label_colors, instance_colors;
+  unordered_map<int, string> instance_color_to_name;
+};
+
+void SUNCGScene::save_baked(const string& fname, const string& obj_file,
+    const string& model_category_file, const string& semantic_label_file) const {
+  Writer w{fname};
+  w.write(kMagic, sizeof(kMagic));
+  w.write(kVersion);
+  for (auto& f : source_stamps(obj_file, model_category_file, semantic_label_file))
+    w.write_stamp(f);
+  w.write(boxmin_);
+  w.write(boxmax_);
+  w.write(background_color_);
+
+  w.write((uint32_t)materials_.size());
+  for (auto& material : materials_) {
+    MeshRecord rec;
+    memcpy(rec.Kd, material.m->diffuse, sizeof(rec.Kd));
+    memcpy(rec.Ka, material.m->ambient, sizeof(rec.Ka));
+    rec.dissolve = material.m->dissolve;
+    memcpy(rec.label_color, &material.label_color, sizeof(rec.label_color));
+    memcpy(rec.instance_color, &material.instance_color, sizeof(rec.instance_color));
+    w.write(rec);
+    w.write_string(material.m->diffuse_texname);
+  }
+
+  auto& vertices = mesh_.vertices();
+  auto& indices = mesh_.indices();
+  w.write((uint32_t)vertices.size());
+  w.write(vertices.data(), vertices.size());
+  w.write((uint32_t)indices.size());
+  w.write(indices.data(), indices.size());
+  w.write(mesh_.first_indices().data(), mesh_.first_indices().size());
+  w.write(mesh_.first_vertices().data(), mesh_.first_vertices().size());
+
+  w.write((uint32_t)instance_color_to_name_.size());
+  for (auto& pair : instance_color_to_name_) {
+    w.write((int32_t)pair.first);
+    w.write_string(pair.second);
+  }
+  if (!w.good())
+    error_exit(ssprintf("Failed to write %s!", fname.c_str()));
+}
+
+SUNCGScene* SUNCGScene::load_baked(
+    const string& fname, const string& obj_file,
+    const string& model_category_file, const string& semantic_label_file,
+    float minDepth, MeshBatch::VertexLayout layout) {
+  Reader r{fname};
+  char magic[sizeof(kMagic)];
+  uint32_t version;
+  if (!r.read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !r.read(version) || version != kVersion)
+    return nullptr;
+  for (auto& f : source_stamps(obj_file, model_category_file, semantic_label_file)) {
+    FileStamp baked_from;
+    if (!r.read_stamp(baked_from))
+      return nullptr;
+    if (!(baked_from == f)) {
+      print_debug("%s is stale: %s has changed since it was baked\n",
+          fname.c_str(), f.name.c_str());
+      return nullptr;
+    }
+  }
+
+  Baked baked;
+  baked.obj.base_dir = dirname_with_slash(fname);
+  uint32_t nr_mesh, nr_vertex, nr_index, nr_instance;
+  if (!r.read(baked.boxmin) || !r.read(baked.boxmax) ||
+      !r.read(baked.background_color) || !r.read(nr_mesh))
+    return nullptr;
+
+  auto& materials = baked.obj.materials;
+  for (uint32_t i = 0; i < nr_mesh; ++i) {
+    MeshRecord rec;
+    tinyobj::material_t m;
+    if (!r.read(rec) || !r.read_string(m.diffuse_texname))
+      return nullptr;
+    memcpy(m.diffuse, rec.Kd, sizeof(rec.Kd));
+    memcpy(m.ambient, rec.Ka, sizeof(rec.Ka));
+    m.dissolve = rec.dissolve;
+    materials.emplace_back(move(m));
+    baked.label_colors.emplace_back(rec.label_color[0], rec.label_color[1], rec.label_color[2]);
+    baked.instance_colors.emplace_back(rec.instance_color[0], rec.instance_color[1], rec.instance_color[2]);
+  }
+
+  vector<Vertex> vertices;
+  vector<GLuint> indices;
+  vector<GLint> first_indices, first_vertices;
+  if (!r.read(nr_vertex) || !r.read_vector(vertices, nr_vertex) ||
+      !r.read(nr_index) || !r.read_vector(indices, nr_index) ||
+      !r.read_vector(first_indices, nr_mesh + 1) ||
+      !r.read_vector(first_vertices, nr_mesh + 1))
+    return nullptr;
+  if (!baked.mesh.assign(move(vertices), move(indices),
+        move(first_indices), move(first_vertices)))
+    return nullptr;
+
+  if (!r.read(nr_instance))
+    return nullptr;
+  for (uint32_t i = 0; i < nr_instance; ++i) {
+    int32_t key;
+    string name;
+    if (!r.read(key) || !r.read_string(name))
+      return nullptr;
+    baked.instance_color_to_name.emplace(key, move(name));
+  }
+  return new SUNCGScene{move(baked), minDepth, layout};
+}
+
+SUNCGScene::SUNCGScene(Baked&& baked, float minDepth, MeshBatch::VertexLayout layout):
+  ObjSceneBase{move(baked.obj)},
+  textures_{obj_.materials, obj_.base_dir},
+  mesh_{move(baked.mesh)},
+  minDepth_{minDepth},
+  instance_color_to_name_{move(baked.instance_color_to_name)}
+{
+    background_color_ = baked.background_color;
+    boxmin_ = baked.boxmin;
+    boxmax_ = baked.boxmax;
+    int nr_mesh = obj_.materials.size();
+    for (int i = 0; i < nr_mesh; ++i)
+      materials_.emplace_back(MaterialDesc{
+          i, baked.label_colors[i], baked.instance_colors[i], 0UL, &obj_.materials[i]});
+    build_bvh_();
+    build_instance_ids_();
+    mesh_.set_layout(layout);
+}
+
+} // namespace render
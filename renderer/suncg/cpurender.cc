@@ -0,0 +1,237 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: cpurender.cc
+
+#include "cpurender.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/component_wise.hpp>
+
+#include "render.hh"
+
+using namespace std;
+
+namespace {
+
+// must match DEPTH_SCALE of the shaders in scene.cc
+const float kDepthScale = 20.f;
+
+// a color in [0, 1] as stored in a GL_RGBA8 framebuffer
+inline uint8_t to_byte(float c) {
+  return (uint8_t)lround(min(max(c, 0.f), 1.f) * 255.f);
+}
+
+}
+
+namespace render {
+
+SUNCGCPURenderAPI::SUNCGCPURenderAPI(int w, int h, int nr_threads): geo_{w, h} {
+  if (nr_threads <= 0)
+    nr_threads = max(1u, thread::hardware_concurrency());
+  for (int i = 1; i < nr_threads; ++i)
+    workers_.emplace_back(new ExecutorInThread);
+}
+
+void SUNCGCPURenderAPI::loadScene(
+    string obj_file, string model_category_file, string semantic_label_file) {
+  if (!scene_ || obj_file != obj_file_) {
+    scene_.reset();
+    // same as SUNCGRenderAPI::parse_scene_()
+    SUNCGScene* scene = SUNCGScene::load_baked(baked_scene_file(obj_file),
+        obj_file, model_category_file, semantic_label_file, 0.3f);
+    if (!scene)
+      scene = new SUNCGScene{obj_file, model_category_file, semantic_label_file, 0.3f};
+    scene_.reset(scene);
+    scene_->build_ray_index();
+    obj_file_ = move(obj_file);
+  }
+  // the initial camera of SUNCGRenderAPI::init_camera_()
+  auto range = scene_->get_range();
+  auto mid = scene_->get_min() + range * 0.5f;
+  mid.z += glm::compMax(range);
+  camera_.reset(new Camera{mid});
+}
+
+void SUNCGCPURenderAPI::parallel_for_(int n, int grain, const function<void(int, int)>& f) {
+  atomic<int> next{0};
+  auto work = [&]() {
+    while (true) {
+      int begin = next.fetch_add(grain);
+      if (begin >= n)
+        return;
+      f(begin, min(begin + grain, n));
+    }
+  };
+  int nr_helper = min<int>(workers_.size(), (n + grain - 1) / grain - 1);
+  vector<future<void>> done;
+  for (int i = 0; i < nr_helper; ++i) {
+    auto task = make_shared<packaged_task<void()>>(work);
+    done.emplace_back(task->get_future());
+    workers_[i]->execute_async([task]() { (*task)(); });
+  }
+  work();
+  for (auto& d : done)
+    d.get();
+}
+
+vector<SUNCGScene::RayHit> SUNCGCPURenderAPI::cast_pixels_() {
+  int w = geo_.w, h = geo_.h;
+  const Camera& cam = *camera_;
+  // the basis of glm::lookAt() in Camera::getView()
+  glm::vec3 front = glm::normalize(cam.front);
+  glm::vec3 right = glm::normalize(glm::cross(front, cam.up));
+  glm::vec3 up = glm::cross(right, front);
+  float tan_y = tan(glm::radians(cam.vertical_fov) * 0.5f);
+  float tan_x = tan_y * w / h;
+
+  vector<SUNCGScene::RayHit> ret(w * h);
+  parallel_for_(h, 1, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      float sy = (1.f - 2.f * (y + 0.5f) / h) * tan_y;
+      for (int x = 0; x < w; ++x) {
+        float sx = (2.f * (x + 0.5f) / w - 1.f) * tan_x;
+        glm::vec3 dir = front + sx * right + sy * up;
+        // the depth of a point along dir is its distance times cosine
+        float cosine = 1.f / glm::length(dir);
+        dir *= cosine;
+        // start at the near plane, so the geometry before it is clipped
+        float t0 = cam.near / cosine;
+        auto hit = scene_->cast_ray(cam.pos + dir * t0, dir, cam.far / cosine - t0, false);
+        if (hit.mesh >= 0)
+          hit.distance = (hit.distance + t0) * cosine;
+        ret[y * w + x] = hit;
+      }
+    }
+  });
+  return ret;
+}
+
+int SUNCGCPURenderAPI::numChannels() const {
+  return SUNCGRenderAPI::channelsOf(mode_);
+}
+
+Matuc SUNCGCPURenderAPI::render() {
+  Matuc ret = Matuc::pooled(geo_.h, geo_.w, numChannels());
+  renderInto(ret.ptr());
+  return ret;
+}
+
+void SUNCGCPURenderAPI::renderInto(unsigned char* dst) {
+  if (mode_ == SUNCGScene::RenderMode::RGB)
+    throw invalid_argument("CPURenderAPI: RGB mode is only rendered with OpenGL!");
+  auto hits = cast_pixels_();
+  const glm::vec3& bg = scene_->get_background_color();
+  uint8_t background[3] = {to_byte(bg.x), to_byte(bg.y), to_byte(bg.z)};
+  float min_depth = scene_->get_min_depth();
+  int c = numChannels();
+  for (size_t i = 0; i < hits.size(); ++i) {
+    auto& hit = hits[i];
+    uint8_t* p = dst + i * c;
+    switch (mode_) {
+      case SUNCGScene::RenderMode::DEPTH:
+        // packed like ResolvePass::Packing::DEPTH_MASK
+        if (hit.mesh >= 0) {
+          p[0] = to_byte(hit.distance / kDepthScale);
+          p[1] = 0;
+        } else if (background[0] == background[1] && background[1] == background[2]) {
+          p[0] = background[0];
+          p[1] = 0;
+        } else {
+          p[0] = 0;
+          p[1] = 255;
+        }
+        break;
+      case SUNCGScene::RenderMode::INVDEPTH:
+        if (hit.mesh >= 0) {
+          // as InverseDepthColor() of the shader
+          float f = 65535.f * min_depth / hit.distance + 0.5f;
+          float ms = floor(f / 256.f);
+          float ls = floor(f - ms * 256.f);
+          p[0] = to_byte(ms / 255.f);
+          p[1] = to_byte(ls / 255.f);
+          p[2] = 0;
+        } else {
+          memcpy(p, background, 3);
+        }
+        break;
+      case SUNCGScene::RenderMode::SEMANTIC:
+      case SUNCGScene::RenderMode::INSTANCE:
+        if (hit.mesh >= 0) {
+          const glm::vec3& color = mode_ == SUNCGScene::RenderMode::SEMANTIC ?
+            scene_->get_label_color(hit.mesh) : scene_->get_instance_color(hit.mesh);
+          p[0] = to_byte(color.x);
+          p[1] = to_byte(color.y);
+          p[2] = to_byte(color.z);
+        } else {
+          memcpy(p, background, 3);
+        }
+        break;
+      default:
+        throw runtime_error("unknown render mode");
+    }
+  }
+}
+
+Mat32f SUNCGCPURenderAPI::renderDepth() {
+  auto hits = cast_pixels_();
+  Mat32f ret = Mat32f::pooled(geo_.h, geo_.w, 1);
+  float* p = ret.ptr();
+  for (size_t i = 0; i < hits.size(); ++i)
+    p[i] = hits[i].mesh >= 0 ? hits[i].distance : numeric_limits<float>::infinity();
+  return ret;
+}
+
+Mat32u SUNCGCPURenderAPI::renderInstanceIds() {
+  auto hits = cast_pixels_();
+  Mat32u ret = Mat32u::pooled(geo_.h, geo_.w, 1);
+  unsigned int* p = ret.ptr();
+  for (size_t i = 0; i < hits.size(); ++i)
+    p[i] = hits[i].instance;
+  return ret;
+}
+
+vector<int> SUNCGCPURenderAPI::countInstancePixels() {
+  auto hits = cast_pixels_();
+  vector<int> ret(scene_->get_instance_names().size(), 0);
+  for (auto& hit : hits)
+    ret[hit.instance]++;
+  return ret;
+}
+
+vector<float> SUNCGCPURenderAPI::lidarScan(int nr_beams, float fov, float max_range) {
+  if (nr_beams <= 0)
+    throw invalid_argument("lidarScan: nr_beams must be positive!");
+  const Camera& cam = *camera_;
+  glm::vec3 heading{cam.front.x, 0.f, cam.front.z};
+  if (glm::length(heading) < 1e-6f)   // looking straight up or down
+    heading = glm::vec3{cos(glm::radians(cam.yaw)), 0.f, sin(glm::radians(cam.yaw))};
+  heading = glm::normalize(heading);
+  glm::vec3 right = glm::normalize(glm::cross(heading, WORLD_UP));
+
+  vector<float> ret(nr_beams);
+  parallel_for_(nr_beams, 64, [&](int begin, int end) {
+    for (int k = begin; k < end; ++k) {
+      float a = glm::radians(fov * ((k + 0.5f) / nr_beams - 0.5f));
+      glm::vec3 dir = cos(a) * heading + sin(a) * right;
+      ret[k] = scene_->cast_ray(cam.pos, dir, max_range, true).distance;
+    }
+  });
+  return ret;
+}
+
+void SUNCGCPURenderAPI::printContextInfo() const {
+  printf("CPU ray casting with %d threads\n", numThreads());
+}
+
+}
@@ -0,0 +1,115 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: cpurender.hh
+
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <glm/glm.hpp>
+
+#include "scene.hh"
+#include "gl/camera.hh"
+#include "lib/mat.h"
+#include "lib/executor.hh"
+
+namespace render {
+
+// Renders SUNCG scenes by casting one ray per pixel against the triangles
+// of the scene (see TriangleBVH), for machines without a GPU. It creates no
+// OpenGL context, and has the methods of SUNCGRenderAPI used by Environment.
+//
+// The DEPTH, INVDEPTH, SEMANTIC and INSTANCE modes give the images of
+// SUNCGRenderAPI::render(), up to the pixels on the edges of triangles.
+// Like OpenGL, the back of triangles, and what's nearer than Camera::near or
+// further than Camera::far, are not drawn. RGB mode needs the textures and
+// is not supported.
+//
+// The rows of an image are cast in parallel, by the calling thread and
+// nr_threads - 1 worker threads.
+class SUNCGCPURenderAPI {
+  public:
+    // nr_threads: 0 for the number of cores
+    SUNCGCPURenderAPI(int w, int h, int nr_threads = 0);
+
+    // Load the scene, replacing the current one. See SUNCGRenderAPI::loadScene().
+    void loadScene(
+        std::string obj_file, std::string model_category_file,
+        std::string semantic_label_file);
+
+    // Does nothing: the scene is parsed by loadScene(). It is here so
+    // Environment can use this class in place of SUNCGRenderAPI.
+    void prefetchScene(std::string, std::string, std::string) {}
+
+    void setMode(SUNCGScene::RenderMode m) { mode_ = m; }
+    SUNCGScene::RenderMode getMode() const { return mode_; }
+
+    // See SUNCGRenderAPI::render(). Throws std::invalid_argument in RGB mode.
+    Matuc render();
+    void renderInto(unsigned char* dst);
+    int numChannels() const;
+
+    // See SUNCGRenderAPI::renderDepth(), renderInstanceIds() and
+    // countInstancePixels().
+    Mat32f renderDepth();
+    Mat32u renderInstanceIds();
+    std::vector<int> countInstancePixels();
+
+    std::vector<std::string> getInstanceNames() const { return scene_->get_instance_names(); }
+    std::string getNameFromInstanceColor(int r, int g, int b) const {
+      return scene_->get_name_from_instance_color(r, g, b);
+    }
+
+    // The ranges in meters seen by a 2D lidar at the camera, scanning
+    // horizontally over fov degrees centered on the camera's heading.
+    // Beam k is at -fov / 2 + fov * (k + 0.5) / nr_beams degrees to the
+    // right of the heading, regardless of the pitch of the camera. Both
+    // sides of the triangles are hit. Nothing hit within max_range is +inf.
+    std::vector<float> lidarScan(int nr_beams, float fov = 360.f,
+        float max_range = std::numeric_limits<float>::infinity());
+
+    // See SUNCGRenderAPI::raycast() and queryAABB().
+    std::vector<SUNCGScene::RayHit> raycast(const std::vector<glm::vec3>& origins,
+        const std::vector<glm::vec3>& dirs) {
+      return scene_->raycast(origins, dirs);
+    }
+    std::vector<int> queryAABB(const AABB& box) { return scene_->query_aabb(box); }
+
+    // Does nothing: there's nothing to cull when casting rays. See
+    // SUNCGRenderAPI::setRooms().
+    void setRooms(const std::vector<glm::vec4>&, const std::vector<AABB>&) {}
+
+    // Get the camera. Caller doesn't own pointer. See SUNCGRenderAPI::getCamera().
+    Camera* getCamera() const { return camera_.get(); }
+
+    Geometry resolution() const { return geo_; }
+    void setResolution(int w, int h) { geo_ = Geometry{w, h}; }
+
+    int numThreads() const { return workers_.size() + 1; }
+
+    void printContextInfo() const;
+
+  private:
+    std::unique_ptr<SUNCGScene> scene_;
+    std::string obj_file_;    // of scene_
+    std::unique_ptr<Camera> camera_;
+    Geometry geo_;
+    SUNCGScene::RenderMode mode_ = SUNCGScene::RenderMode::RGB;
+    std::vector<std::unique_ptr<ExecutorInThread>> workers_;
+
+    // Cast the ray of each pixel from camera_, in row-major order, top row
+    // first. The distance of the hits is their depth along the view
+    // direction.
+    std::vector<SUNCGScene::RayHit> cast_pixels_();
+
+    // Run f(begin, end) over [0, n) in blocks of grain, on the calling
+    // thread and the workers. Returns when all are done.
+    void parallel_for_(int n, int grain, const std::function<void(int, int)>& f);
+};
+
+}
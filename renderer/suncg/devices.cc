@@ -0,0 +1,136 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: devices.cc
+
+#include "devices.hh"
+
+#include <algorithm>
+#include <tuple>
+
+#include "gl/glContext.hh"
+#include "lib/debugutils.hh"
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace render {
+
+DeviceManager& DeviceManager::get() {
+  // never deleted, so that contexts destroyed at exit can still unregister
+  static DeviceManager* manager = new DeviceManager;
+  return *manager;
+}
+
+DeviceManager::DeviceManager(): num_devices_{numHeadlessDevices()} {}
+
+int DeviceManager::add_context(int device, const void* owner) {
+  if (device >= num_devices_)
+    error_exit(ssprintf("Request device %d but only found %d devices", device, num_devices_));
+  lock_guard<mutex> lg(mutex_);
+  // picked under the lock, so concurrent contexts see each other
+  if (device < 0)
+    device = pick_("", {});
+  contexts_[owner] = Context{device, {}, {}};
+  return device;
+}
+
+void DeviceManager::remove_context(const void* owner) {
+  lock_guard<mutex> lg(mutex_);
+  contexts_.erase(owner);
+}
+
+void DeviceManager::set_scenes(const void* owner, vector<pair<string, size_t>> scenes) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = contexts_.find(owner);
+  m_assert(itr != contexts_.end());
+  auto& ctx = itr->second;
+  ctx.scenes = move(scenes);
+  auto& exp = ctx.expected;
+  exp.erase(remove_if(exp.begin(), exp.end(), [&](const string& f) {
+        for (auto& s : ctx.scenes)
+          if (s.first == f)
+            return true;
+        return false;
+      }), exp.end());
+}
+
+void DeviceManager::expect_scene(const void* owner, const string& obj_file) {
+  lock_guard<mutex> lg(mutex_);
+  auto itr = contexts_.find(owner);
+  m_assert(itr != contexts_.end());
+  auto& exp = itr->second.expected;
+  if (find(exp.begin(), exp.end(), obj_file) == exp.end())
+    exp.push_back(obj_file);
+}
+
+vector<DeviceManager::DeviceLoad> DeviceManager::load_() const {
+  vector<DeviceLoad> ret(num_devices_);
+  for (int i = 0; i < num_devices_; ++i)
+    ret[i].device = i;
+  for (auto& pair : contexts_) {
+    auto& d = ret[pair.second.device];
+    d.contexts++;
+    d.scenes += pair.second.scenes.size();
+    d.expected_scenes += pair.second.expected.size();
+    for (auto& s : pair.second.scenes)
+      d.scene_bytes += s.second;
+  }
+  return ret;
+}
+
+vector<DeviceManager::DeviceLoad> DeviceManager::load() const {
+  lock_guard<mutex> lg(mutex_);
+  return load_();
+}
+
+int DeviceManager::pick(const string& obj_file, const vector<int>& candidates) const {
+  lock_guard<mutex> lg(mutex_);
+  return pick_(obj_file, candidates);
+}
+
+int DeviceManager::pick_(const string& obj_file, const vector<int>& candidates) const {
+  vector<int> devices = candidates;
+  if (devices.empty())
+    for (int i = 0; i < num_devices_; ++i)
+      devices.push_back(i);
+  for (int d : devices)
+    m_assert(d >= 0 && d < num_devices_);
+
+  if (obj_file.size()) {
+    for (auto& pair : contexts_) {
+      auto& ctx = pair.second;
+      if (find(devices.begin(), devices.end(), ctx.device) == devices.end())
+        continue;
+      for (auto& s : ctx.scenes)
+        if (s.first == obj_file)
+          return ctx.device;
+      for (auto& f : ctx.expected)
+        if (f == obj_file)
+          return ctx.device;
+    }
+  }
+
+  auto load = load_();
+  // the expected scenes are of the average size of the activated ones
+  size_t total_bytes = 0;
+  int total_scenes = 0;
+  for (auto& d : load) {
+    total_bytes += d.scene_bytes;
+    total_scenes += d.scenes;
+  }
+  double avg_bytes = total_scenes ? (double)total_bytes / total_scenes : 1.;
+  auto key = [&](int d) {
+    return make_tuple(load[d].scene_bytes + load[d].expected_scenes * avg_bytes,
+        load[d].contexts);
+  };
+  int best = devices[0];
+  for (int d : devices)
+    if (key(d) < key(best))
+      best = d;
+  return best;
+}
+
+} // namespace render
@@ -0,0 +1,79 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: devices.hh
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace render {
+
+// The load of the rendering devices of this process: the contexts on each
+// device, and the scenes they keep activated in GPU memory. Used to place
+// new contexts and scenes, instead of picking the devices by hand, which
+// unbalances them when the scenes differ in size.
+//
+// Contexts register themselves with an owner, e.g. their SUNCGRenderAPI.
+// The scenes of contexts sharing objects are counted once per context.
+// Thread-safe.
+class DeviceManager {
+  public:
+    struct DeviceLoad {
+      int device;
+      int contexts = 0;
+      int scenes = 0;           // activated scenes, counted once per context
+      size_t scene_bytes = 0;   // their gpu_bytes()
+      int expected_scenes = 0;  // see expect_scene()
+    };
+
+    // The instance of this process.
+    static DeviceManager& get();
+
+    int num_devices() const { return num_devices_; }
+
+    // The device for a new context: the device that has obj_file activated
+    // if any, or else the one with the fewest scene bytes, and then the
+    // fewest contexts. Only devices in candidates are considered, or all if
+    // it's empty.
+    int pick(const std::string& obj_file = "",
+        const std::vector<int>& candidates = std::vector<int>()) const;
+
+    // Register the context of owner on device, or on pick() if device < 0,
+    // and return its device.
+    int add_context(int device, const void* owner);
+    void remove_context(const void* owner);
+
+    // Replace the activated scenes of owner by scenes, as (obj_file, gpu_bytes).
+    void set_scenes(const void* owner, std::vector<std::pair<std::string, size_t>> scenes);
+
+    // obj_file will be activated by owner, e.g. it is queued. Until
+    // set_scenes() includes it, pick() counts it as a scene of average size.
+    void expect_scene(const void* owner, const std::string& obj_file);
+
+    std::vector<DeviceLoad> load() const;
+
+  private:
+    DeviceManager();
+
+    struct Context {
+      int device;
+      std::vector<std::pair<std::string, size_t>> scenes;
+      std::vector<std::string> expected;
+    };
+
+    int num_devices_;
+    mutable std::mutex mutex_;   // guards contexts_
+    std::unordered_map<const void*, Context> contexts_;   // by owner
+
+    std::vector<DeviceLoad> load_() const;
+    int pick_(const std::string& obj_file, const std::vector<int>& candidates) const;
+};
+
+} // namespace render
@@ -0,0 +1,171 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: labels.cc
+
+#include "labels.hh"
+
+#include <csv.h>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "lib/debugutils.hh"
+
+using namespace std;
+
+namespace {
+
+inline char lower(char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// FNV-1a
+template <bool kNoCase>
+size_t hash_name(const char* s, size_t n) {
+  size_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= (unsigned char)(kNoCase ? lower(s[i]) : s[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+inline bool has_prefix(const char* s, size_t n, const char* prefix, size_t k) {
+  return n >= k && memcmp(s, prefix, k) == 0;
+}
+
+} // namespace
+
+namespace render {
+
+size_t SemanticLabels::NameHash::operator()(const NameRef& r) const {
+  return hash_name<false>(r.s, r.n);
+}
+
+bool SemanticLabels::NameEq::operator()(const NameRef& a, const NameRef& b) const {
+  return a.n == b.n && memcmp(a.s, b.s, a.n) == 0;
+}
+
+size_t SemanticLabels::NoCaseHash::operator()(const NameRef& r) const {
+  return hash_name<true>(r.s, r.n);
+}
+
+bool SemanticLabels::NoCaseEq::operator()(const NameRef& a, const NameRef& b) const {
+  if (a.n != b.n)
+    return false;
+  for (size_t i = 0; i < a.n; ++i)
+    if (lower(a.s[i]) != lower(b.s[i]))
+      return false;
+  return true;
+}
+
+SemanticLabels::SemanticLabels(const string& model_category_file,
+    const string& semantic_label_file) {
+  {
+    io::CSVReader<4> reader{semantic_label_file};
+    reader.read_header(io::ignore_extra_column, "name", "r", "g", "b");
+    string name;
+    unsigned int r, g, b;
+    while (reader.read_row(name, r, g, b)) {
+      NameRef key{name.data(), name.size()};
+      if (colors_.count(key))
+        continue;
+      colors_.emplace(own_(move(name)), glm::vec3{r/255.0, g/255.0, b/255.0});
+    }
+    nr_colors_ = colors_.size();
+    auto itr = colors_.find(NameRef{"other", 5});
+    if (itr != colors_.end())
+      background_color_ = itr->second;
+  }
+
+  io::CSVReader<3> reader{model_category_file};
+  reader.read_header(io::ignore_extra_column, "model_id", "fine_grained_class", "coarse_grained_class");
+  string model_id, fine_class, coarse_class;
+  while (reader.read_row(model_id, fine_class, coarse_class)) {
+    if (models_.count(NameRef{model_id.data(), model_id.size()}))
+      continue;
+    Model model{intern_class_(coarse_class), intern_class_(fine_class)};
+    models_.emplace(own_(move(model_id)), model);
+  }
+}
+
+shared_ptr<const SemanticLabels> SemanticLabels::get(
+    const string& model_category_file, const string& semantic_label_file) {
+  // never deleted, so that scenes parsed by threads at exit can still use it
+  static mutex* mtx = new mutex;
+  static auto* labels = new map<pair<string, string>, shared_ptr<const SemanticLabels>>;
+  lock_guard<mutex> lg(*mtx);
+  auto& ret = (*labels)[make_pair(model_category_file, semantic_label_file)];
+  if (!ret)
+    ret = make_shared<const SemanticLabels>(model_category_file, semantic_label_file);
+  return ret;
+}
+
+glm::vec3 SemanticLabels::shape_color(const string& shape_name, bool fine) const {
+  const char* s = shape_name.data();
+  size_t n = shape_name.size();
+  if (has_prefix(s, n, "Model#", 6)) {
+    auto itr = models_.find(NameRef{s + 6, n - 6});
+    if (itr == models_.end()) {
+      print_debug("Cannot find model %s\n", s + 6);
+      return {0, 0, 0};
+    }
+    return class_colors_[fine ? itr->second.fine : itr->second.coarse];
+  }
+  if (shape_name == "Ground")
+    return color_("Ground", 6);
+  const char* split = static_cast<const char*>(memchr(s, '#', n));
+  if (split) {
+    size_t k = split - s;
+    if ((k == 10 && has_prefix(s, n, "WallInside", 10)) ||
+        (k == 11 && has_prefix(s, n, "WallOutside", 11)))
+      return color_("Wall", 4);
+    return color_(s, k);
+  }
+  print_debug("Failed to get color for shape %s\n", s);
+  return background_color_;
+}
+
+int SemanticLabels::class_id(const string& klass) const {
+  auto itr = class_ids_.find(NameRef{klass.data(), klass.size()});
+  return itr == class_ids_.end() ? -1 : itr->second;
+}
+
+bool SemanticLabels::is_coarse_class(const string& shape_name, int klass) const {
+  const char* s = shape_name.data();
+  size_t n = shape_name.size();
+  if (klass < 0 || !has_prefix(s, n, "Model#", 6))
+    return false;
+  auto itr = models_.find(NameRef{s + 6, n - 6});
+  return itr != models_.end() && itr->second.coarse == klass;
+}
+
+SemanticLabels::NameRef SemanticLabels::own_(string name) {
+  names_.push_back(move(name));
+  return NameRef{names_.back().data(), names_.back().size()};
+}
+
+int SemanticLabels::intern_class_(const string& klass) {
+  auto itr = class_ids_.find(NameRef{klass.data(), klass.size()});
+  if (itr != class_ids_.end())
+    return itr->second;
+  int id = class_colors_.size();
+  class_colors_.push_back(color_(klass.data(), klass.size()));
+  class_ids_.emplace(own_(klass), id);
+  return id;
+}
+
+glm::vec3 SemanticLabels::color_(const char* s, size_t n) const {
+  auto itr = colors_.find(NameRef{s, n});
+  if (itr == colors_.end()) {
+    print_debug("Couldn't find color for class %.*s\n", (int)n, s);
+    return {0, 0, 0};
+  }
+  return itr->second;
+}
+
+} // namespace render
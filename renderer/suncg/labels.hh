@@ -0,0 +1,89 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: labels.hh
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace render {
+
+// The classes of the SUNCG models and the colors of the classes, read from
+// ModelCategoryMapping.csv and a colormap csv. Immutable, and shared by all
+// scenes parsed with the same pair of files.
+//
+// Class names are interned into ids, and the colors of the classes are
+// resolved once, so a shape name resolves to its color with one hash
+// lookup and no string allocation.
+class SemanticLabels final {
+  public:
+    // model_category_file: a csv with columns model_id,fine_grained_class,coarse_grained_class
+    // semantic_label_file: a csv with columns name,r,g,b, r,g,b in [0,255].
+    //   The names are case-insensitive.
+    SemanticLabels(const std::string& model_category_file,
+        const std::string& semantic_label_file);
+    SemanticLabels(const SemanticLabels&) = delete;
+    SemanticLabels& operator = (const SemanticLabels&) = delete;
+
+    // The labels of a pair of files, read once per process. Thread-safe.
+    static std::shared_ptr<const SemanticLabels> get(
+        const std::string& model_category_file, const std::string& semantic_label_file);
+
+    // number of colors of the colormap
+    int nr_colors() const { return nr_colors_; }
+
+    // the color of class "other", or black
+    glm::vec3 background_color() const { return background_color_; }
+
+    // The label color of a shape of a SUNCG obj:
+    //  "Model#<id>": the color of the fine or coarse class of the model
+    //  "Ground": the color of class ground
+    //  "<class>#...": the color of class, with WallInside and WallOutside as Wall
+    // Unknown models and classes are black. Other names have the background color.
+    glm::vec3 shape_color(const std::string& shape_name, bool fine) const;
+
+    // The id of a coarse or fine class, or -1 if no model has it.
+    int class_id(const std::string& klass) const;
+
+    // Whether shape_name is "Model#<id>" of a model of coarse class klass.
+    bool is_coarse_class(const std::string& shape_name, int klass) const;
+
+  private:
+    // a string not owned, used as the key of a lookup without allocation
+    struct NameRef {
+      const char* s;
+      size_t n;
+    };
+    struct NameHash { size_t operator()(const NameRef& r) const; };
+    struct NameEq { bool operator()(const NameRef& a, const NameRef& b) const; };
+    // the same, ignoring case
+    struct NoCaseHash { size_t operator()(const NameRef& r) const; };
+    struct NoCaseEq { bool operator()(const NameRef& a, const NameRef& b) const; };
+
+    struct Model {
+      int coarse, fine;   // class ids
+    };
+
+    std::deque<std::string> names_;   // own the keys below; a deque never moves them
+    std::unordered_map<NameRef, Model, NameHash, NameEq> models_;
+    std::unordered_map<NameRef, int, NameHash, NameEq> class_ids_;
+    std::vector<glm::vec3> class_colors_;   // of each class id
+    std::unordered_map<NameRef, glm::vec3, NoCaseHash, NoCaseEq> colors_;
+    int nr_colors_ = 0;
+    glm::vec3 background_color_{0, 0, 0};
+
+    NameRef own_(std::string name);
+    int intern_class_(const std::string& klass);
+    glm::vec3 color_(const char* s, size_t n) const;
+};
+
+} // namespace render
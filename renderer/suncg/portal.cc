@@ -0,0 +1,130 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: portal.cc
+
+#include "portal.hh"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// whether [a1, a2] x [b1, b2] and [c1, c2] x [d1, d2] overlap
+bool overlap(float a1, float b1, float a2, float b2,
+    float c1, float d1, float c2, float d2) {
+  return a1 < c2 && c1 < a2 && b1 < d2 && d1 < b2;
+}
+
+}
+
+namespace render {
+
+PortalCuller::PortalCuller(const vector<glm::vec4>& rooms, const vector<AABB>& portals,
+    const vector<AABB>& mesh_boxes):
+  rooms_{rooms}, portals_{portals},
+  edges_(rooms.size()), room_meshes_(rooms.size()), nr_mesh_(mesh_boxes.size()) {
+  int nr_room = rooms_.size();
+  for (int m = 0; m < nr_mesh_; ++m) {
+    auto& box = mesh_boxes[m];
+    bool in_room = false;
+    for (int r = 0; r < nr_room; ++r) {
+      auto& room = rooms_[r];
+      if (overlap(box.min.x, box.min.z, box.max.x, box.max.z,
+            room.x, room.y, room.z, room.w)) {
+        room_meshes_[r].push_back(m);
+        in_room = true;
+      }
+    }
+    if (!in_room)
+      outside_meshes_.push_back(m);
+  }
+
+  for (int p = 0; p < (int)portals_.size(); ++p) {
+    auto& box = portals_[p];
+    vector<int> connected;
+    for (int r = 0; r < nr_room; ++r) {
+      auto& room = rooms_[r];
+      float e = kPortalMargin;
+      if (overlap(box.min.x, box.min.z, box.max.x, box.max.z,
+            room.x - e, room.y - e, room.z + e, room.w + e))
+        connected.push_back(r);
+    }
+    for (int a : connected)
+      for (int b : connected)
+        if (a != b)
+          edges_[a].push_back(Edge{p, b});
+  }
+}
+
+bool PortalCuller::contains_(int room, const glm::vec3& eye) const {
+  auto& r = rooms_[room];
+  return eye.x >= r.x && eye.x <= r.z && eye.z >= r.y && eye.z <= r.w;
+}
+
+PortalCuller::Rect PortalCuller::project_(const AABB& box, const glm::mat4& camera_matrix) {
+  float inf = numeric_limits<float>::max();
+  Rect ret{inf, inf, -inf, -inf};
+  for (int k = 0; k < 8; ++k) {
+    glm::vec4 corner{k & 1 ? box.max.x : box.min.x,
+                     k & 2 ? box.max.y : box.min.y,
+                     k & 4 ? box.max.z : box.min.z, 1.f};
+    glm::vec4 clip = camera_matrix * corner;
+    if (clip.w <= 1e-4f)
+      return Rect{-1.f, -1.f, 1.f, 1.f};
+    float x = clip.x / clip.w, y = clip.y / clip.w;
+    ret.x1 = min(ret.x1, x);
+    ret.y1 = min(ret.y1, y);
+    ret.x2 = max(ret.x2, x);
+    ret.y2 = max(ret.y2, y);
+  }
+  return ret;
+}
+
+void PortalCuller::visit_(int room, const Rect& rect, const glm::mat4& camera_matrix,
+    int depth, vector<uint8_t>& on_path, vector<uint8_t>& room_visible) const {
+  room_visible[room] = 1;
+  if (depth == kMaxDepth)
+    return;
+  on_path[room] = 1;
+  for (auto& edge : edges_[room]) {
+    if (on_path[edge.room])
+      continue;
+    Rect r = project_(portals_[edge.portal], camera_matrix);
+    r = Rect{max(r.x1, rect.x1), max(r.y1, rect.y1), min(r.x2, rect.x2), min(r.y2, rect.y2)};
+    if (!r.empty())
+      visit_(edge.room, r, camera_matrix, depth + 1, on_path, room_visible);
+  }
+  on_path[room] = 0;
+}
+
+void PortalCuller::cull(const glm::vec3& eye, const glm::mat4& camera_matrix,
+    vector<uint8_t>& visible) const {
+  int nr_room = rooms_.size();
+  vector<uint8_t> on_path(nr_room, 0), room_visible(nr_room, 0);
+  bool in_room = false;
+  // near a door, the eye may be in two rooms
+  for (int r = 0; r < nr_room; ++r)
+    if (contains_(r, eye)) {
+      in_room = true;
+      visit_(r, Rect{-1.f, -1.f, 1.f, 1.f}, camera_matrix, 0, on_path, room_visible);
+    }
+  if (!in_room)
+    return;
+
+  vector<uint8_t> seen(nr_mesh_, 0);
+  for (int m : outside_meshes_)
+    seen[m] = 1;
+  for (int r = 0; r < nr_room; ++r)
+    if (room_visible[r])
+      for (int m : room_meshes_[r])
+        seen[m] = 1;
+  for (int m = 0; m < nr_mesh_; ++m)
+    visible[m] &= seen[m];
+}
+
+}
@@ -0,0 +1,79 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: portal.hh
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "model/bvh.hh"
+
+namespace render {
+
+// Occlusion culling by the rooms of a house: from inside a room, only that
+// room and the rooms seen through its doors and windows (the portals) can
+// be visible.
+//
+// Meshes belong to the rooms their bounding box overlaps on the floor plan,
+// and meshes outside of all rooms (e.g. the ground, or the outside of the
+// walls) are always visible. Two rooms are connected by a portal that
+// overlaps both. A room is visible if it is reached from the camera's room
+// through a chain of portals, each seen through the screen rectangle of the
+// previous ones.
+//
+// It assumes the rooms are closed except at their portals: an opening in a
+// wall that is not a door or window object hides what is behind it.
+class PortalCuller {
+  public:
+    // rooms: the floor rectangle (x1, z1, x2, z2) of each room
+    // portals: the bounding boxes of the doors and windows
+    // mesh_boxes: the bounding box of each mesh of the scene
+    PortalCuller(const std::vector<glm::vec4>& rooms, const std::vector<AABB>& portals,
+        const std::vector<AABB>& mesh_boxes);
+
+    // Clear visible[i] of each mesh i that cannot be seen from eye, with the
+    // view frustum of camera_matrix. Nothing is culled when eye is not in
+    // a room.
+    void cull(const glm::vec3& eye, const glm::mat4& camera_matrix,
+        std::vector<uint8_t>& visible) const;
+
+  private:
+    // a rectangle of normalized device coordinates
+    struct Rect {
+      float x1, y1, x2, y2;
+      bool empty() const { return x1 >= x2 || y1 >= y2; }
+    };
+    struct Edge {
+      int portal, room;
+    };
+
+    // how far a portal may be from a room, as it is inside the wall
+    static constexpr float kPortalMargin = 0.25f;
+    // chains of portals longer than this are not followed
+    static const int kMaxDepth = 8;
+
+    std::vector<glm::vec4> rooms_;
+    std::vector<AABB> portals_;
+    std::vector<std::vector<Edge>> edges_;  // of each room
+    std::vector<std::vector<int>> room_meshes_;
+    std::vector<int> outside_meshes_;   // in no room
+    int nr_mesh_;
+
+    // whether eye is in the floor rectangle of room
+    bool contains_(int room, const glm::vec3& eye) const;
+
+    // The screen rectangle of box. The whole screen if part of box is
+    // behind the camera.
+    static Rect project_(const AABB& box, const glm::mat4& camera_matrix);
+
+    // mark room and the rooms seen from it through rect
+    void visit_(int room, const Rect& rect, const glm::mat4& camera_matrix, int depth,
+        std::vector<uint8_t>& on_path, std::vector<uint8_t>& room_visible) const;
+};
+
+}
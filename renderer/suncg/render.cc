@@ -7,43 +7,432 @@
 
 #include "render.hh"
 
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
 #include "gl/fbScope.hh"
+#include "gl/gpuTimer.hh"
 #include "lib/imgproc.hh"
+#include "lib/profiler.hh"
+#include "lib/strutils.hh"
 
 namespace render {
 
+struct SUNCGRenderAPI::ShareGroup {
+  std::mutex mutex;   // guards contexts
+  std::vector<GLContext*> contexts;   // of the live APIs
+  TexturePool textures;
+  MeshBufferPool meshes;
+};
 
-Matuc SUNCGRenderAPI::render() {
-  FramebufferScope fb{fb_};
+std::shared_ptr<SUNCGRenderAPI::ShareGroup> SUNCGRenderAPI::share_group_of_(int device) {
+  static std::mutex mutex;
+  static std::unordered_map<int, std::weak_ptr<ShareGroup>> groups;
+  std::lock_guard<std::mutex> lg(mutex);
+  auto group = groups[device].lock();
+  if (!group) {
+    group = std::make_shared<ShareGroup>();
+    groups[device] = group;
+  }
+  return group;
+}
+
+GLContext* SUNCGRenderAPI::create_context_(Geometry win_size, int device, ShareGroup* group) {
+  if (!group)
+    return createHeadlessContext(win_size, device);
+  // hold the lock, so the context to share with is not destroyed meanwhile
+  std::lock_guard<std::mutex> lg(group->mutex);
+  GLContext* share = group->contexts.empty() ? nullptr : group->contexts.front();
+  GLContext* ctx = createHeadlessContext(win_size, device, share);
+  group->contexts.push_back(ctx);
+  return ctx;
+}
+
+
+void SUNCGRenderAPI::draw_() {
+  PROFILE_ZONE("draw");
+  GPU_ZONE(gpu_timer_, "gpu:draw");
   Shader* shader_ = scene_->get_shader();
   shader_->use();
-  shader_->setMat4("projection", camera_->getCameraMatrix(geo_));
+  glm::mat4 camera_matrix = camera_->getCameraMatrix(geo_);
+  shader_->setMat4("projection", camera_matrix);
   shader_->setVec3("eye", camera_->pos);
 
-  scene_->draw();
-
-  auto buf = fb.capture();
-  if (scene_->get_mode() == SUNCGScene::RenderMode::DEPTH) {
-    Matuc ret(geo_.h, geo_.w, 2);
-    fill(ret, (unsigned char)0);
-    for (int i = 0; i < geo_.h; ++i) {
-      unsigned char* destptr = ret.ptr(i);
-      for (int j = 0; j < geo_.w; ++j) {
-        unsigned char* ptr = buf.ptr(i, j);
-        if (ptr[0] == ptr[1] and ptr[1] == ptr[2])
-          destptr[j * 2] = ptr[0];
-        else
-          destptr[j * 2 + 1] = 255;
-      }
+  scene_->set_view(camera_matrix, camera_->pos);
+  scene_->draw(camera_matrix);
+}
+
+Matuc SUNCGRenderAPI::render() {
+  Matuc ret = Matuc::pooled(geo_.h, geo_.w, numChannels());
+  renderInto(ret.ptr());
+  return ret;
+}
+
+const Framebuffer& SUNCGRenderAPI::draw_frame_() {
+  bool antialias = (msaa_samples_ > 0 || supersampling_ > 1) &&
+    scene_->get_mode() == SUNCGScene::RenderMode::RGB;
+  if (!antialias) {
+    FramebufferScope fb{*fb_};
+    draw_();
+    return *fb_;
+  }
+  Geometry size{geo_.w * supersampling_, geo_.h * supersampling_};
+  if (!aa_fb_) {
+    aa_fb_.reset(new Framebuffer{size, true, 1, GL_RGBA8, msaa_samples_});
+    if (msaa_samples_ > 0)
+      aa_resolved_fb_.reset(new Framebuffer{size, false});
+  }
+  {
+    FramebufferScope fb{*aa_fb_};
+    glViewport(0, 0, size.w, size.h);
+    draw_();
+    glViewport(0, 0, geo_.w, geo_.h);
+  }
+  if (!aa_resolved_fb_)
+    return *aa_fb_;
+  aa_fb_->blit_to(*aa_resolved_fb_);
+  return *aa_resolved_fb_;
+}
+
+void SUNCGRenderAPI::renderInto(unsigned char* dst) {
+  auto packing = packing_();
+  const Framebuffer& frame = draw_frame_();
+  // flip & pack on the GPU, so the pixels can be read into dst as is
+  resolve_.run(frame, *resolved_fb_, packing);
+  FramebufferScope fb{*resolved_fb_};
+  resolved_fb_->read_pixels(dst, ResolvePass::format(packing));
+}
+
+void SUNCGRenderAPI::renderAsync() {
+  auto packing = packing_();
+  const Framebuffer& frame = draw_frame_();
+  resolve_.run(frame, *resolved_fb_, packing);
+  FramebufferScope fb{*resolved_fb_};
+  async_ring_->start(*resolved_fb_, ResolvePass::format(packing));
+}
+
+Matuc SUNCGRenderAPI::collect() {
+  return async_ring_->collect();
+}
+
+std::vector<Matuc> SUNCGRenderAPI::renderMulti(
+    const std::vector<SUNCGScene::RenderMode>& modes) {
+  if (modes.empty())
+    return {};
+  const int nr_target = SUNCGScene::kNumRenderModes;
+  if (!multi_fb_)
+    multi_fb_.reset(new Framebuffer{geo_, true, nr_target});
+
+  // only write the targets that are asked for
+  std::vector<GLenum> draw_buffers(nr_target, GL_NONE);
+  for (auto m : modes) {
+    int idx = static_cast<int>(m);
+    draw_buffers[idx] = GL_COLOR_ATTACHMENT0 + idx;
+  }
+  {
+    FramebufferScope fb{*multi_fb_};
+    glDrawBuffers(nr_target, draw_buffers.data());
+    Shader* shader_ = scene_->get_multi_target_shader();
+    shader_->use();
+    glm::mat4 camera_matrix = camera_->getCameraMatrix(geo_);
+    shader_->setMat4("projection", camera_matrix);
+    shader_->setVec3("eye", camera_->pos);
+    scene_->set_view(camera_matrix, camera_->pos);
+    PROFILE_ZONE("draw");
+    GPU_ZONE(gpu_timer_, "gpu:draw");
+    scene_->draw_multi_target();
+  }
+
+  std::vector<Matuc> ret;
+  for (auto m : modes) {
+    auto packing = packing_(m);
+    resolve_.run(*multi_fb_, *resolved_fb_, packing, static_cast<int>(m));
+    ret.push_back(Matuc::pooled(geo_.h, geo_.w, ResolvePass::channels(packing)));
+    resolved_fb_->read_pixels(ret.back().ptr(), ResolvePass::format(packing));
+  }
+  resolved_fb_->unbind();
+  return ret;
+}
+
+void SUNCGRenderAPI::check_draw_size_(int w, int h, int supersampling) const {
+  if (w <= 0 || h <= 0)
+    throw std::invalid_argument(ssprintf("Invalid resolution %dx%d!", w, h));
+  GLint max_renderbuffer, max_texture;
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer);
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+  long max_size = std::min(max_renderbuffer, max_texture);
+  if ((long)w * supersampling > max_size || (long)h * supersampling > max_size)
+    throw std::invalid_argument(ssprintf(
+          "Cannot draw %dx%d with supersampling %d: the framebuffers of this context are at most %ldx%ld!",
+          w, h, supersampling, max_size, max_size));
+}
+
+void SUNCGRenderAPI::setResolution(int w, int h) {
+  if (numPendingFrames() > 0)
+    throw std::logic_error("setResolution: collect() the frames of renderAsync() first!");
+  check_draw_size_(w, h, supersampling_);
+  geo_ = Geometry{w, h};
+  fb_.reset(new Framebuffer{geo_});
+  resolved_fb_.reset(new Framebuffer{geo_, false});
+  async_ring_.reset(new PixelPackRing{geo_});
+  // the others are created again on demand
+  batch_fb_.reset();
+  batch_resolved_fb_.reset();
+  multi_fb_.reset();
+  cube_fb_.reset();
+  cube_resolved_fb_.reset();
+  float_fb_.reset();
+  float_resolved_fb_.reset();
+  id_fb_.reset();
+  id_resolved_fb_.reset();
+  aa_fb_.reset();
+  aa_resolved_fb_.reset();
+  glViewport(0, 0, w, h);
+  update_textures_();
+}
+
+void SUNCGRenderAPI::setAntialiasing(int samples, int supersampling) {
+  m_assert(samples >= 0 && supersampling >= 1);
+  check_draw_size_(geo_.w, geo_.h, supersampling);
+  if (samples > 0) {
+    GLint max_samples;
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    samples = std::min(samples, (int)max_samples);
+  }
+  msaa_samples_ = samples;
+  supersampling_ = supersampling;
+  aa_fb_.reset();
+  aa_resolved_fb_.reset();
+  update_textures_();
+}
+
+void SUNCGRenderAPI::setTextureStreaming(bool enabled) {
+  texture_streaming_ = enabled;
+  update_textures_();
+}
+
+void SUNCGRenderAPI::setTextureBudget(size_t bytes) {
+  texture_budget_ = bytes;
+  update_textures_();
+}
+
+int SUNCGRenderAPI::texture_max_size_(const TextureRegistry& textures) const {
+  int ret = 0;
+  if (texture_streaming_) {
+    // a texel of a finer level would cover less than a pixel wherever the
+    // texture fits on screen
+    int side = std::max(geo_.w, geo_.h) * supersampling_;
+    ret = kMinTextureSize;
+    while (ret < side)
+      ret *= 2;
+  }
+  if (texture_budget_) {
+    const TexturePool& pool = share_group_ ? share_group_->textures : texture_pool_;
+    // the textures of the other scenes. Those shared with this one count
+    // as its own once it's activated, and as the others' before.
+    size_t own = textures.gpu_bytes(), total = pool.bytes();
+    size_t others = total > own ? total - own : 0;
+    if (ret == 0 && others + textures.gpu_bytes(0) > texture_budget_)
+      ret = std::max(textures.full_size(), kMinTextureSize);
+    while (ret > kMinTextureSize && others + textures.gpu_bytes(ret) > texture_budget_)
+      ret /= 2;
+  }
+  return ret;
+}
+
+void SUNCGRenderAPI::update_textures_() {
+  if (!scene_)
+    return;
+  scene_->set_texture_max_size(texture_max_size_(scene_->textures()));
+  DeviceManager::get().set_scenes(this, scene_cache_.activated());
+}
+
+int SUNCGRenderAPI::max_batch_tiles_() const {
+  GLint max_rb_size, max_tex_size, max_viewport[2];
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_rb_size);
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex_size);
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+  int max_h = std::min({max_rb_size, max_tex_size, max_viewport[1]});
+  return std::max(max_h / geo_.h, 1);
+}
+
+Matuc SUNCGRenderAPI::renderBatch(const std::vector<Camera>& cameras) {
+  std::vector<glm::mat4> matrices;
+  std::vector<glm::vec3> eyes;
+  for (auto& cam : cameras) {
+    matrices.push_back(cam.getCameraMatrix(geo_));
+    eyes.push_back(cam.pos);
+  }
+  return render_views_(matrices, eyes);
+}
+
+Matuc SUNCGRenderAPI::renderBatch(const CameraBatch& cameras) {
+  std::vector<glm::mat4> matrices;
+  cameras.matrices(geo_, matrices);
+  std::vector<glm::vec3> eyes(cameras.size());
+  for (int i = 0; i < cameras.size(); ++i)
+    eyes[i] = cameras.position(i);
+  return render_views_(matrices, eyes);
+}
+
+Matuc SUNCGRenderAPI::render_views_(
+    const std::vector<glm::mat4>& matrices, const std::vector<glm::vec3>& eyes) {
+  int nr_cam = matrices.size();
+  m_assert(nr_cam > 0);
+  int nr_tile = std::min(nr_cam, max_batch_tiles_());
+  if (!batch_fb_ || batch_fb_->size().h != nr_tile * geo_.h) {
+    Geometry size{geo_.w, nr_tile * geo_.h};
+    batch_fb_.reset(new Framebuffer{size});
+    batch_resolved_fb_.reset(new Framebuffer{size, false});
+  }
+
+  auto packing = packing_();
+  Matuc ret = Matuc::pooled(nr_cam * geo_.h, geo_.w, ResolvePass::channels(packing));
+
+  Shader* shader_ = scene_->get_shader();
+  for (int start = 0; start < nr_cam; start += nr_tile) {
+    int nr_draw = std::min(nr_tile, nr_cam - start);
+    batch_fb_->bind();
+    shader_->use();
+    // each view only clears its own tile
+    glEnable(GL_SCISSOR_TEST);
+    for (int k = 0; k < nr_draw; ++k) {
+      PROFILE_ZONE("draw");
+      GPU_ZONE(gpu_timer_, "gpu:draw");
+      // opengl is bottom-up: put the k-th view at the k-th tile from the top,
+      // so that after the flip in ResolvePass, the views are ordered like
+      // `cameras` from the first row.
+      int y = (nr_tile - 1 - k) * geo_.h;
+      glViewport(0, y, geo_.w, geo_.h);
+      glScissor(0, y, geo_.w, geo_.h);
+      const glm::mat4& camera_matrix = matrices[start + k];
+      const glm::vec3& eye = eyes[start + k];
+      shader_->setMat4("projection", camera_matrix);
+      shader_->setVec3("eye", eye);
+      scene_->set_view(camera_matrix, eye);
+      scene_->draw(camera_matrix);
     }
-    return ret;
-  } else {
-    return buf;
+    glDisable(GL_SCISSOR_TEST);
+    resolve_.run(*batch_fb_, *batch_resolved_fb_, packing);
+    batch_resolved_fb_->read_pixels(ret.ptr(start * geo_.h),
+        ResolvePass::format(packing), nr_draw * geo_.h);
+    batch_resolved_fb_->unbind();
   }
+  glViewport(0, 0, geo_.w, geo_.h);
+  return ret;
 }
 
+Mat32f SUNCGRenderAPI::renderDepth() {
+  if (!float_fb_) {
+    float_fb_.reset(new Framebuffer{geo_, true, 1, GL_R32F});
+    float_resolved_fb_.reset(new Framebuffer{geo_, false, 1, GL_R32F});
+  }
+  {
+    FramebufferScope fb{*float_fb_};
+    Shader* shader = scene_->get_linear_depth_shader();
+    shader->use();
+    glm::mat4 camera_matrix = camera_->getCameraMatrix(geo_);
+    shader->setMat4("projection", camera_matrix);
+    scene_->set_view(camera_matrix, camera_->pos);
+    PROFILE_ZONE("draw");
+    GPU_ZONE(gpu_timer_, "gpu:draw");
+    scene_->draw_linear_depth();
+  }
+  auto packing = ResolvePass::Packing::FLOAT;
+  resolve_.run(*float_fb_, *float_resolved_fb_, packing);
+  Mat32f ret = Mat32f::pooled(geo_.h, geo_.w, 1);
+  float_resolved_fb_->read_pixels(ret.ptr(), ResolvePass::format(packing), -1,
+      ResolvePass::type(packing));
+  float_resolved_fb_->unbind();
+  return ret;
+}
+
+void SUNCGRenderAPI::draw_instance_ids_() {
+  if (!id_fb_) {
+    id_fb_.reset(new Framebuffer{geo_, true, 1, GL_R32UI});
+    id_resolved_fb_.reset(new Framebuffer{geo_, false, 1, GL_R32UI});
+  }
+  FramebufferScope fb{*id_fb_};
+  Shader* shader = scene_->get_instance_id_shader();
+  shader->use();
+  glm::mat4 camera_matrix = camera_->getCameraMatrix(geo_);
+  shader->setMat4("projection", camera_matrix);
+  scene_->set_view(camera_matrix, camera_->pos);
+  PROFILE_ZONE("draw");
+  GPU_ZONE(gpu_timer_, "gpu:draw");
+  scene_->draw_instance_ids();
+}
+
+Mat32u SUNCGRenderAPI::renderInstanceIds() {
+  draw_instance_ids_();
+  // integers can't be sampled by ResolvePass: flip them with a blit
+  id_fb_->blit_to(*id_resolved_fb_, true);
+  Mat32u ret = Mat32u::pooled(geo_.h, geo_.w, 1);
+  FramebufferScope fb{*id_resolved_fb_};
+  id_resolved_fb_->read_pixels(ret.ptr(), GL_RED_INTEGER, -1, GL_UNSIGNED_INT);
+  return ret;
+}
+
+std::vector<int> SUNCGRenderAPI::countInstancePixels() {
+  draw_instance_ids_();
+  if (!histogram_)
+    histogram_.reset(new HistogramPass);
+  auto ret = histogram_->run(*id_fb_, scene_->get_instance_names().size());
+  glViewport(0, 0, geo_.w, geo_.h);
+  return ret;
+}
 
 Matuc SUNCGRenderAPI::renderCubeMap() {
+  const int nr_face = SUNCGCubeMapShader::kNumFaces;
+  Geometry size{geo_.w * nr_face, geo_.h};
+  GLint max_tex_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex_size);
+  if (size.w > max_tex_size)
+    return render_cube_map_by_face_();
+  if (!cube_fb_) {
+    cube_fb_.reset(new Framebuffer{size});
+    cube_resolved_fb_.reset(new Framebuffer{size, false});
+  }
+
+  // Cube map orientations are { BACK, LEFT, FORWARD, RIGHT, UP, DOWN }
+  const float face_yaw[nr_face] = {180.f, 270.f, 0.f, 90.f, 0.f, 0.f};
+  const float face_pitch[nr_face] = {0.f, 0.f, 0.f, 0.f, 89.f, -89.f};
+  glm::mat4 projections[nr_face];
+  for (int i = 0; i < nr_face; ++i) {
+    Camera cam = *camera_;
+    cam.vertical_fov = 90.f;
+    cam.yaw += face_yaw[i];
+    cam.pitch = face_pitch[i];
+    cam.updateDirection();
+    projections[i] = cam.getCameraMatrix(geo_);
+  }
+
+  auto packing = packing_();
+  {
+    FramebufferScope fb{*cube_fb_};
+    glViewport(0, 0, size.w, size.h);
+    SUNCGCubeMapShader* shader = scene_->get_cube_map_shader();
+    shader->use();
+    shader->setFaceProjections(projections);
+    shader->setVec3("eye", camera_->pos);
+    glEnable(GL_CLIP_DISTANCE0);
+    glEnable(GL_CLIP_DISTANCE1);
+    PROFILE_ZONE("draw");
+    GPU_ZONE(gpu_timer_, "gpu:draw");
+    scene_->draw_cube_map();
+    glDisable(GL_CLIP_DISTANCE0);
+    glDisable(GL_CLIP_DISTANCE1);
+  }
+  resolve_.run(*cube_fb_, *cube_resolved_fb_, packing);
+  Matuc ret = Matuc::pooled(size.h, size.w, ResolvePass::channels(packing));
+  cube_resolved_fb_->read_pixels(ret.ptr(), ResolvePass::format(packing));
+  cube_resolved_fb_->unbind();
+  glViewport(0, 0, geo_.w, geo_.h);
+  return ret;
+}
+
+Matuc SUNCGRenderAPI::render_cube_map_by_face_() {
   float prev_fov = camera_->vertical_fov;
   float prev_pitch = camera_->pitch;
   camera_->pitch = 0.f;
@@ -76,16 +465,96 @@ Matuc SUNCGRenderAPI::renderCubeMap() {
   return hconcat(faces);
 }
 
+SUNCGRenderAPI::~SUNCGRenderAPI() {
+  DeviceManager::get().remove_context(this);
+  // wait for the workers, and delete what they parsed. The error of a
+  // prefetch that failed is of no use any more.
+  for (auto& pair : prefetched_) {
+    try {
+      delete pair.second.get();
+    } catch (...) {}
+  }
+  if (share_group_) {
+    std::lock_guard<std::mutex> lg(share_group_->mutex);
+    auto& ctxs = share_group_->contexts;
+    ctxs.erase(std::find(ctxs.begin(), ctxs.end(), context_.get()));
+  }
+}
+
+SUNCGScene* SUNCGRenderAPI::parse_scene_(
+    const std::string& obj_file, const std::string& model_category_file,
+    const std::string& semantic_label_file, MeshBatch::VertexLayout layout) {
+  PROFILE_ZONE("parseScene");
+  // use the baked scene if there is one
+  SUNCGScene* scene = SUNCGScene::load_baked(baked_scene_file(obj_file),
+      obj_file, model_category_file, semantic_label_file, 0.3f, layout);
+  if (!scene)
+    scene = new SUNCGScene{obj_file, model_category_file, semantic_label_file,
+        0.3f, layout};
+  return scene;
+}
+
 void SUNCGRenderAPI::loadScene(
     std::string obj_file, std::string model_category_file,
     std::string semantic_label_file) {
+  PROFILE_ZONE("loadScene");
   // check cache for previously loaded scenes
   scene_ = dynamic_cast<SUNCGScene*>(scene_cache_.get(obj_file));
+  if (scene_)
+    PROFILE_COUNT("scene_cache_hits", 1);
+  else
+    PROFILE_COUNT("scene_cache_misses", 1);
   if (!scene_) {
-    scene_ = new SUNCGScene{obj_file, model_category_file, semantic_label_file};
+    auto itr = prefetched_.find(obj_file);
+    if (itr != prefetched_.end()) {
+      // erased first, so that a failed prefetch can be loaded again
+      auto future = std::move(itr->second);
+      prefetched_.erase(itr);
+      scene_ = future.get();
+    } else {
+      scene_ = parse_scene_(obj_file, model_category_file, semantic_label_file,
+          vertex_layout_);
+    }
+    scene_->set_compressed_textures(compressed_textures_);
+    // not activated yet, so only the levels needed are uploaded
+    scene_->set_texture_max_size(texture_max_size_(scene_->textures()));
+    if (share_group_) {
+      scene_->set_texture_pool(&share_group_->textures);
+      scene_->set_mesh_pool(&share_group_->meshes, obj_file);
+    } else {
+      scene_->set_texture_pool(&texture_pool_);
+    }
+    {
+      PROFILE_ZONE("uploadScene");
+      scene_->activate();
+    }
     scene_cache_.put(obj_file, scene_);
   }
+  scene_->set_depth_prepass(depth_prepass_);
+  // a cached scene may have been edited: load it as in the obj, as if it was
+  // parsed again
+  scene_->reset_objects();
+  // a cached scene may have the levels of another resolution or budget
+  update_textures_();
   init_camera_();
 }
 
+void SUNCGRenderAPI::prefetchScene(
+    std::string obj_file, std::string model_category_file,
+    std::string semantic_label_file) {
+  if (scene_cache_.contains(obj_file) || prefetched_.count(obj_file))
+    return;
+  auto& worker = prefetch_workers_[next_prefetch_worker_];
+  next_prefetch_worker_ = (next_prefetch_worker_ + 1) % kNumPrefetchWorkers;
+  if (!worker)
+    worker.reset(new ExecutorInThread);
+
+  auto layout = vertex_layout_;
+  auto task = std::make_shared<std::packaged_task<SUNCGScene*()>>([=]() {
+      return parse_scene_(obj_file, model_category_file, semantic_label_file, layout);
+  });
+  prefetched_[obj_file] = task->get_future();
+  worker->execute_async([task]() { (*task)(); });
+}
+
 }
@@ -10,14 +10,20 @@
 #include <memory>
 #include <utility>
 #include <future>
-#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <glm/glm.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/component_wise.hpp>
 
+#include "devices.hh"
 #include "scene.hh"
 #include "gl/fbScope.hh"
+#include "gl/pixelPack.hh"
+#include "gl/resolve.hh"
+#include "gl/histogram.hh"
 #include "gl/glContext.hh"
+#include "gl/gpuTimer.hh"
 #include "gl/camera.hh"
 #include "model/scenecache.hh"
 #include "lib/executor.hh"
@@ -26,27 +32,90 @@ namespace render {
 
 // An instance of this class has to be created and used in the same thread.
 // If not, use SUNCGRenderAPIThread.
+// Distinct instances can be used by different threads at once, e.g. by the
+// threads of one Python process, as the bindings release the GIL while
+// they load, render and read back.
 class SUNCGRenderAPI {
   public:
-    SUNCGRenderAPI(int w, int h, int device)
-      : context_(render::createHeadlessContext(Geometry{w, h}, device)),
-      geo_{w, h}, fb_{geo_} {
+    // device: the device to render on, or -1 for the least loaded one, see
+    //  DeviceManager::pick().
+    // share: put the context in the share group of the other instances
+    //  created with share=true on the same device in this process. They
+    //  upload the vertex buffers of a scene and each texture once for all,
+    //  instead of once per instance. Each still has its own framebuffers,
+    //  shaders and vertex arrays, so they don't disturb each other.
+    SUNCGRenderAPI(int w, int h, int device, bool share = false)
+      : device_(DeviceManager::get().add_context(device, this)),
+      share_group_(share ? share_group_of_(device_) : nullptr),
+      context_(create_context_(Geometry{w, h}, device_, share_group_.get())),
+      geo_{w, h}, fb_{new Framebuffer{geo_}}, resolved_fb_{new Framebuffer{geo_, false}},
+      async_ring_{new PixelPackRing{geo_}} {
         // enable the common context options
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glEnable(GL_CULL_FACE);
       }
+    ~SUNCGRenderAPI();
+
+    int device() const { return device_; }
 
     // Load the scene objects to GPU, and unload current scene if it exists.
     // obj_file: house.obj in SUNCG
     // model_category_file: path to ModelCategoryMapping.csv
     // semantic_label_file: path to colormap_coarse.csv or colormap_fine.csv
+    // If baked_scene_file(obj_file) is a scene baked with the same
+    // semantic_label_file (see suncg-bake.cpp), it is loaded instead of
+    // parsing the files.
     void loadScene(
         std::string obj_file, std::string model_category_file,
         std::string semantic_label_file);
 
+    // Parse the scene in a background thread and return immediately. A later
+    // loadScene() with the same obj_file then only has to wait for the
+    // parsing to finish (if it hasn't), and upload the scene to the GPU.
+    // Does nothing if the scene is cached or being prefetched already.
+    void prefetchScene(
+        std::string obj_file, std::string model_category_file,
+        std::string semantic_label_file);
+
     void setMode(SUNCGScene::RenderMode m) { scene_->set_mode(m); }
+    SUNCGScene::RenderMode getMode() const { return scene_->get_mode(); }
+
+    // Store normals and texcoords of the scenes loaded from now on in a
+    // compact format (packed normals, half-float texcoords), to fit more
+    // scenes in GPU memory. Texcoords lose precision far from the origin.
+    void setCompactVertexLayout(bool compact) {
+      vertex_layout_ = compact ? MeshBatch::VertexLayout::COMPACT : MeshBatch::VertexLayout::FULL;
+    }
+
+    // Store the textures of the scenes loaded from now on compressed in GPU
+    // memory. See TextureRegistry::set_compressed().
+    void setCompressedTextures(bool compressed) { compressed_textures_ = compressed; }
+
+    // Upload only the mip levels of the textures needed at the resolution:
+    // their largest side is capped to the power of two at or above the
+    // width and height drawn, including supersampling. Saves most of the
+    // texture memory at low resolutions. setResolution() and
+    // setAntialiasing() upload the levels needed by the current scene again,
+    // and the cached scenes get them when they're loaded again.
+    // See TextureRegistry::set_max_size().
+    void setTextureStreaming(bool enabled);
+
+    // Budget in bytes of the textures in GPU memory, or 0 for none. It
+    // applies to the texture pool of this context, i.e. to the device if
+    // the context is shared. The textures of a scene loaded over the budget
+    // are downgraded by whole mip levels, down to kMinTextureSize.
+    void setTextureBudget(size_t bytes);
+
+    // Draw the depth of opaque meshes before shading them in RGB mode, to
+    // shade each pixel once. Faster for cluttered scenes at high resolutions.
+    // See SUNCGScene::set_depth_prepass().
+    void setDepthPrepass(bool enabled) {
+      depth_prepass_ = enabled;
+      if (scene_)
+        scene_->set_depth_prepass(enabled);
+    }
 
     // Render the image. The return format depends on the rendering mode, which
     // is set with the method above:
@@ -81,13 +150,120 @@ class SUNCGRenderAPI {
     //
     Matuc render();
 
+    // Same as render(), but write the image into dst, which must hold
+    // h * w * numChannels() bytes, in row-major (h, w, c) order.
+    void renderInto(unsigned char* dst);
+
+    // Number of channels of the images rendered in the current mode.
+    int numChannels() const { return channelsOf(scene_->get_mode()); }
+    // Number of channels of the images rendered in mode m.
+    static int channelsOf(SUNCGScene::RenderMode m) {
+      return ResolvePass::channels(packing_(m));
+    }
+
+    // Render the images of several modes with a single pass over the scene,
+    // using one render target per mode. Returns one image per element of
+    // `modes`, each the same as setMode(mode) + render() would return.
+    // The current mode is not changed.
+    std::vector<Matuc> renderMulti(const std::vector<SUNCGScene::RenderMode>& modes);
+
+    // Asynchronous version of render(): draw the scene and start reading it
+    // back without waiting for the transfer. The result is retrieved later by
+    // collect(), which returns the frames in the order they were rendered.
+    // So e.g. the next frame can be drawn while this one is being read back.
+    // At most asyncDepth() frames can be in flight; collect() before
+    // calling renderAsync() again in that case.
+    void renderAsync();
+    Matuc collect();
+    int numPendingFrames() const { return async_ring_->pending(); }
+    int asyncDepth() const { return async_ring_->capacity(); }
+
+    // Render the depth in meters of each pixel along the view direction, as
+    // an h * w * 1 float image, regardless of the current mode. Pixels where
+    // nothing is drawn are +inf.
+    // Unlike the DEPTH and INVDEPTH modes, the depth is not quantized, and
+    // it is linearized on the GPU, so it needs no unpacking.
+    Mat32f renderDepth();
+
+    // Render the instance id of each pixel as an h * w * 1 image,
+    // regardless of the current mode. Pixels where nothing is drawn are 0.
+    // getInstanceNames()[id] is the object name of an id, so that objects
+    // can be counted with a histogram of the ids, without looking up each
+    // color of the INSTANCE mode with getNameFromInstanceColor().
+    Mat32u renderInstanceIds();
+
+    // The object name of each instance id of the current scene.
+    // The first one, of id 0, is "". See getNameFromInstanceColor().
+    std::vector<std::string> getInstanceNames() const { return scene_->get_instance_names(); }
+
+    // The number of pixels of each instance id in the current view, i.e.
+    // the histogram of renderInstanceIds(), indexed like
+    // getInstanceNames(). It is computed on the GPU, so only the counts
+    // are read back.
+    std::vector<int> countInstancePixels();
+
+    // Cast rays from origins[i] along dirs[i] in the current scene, on the
+    // CPU. See SUNCGScene::raycast().
+    std::vector<SUNCGScene::RayHit> raycast(const std::vector<glm::vec3>& origins,
+        const std::vector<glm::vec3>& dirs) {
+      return scene_->raycast(origins, dirs);
+    }
+
+    // The instance ids of the objects of the current scene intersecting
+    // box, see getInstanceNames().
+    std::vector<int> queryAABB(const AABB& box) { return scene_->query_aabb(box); }
+
+    // Move or hide an object of the current scene (an instance id of
+    // getInstanceNames()) without loading the scene again. Only the GPU
+    // range of that object is updated. transform is a model matrix applied
+    // in world space, the identity being the pose in the obj. Edits last
+    // until the next loadScene(), which loads the scene as in the obj even
+    // if it is in the scene cache. See SUNCGScene::set_object_transform().
+    void setObjectTransform(int instance, const glm::mat4& transform) {
+      scene_->set_object_transform(instance, transform);
+    }
+    glm::mat4 getObjectTransform(int instance) const { return scene_->get_object_transform(instance); }
+    void setObjectVisible(int instance, bool visible) { scene_->set_object_visible(instance, visible); }
+    bool isObjectVisible(int instance) const { return scene_->is_object_visible(instance); }
+
     // Render a cube map of size 6w * h * c.  See render() for rendering details.
     // Cube map orientations are { BACK, LEFT, FORWARD, RIGHT, UP, DOWN }
+    // All faces are drawn in one pass and read back as one image.
     Matuc renderCubeMap();
 
+    // Render the current scene from N cameras, returns a (N*h) * w * c image
+    // where the i-th h * w * c block is the image seen by cameras[i]. See
+    // render() for rendering details.
+    // All views are drawn as tiles of one framebuffer, so the binding and
+    // readback cost is paid once for the whole batch instead of once per view.
+    Matuc renderBatch(const std::vector<Camera>& cameras);
+    // Same, for the cameras of a batch
+    Matuc renderBatch(const CameraBatch& cameras);
+
+    // Render the views of a rig at the current camera, e.g. a stereo pair,
+    // in one submission as renderBatch(): returns a (N*h) * w * c image of
+    // the N views of the rig, stacked vertically.
+    Matuc renderRig(const CameraRig& rig) { return renderBatch(rig.cameras(*camera_)); }
+
+    // Skip the meshes hidden by the walls of the camera's room when drawing
+    // the current scene, see PortalCuller. An empty rooms disables it.
+    // rooms: the floor rectangle (x1, z1, x2, z2) of each room
+    // portals: the bounding boxes of the doors and windows between them
+    void setRooms(const std::vector<glm::vec4>& rooms, const std::vector<AABB>& portals) {
+      scene_->set_rooms(rooms, portals);
+    }
+
     // Print OpenGL context info.
     void printContextInfo() const { context_->printInfo(); }
 
+    // Memory budgets in bytes for the scenes loaded by loadScene().
+    // See SceneCache for the eviction policy.
+    void setSceneCacheBudget(size_t gpu_bytes, size_t cpu_bytes) {
+      scene_cache_.set_budget(gpu_bytes, cpu_bytes);
+      DeviceManager::get().set_scenes(this, scene_cache_.activated());
+    }
+    SceneCache::Stats getSceneCacheStats() const { return scene_cache_.stats(); }
+
     // Get the camera. Caller doesn't own pointer
     // Caller can use the returned camera to move around the scene.
     // After the loading a new scene, you'll need to call getCamera() again
@@ -97,6 +273,23 @@ class SUNCGRenderAPI {
     // Get the resolution.
     Geometry resolution() const { return geo_; }
 
+    // Change the resolution of the images rendered from now on, e.g. to
+    // evaluate at a higher resolution than for training, without another
+    // context. Throws std::logic_error if a frame of renderAsync() is
+    // pending, and std::invalid_argument if the context can't draw that
+    // size (times the supersampling of setAntialiasing()).
+    void setResolution(int w, int h);
+
+    // Antialias the images of render(), renderInto() and renderAsync() in
+    // RGB mode:
+    // samples: the number of MSAA samples per pixel, or 0 for none.
+    // supersampling: draw at supersampling times the resolution in both
+    //  dimensions, and average each block of pixels on the GPU. Throws
+    //  std::invalid_argument if the context can't draw that size.
+    // Other modes and render methods are not antialiased, as their labels
+    // and depths can't be averaged.
+    void setAntialiasing(int samples, int supersampling = 1);
+
     // r, g, b: integer in [0, 255]
     // Returns: an object name defined in the obj file, or "" if not found.
     // For SUNCG data, this object name is usually the "modelId" field
@@ -107,13 +300,97 @@ class SUNCGRenderAPI {
     }
 
     private:
+    // The APIs created with share=true on one device, whose contexts share
+    // objects. It has the pools of their scenes, with the vertex buffers by
+    // obj_file. Defined in render.cc.
+    struct ShareGroup;
+    static std::shared_ptr<ShareGroup> share_group_of_(int device);
+    static GLContext* create_context_(Geometry win_size, int device, ShareGroup* group);
+
+    int device_;
+
+    // Declared first, so they outlive the scenes and framebuffers which
+    // are deleted in context_.
+    std::shared_ptr<ShareGroup> share_group_;
+    std::unique_ptr<GLContext> context_;
+
+    GpuTimer gpu_timer_;   // of the draws, recorded as the zone "gpu:draw"
+
+    TexturePool texture_pool_;  // textures of the scenes in scene_cache_, so it has to outlive them
     SceneCache scene_cache_;
     SUNCGScene* scene_ = nullptr; // no ownership
+    MeshBatch::VertexLayout vertex_layout_ = MeshBatch::VertexLayout::FULL;
+    bool compressed_textures_ = false;
+    bool depth_prepass_ = false;
+    bool texture_streaming_ = false;
+    size_t texture_budget_ = 0;
+    // the smallest side the budget downgrades textures to
+    static const int kMinTextureSize = 32;
+
+    // Parse a scene, without activating it. Runs in any thread.
+    // The caller owns the returned pointer.
+    static SUNCGScene* parse_scene_(
+        const std::string& obj_file, const std::string& model_category_file,
+        const std::string& semantic_label_file, MeshBatch::VertexLayout layout);
+
+    // scenes parsed by prefetchScene() and not loaded yet, by obj_file.
+    // The futures own the scenes.
+    std::unordered_map<std::string, std::future<SUNCGScene*>> prefetched_;
+    static constexpr int kNumPrefetchWorkers = 2;
+    std::unique_ptr<ExecutorInThread> prefetch_workers_[kNumPrefetchWorkers];   // created on demand
+    int next_prefetch_worker_ = 0;
 
-    std::unique_ptr<GLContext> context_;
     std::unique_ptr<Camera> camera_;
     Geometry geo_;
-    Framebuffer fb_;
+    // the framebuffers below are of size geo_, and recreated by setResolution()
+    std::unique_ptr<Framebuffer> fb_;
+    std::unique_ptr<Framebuffer> resolved_fb_;   // fb_ after ResolvePass, ready to be read back
+    std::unique_ptr<Framebuffer> batch_fb_, batch_resolved_fb_;   // tiles of geo_ stacked vertically, created on demand
+    std::unique_ptr<Framebuffer> multi_fb_;   // one attachment per mode, created on demand
+    std::unique_ptr<Framebuffer> cube_fb_, cube_resolved_fb_;   // 6 faces side by side, created on demand
+    std::unique_ptr<Framebuffer> float_fb_, float_resolved_fb_;   // GL_R32F, created on demand
+    std::unique_ptr<Framebuffer> id_fb_, id_resolved_fb_;   // GL_R32UI, created on demand
+    // geo_ * supersampling_, created on demand. aa_fb_ is multisampled if
+    // msaa_samples_ > 0, and then resolved into aa_resolved_fb_
+    std::unique_ptr<Framebuffer> aa_fb_, aa_resolved_fb_;
+    int msaa_samples_ = 0, supersampling_ = 1;
+    ResolvePass resolve_;
+    std::unique_ptr<HistogramPass> histogram_;   // created on demand
+    std::unique_ptr<PixelPackRing> async_ring_;
+
+    // draw the scene from camera_ into the bound framebuffer
+    void draw_();
+    // Draw the scene from camera_ into fb_, or the antialiasing framebuffers.
+    // Returns the one for ResolvePass.
+    const Framebuffer& draw_frame_();
+    // draw the instance ids from camera_ into id_fb_
+    void draw_instance_ids_();
+
+    // how the output of a mode is packed
+    static ResolvePass::Packing packing_(SUNCGScene::RenderMode mode) {
+      return mode == SUNCGScene::RenderMode::DEPTH ?
+        ResolvePass::Packing::DEPTH_MASK : ResolvePass::Packing::RGB;
+    }
+    ResolvePass::Packing packing_() const { return packing_(scene_->get_mode()); }
+
+    // renderCubeMap() with one render() per face, when 6w is too wide for
+    // a single framebuffer
+    Matuc render_cube_map_by_face_();
+
+    // number of geo_-sized tiles that fit in one framebuffer
+    int max_batch_tiles_() const;
+
+    // renderBatch() of the views of camera matrices and eye positions
+    Matuc render_views_(const std::vector<glm::mat4>& matrices, const std::vector<glm::vec3>& eyes);
+
+    // throw std::invalid_argument if w * h isn't a size this context can
+    // draw with supersampling
+    void check_draw_size_(int w, int h, int supersampling) const;
+
+    // The max size of textures for setTextureStreaming() and setTextureBudget()
+    int texture_max_size_(const TextureRegistry& textures) const;
+    // apply it to the current scene
+    void update_textures_();
 
     // set camera "smartly" to some place in the scene
     void init_camera_() {
@@ -132,9 +409,10 @@ class SUNCGRenderAPI {
 // Note that this class is still NOT thread-safe. You cannot call its methods concurrently.
 class SUNCGRenderAPIThread {
   public:
-    SUNCGRenderAPIThread(int w, int h, int device) {
+    // share: see SUNCGRenderAPI
+    SUNCGRenderAPIThread(int w, int h, int device, bool share = false) {
       exec_.execute_sync([=]() {
-            this->api_.reset(new SUNCGRenderAPI{w, h, device});
+            this->api_.reset(new SUNCGRenderAPI{w, h, device, share});
           });
     }
 
@@ -150,10 +428,40 @@ class SUNCGRenderAPIThread {
           } );
     }
 
+    void setSceneCacheBudget(size_t gpu_bytes, size_t cpu_bytes) {
+      exec_.execute_sync([=]() {
+            this->api_->setSceneCacheBudget(gpu_bytes, cpu_bytes);
+          });
+    }
+    SceneCache::Stats getSceneCacheStats() {
+      return exec_.execute_sync<SceneCache::Stats>([=]() {
+            return this->api_->getSceneCacheStats();
+          });
+    }
+
     // caller doesn't own pointer
     Camera* getCamera() const { return api_->getCamera(); }
     void setMode(SUNCGScene::RenderMode m) { api_->setMode(m); }
+    SUNCGScene::RenderMode getMode() const { return api_->getMode(); }
+    void setCompactVertexLayout(bool compact) { api_->setCompactVertexLayout(compact); }
+    void setCompressedTextures(bool compressed) { api_->setCompressedTextures(compressed); }
+    void setDepthPrepass(bool enabled) { api_->setDepthPrepass(enabled); }
+    void setTextureStreaming(bool enabled) {
+      exec_.execute_sync([=]() { this->api_->setTextureStreaming(enabled); });
+    }
+    void setTextureBudget(size_t bytes) {
+      exec_.execute_sync([=]() { this->api_->setTextureBudget(bytes); });
+    }
     Geometry resolution() const { return api_->resolution(); }
+    int device() const { return api_->device(); }
+
+    void setResolution(int w, int h) {
+      exec_.execute_sync([=]() { this->api_->setResolution(w, h); });
+    }
+
+    void setAntialiasing(int samples, int supersampling) {
+      exec_.execute_sync([=]() { this->api_->setAntialiasing(samples, supersampling); });
+    }
 
     void loadScene(
         std::string obj_file, std::string model_category_file,
@@ -163,23 +471,183 @@ class SUNCGRenderAPIThread {
           });
     }
 
+    void prefetchScene(
+        std::string obj_file, std::string model_category_file,
+        std::string semantic_label_file) {
+      exec_.execute_sync([=]() {
+            this->api_->prefetchScene(obj_file, model_category_file, semantic_label_file);
+          });
+    }
+
+    void setRooms(const std::vector<glm::vec4>& rooms, const std::vector<AABB>& portals) {
+      exec_.execute_sync([&]() { this->api_->setRooms(rooms, portals); });
+    }
+
     Matuc render() {
       return exec_.execute_sync<Matuc>([=]() { return this->api_->render(); });
     }
 
+    void renderInto(unsigned char* dst) {
+      exec_.execute_sync([=]() { this->api_->renderInto(dst); });
+    }
+
+    std::vector<Matuc> renderMulti(const std::vector<SUNCGScene::RenderMode>& modes) {
+      return exec_.execute_sync<std::vector<Matuc>>([&]() {
+        return this->api_->renderMulti(modes);
+      });
+    }
+
+    // Render each (mode, camera) of views in order, with a single handoff to
+    // the render thread instead of one per view. The mode and camera of the
+    // last view stay set.
+    std::vector<Matuc> renderViews(
+        const std::vector<std::pair<SUNCGScene::RenderMode, Camera>>& views) {
+      std::vector<Matuc> ret(views.size());
+      std::vector<std::function<void()>> jobs;
+      for (size_t i = 0; i < views.size(); ++i)
+        jobs.emplace_back([this, &views, &ret, i]() {
+            this->api_->setMode(views[i].first);
+            *this->api_->getCamera() = views[i].second;
+            ret[i] = this->api_->render();
+          });
+      exec_.execute_batch(jobs);
+      return ret;
+    }
+
+    int numChannels() const { return api_->numChannels(); }
+
     Matuc renderCubeMap() {
       return exec_.execute_sync<Matuc>([=]() {
         return this->api_->renderCubeMap();
       });
     }
 
+    Mat32f renderDepth() {
+      return exec_.execute_sync<Mat32f>([&]() {
+        return this->api_->renderDepth();
+      });
+    }
+
+    Mat32u renderInstanceIds() {
+      return exec_.execute_sync<Mat32u>([&]() {
+        return this->api_->renderInstanceIds();
+      });
+    }
+
+    Matuc renderBatch(const std::vector<Camera>& cameras) {
+      return exec_.execute_sync<Matuc>([&]() {
+        return this->api_->renderBatch(cameras);
+      });
+    }
+
+    Matuc renderBatch(const CameraBatch& cameras) {
+      return exec_.execute_sync<Matuc>([&]() {
+        return this->api_->renderBatch(cameras);
+      });
+    }
+
+    Matuc renderRig(const CameraRig& rig) {
+      return exec_.execute_sync<Matuc>([&]() {
+        return this->api_->renderRig(rig);
+      });
+    }
+
+    // Start rendering the current view and return immediately.
+    // The returned future must not outlive this object. Its get() waits for
+    // the frame in the render thread, so the caller can keep working (e.g.
+    // step other environments) while the frame is drawn and transferred.
+    // The frame of a future destroyed without get() is discarded.
+    std::future<Matuc> renderAsync() {
+      int id = exec_.execute_sync<int>([=]() {
+        // free a slot by moving the oldest frame to host memory
+        if (api_->numPendingFrames() == api_->asyncDepth())
+          this->collect_one_();
+        api_->renderAsync();
+        return num_async_started_++;
+      });
+      std::shared_ptr<AsyncTicket> ticket{new AsyncTicket{this, id}};
+      return std::async(std::launch::deferred, [=]() {
+        ticket->claimed = true;
+        return exec_.execute_sync<Matuc>([=]() {
+          while (this->num_async_collected_ <= id)
+            this->collect_one_();
+          auto itr = async_results_.find(id);
+          Matuc ret = std::move(itr->second);
+          async_results_.erase(itr);
+          return ret;
+        });
+      });
+    }
+
     std::string getNameFromInstanceColor(int r, int g, int b) const {
         return this->api_->getNameFromInstanceColor(r, g, b);
     }
 
+    std::vector<std::string> getInstanceNames() const {
+        return this->api_->getInstanceNames();
+    }
+
+    std::vector<int> countInstancePixels() {
+      return exec_.execute_sync<std::vector<int>>([&]() {
+        return this->api_->countInstancePixels();
+      });
+    }
+
+    std::vector<SUNCGScene::RayHit> raycast(const std::vector<glm::vec3>& origins,
+        const std::vector<glm::vec3>& dirs) {
+      return exec_.execute_sync<std::vector<SUNCGScene::RayHit>>([&]() {
+        return this->api_->raycast(origins, dirs);
+      });
+    }
+
+    std::vector<int> queryAABB(const AABB& box) {
+      return exec_.execute_sync<std::vector<int>>([&]() {
+        return this->api_->queryAABB(box);
+      });
+    }
+
+    void setObjectTransform(int instance, const glm::mat4& transform) {
+      exec_.execute_sync([&]() { this->api_->setObjectTransform(instance, transform); });
+    }
+    glm::mat4 getObjectTransform(int instance) const { return api_->getObjectTransform(instance); }
+    void setObjectVisible(int instance, bool visible) {
+      exec_.execute_sync([=]() { this->api_->setObjectVisible(instance, visible); });
+    }
+    bool isObjectVisible(int instance) const { return api_->isObjectVisible(instance); }
+
     private:
     std::unique_ptr<SUNCGRenderAPI> api_;
     ExecutorInThread exec_;
+
+    // bookkeeping of renderAsync(). Only accessed in the render thread.
+    int num_async_started_ = 0, num_async_collected_ = 0;
+    std::unordered_map<int, Matuc> async_results_;   // collected but not claimed yet
+    std::unordered_set<int> async_abandoned_;   // not collected yet, nor ever claimed
+    void collect_one_() {
+      int id = num_async_collected_++;
+      Matuc frame = api_->collect();
+      if (!async_abandoned_.erase(id))
+        async_results_[id] = std::move(frame);
+    }
+
+    // Held by the future of a frame of renderAsync(): if the future is
+    // destroyed without get(), the frame is dropped.
+    struct AsyncTicket {
+      SUNCGRenderAPIThread* self;
+      int id;
+      bool claimed = false;
+      AsyncTicket(SUNCGRenderAPIThread* self, int id): self{self}, id{id} {}
+      ~AsyncTicket() {
+        if (claimed)
+          return;
+        SUNCGRenderAPIThread* api = self;
+        int id = this->id;
+        api->exec_.execute_sync([=]() {
+          if (!api->async_results_.erase(id))
+            api->async_abandoned_.insert(id);
+        });
+      }
+    };
 };
 
 }
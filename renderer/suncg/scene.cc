@@ -8,8 +8,8 @@
 #include "scene.hh"
 #include "model/shader.hh"
 
-#include "category.hh"
-
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 using namespace std;
@@ -36,18 +36,85 @@ std::vector<glm::vec3> get_uniform_sampled_colors(int count) {
   return result;
 }
 
+glm::vec3 transform_point(const glm::mat4& t, const glm::vec3& p) {
+  glm::vec4 q = t * glm::vec4{p, 1.f};
+  return glm::vec3{q.x, q.y, q.z};
+}
 
 }
 
 namespace render {
 
+// The sources below are compiled once per SUNCGShader::Program, with one of
+// these defined (see SUNCGShader::defines_()):
+//  PROGRAM_LIGHTING, PROGRAM_LABEL, PROGRAM_INSTANCE, PROGRAM_DEPTH,
+//  PROGRAM_INVDEPTH: only the output of that mode is computed.
+//  PROGRAM_MULTI_TARGET: the outputs of all modes, see draw_multi_target().
+//  PROGRAM_LINEAR_DEPTH: the depth in meters, see draw_linear_depth().
+//  PROGRAM_INSTANCE_ID: the instance id, see draw_instance_ids().
+//  nothing: the mode is chosen at runtime by the `mode` uniform.
+// POSITION_ONLY is also defined for the modes that don't need normals or
+// texcoords, which then don't pass through the pipeline.
+const char* SUNCGShader::vShader = R"xxx(
+#version 330 core
+layout (location = 0) in vec3 posIn;
+layout (location = 3) in int meshidIn;
+out vec3 pos;
+flat out int meshid;
+#ifndef POSITION_ONLY
+layout (location = 1) in vec3 normalIn;
+layout (location = 2) in vec2 texcoordIn;
+out vec3 normal;
+out vec2 texcoord;
+#endif
+
+uniform mat4 projection;
+// the same in all programs, for the GL_EQUAL pass after the depth pre-pass
+invariant gl_Position;
+
+// the model matrix of the object of each mesh, see SUNCGScene::set_object_transform()
+uniform samplerBuffer materials;
+uniform samplerBuffer transforms;
+mat4 ObjectTransform(int mesh) {
+    int k = 4 * int(texelFetch(materials, mesh * 4 + 3).w);
+    return mat4(texelFetch(transforms, k), texelFetch(transforms, k + 1),
+                texelFetch(transforms, k + 2), texelFetch(transforms, k + 3));
+}
+
+void main()
+{
+    mat4 model = ObjectTransform(meshidIn);
+#ifndef POSITION_ONLY
+    texcoord = texcoordIn;
+    normal = normalize(mat3(model) * normalIn);
+#endif
+    pos = (model * vec4(posIn, 1.0f)).xyz;
+    meshid = meshidIn;
+    gl_Position = projection * vec4(pos, 1.0f);
+}
+)xxx";
+
 const char* SUNCGShader::fShader = R"xxx(
 #version 330 core
 
 in vec3 pos;
+flat in int meshid;
+#ifndef POSITION_ONLY
 in vec3 normal;
 in vec2 texcoord;
-out vec4 fragcolor;
+#endif
+// location i is the output of SUNCGScene::RenderMode i, see draw_multi_target()
+#ifdef PROGRAM_INSTANCE_ID
+layout(location = 0) out uint instance_id;
+#else
+layout(location = 0) out vec4 fragcolor;
+#endif
+#ifdef PROGRAM_MULTI_TARGET
+layout(location = 1) out vec4 semantic_out;
+layout(location = 2) out vec4 depth_out;
+layout(location = 3) out vec4 instance_out;
+layout(location = 4) out vec4 invdepth_out;
+#endif
 
 // Note these values need to match DEFAULT_NEAR and DEFAULT_FAR in camera.h
 const float NEAR = 0.1f;
@@ -59,15 +126,21 @@ const float DEPTH_SCALE = 20.0f;
 uniform uint mode;
 // 0: light + texture
 // 1: light
-// 2: const Kd
+// 2: semantic label color
 // 3: depth
-uniform vec3 Kd;
-uniform vec3 Ka;
+// 4: inverse depth
+// 5: instance color
+// Programs of one mode only read it for lighting, as 0 or 1.
 uniform vec3 eye;
-uniform float dissolve;
 uniform sampler2D texture_diffuse;
 uniform float minDepth = NEAR;
 
+// per-mesh data, indexed by meshid. See SUNCGScene::MaterialTexel
+uniform samplerBuffer materials;
+vec4 Material(int k) {
+    return texelFetch(materials, meshid * 4 + k);
+}
+
 // Convert depth buffer value to inverse depth.
 // The depth buffer value <d> is 0.0 for INV_NEAR, 1.0 for INV_FAR.
 float InverseDepth(float d) {
@@ -79,28 +152,27 @@ float TrueDepth(float d) {
     return 1.0f / InverseDepth(d);
 }
 
-void main() {
-    if (mode == 2u) { // constant
-      fragcolor = vec4(Kd, 1.0f);
-      return;
-    }
-    else if (mode == 3u) { // depth
-      float scaledDepth = TrueDepth(gl_FragCoord.z) / DEPTH_SCALE;
-      fragcolor = vec4(vec3(scaledDepth), 1.0f);
-      return;
-    }
-    else if (mode == 4u) { // inverse depth
-      float invDepth = InverseDepth(gl_FragCoord.z);
-      // invDepth \in [INV_FAR, INV_NEAR] i.e., [0.01, 10.0] with above values.
-      // We convert to 16 bits, with 65535 corresponding to INV_NEAR
-      float f = 65535 * minDepth * invDepth + 0.5; // \in [0.0, 65535.0]
-      float ms = floor(f/256.0f); // \in {0.0, .., 255.0}
-      float ls = floor(f - ms * 256.0f); // \in {0.0, .., 255.0}
-      fragcolor = vec4(ms/255.0f, ls/255.0f, 0.0f, 1.0f);
-      return;
-    }
+vec4 DepthColor() {
+    float scaledDepth = TrueDepth(gl_FragCoord.z) / DEPTH_SCALE;
+    return vec4(vec3(scaledDepth), 1.0f);
+}
+
+vec4 InverseDepthColor() {
+    float invDepth = InverseDepth(gl_FragCoord.z);
+    // invDepth \in [INV_FAR, INV_NEAR] i.e., [0.01, 10.0] with above values.
+    // We convert to 16 bits, with 65535 corresponding to INV_NEAR
+    float f = 65535 * minDepth * invDepth + 0.5; // \in [0.0, 65535.0]
+    float ms = floor(f/256.0f); // \in {0.0, .., 255.0}
+    float ls = floor(f - ms * 256.0f); // \in {0.0, .., 255.0}
+    return vec4(ms/255.0f, ls/255.0f, 0.0f, 1.0f);
+}
 
-    float alpha = dissolve;
+#ifndef POSITION_ONLY
+vec4 LightingColor() {
+    vec4 Kd_dissolve = Material(0);
+    vec3 Kd = Kd_dissolve.rgb;
+    vec3 Ka = Material(1).rgb;
+    float alpha = Kd_dissolve.a;
     vec3 color;
     switch(mode) {
       case 0u:
@@ -119,45 +191,209 @@ void main() {
     vec3 ambient = Ka * 0.1f;
     color = color * scale + ambient;
     color = clamp(color, 0.0f, 1.0f);
-    fragcolor = vec4(color, alpha);
+    return vec4(color, alpha);
+}
+#endif
+
+void main() {
+#if defined(PROGRAM_MULTI_TARGET)
+    fragcolor = LightingColor();
+    semantic_out = vec4(Material(2).rgb, 1.0f);
+    depth_out = DepthColor();
+    instance_out = vec4(Material(3).rgb, 1.0f);
+    invdepth_out = InverseDepthColor();
+#elif defined(PROGRAM_LIGHTING)
+    fragcolor = LightingColor();
+#elif defined(PROGRAM_LABEL)
+    fragcolor = vec4(Material(2).rgb, 1.0f);
+#elif defined(PROGRAM_INSTANCE)
+    fragcolor = vec4(Material(3).rgb, 1.0f);
+#elif defined(PROGRAM_DEPTH)
+    fragcolor = DepthColor();
+#elif defined(PROGRAM_INVDEPTH)
+    fragcolor = InverseDepthColor();
+#elif defined(PROGRAM_INSTANCE_ID)
+    instance_id = uint(Material(3).a);
+#elif defined(PROGRAM_LINEAR_DEPTH)
+    fragcolor = vec4(TrueDepth(gl_FragCoord.z), 0.0f, 0.0f, 1.0f);
+#else
+    if (mode == 2u) { // semantic
+      fragcolor = vec4(Material(2).rgb, 1.0f);
+    }
+    else if (mode == 5u) { // instance
+      fragcolor = vec4(Material(3).rgb, 1.0f);
+    }
+    else if (mode == 3u) { // depth
+      fragcolor = DepthColor();
+    }
+    else if (mode == 4u) { // inverse depth
+      fragcolor = InverseDepthColor();
+    } else {
+      fragcolor = LightingColor();
+    }
+#endif
 }
 )xxx";
 
-SUNCGShader::SUNCGShader():
-  Shader{BasicShader::vShader, fShader} {
+string SUNCGShader::defines_(Program program) {
+  switch (program) {
+    case Program::LIGHTING: return "#define PROGRAM_LIGHTING\n";
+    case Program::LABEL: return "#define PROGRAM_LABEL\n#define POSITION_ONLY\n";
+    case Program::INSTANCE: return "#define PROGRAM_INSTANCE\n#define POSITION_ONLY\n";
+    case Program::DEPTH: return "#define PROGRAM_DEPTH\n#define POSITION_ONLY\n";
+    case Program::INVDEPTH: return "#define PROGRAM_INVDEPTH\n#define POSITION_ONLY\n";
+    case Program::MULTI_TARGET: return "#define PROGRAM_MULTI_TARGET\n";
+    case Program::LINEAR_DEPTH: return "#define PROGRAM_LINEAR_DEPTH\n#define POSITION_ONLY\n";
+    case Program::INSTANCE_ID: return "#define PROGRAM_INSTANCE_ID\n#define POSITION_ONLY\n";
+    case Program::ANY: return "";
+  }
+  return "";
+}
+
+string SUNCGShader::specialize_(const char* source, const string& defines) {
+  // the defines have to follow the #version line
+  string src{source};
+  if (defines.empty())
+    return src;
+  auto pos = src.find("#version");
+  m_assert(pos != string::npos);
+  pos = src.find('\n', pos) + 1;
+  return src.insert(pos, defines);
+}
+
+SUNCGShader::SUNCGShader(Program program):
+  SUNCGShader{specialize_(vShader, defines_(program)).c_str(), nullptr, defines_(program)} {}
+
+SUNCGShader::SUNCGShader(const char* vertexShader, const char* geometryShader,
+    const string& defines):
+  Shader{vertexShader, geometryShader, specialize_(fShader, defines).c_str()} {
 
-  Kd_loc = getUniformLocation("Kd");
-  Ka_loc = getUniformLocation("Ka");
   mode_loc = getUniformLocation("mode");
   texture_loc = getUniformLocation("texture_diffuse");
-  dissolve_loc = getUniformLocation("dissolve");
+  materials_loc = getUniformLocation("materials");
+  transforms_loc = getUniformLocation("transforms");
   minDepth_loc = getUniformLocation("minDepth");
   };
 
+const char* SUNCGCubeMapShader::vShader = R"xxx(
+#version 330 core
+layout (location = 0) in vec3 posIn;
+layout (location = 1) in vec3 normalIn;
+layout (location = 2) in vec2 texcoordIn;
+layout (location = 3) in int meshidIn;
+
+out vec3 vpos;
+out vec3 vnormal;
+out vec2 vtexcoord;
+flat out int vmeshid;
+
+// the same as in SUNCGShader::vShader
+uniform samplerBuffer materials;
+uniform samplerBuffer transforms;
+mat4 ObjectTransform(int mesh) {
+    int k = 4 * int(texelFetch(materials, mesh * 4 + 3).w);
+    return mat4(texelFetch(transforms, k), texelFetch(transforms, k + 1),
+                texelFetch(transforms, k + 2), texelFetch(transforms, k + 3));
+}
+
+void main()
+{
+    mat4 model = ObjectTransform(meshidIn);
+    vtexcoord = texcoordIn;
+    vnormal = normalize(mat3(model) * normalIn);
+    vpos = (model * vec4(posIn, 1.0f)).xyz;
+    vmeshid = meshidIn;
+}
+)xxx";
+
+const char* SUNCGCubeMapShader::gShader = R"xxx(
+#version 330 core
+#define NR_FACE 6
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;   // 3 * NR_FACE
+
+in vec3 vpos[];
+in vec3 vnormal[];
+in vec2 vtexcoord[];
+flat in int vmeshid[];
+
+out vec3 pos;
+out vec3 normal;
+out vec2 texcoord;
+flat out int meshid;
+
+uniform mat4 face_projection[NR_FACE];
+
+void main() {
+  for (int f = 0; f < NR_FACE; ++f) {
+    vec4 p[3];
+    for (int i = 0; i < 3; ++i)
+      p[i] = face_projection[f] * vec4(vpos[i], 1.0f);
+    // skip the faces where the triangle is entirely outside of one frustum plane
+    bvec3 out_left = bvec3(p[0].x < -p[0].w, p[1].x < -p[1].w, p[2].x < -p[2].w);
+    bvec3 out_right = bvec3(p[0].x > p[0].w, p[1].x > p[1].w, p[2].x > p[2].w);
+    bvec3 out_bottom = bvec3(p[0].y < -p[0].w, p[1].y < -p[1].w, p[2].y < -p[2].w);
+    bvec3 out_top = bvec3(p[0].y > p[0].w, p[1].y > p[1].w, p[2].y > p[2].w);
+    bvec3 out_near = bvec3(p[0].z < -p[0].w, p[1].z < -p[1].w, p[2].z < -p[2].w);
+    if (all(out_left) || all(out_right) || all(out_bottom) || all(out_top) || all(out_near))
+      continue;
+
+    for (int i = 0; i < 3; ++i) {
+      // clip to the frustum of this face, since it no longer spans the viewport
+      gl_ClipDistance[0] = p[i].w + p[i].x;
+      gl_ClipDistance[1] = p[i].w - p[i].x;
+      // map x from [-w, w] to the f-th of NR_FACE horizontal tiles
+      float x = (p[i].x + p[i].w * float(2 * f + 1)) / float(NR_FACE) - p[i].w;
+      gl_Position = vec4(x, p[i].yzw);
+      pos = vpos[i];
+      normal = vnormal[i];
+      texcoord = vtexcoord[i];
+      meshid = vmeshid[i];
+      EmitVertex();
+    }
+    EndPrimitive();
+  }
+}
+)xxx";
+
+SUNCGCubeMapShader::SUNCGCubeMapShader(): SUNCGShader{vShader, gShader, ""} {
+  face_projection_loc = getUniformLocation("face_projection");
+}
+
 
 SUNCGScene::SUNCGScene(string obj_file, string model_category_file,
-    string semantic_label_file, float minDepth):
+    string semantic_label_file, float minDepth,
+    MeshBatch::VertexLayout layout):
   ObjSceneBase{obj_file},
   textures_{obj_.materials, obj_.base_dir},
-  model_category_{model_category_file},
-  semantic_color_{semantic_label_file},
+  labels_{SemanticLabels::get(model_category_file, semantic_label_file)},
   minDepth_{minDepth}
 {
-    background_color_ = semantic_color_.get_background_color();
+    background_color_ = labels_->background_color();
 
     // use FINE_GRAINED if color mapping > 128
-    if (semantic_color_.size() > 128)
+    if (labels_->nr_colors() > 128)
       set_object_name_resolution_mode(ObjectNameResolution::FINE);
 
     // filter out person
-    model_category_.filter_category(obj_.shapes, {"person"});
+    int person = labels_->class_id("person");
+    auto& shapes = obj_.shapes;
+    shapes.erase(remove_if(shapes.begin(), shapes.end(), [&](const ObjLoader::Shape& shape) {
+          if (!labels_->is_coarse_class(shape.name, person))
+            return false;
+          print_debug("Removing %s of class person\n", shape.name.c_str());
+          return true;
+        }), shapes.end());
     // split shapes
     obj_.split_shapes_by_material();
     obj_.printInfo();
     obj_.sort_by_transparent(textures_);
 
     parse_scene();
-    activate();
+    build_bvh_();
+    build_instance_ids_();
+    labels_.reset();
+    mesh_.set_layout(layout);
 }
 
 void SUNCGScene::activate() {
@@ -165,44 +401,86 @@ void SUNCGScene::activate() {
   int nr_mesh = mesh_.size();
   m_assert(nr_mesh == (int)materials_.size());
 
+  std::vector<MaterialTexel> texels;
+  texels.reserve(nr_mesh);
   for (int i = 0; i < nr_mesh; ++i) {
     MaterialDesc& material = materials_[i];
     material.texture = textures_.get(material.m->diffuse_texname);
-    mesh_[i].activate();
+    static_assert(
+        std::is_same<std::decay<
+        decltype(material.m->diffuse[0])>::type, GLfloat>::value,
+        "tinyobj material type incompatible with GLfloat!");
+    auto d = material.m->diffuse, a = material.m->ambient;
+    texels.push_back(MaterialTexel{
+        {d[0], d[1], d[2], material.m->dissolve},
+        {a[0], a[1], a[2], 0.f},
+        glm::vec4{material.label_color, 0.f},
+        glm::vec4{material.instance_color, (float)instance_ids_[i]}});
+  }
+  mesh_.activate();
+
+  // transparent meshes are last, see ObjLoader::sort_by_transparent
+  nr_opaque_ = 0;
+  while (nr_opaque_ < nr_mesh) {
+    auto& m = *materials_[nr_opaque_].m;
+    if (m.dissolve < 1.0 || (!m.diffuse_texname.empty() &&
+          textures_.is_transparent(m.diffuse_texname)))
+      break;
+    ++nr_opaque_;
   }
+
+  GLint max_texels;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  if ((long)nr_mesh * 4 > max_texels)
+    error_exit(ssprintf("Scene has %d meshes, but GL_MAX_TEXTURE_BUFFER_SIZE is %d!",
+          nr_mesh, max_texels));
+  glGenBuffers(1, material_buffer_);
+  glBindBuffer(GL_TEXTURE_BUFFER, material_buffer_);
+  glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(MaterialTexel),
+      texels.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glGenTextures(1, material_texture_);
+  glBindTexture(GL_TEXTURE_BUFFER, material_texture_);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, material_buffer_);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  std::vector<glm::mat4> transforms = object_transforms_;
+  transforms.resize(instance_names_.size(), glm::mat4{1.f});
+  glGenBuffers(1, transform_buffer_);
+  glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer_);
+  glBufferData(GL_TEXTURE_BUFFER, transforms.size() * sizeof(glm::mat4),
+      transforms.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glGenTextures(1, transform_texture_);
+  glBindTexture(GL_TEXTURE_BUFFER, transform_texture_);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transform_buffer_);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
 }
 
-void SUNCGScene::deactivate() {
-  for (auto& m : mesh_)
-    m.deactivate();
+void SUNCGScene::set_texture_max_size(int max_size) {
+  textures_.set_max_size(max_size);
+  if (!textures_.activated() || textures_.max_size_active() == max_size)
+    return;
   textures_.deactivate();
+  textures_.activate();
+  // the order of the meshes stays: the textures are only uploaded again
+  for (auto& material : materials_)
+    material.texture = textures_.get(material.m->diffuse_texname);
 }
 
-glm::vec3 SUNCGScene::get_color_by_shape_name(const string& name) {
-  if (name.find("Model#") == 0) {
-    int size_prefix = 6;  // len(Model#)
-    string model_id = name.substr(size_prefix);
-    string klass = name_from_mode_id(model_id);
-    glm::vec3 color = semantic_color_.get_color(klass);
-    //print_debug("Shape %s, Class: %s -> color %f,%f,%f\n", name.c_str(), klass.c_str(), color.x, color.y, color.z);
-    return color;
-  } else if (name == "Ground") {
-    return semantic_color_.get_color("Ground");
-  } else {
-    auto split = name.find('#');
-    if (split != string::npos) {
-      string klass = name.substr(0, split);
-
-      if (klass == "WallInside" or klass == "WallOutside")
-        klass = "Wall";
-      glm::vec3 color = semantic_color_.get_color(klass);
-      //print_debug("Shape %s, Class: %s -> color %f,%f,%f\n", name.c_str(), klass.c_str(), color.x, color.y, color.z);
-      return color;
-    }
-  }
-  print_debug("Failed to get color for shape %s\n", name.c_str());
-  // TODO
-  return background_color_;
+void SUNCGScene::deactivate() {
+  mesh_.deactivate();
+  if (material_texture_)
+    glDeleteTextures(1, material_texture_);
+  if (material_buffer_)
+    glDeleteBuffers(1, material_buffer_);
+  material_texture_.obj = material_buffer_.obj = 0;
+  if (transform_texture_)
+    glDeleteTextures(1, transform_texture_);
+  if (transform_buffer_)
+    glDeleteBuffers(1, transform_buffer_);
+  transform_texture_.obj = transform_buffer_.obj = 0;
+  textures_.deactivate();
 }
 
 void SUNCGScene::parse_scene() {
@@ -211,10 +489,12 @@ void SUNCGScene::parse_scene() {
   x = std::numeric_limits<float>::lowest();
   boxmax_ = {x, x, x};
   auto rand_instance_colors = get_uniform_sampled_colors(obj_.original_num_shapes);
+  std::vector<Vertex> vertices;
 
   for (size_t i = 0; i < obj_.shapes.size(); i++) {
     auto& shp = obj_.shapes[i];
-    glm::vec3 label_color = get_color_by_shape_name(shp.name);
+    glm::vec3 label_color = labels_->shape_color(
+        shp.name, object_name_mode_ == ObjectNameResolution::FINE);
     glm::vec3 instance_color = rand_instance_colors[shp.original_index];
     int instance_color_key = (int)instance_color.x * 256 * 256 + (int)instance_color.y * 256 + (int)instance_color.z;
     instance_color_to_name_[instance_color_key] = shp.name;
@@ -226,74 +506,364 @@ void SUNCGScene::parse_scene() {
     m_assert(nr_face > 0);
 
     int mid = matids[0];
-    mesh_.emplace_back();
     // Assume that obj_.materials won't change size any more
     materials_.emplace_back(MaterialDesc{mid, label_color, instance_color, 0UL, &obj_.materials[mid]});
 
+    vertices.clear();
     for (int f = 0; f < nr_face; ++f) {
       auto face = obj_.convertFace(tmesh, f);
       for (auto& v : face) {
-        mesh_.back().vertices.emplace_back(move(v));
+        vertices.emplace_back(move(v));
         boxmin_ = glm::min(boxmin_, v.pos);
         boxmax_ = glm::max(boxmax_, v.pos);
       }
     }
+    mesh_.add(vertices);
   }
-  mesh_.shrink_to_fit();
   obj_.shapes.clear();
   obj_.shapes.shrink_to_fit();
 }
 
-void SUNCGScene::draw() {
+SUNCGCubeMapShader* SUNCGScene::get_cube_map_shader() {
+  if (!cube_map_shader_)
+    cube_map_shader_.reset(new SUNCGCubeMapShader);
+  return cube_map_shader_.get();
+}
+
+SUNCGShader::Program SUNCGScene::program_of_(RenderMode mode) {
+  switch (mode) {
+    case RenderMode::RGB: return SUNCGShader::Program::LIGHTING;
+    case RenderMode::SEMANTIC: return SUNCGShader::Program::LABEL;
+    case RenderMode::INSTANCE: return SUNCGShader::Program::INSTANCE;
+    case RenderMode::DEPTH: return SUNCGShader::Program::DEPTH;
+    case RenderMode::INVDEPTH: return SUNCGShader::Program::INVDEPTH;
+  }
+  throw runtime_error("unknown render mode");
+}
+
+SUNCGShader* SUNCGScene::get_program_(SUNCGShader::Program program) {
+  auto& ptr = programs_[static_cast<int>(program)];
+  if (!ptr)
+    ptr.reset(new SUNCGShader{program});
+  return ptr.get();
+}
+
+void SUNCGScene::draw() { draw_(*get_program_(program_of_(mode_)), nullptr); }
+
+void SUNCGScene::draw(const glm::mat4& camera_matrix) {
+  draw_(*get_program_(program_of_(mode_)), &camera_matrix);
+}
+
+void SUNCGScene::draw_(const SUNCGShader& shader, const glm::mat4* camera_matrix) {
   glClearColor(background_color_.x, background_color_.y, background_color_.z, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  bind_materials_(shader);
 
-  int nr_mesh = mesh_.size();
   if (mode_ == RenderMode::RGB) {
-    for (int i = 0; i < nr_mesh; ++i) {
-      const auto& material = materials_[i];
-      static_assert(
-          std::is_same<std::decay<
-          decltype(material.m->diffuse[0])>::type, GLfloat>::value,
-          "tinyobj material type incompatible with GLfloat!");
-      glUniform3fv(shader_.Kd_loc, 1, (GLfloat*)&material.m->diffuse);
-      glUniform3fv(shader_.Ka_loc, 1, (GLfloat*)&material.m->ambient);
-      glUniform1f(shader_.dissolve_loc, material.m->dissolve);
-
-      auto mode = SUNCGShader::RenderMode::LIGHTING;
-      if (material.texture) {
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(shader_.texture_loc, 0);  // use TU0
-        mode = SUNCGShader::RenderMode::TEXTURE_LIGHTING;
-      }
-      glUniform1ui(shader_.mode_loc, static_cast<GLuint>(mode));
-
-      TextureGuard TG{material.texture};
-      mesh_[i].draw();
+    if (depth_prepass_ && camera_matrix && nr_opaque_ > 0) {
+      draw_depth_prepass_(shader, *camera_matrix);
+      // the opaque meshes only shade the fragments that are visible
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+      draw_by_texture_(shader, 0, nr_opaque_);
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_TRUE);
+      draw_by_texture_(shader, nr_opaque_, mesh_.size());
+    } else {
+      draw_by_texture_(shader, 0, mesh_.size());
     }
   } else if (mode_ == RenderMode::SEMANTIC || mode_ == RenderMode::INSTANCE) {
-    auto mode = SUNCGShader::RenderMode::CONSTANT;
-    for (int i = 0; i < nr_mesh; ++i) {
-      glm::vec3 color = mode_ == RenderMode::SEMANTIC ?
-        materials_[i].label_color : materials_[i].instance_color;
-      glUniform3fv(shader_.Kd_loc, 1, (GLfloat*)&color);
-      glUniform1ui(shader_.mode_loc, static_cast<GLuint>(mode));
-      mesh_[i].draw();
-    }
+    auto mode = mode_ == RenderMode::SEMANTIC ?
+      SUNCGShader::RenderMode::LABEL : SUNCGShader::RenderMode::INSTANCE;
+    glUniform1ui(shader.mode_loc, static_cast<GLuint>(mode));
+    draw_meshes_(0, mesh_.size(), true);
   } else if (mode_ == RenderMode::DEPTH) {
     auto mode = SUNCGShader::RenderMode::DEPTH;
-    glUniform1ui(shader_.mode_loc, static_cast<GLuint>(mode));
-    for (int i = 0; i < nr_mesh; ++i)
-      mesh_[i].draw();
+    glUniform1ui(shader.mode_loc, static_cast<GLuint>(mode));
+    draw_meshes_(0, mesh_.size(), true);
   } else if (mode_ == RenderMode::INVDEPTH) {
     auto mode = SUNCGShader::RenderMode::INVDEPTH;
-    glUniform1ui(shader_.mode_loc, static_cast<GLuint>(mode));
-    glUniform1f(shader_.minDepth_loc, minDepth_);
-    for (int i = 0; i < nr_mesh; ++i)
-      mesh_[i].draw();
+    glUniform1ui(shader.mode_loc, static_cast<GLuint>(mode));
+    glUniform1f(shader.minDepth_loc, minDepth_);
+    draw_meshes_(0, mesh_.size(), true);
   } else {
     throw runtime_error("unknown render mode");
   }
+  unbind_materials_();
+  culling_ = false;
+}
+
+void SUNCGScene::draw_multi_target() {
+  glClearColor(background_color_.x, background_color_.y, background_color_.z, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  auto& shader = *get_program_(SUNCGShader::Program::MULTI_TARGET);
+  bind_materials_(shader);
+
+  glUniform1f(shader.minDepth_loc, minDepth_);
+  draw_by_texture_(shader, 0, mesh_.size());
+  unbind_materials_();
+  culling_ = false;
+}
+
+void SUNCGScene::draw_linear_depth() {
+  glClearColor(0.f, 0.f, 0.f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  // for the object transforms
+  bind_materials_(*get_program_(SUNCGShader::Program::LINEAR_DEPTH));
+  draw_meshes_(0, mesh_.size(), true);
+  unbind_materials_();
+  culling_ = false;
+}
+
+void SUNCGScene::draw_instance_ids() {
+  const GLuint background[4] = {0, 0, 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, background);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  auto& shader = *get_program_(SUNCGShader::Program::INSTANCE_ID);
+  bind_materials_(shader);
+  draw_meshes_(0, mesh_.size(), true);
+  unbind_materials_();
+  culling_ = false;
+}
+
+void SUNCGScene::build_triangle_bvh_() {
+  if (triangles_.built())
+    return;
+  auto& vertices = mesh_.vertices();
+  auto& indices = mesh_.indices();
+  std::vector<glm::vec3> corners(indices.size());
+  for (size_t k = 0; k < indices.size(); ++k)
+    corners[k] = vertices[indices[k]].pos;
+  if (!object_transforms_.empty()) {
+    auto& first = mesh_.first_indices();
+    for (int i = 0; i < mesh_.size(); ++i) {
+      int instance = instance_ids_[i];
+      const glm::mat4& t = object_transforms_[instance];
+      for (int k = first[i]; k < first[i + 1]; ++k) {
+        // hidden triangles are degenerate, which rays never hit
+        if (!object_visible_[instance])
+          corners[k] = corners[first[i]];
+        else
+          corners[k] = transform_point(t, corners[k]);
+      }
+    }
+  }
+  triangles_.build(move(corners));
+}
+
+int SUNCGScene::mesh_of_triangle_(int k) const {
+  auto& first = mesh_.first_indices();
+  return upper_bound(first.begin(), first.end(), 3 * k) - first.begin() - 1;
+}
+
+SUNCGScene::RayHit SUNCGScene::cast_ray(const glm::vec3& origin, const glm::vec3& dir,
+    float max_distance, bool back_faces) const {
+  m_assert(triangles_.built());
+  auto hit = triangles_.raycast(origin, dir, max_distance, back_faces);
+  if (hit.triangle < 0)
+    return RayHit{hit.t, 0, -1};
+  int mesh = mesh_of_triangle_(hit.triangle);
+  return RayHit{hit.t, instance_ids_[mesh], mesh};
+}
+
+std::vector<SUNCGScene::RayHit> SUNCGScene::raycast(
+    const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& dirs) {
+  m_assert(origins.size() == dirs.size());
+  build_triangle_bvh_();
+  std::vector<RayHit> ret(origins.size());
+  for (size_t i = 0; i < origins.size(); ++i)
+    ret[i] = cast_ray(origins[i], glm::normalize(dirs[i]),
+        std::numeric_limits<float>::infinity(), true);
+  return ret;
+}
+
+std::vector<int> SUNCGScene::query_aabb(const AABB& box) {
+  build_triangle_bvh_();
+  std::vector<int> triangles;
+  triangles_.query(box, triangles);
+  std::vector<int> ret;
+  for (int k : triangles) {
+    int instance = instance_ids_[mesh_of_triangle_(k)];
+    if (object_visible_.empty() || object_visible_[instance])
+      ret.push_back(instance);
+  }
+  sort(ret.begin(), ret.end());
+  ret.erase(unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+void SUNCGScene::build_instance_ids_() {
+  std::vector<int> colors;
+  for (auto& pair : instance_color_to_name_)
+    colors.push_back(pair.first);
+  std::sort(colors.begin(), colors.end());
+  std::unordered_map<int, int> color_to_id;
+  instance_names_.assign(1, "");
+  for (int c : colors) {
+    color_to_id[c] = instance_names_.size();
+    instance_names_.push_back(instance_color_to_name_[c]);
+  }
+  instance_ids_.clear();
+  for (auto& material : materials_) {
+    glm::vec3 c = material.instance_color * 255.f;
+    int key = lround(c.x) * 256 * 256 + lround(c.y) * 256 + lround(c.z);
+    auto itr = color_to_id.find(key);
+    instance_ids_.push_back(itr == color_to_id.end() ? 0 : itr->second);
+  }
+}
+
+void SUNCGScene::draw_depth_prepass_(const SUNCGShader& shader, const glm::mat4& camera_matrix) {
+  // the caller only set the projection of the lighting program
+  auto& depth = *get_program_(SUNCGShader::Program::DEPTH);
+  depth.use();
+  depth.setMat4("projection", camera_matrix);
+  bind_materials_(depth);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  draw_meshes_(0, nr_opaque_, true);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  shader.use();
+  bind_materials_(shader);
+}
+
+void SUNCGScene::draw_by_texture_(const SUNCGShader& shader, int first, int last) {
+  // Meshes are in the order of ObjLoader::sort_by_transparent, where
+  // consecutive meshes often share the texture: draw each run with one call.
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(shader.texture_loc, 0);  // use TU0
+  for (int begin = first; begin < last; ) {
+    GLuint texture = materials_[begin].texture;
+    int end = begin + 1;
+    while (end < last && materials_[end].texture == texture)
+      ++end;
+    if (culling_ && std::find(visible_.begin() + begin, visible_.begin() + end, 1) ==
+        visible_.begin() + end) {
+      begin = end;
+      continue;
+    }
+    auto mode = texture ?
+      SUNCGShader::RenderMode::TEXTURE_LIGHTING : SUNCGShader::RenderMode::LIGHTING;
+    glUniform1ui(shader.mode_loc, static_cast<GLuint>(mode));
+    TextureGuard TG{texture};
+    draw_meshes_(begin, end);
+    begin = end;
+  }
+}
+
+void SUNCGScene::bind_materials_(const SUNCGShader& shader) {
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, material_texture_);
+  glUniform1i(shader.materials_loc, 1);  // use TU1
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_BUFFER, transform_texture_);
+  glUniform1i(shader.transforms_loc, 2);  // use TU2
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void SUNCGScene::unbind_materials_() {
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void SUNCGScene::check_instance_(int instance) const {
+  if (instance <= 0 || instance >= (int)instance_names_.size())
+    throw std::out_of_range(ssprintf("Object %d is not an instance id in [1, %d)!",
+          instance, (int)instance_names_.size()));
+}
+
+void SUNCGScene::init_objects_() {
+  if (!object_transforms_.empty())
+    return;
+  int nr_instance = instance_names_.size(), nr_mesh = mesh_.size();
+  object_transforms_.assign(nr_instance, glm::mat4{1.f});
+  object_visible_.assign(nr_instance, 1);
+  mesh_shown_.assign(nr_mesh, 1);
+  // bucket the meshes by instance
+  instance_first_.assign(nr_instance + 1, 0);
+  for (int id : instance_ids_)
+    instance_first_[id + 1]++;
+  for (int i = 0; i < nr_instance; ++i)
+    instance_first_[i + 1] += instance_first_[i];
+  instance_meshes_.resize(nr_mesh);
+  std::vector<int> next(instance_first_.begin(), instance_first_.end() - 1);
+  for (int i = 0; i < nr_mesh; ++i)
+    instance_meshes_[next[instance_ids_[i]]++] = i;
+  mesh_boxes_loaded_ = mesh_.bounding_boxes();
+  mesh_boxes_moved_ = mesh_boxes_loaded_;
+}
+
+void SUNCGScene::set_object_transform(int instance, const glm::mat4& transform) {
+  check_instance_(instance);
+  init_objects_();
+  object_transforms_[instance] = transform;
+  if (transform_buffer_) {
+    glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer_);
+    glBufferSubData(GL_TEXTURE_BUFFER, instance * sizeof(glm::mat4), sizeof(glm::mat4),
+        &transform[0][0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+  // the box around the 8 moved corners of each box of the object
+  for (int k = instance_first_[instance]; k < instance_first_[instance + 1]; ++k) {
+    int mesh = instance_meshes_[k];
+    const AABB& box = mesh_boxes_loaded_[mesh];
+    AABB& moved = mesh_boxes_moved_[mesh];
+    for (int c = 0; c < 8; ++c) {
+      glm::vec3 corner{c & 1 ? box.max.x : box.min.x, c & 2 ? box.max.y : box.min.y,
+        c & 4 ? box.max.z : box.min.z};
+      glm::vec3 p = transform_point(transform, corner);
+      moved.min = c ? glm::min(moved.min, p) : p;
+      moved.max = c ? glm::max(moved.max, p) : p;
+    }
+  }
+  bvh_.build(mesh_boxes_moved_);
+  build_portals_();
+  // rebuilt with the transforms by the next query
+  triangles_ = TriangleBVH{};
+}
+
+glm::mat4 SUNCGScene::get_object_transform(int instance) const {
+  check_instance_(instance);
+  return object_transforms_.empty() ? glm::mat4{1.f} : object_transforms_[instance];
+}
+
+void SUNCGScene::set_object_visible(int instance, bool visible) {
+  check_instance_(instance);
+  init_objects_();
+  if (object_visible_[instance] == visible)
+    return;
+  object_visible_[instance] = visible;
+  int nr_mesh = instance_first_[instance + 1] - instance_first_[instance];
+  nr_hidden_ += visible ? -nr_mesh : nr_mesh;
+  for (int k = instance_first_[instance]; k < instance_first_[instance + 1]; ++k)
+    mesh_shown_[instance_meshes_[k]] = visible;
+  triangles_ = TriangleBVH{};
+}
+
+bool SUNCGScene::is_object_visible(int instance) const {
+  check_instance_(instance);
+  return object_visible_.empty() || object_visible_[instance];
+}
+
+void SUNCGScene::reset_objects() {
+  if (object_transforms_.empty())
+    return;
+  if (transform_buffer_) {
+    std::vector<glm::mat4> identity(instance_names_.size(), glm::mat4{1.f});
+    glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer_);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, identity.size() * sizeof(glm::mat4),
+        identity.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+  object_transforms_.clear();
+  object_visible_.clear();
+  mesh_shown_.clear();
+  nr_hidden_ = 0;
+  mesh_boxes_moved_.clear();
+  build_bvh_();
+  build_portals_();
+  triangles_ = TriangleBVH{};
 }
 
 }   // namespace render
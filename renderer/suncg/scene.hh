@@ -9,6 +9,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "gl/api.hh"
 #include <glm/glm.hpp>
@@ -20,42 +21,232 @@
 #include "model/scene.hh"
 #include "gl/shader.hh"
 
-#include "suncg/category.hh"
-#include "suncg/color_mapping.hh"
+#include "suncg/labels.hh"
+#include "suncg/portal.hh"
 
 namespace render {
 
 class SUNCGShader: public Shader {
   public:
-    SUNCGShader();
+    // The program is specialized for one use at compile time, so it
+    // doesn't branch on the mode or carry unused vertex attributes.
+    enum class Program {
+      LIGHTING = 0,   // RGB, with the mode uniform choosing TEXTURE_LIGHTING or LIGHTING
+      LABEL = 1,
+      INSTANCE = 2,
+      DEPTH = 3,
+      INVDEPTH = 4,
+      MULTI_TARGET = 5,   // all modes at once, see SUNCGScene::draw_multi_target()
+      LINEAR_DEPTH = 6,   // float depth in meters, see SUNCGScene::draw_linear_depth()
+      INSTANCE_ID = 7,    // integer instance ids, see SUNCGScene::draw_instance_ids()
+      ANY = 8,        // the mode is chosen by the mode uniform
+    };
+    static constexpr int kNumPrograms = 9;
 
-    static const char* fShader;
-    GLint Kd_loc, Ka_loc, mode_loc,
-          texture_loc, dissolve_loc, minDepth_loc;
+    explicit SUNCGShader(Program program = Program::ANY);
+
+    static const char *vShader, *fShader;
+    GLint mode_loc, texture_loc, materials_loc, transforms_loc, minDepth_loc;
 
     enum class RenderMode : GLuint {
       TEXTURE_LIGHTING = 0,
       LIGHTING = 1,
-      CONSTANT = 2,
+      LABEL = 2,
       DEPTH = 3,
-      INVDEPTH = 4
+      INVDEPTH = 4,
+      INSTANCE = 5
     };
+
+  protected:
+    // use another vertex (and optionally geometry) shader with fShader,
+    // specialized by the defines
+    SUNCGShader(const char* vertexShader, const char* geometryShader,
+        const std::string& defines);
+
+    // the #defines that specialize the sources for program
+    static std::string defines_(Program program);
+    // source with defines inserted after its #version line
+    static std::string specialize_(const char* source, const std::string& defines);
 };
 
+// Draws the 6 faces of a cube map side by side into one (6w) x h target in a
+// single pass: a geometry shader emits each triangle once per face, with the
+// projection of that face, moved into its horizontal tile and clipped to it.
+// GL_CLIP_DISTANCE0 and GL_CLIP_DISTANCE1 have to be enabled when drawing.
+class SUNCGCubeMapShader: public SUNCGShader {
+  public:
+    SUNCGCubeMapShader();
+
+    static const int kNumFaces = 6;
+    static const char *vShader, *gShader;
+    GLint face_projection_loc;
+
+    // projections: kNumFaces matrices, the camera matrix of each face
+    void setFaceProjections(const glm::mat4* projections) const {
+      glUniformMatrix4fv(face_projection_loc, kNumFaces, GL_FALSE, &projections[0][0][0]);
+    }
+};
+
+// house.obj -> house.bake, where suncg-bake.cpp writes the baked scene
+inline std::string baked_scene_file(const std::string& obj_file) {
+  std::string ext = ".obj";
+  if (obj_file.size() >= ext.size() &&
+      obj_file.compare(obj_file.size() - ext.size(), ext.size(), ext) == 0)
+    return obj_file.substr(0, obj_file.size() - ext.size()) + ".bake";
+  return obj_file + ".bake";
+}
+
+// Constructing a scene only parses and decodes the files, without OpenGL
+// calls, so it can be done in any thread. Call activate() in the thread of
+// the GL context before drawing.
 class SUNCGScene : public ObjSceneBase {
   public:
     explicit SUNCGScene(
         std::string obj_file,
         std::string model_category_file,
         std::string semantic_label_file,
-        float minDepth = 0.3);
-    ~SUNCGScene() {}
+        float minDepth = 0.3,
+        MeshBatch::VertexLayout layout = MeshBatch::VertexLayout::FULL);
+    ~SUNCGScene() { deactivate(); }
 
     void draw() override;
+    // Like draw(), for the camera_matrix the shader was set up with. Only
+    // this one uses the depth pre-pass (see set_depth_prepass()), which
+    // draws with its own program.
+    void draw(const glm::mat4& camera_matrix);
+
+    // Only draw the meshes that may be inside the view frustum of
+    // camera_matrix (see Camera::getCameraMatrix()) in the next draw() or
+    // draw_multi_target(). The meshes are tested by their bounding boxes in
+    // a BVH, so the image is the same as without culling.
+    // With set_rooms(), meshes hidden by the walls of the room of eye are
+    // skipped as well.
+    void set_view(const glm::mat4& camera_matrix, const glm::vec3& eye) {
+      bvh_.cull(camera_matrix, visible_);
+      if (portals_)
+        portals_->cull(eye, camera_matrix, visible_);
+      if (nr_hidden_)
+        for (size_t i = 0; i < visible_.size(); ++i)
+          visible_[i] &= mesh_shown_[i];
+      culling_ = true;
+    }
+
+    // Enable occlusion culling by rooms, see PortalCuller. Disabled if rooms
+    // is empty.
+    // rooms: the floor rectangle (x1, z1, x2, z2) of each room
+    // portals: the bounding boxes of the doors and windows
+    void set_rooms(const std::vector<glm::vec4>& rooms, const std::vector<AABB>& portals) {
+      rooms_ = rooms;
+      portal_boxes_ = portals;
+      build_portals_();
+    }
+
+    // Move an object (an instance id of get_instance_names(), but 0) by
+    // transform, a model matrix applied to its meshes in world space: the
+    // identity is its pose in the obj. Also moves it in raycast() and
+    // query_aabb(). The transforms are kept when the scene is deactivated.
+    // Throws std::out_of_range for an invalid id.
+    void set_object_transform(int instance, const glm::mat4& transform);
+    glm::mat4 get_object_transform(int instance) const;
+
+    // Hide or show an object, in every mode and in raycast() and query_aabb().
+    // Throws std::out_of_range for an invalid id.
+    void set_object_visible(int instance, bool visible);
+    bool is_object_visible(int instance) const;
+
+    // Undo all the edits of set_object_transform() and set_object_visible().
+    void reset_objects();
+
+    // Draw the current mode into all faces of a cube map, with the shader
+    // returned by get_cube_map_shader(). Nothing is culled, and the depth
+    // pre-pass is not used.
+    void draw_cube_map() { culling_ = false; draw_(*get_cube_map_shader(), nullptr); }
+
+    // Created on first use.
+    SUNCGCubeMapShader* get_cube_map_shader();
+
+    // Draw all the render modes at once, regardless of the current mode.
+    // The output of RenderMode m goes to fragment output location int(m),
+    // i.e. the int(m)-th color attachment of the bound framebuffer.
+    void draw_multi_target();
+
+    // Draw the depth in meters along the view direction into the bound
+    // GL_R32F framebuffer, with the shader returned by
+    // get_linear_depth_shader(). It is 0 where nothing is drawn.
+    void draw_linear_depth();
+
+    // Draw the instance id of each pixel into the bound GL_R32UI
+    // framebuffer, with the shader returned by get_instance_id_shader().
+    // It is 0 where nothing is drawn. See get_instance_names().
+    void draw_instance_ids();
+
+    // The name of each instance id of draw_instance_ids(), the same as
+    // get_name_from_instance_color() of its instance color. The
+    // first one, of id 0, is "".
+    const std::vector<std::string>& get_instance_names() const { return instance_names_; }
+
+    struct RayHit {
+      float distance;   // along the normalized direction. inf if nothing is hit
+      int instance;     // instance id, see get_instance_names(). 0 if nothing is hit
+      int mesh;         // the mesh hit, see get_label_color(). -1 if nothing is hit
+    };
+
+    // Cast the rays from origins[i] along dirs[i] against the triangles of
+    // the scene, on the CPU. Triangles are hit from both sides.
+    // The triangles are indexed by a TriangleBVH on the first query.
+    std::vector<RayHit> raycast(const std::vector<glm::vec3>& origins,
+        const std::vector<glm::vec3>& dirs);
+
+    // Index the triangles for raycast() and cast_ray() now, if they aren't yet.
+    void build_ray_index() { build_triangle_bvh_(); }
+
+    // Cast one ray along the normalized dir, up to max_distance, after
+    // build_ray_index(). Can be called from several threads at once.
+    // back_faces: whether triangles are hit from their back, which OpenGL
+    //  culls when drawing
+    RayHit cast_ray(const glm::vec3& origin, const glm::vec3& dir,
+        float max_distance, bool back_faces) const;
+
+    // The colors of a mesh in SEMANTIC and INSTANCE modes, and of the
+    // pixels where nothing is drawn, in [0, 1].
+    const glm::vec3& get_label_color(int mesh) const { return materials_[mesh].label_color; }
+    const glm::vec3& get_instance_color(int mesh) const { return materials_[mesh].instance_color; }
+    const glm::vec3& get_background_color() const { return background_color_; }
+    // the depth of the largest inverse depth in INVDEPTH mode
+    float get_min_depth() const { return minDepth_; }
+
+    // The instance ids of the objects with a triangle intersecting box, in
+    // increasing order.
+    std::vector<int> query_aabb(const AABB& box);
+
+    static constexpr int kNumRenderModes = 5;
+
     void activate() override;
     void deactivate() override;
 
-    Shader* get_shader() override { return &shader_; }
+    // The program of the current mode. Created on first use.
+    Shader* get_shader() override { return get_program_(program_of_(mode_)); }
+    // The program of draw_multi_target(). Created on first use.
+    Shader* get_multi_target_shader() {
+      return get_program_(SUNCGShader::Program::MULTI_TARGET);
+    }
+    // The program of draw_linear_depth(). Created on first use.
+    Shader* get_linear_depth_shader() {
+      return get_program_(SUNCGShader::Program::LINEAR_DEPTH);
+    }
+    // The program of draw_instance_ids(). Created on first use.
+    Shader* get_instance_id_shader() {
+      return get_program_(SUNCGShader::Program::INSTANCE_ID);
+    }
+
+    size_t cpu_bytes() const override {
+      return textures_.cpu_bytes() + mesh_.cpu_bytes() + triangles_.bytes();
+    }
+    size_t gpu_bytes() const override {
+      size_t materials = material_buffer_ ? materials_.size() * sizeof(MaterialTexel) : 0;
+      size_t transforms = transform_buffer_ ? instance_names_.size() * sizeof(glm::mat4) : 0;
+      return textures_.gpu_bytes() + mesh_.gpu_bytes() + materials + transforms;
+    }
 
     enum class RenderMode {
       RGB = 0,
@@ -72,11 +263,52 @@ class SUNCGScene : public ObjSceneBase {
 
     void set_mode(RenderMode m) { mode_ = m; }
 
+    // In RGB mode, draw the depth of the opaque meshes first, and then only
+    // shade their visible fragments. Saves the shading of overdrawn
+    // fragments, at the cost of drawing the geometry twice.
+    void set_depth_prepass(bool enabled) { depth_prepass_ = enabled; }
+
+    // See TextureRegistry::set_compressed(). Takes effect on the next activate().
+    void set_compressed_textures(bool compressed) { textures_.set_compressed(compressed); }
+
+    // See TextureRegistry::set_max_size(). If the scene is activated and the
+    // size changes, its textures are uploaded again right away, e.g. to page
+    // in the mip levels needed at a higher resolution.
+    void set_texture_max_size(int max_size);
+    const TextureRegistry& textures() const { return textures_; }
+
+    // Share the textures with other scenes through pool. See TextureRegistry::set_pool().
+    void set_texture_pool(TexturePool* pool) { textures_.set_pool(pool); }
+
+    // Share the vertex buffers with the copies of this scene in other
+    // contexts of a share group, identified by key. See MeshBatch::set_pool().
+    void set_mesh_pool(MeshBufferPool* pool, std::string key) {
+      mesh_.set_pool(pool, std::move(key));
+    }
+
     void set_object_name_resolution_mode(ObjectNameResolution m)
     { object_name_mode_ = m; }
 
     RenderMode get_mode() const { return mode_; }
 
+    // Write the parsed scene to a binary file, which load_baked() loads
+    // without parsing the obj and csv files again. See suncg/baked.cc.
+    // obj_file, model_category_file, semantic_label_file: the files this
+    //  scene was parsed from. Their names, sizes and modification times are
+    //  recorded, to detect a baked scene that is out of date.
+    void save_baked(const std::string& fname, const std::string& obj_file,
+        const std::string& model_category_file, const std::string& semantic_label_file) const;
+
+    // Returns nullptr if fname is not a baked scene of the current version,
+    // or it was baked from other versions of the files (or of the mtl next
+    // to obj_file).
+    // The caller owns the returned pointer, which is not activated yet.
+    static SUNCGScene* load_baked(
+        const std::string& fname, const std::string& obj_file,
+        const std::string& model_category_file, const std::string& semantic_label_file,
+        float minDepth = 0.3,
+        MeshBatch::VertexLayout layout = MeshBatch::VertexLayout::FULL);
+
     std::string get_name_from_instance_color(int r, int g, int b) const {
       int key = r * 256 * 256 + g * 256 + b;
       auto itr = instance_color_to_name_.find(key);
@@ -87,29 +319,78 @@ class SUNCGScene : public ObjSceneBase {
     }
 
   protected:
-    void parse_scene();
+    // the parts of a scene stored by save_baked()
+    struct Baked;
+    SUNCGScene(Baked&& baked, float minDepth, MeshBatch::VertexLayout layout);
 
-    std::string name_from_mode_id(std::string name) {
-      // return the name used for rendering, from model id
-      if (object_name_mode_ == ObjectNameResolution::COARSE) {
-        return model_category_.get_coarse_grained_class(name);
-      } else {
-        return model_category_.get_fine_grained_class(name);
-      }
+    void parse_scene();
+    // build bvh_ over the meshes in mesh_
+    void build_bvh_() { bvh_.build(mesh_.bounding_boxes()); }
+    // the bounding box of each mesh, with the object transforms
+    std::vector<AABB> mesh_boxes_() const {
+      return mesh_boxes_moved_.empty() ? mesh_.bounding_boxes() : mesh_boxes_moved_;
     }
+    void build_portals_() {
+      if (rooms_.empty())
+        portals_.reset();
+      else
+        portals_.reset(new PortalCuller{rooms_, portal_boxes_, mesh_boxes_()});
+    }
+    void check_instance_(int instance) const;
+    // size the per-object state, on the first edit of an object
+    void init_objects_();
+    // Number the instances of instance_color_to_name_, in the order of
+    // their colors, into instance_names_ and instance_ids_.
+    void build_instance_ids_();
+    // build triangles_ over the triangles of mesh_, if it's not built yet
+    void build_triangle_bvh_();
+    // the mesh of triangle k of mesh_
+    int mesh_of_triangle_(int k) const;
+
+    static SUNCGShader::Program program_of_(RenderMode mode);
+    SUNCGShader* get_program_(SUNCGShader::Program program);
 
-    glm::vec3 get_color_by_shape_name(const std::string& name);
+    // draw the current mode with the shader. The depth pre-pass is only
+    // used with a camera_matrix.
+    void draw_(const SUNCGShader& shader, const glm::mat4* camera_matrix);
+    // fill the depth buffer with the opaque meshes seen by camera_matrix,
+    // before they are shaded with shader
+    void draw_depth_prepass_(const SUNCGShader& shader, const glm::mat4& camera_matrix);
+    // draw meshes [first, last) with their texture, in as few calls as possible
+    void draw_by_texture_(const SUNCGShader& shader, int first, int last);
+    void bind_materials_(const SUNCGShader& shader);
+    void unbind_materials_();
+    // draw meshes [begin, end), without the ones culled by set_view() or hidden
+    void draw_meshes_(int begin, int end, bool position_only=false) {
+      if (culling_)
+        mesh_.draw(begin, end, visible_, position_only);
+      else if (nr_hidden_)
+        mesh_.draw(begin, end, mesh_shown_, position_only);
+      else
+        mesh_.draw(begin, end, position_only);
+    }
 
     RenderMode mode_ = RenderMode::RGB;
     ObjectNameResolution object_name_mode_ = ObjectNameResolution::COARSE;
-    SUNCGShader shader_;
+    std::unique_ptr<SUNCGShader> programs_[SUNCGShader::kNumPrograms];  // created on demand
+    std::unique_ptr<SUNCGCubeMapShader> cube_map_shader_;
     TextureRegistry textures_;
 
-    ModelCategory model_category_;
-    ColorMappingReader semantic_color_;
+    // only used while parsing the obj
+    std::shared_ptr<const SemanticLabels> labels_;
     glm::vec3 background_color_;
-    std::vector<Mesh> mesh_;
+    MeshBatch mesh_;  // one mesh for each material of each shape
     float minDepth_; // used for inverse depth mode
+    bool depth_prepass_ = false;
+    int nr_opaque_ = 0;   // meshes [0, nr_opaque_) are opaque. Set by activate()
+
+    BVH bvh_;   // over the bounding boxes of the meshes
+    TriangleBVH triangles_;   // for raycast() and query_aabb()
+    std::vector<uint8_t> visible_;  // of each mesh, set by set_view()
+    bool culling_ = false;  // whether the next draw uses visible_
+    std::unique_ptr<PortalCuller> portals_;   // set by set_rooms()
+    std::vector<glm::vec4> rooms_;   // of set_rooms(), to rebuild portals_ when objects move
+    std::vector<AABB> portal_boxes_;
 
     struct MaterialDesc {
       int id;  // material id in tinyobj
@@ -123,9 +404,33 @@ class SUNCGScene : public ObjSceneBase {
     // material for each mesh. Must have same size as mesh_
     std::vector<MaterialDesc> materials_;
 
+    // The per-mesh data the shader reads from the `materials` buffer texture.
+    struct MaterialTexel {
+      glm::vec4 Kd_dissolve;
+      glm::vec4 Ka;
+      glm::vec4 label_color;
+      glm::vec4 instance_color;   // the instance id in w, exact up to 2^24
+    };
+    GLIntResource<GLuint> material_buffer_, material_texture_;
+
     // keys: r * 256 * 256 + g * 256 + b
     // value: shape.name as in the obj file
     std::unordered_map<int, std::string> instance_color_to_name_;
+    std::vector<std::string> instance_names_;  // by instance id
+    std::vector<int> instance_ids_;   // of each mesh
+
+    // The state of the objects edited by set_object_transform() and
+    // set_object_visible(). Empty until the first edit.
+    std::vector<glm::mat4> object_transforms_;   // by instance id
+    std::vector<uint8_t> object_visible_;        // by instance id
+    std::vector<uint8_t> mesh_shown_;            // of each mesh, by its object
+    int nr_hidden_ = 0;                          // of the meshes
+    // the meshes of instance i are instance_meshes_[instance_first_[i], instance_first_[i+1])
+    std::vector<int> instance_first_, instance_meshes_;
+    std::vector<AABB> mesh_boxes_loaded_, mesh_boxes_moved_;
+    // the model matrix of each instance id for the vertex shaders, 4
+    // GL_RGBA32F texels each. Created by activate()
+    GLIntResource<GLuint> transform_buffer_, transform_texture_;
 };
 
 } // namespace render
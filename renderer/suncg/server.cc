@@ -0,0 +1,288 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: server.cc
+
+#include "server.hh"
+
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace render {
+
+RenderServer::RenderServer(int w, int h, const vector<int>& devices, int contexts_per_device):
+  geo_{w, h}, devices_{devices} {
+  m_assert(contexts_per_device > 0);
+  if (devices_.empty())
+    for (int i = 0; i < DeviceManager::get().num_devices(); ++i)
+      devices_.push_back(i);
+  vector<future<void>> started;
+  for (int k = 0; k < contexts_per_device; ++k)
+    for (int device : devices_) {
+      workers_.emplace_back(new Worker);
+      Worker& worker = *workers_.back();
+      worker.device = device;
+      auto ready = make_shared<promise<void>>();
+      started.emplace_back(ready->get_future());
+      worker.thread = thread([this, &worker, device, ready]() {
+          worker.api.reset(new SUNCGRenderAPI{geo_.w, geo_.h, device, true});
+          worker.api->setSceneCacheBudget(
+              numeric_limits<size_t>::max(), numeric_limits<size_t>::max());
+          ready->set_value();
+          this->work_(worker);
+        });
+    }
+  for (auto& f : started)
+    f.wait();
+}
+
+RenderServer::~RenderServer() {
+  stopped_.store(true);
+  for (auto& w : workers_) {
+    {
+      lock_guard<mutex> lg(w->mutex);
+      w->cv.notify_one();
+    }
+    w->thread.join();
+  }
+}
+
+void RenderServer::setSceneCacheBudget(size_t gpu_bytes, size_t cpu_bytes) {
+  vector<future<void>> done;
+  for (auto& w : workers_) {
+    auto p = make_shared<promise<void>>();
+    done.emplace_back(p->get_future());
+    unique_ptr<Job> job{new Job};
+    job->task = [=](SUNCGRenderAPI& api) {
+      api.setSceneCacheBudget(gpu_bytes, cpu_bytes);
+      p->set_value();
+    };
+    push_(*w, move(job));
+  }
+  for (auto& f : done)
+    f.wait();
+}
+
+RenderServer::Worker& RenderServer::worker_of_(const string& obj_file) {
+  lock_guard<mutex> lg(scenes_mutex_);
+  auto itr = scene_worker_.find(obj_file);
+  if (itr != scene_worker_.end())
+    return *itr->second;
+  // the context with the fewest scenes on the least loaded device
+  int device = DeviceManager::get().pick(obj_file, devices_);
+  Worker* best = nullptr;
+  for (auto& w : workers_)
+    if (w->device == device && (!best || w->nr_scene < best->nr_scene))
+      best = w.get();
+  best->nr_scene++;
+  scene_worker_[obj_file] = best;
+  DeviceManager::get().expect_scene(best->api.get(), obj_file);
+  return *best;
+}
+
+void RenderServer::push_(Worker& w, unique_ptr<Job> job) {
+  w.queue.push(move(job));
+  if (w.sleeping.load()) {
+    lock_guard<mutex> lg(w.mutex);
+    w.cv.notify_one();
+  }
+}
+
+future<Matuc> RenderServer::render(
+    shared_ptr<const Scene> scene, const Camera& cam, SUNCGScene::RenderMode mode) {
+  unique_ptr<Job> job{new Job};
+  job->cam = cam;
+  job->mode = mode;
+  auto ret = job->result.get_future();
+  Worker& w = worker_of_(scene->obj_file);
+  job->scene = move(scene);
+  push_(w, move(job));
+  return ret;
+}
+
+future<void> RenderServer::execute(const string& obj_file, Task task) {
+  unique_ptr<Job> job{new Job};
+  job->task = move(task);
+  auto ret = job->done.get_future();
+  push_(worker_of_(obj_file), move(job));
+  return ret;
+}
+
+void RenderServer::work_(Worker& w) {
+  vector<unique_ptr<Job>> batch;
+  unique_ptr<Job> job;
+  while (true) {
+    while ((int)batch.size() < kMaxBatch && w.queue.pop(job))
+      batch.emplace_back(move(job));
+    if (batch.size()) {
+      run_batch_(*w.api, batch);
+      batch.clear();
+      continue;
+    }
+    if (stopped_.load())
+      break;
+    // Sleep until a job is pushed. push_() may miss `sleeping` right after
+    // it is set, so never sleep for long.
+    unique_lock<mutex> lk(w.mutex);
+    w.sleeping.store(true);
+    if (w.queue.empty() && !stopped_.load())
+      w.cv.wait_for(lk, chrono::milliseconds(1));
+    w.sleeping.store(false);
+  }
+  w.api.reset(nullptr);
+}
+
+void RenderServer::run_batch_(SUNCGRenderAPI& api, vector<unique_ptr<Job>>& batch) {
+  // render jobs by (scene, mode), in the order of their first job. A task
+  // waits for the groups of the jobs queued before it.
+  vector<vector<Job*>> groups;
+  for (auto& job : batch) {
+    if (job->task) {
+      render_groups_(api, groups);
+      groups.clear();
+      try {
+        job->task(api);
+        job->done.set_value();
+      } catch (...) {
+        job->done.set_exception(current_exception());
+      }
+      continue;
+    }
+    bool found = false;
+    for (auto& g : groups)
+      if (g[0]->scene->obj_file == job->scene->obj_file && g[0]->mode == job->mode) {
+        g.push_back(job.get());
+        found = true;
+        break;
+      }
+    if (!found)
+      groups.push_back({job.get()});
+  }
+  render_groups_(api, groups);
+}
+
+void RenderServer::render_groups_(SUNCGRenderAPI& api, const vector<vector<Job*>>& groups) {
+  for (auto& g : groups) {
+    try {
+      auto& scene = *g[0]->scene;
+      api.loadScene(scene.obj_file, scene.model_category_file, scene.semantic_label_file);
+      api.setMode(g[0]->mode);
+      if (g.size() == 1) {
+        *api.getCamera() = g[0]->cam;
+        g[0]->result.set_value(api.render());
+        continue;
+      }
+      vector<Camera> cams;
+      for (Job* job : g)
+        cams.push_back(job->cam);
+      Matuc all = api.renderBatch(cams);
+      int h = geo_.h;
+      for (size_t k = 0; k < g.size(); ++k) {
+        Matuc img(h, all.cols(), all.channels());
+        memcpy(img.ptr(), all.ptr(k * h), (size_t)h * all.cols() * all.channels());
+        g[k]->result.set_value(move(img));
+      }
+    } catch (...) {
+      for (Job* job : g)
+        job->result.set_exception(current_exception());
+    }
+  }
+}
+
+
+template <typename T>
+T RenderClient::run_(function<T(SUNCGRenderAPI&)> f) {
+  auto scene = scene_();
+  Camera cam = camera_;
+  auto mode = mode_;
+  return server_.execute_sync<T>(scene->obj_file, [=](SUNCGRenderAPI& api) {
+      api.loadScene(scene->obj_file, scene->model_category_file, scene->semantic_label_file);
+      api.setMode(mode);
+      *api.getCamera() = cam;
+      return f(api);
+  });
+}
+
+void RenderClient::loadScene(
+    string obj_file, string model_category_file, string semantic_label_file) {
+  auto scene = make_shared<const RenderServer::Scene>(RenderServer::Scene{
+      obj_file, model_category_file, semantic_label_file});
+  // start from the initial camera of the scene, as SUNCGRenderAPI::loadScene
+  camera_ = server_.execute_sync<Camera>(obj_file, [=](SUNCGRenderAPI& api) {
+      api.loadScene(scene->obj_file, scene->model_category_file, scene->semantic_label_file);
+      return *api.getCamera();
+  });
+  scene_ptr_ = move(scene);
+}
+
+void RenderClient::prefetchScene(
+    string obj_file, string model_category_file, string semantic_label_file) {
+  server_.execute(obj_file, [=](SUNCGRenderAPI& api) {
+      api.prefetchScene(obj_file, model_category_file, semantic_label_file);
+  });
+}
+
+void RenderClient::renderInto(unsigned char* dst) {
+  Matuc img = render();
+  memcpy(dst, img.ptr(), img.elements());
+}
+
+vector<Matuc> RenderClient::renderMulti(const vector<SUNCGScene::RenderMode>& modes) {
+  return run_<vector<Matuc>>([=](SUNCGRenderAPI& api) { return api.renderMulti(modes); });
+}
+
+Matuc RenderClient::renderCubeMap() {
+  return run_<Matuc>([](SUNCGRenderAPI& api) { return api.renderCubeMap(); });
+}
+
+Mat32f RenderClient::renderDepth() {
+  return run_<Mat32f>([](SUNCGRenderAPI& api) { return api.renderDepth(); });
+}
+
+Mat32u RenderClient::renderInstanceIds() {
+  return run_<Mat32u>([](SUNCGRenderAPI& api) { return api.renderInstanceIds(); });
+}
+
+vector<string> RenderClient::getInstanceNames() {
+  return run_<vector<string>>([](SUNCGRenderAPI& api) { return api.getInstanceNames(); });
+}
+
+vector<int> RenderClient::countInstancePixels() {
+  return run_<vector<int>>([](SUNCGRenderAPI& api) { return api.countInstancePixels(); });
+}
+
+vector<SUNCGScene::RayHit> RenderClient::raycast(const vector<glm::vec3>& origins,
+    const vector<glm::vec3>& dirs) {
+  return run_<vector<SUNCGScene::RayHit>>([&](SUNCGRenderAPI& api) {
+      return api.raycast(origins, dirs);
+  });
+}
+
+vector<int> RenderClient::queryAABB(const AABB& box) {
+  return run_<vector<int>>([=](SUNCGRenderAPI& api) { return api.queryAABB(box); });
+}
+
+Matuc RenderClient::renderBatch(const vector<Camera>& cameras) {
+  return run_<Matuc>([=](SUNCGRenderAPI& api) { return api.renderBatch(cameras); });
+}
+
+string RenderClient::getNameFromInstanceColor(int r, int g, int b) {
+  return run_<string>([=](SUNCGRenderAPI& api) {
+      return api.getNameFromInstanceColor(r, g, b);
+  });
+}
+
+void RenderClient::setRooms(const vector<glm::vec4>& rooms, const vector<AABB>& portals) {
+  run_<int>([=](SUNCGRenderAPI& api) { api.setRooms(rooms, portals); return 0; });
+}
+
+void RenderClient::printContextInfo() {
+  run_<int>([](SUNCGRenderAPI& api) { api.printContextInfo(); return 0; });
+}
+
+}
@@ -0,0 +1,192 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: server.hh
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "render.hh"
+#include "lib/mpscqueue.hh"
+
+namespace render {
+
+class RenderClient;
+
+// A fixed set of rendering contexts, each owned by a thread, shared by many
+// clients (e.g. environments). Unlike SUNCGRenderAPIThread, clients don't
+// cost a thread and a context each.
+//
+// Clients submit jobs to the queue of a context without taking a lock. All
+// the clients of a scene use the same context, which keeps its scenes
+// activated, so they are not uploaded again on every switch. A context
+// takes all the jobs in its queue at once, and draws the render jobs of the
+// same scene and mode with one renderBatch(). The contexts of a device are
+// in one share group, so a texture used by several scenes is uploaded once.
+// A new scene goes to the device with the fewest scene bytes, see
+// DeviceManager, and then to its context with the fewest scenes.
+class RenderServer {
+  public:
+    // contexts_per_device contexts on each of the devices, or on all the
+    // devices if it's empty.
+    RenderServer(int w, int h, const std::vector<int>& devices, int contexts_per_device = 1);
+    ~RenderServer();
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator = (const RenderServer&) = delete;
+
+    Geometry resolution() const { return geo_; }
+    int numContexts() const { return workers_.size(); }
+
+    // Memory budgets of the scene cache of each context, see SceneCache.
+    // By default, all scenes stay activated.
+    void setSceneCacheBudget(size_t gpu_bytes, size_t cpu_bytes);
+
+    // Jobs of a client, run in the thread of a context.
+    struct Scene {
+      std::string obj_file, model_category_file, semantic_label_file;
+    };
+    using Task = std::function<void(SUNCGRenderAPI&)>;
+
+    // Render scene from cam in mode. Jobs of the same scene and mode that are
+    // queued together are drawn with one renderBatch().
+    std::future<Matuc> render(std::shared_ptr<const Scene> scene,
+        const Camera& cam, SUNCGScene::RenderMode mode);
+
+    // Run task in the thread of the context of obj_file, after the jobs
+    // queued before it. The future holds the exception task throws, if any.
+    std::future<void> execute(const std::string& obj_file, Task task);
+
+    // Run task in the thread of the context of obj_file and wait for it.
+    template <typename T>
+    T execute_sync(const std::string& obj_file, std::function<T(SUNCGRenderAPI&)> task) {
+      auto job = std::make_shared<std::packaged_task<T(SUNCGRenderAPI&)>>(std::move(task));
+      auto res = job->get_future();
+      execute(obj_file, [job](SUNCGRenderAPI& api) { (*job)(api); });
+      return res.get();
+    }
+
+  private:
+    struct Job {
+      Task task;    // if set, the job is a task. Otherwise a render job:
+      std::shared_ptr<const Scene> scene;
+      Camera cam{glm::vec3{0}};
+      SUNCGScene::RenderMode mode;
+      std::promise<Matuc> result;
+      std::promise<void> done;    // of a task
+    };
+
+    struct Worker {
+      std::unique_ptr<SUNCGRenderAPI> api;
+      MPSCQueue<std::unique_ptr<Job>> queue;
+      std::atomic<bool> sleeping{false};
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::thread thread;
+      int device;
+      int nr_scene = 0;   // number of scenes assigned to it
+    };
+
+    static constexpr int kMaxBatch = 64;
+
+    Geometry geo_;
+    std::vector<int> devices_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> stopped_{false};
+
+    std::mutex scenes_mutex_;
+    std::unordered_map<std::string, Worker*> scene_worker_;   // by obj_file
+
+    // the context of a scene, assigning one if needed
+    Worker& worker_of_(const std::string& obj_file);
+    void push_(Worker& w, std::unique_ptr<Job> job);
+    void work_(Worker& w);
+    void run_batch_(SUNCGRenderAPI& api, std::vector<std::unique_ptr<Job>>& batch);
+    // render jobs grouped by (scene, mode)
+    void render_groups_(SUNCGRenderAPI& api, const std::vector<std::vector<Job*>>& groups);
+};
+
+
+// A client of a RenderServer, with the interface of SUNCGRenderAPI. It has
+// its own scene, camera and mode, and can be used from any thread.
+class RenderClient {
+  public:
+    explicit RenderClient(RenderServer& server): server_(server) {}
+
+    void loadScene(
+        std::string obj_file, std::string model_category_file,
+        std::string semantic_label_file);
+
+    // Parse the scene in the background. See SUNCGRenderAPI::prefetchScene().
+    void prefetchScene(
+        std::string obj_file, std::string model_category_file,
+        std::string semantic_label_file);
+
+    // caller doesn't own pointer
+    Camera* getCamera() { return &camera_; }
+    void setMode(SUNCGScene::RenderMode m) { mode_ = m; }
+    SUNCGScene::RenderMode getMode() const { return mode_; }
+    Geometry resolution() const { return server_.resolution(); }
+    int numChannels() const { return SUNCGRenderAPI::channelsOf(mode_); }
+
+    Matuc render() { return renderAsync().get(); }
+
+    // Same as render(), but write the image into dst, which must hold
+    // h * w * numChannels() bytes.
+    void renderInto(unsigned char* dst);
+
+    // Submit a render job of the current camera and mode, and return
+    // without waiting for it.
+    std::future<Matuc> renderAsync() {
+      return server_.render(scene_(), camera_, mode_);
+    }
+
+    std::vector<Matuc> renderMulti(const std::vector<SUNCGScene::RenderMode>& modes);
+    Matuc renderCubeMap();
+    Mat32f renderDepth();
+    Mat32u renderInstanceIds();
+    std::vector<std::string> getInstanceNames();
+    std::vector<int> countInstancePixels();
+    std::vector<SUNCGScene::RayHit> raycast(const std::vector<glm::vec3>& origins,
+        const std::vector<glm::vec3>& dirs);
+    std::vector<int> queryAABB(const AABB& box);
+    Matuc renderBatch(const std::vector<Camera>& cameras);
+    Matuc renderBatch(const CameraBatch& cameras) { return renderBatch(cameras.cameras()); }
+    Matuc renderRig(const CameraRig& rig) { return renderBatch(rig.cameras(camera_)); }
+    std::string getNameFromInstanceColor(int r, int g, int b);
+    void printContextInfo();
+
+    // Set the rooms of the scene, for all its clients. See SUNCGRenderAPI::setRooms().
+    void setRooms(const std::vector<glm::vec4>& rooms, const std::vector<AABB>& portals);
+
+  private:
+    RenderServer& server_;
+    std::shared_ptr<const RenderServer::Scene> scene_ptr_;
+    Camera camera_{glm::vec3{0}};
+    SUNCGScene::RenderMode mode_ = SUNCGScene::RenderMode::RGB;
+
+    const std::shared_ptr<const RenderServer::Scene>& scene_() const {
+      if (!scene_ptr_)
+        throw std::runtime_error("RenderClient: loadScene() must be called first!");
+      return scene_ptr_;
+    }
+
+    // run f on the api of the context of the scene, with the camera and
+    // mode of this client, and wait for it
+    template <typename T>
+    T run_(std::function<T(SUNCGRenderAPI&)> f);
+};
+
+}
@@ -0,0 +1,324 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: trajectory.cc
+
+#include "trajectory.hh"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "lib/imgproc.hh"
+#include "lib/strutils.hh"
+
+using namespace std;
+
+namespace {
+
+// mkdir -p
+void make_dirs(const string& path) {
+  for (size_t pos = 1; pos <= path.size(); ++pos) {
+    if (pos < path.size() && path[pos] != '/')
+      continue;
+    string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      throw runtime_error(ssprintf("Cannot create directory %s: %s", dir.c_str(), strerror(errno)));
+  }
+}
+
+// A file written at any offset by the writers, closed with its last job
+struct RawFile {
+  int fd;
+  string fname;
+  RawFile(const string& fname, size_t size): fname{fname} {
+    fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, size) != 0) {
+      int err = errno;
+      close(fd);
+      fd = -1;
+      errno = err;
+    }
+    if (fd < 0)
+      throw runtime_error(ssprintf("Cannot write %s: %s", fname.c_str(), strerror(errno)));
+  }
+  ~RawFile() { close(fd); }
+
+  void write(const void* data, size_t size, size_t offset) {
+    const char* p = static_cast<const char*>(data);
+    while (size) {
+      ssize_t n = pwrite(fd, p, size, offset);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw runtime_error(ssprintf("Cannot write %s: %s", fname.c_str(), strerror(errno)));
+      }
+      p += n;
+      size -= n;
+      offset += n;
+    }
+  }
+};
+
+// Interleave the bits of x and y, so that sorting by it keeps poses close
+// in space close in order.
+uint32_t morton_code(uint16_t x, uint16_t y) {
+  uint32_t ret = 0;
+  for (int b = 0; b < 16; ++b)
+    ret |= ((x >> b) & 1u) << (2 * b) | ((y >> b) & 1u) << (2 * b + 1);
+  return ret;
+}
+
+// the indices of poses, in Morton order of their (x, z) in cells of 0.5m
+vector<int> spatial_order(const vector<render::TrajectoryPose>& poses) {
+  constexpr float kCell = 0.5f;
+  float min_x = 0, min_z = 0;
+  if (poses.size()) {
+    min_x = poses[0].x;
+    min_z = poses[0].z;
+  }
+  for (auto& p : poses) {
+    min_x = min(min_x, p.x);
+    min_z = min(min_z, p.z);
+  }
+  auto cell = [&](float v, float lo) {
+    return (uint16_t)min(floor((v - lo) / kCell), 65535.f);
+  };
+  vector<pair<uint32_t, int>> keys;
+  for (size_t i = 0; i < poses.size(); ++i)
+    keys.emplace_back(morton_code(cell(poses[i].x, min_x), cell(poses[i].z, min_z)), i);
+  sort(keys.begin(), keys.end());
+  vector<int> ret;
+  for (auto& k : keys)
+    ret.push_back(k.second);
+  return ret;
+}
+
+} // namespace
+
+namespace render {
+
+vector<TrajectoryPose> read_trajectory(const string& fname) {
+  ifstream is(fname);
+  if (!is.good())
+    throw runtime_error(ssprintf("Cannot read %s", fname.c_str()));
+  vector<TrajectoryPose> ret;
+  string line;
+  int lineno = 0;
+  while (getline(is, line)) {
+    lineno++;
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == string::npos || line[start] == '#')
+      continue;
+    istringstream ss(line);
+    TrajectoryPose p;
+    if (!(ss >> p.x >> p.y >> p.z >> p.yaw))
+      throw runtime_error(ssprintf("%s:%d: expect \"x y z yaw [pitch]\"", fname.c_str(), lineno));
+    if (!(ss >> p.pitch))
+      p.pitch = 0;
+    ret.push_back(p);
+  }
+  return ret;
+}
+
+const char* TrajectoryRenderer::mode_name(SUNCGScene::RenderMode mode) {
+  switch (mode) {
+    case SUNCGScene::RenderMode::RGB: return "rgb";
+    case SUNCGScene::RenderMode::SEMANTIC: return "semantic";
+    case SUNCGScene::RenderMode::INSTANCE: return "instance";
+    case SUNCGScene::RenderMode::DEPTH: return "depth";
+    case SUNCGScene::RenderMode::INVDEPTH: return "invdepth";
+  }
+  error_exit("Unknown render mode!");
+}
+
+TrajectoryRenderer::TrajectoryRenderer(SUNCGRenderAPI& api, string model_category_file,
+    string semantic_label_file, Options options):
+  api_(api), model_category_file_{move(model_category_file)},
+  semantic_label_file_{move(semantic_label_file)}, options_{move(options)} {
+    if (options_.nr_writers <= 0 || options_.batch <= 0 || options_.modes.empty())
+      throw invalid_argument("TrajectoryRenderer: needs nr_writers > 0, batch > 0 and some modes!");
+    for (int i = 0; i < options_.nr_writers; ++i)
+      writers_.emplace_back([this]() { this->write_loop_(); });
+  }
+
+TrajectoryRenderer::~TrajectoryRenderer() {
+  {
+    lock_guard<mutex> lg(mutex_);
+    stopped_ = true;
+  }
+  not_empty_.notify_all();
+  for (auto& th : writers_)
+    th.join();
+}
+
+void TrajectoryRenderer::push_(function<void()> job) {
+  unique_lock<mutex> lk(mutex_);
+  // bounded, so that rendering waits for the writers instead of filling memory
+  not_full_.wait(lk, [this]() {
+      return (int)jobs_.size() < 2 * options_.nr_writers || error_.size(); });
+  if (error_.size()) {
+    string err;
+    swap(err, error_);
+    throw runtime_error(err);
+  }
+  jobs_.push(move(job));
+  not_empty_.notify_one();
+}
+
+void TrajectoryRenderer::write_loop_() {
+  unique_lock<mutex> lk(mutex_);
+  while (true) {
+    not_empty_.wait(lk, [this]() { return jobs_.size() || stopped_; });
+    if (jobs_.empty())
+      break;
+    auto job = move(jobs_.front());
+    jobs_.pop();
+    nr_running_++;
+    not_full_.notify_one();
+    lk.unlock();
+    string err;
+    try {
+      job();
+    } catch (const std::exception& e) {
+      err = e.what();
+    }
+    lk.lock();
+    if (err.size() && error_.empty())
+      error_ = err;
+    nr_running_--;
+    if (err.size())
+      not_full_.notify_all();
+    if (jobs_.empty() && nr_running_ == 0)
+      idle_.notify_all();
+  }
+}
+
+void TrajectoryRenderer::wait_() {
+  unique_lock<mutex> lk(mutex_);
+  idle_.wait(lk, [this]() { return jobs_.empty() && nr_running_ == 0; });
+  if (error_.size()) {
+    string err;
+    swap(err, error_);
+    throw runtime_error(err);
+  }
+}
+
+size_t TrajectoryRenderer::run(vector<House> houses) {
+  // the poses of a house are rendered together, with one loadScene()
+  stable_sort(houses.begin(), houses.end(), [](const House& a, const House& b) {
+      return a.obj_file < b.obj_file; });
+  {
+    lock_guard<mutex> lg(mutex_);
+    nr_written_ = 0;
+  }
+  for (size_t i = 0; i < houses.size(); ++i) {
+    api_.loadScene(houses[i].obj_file, model_category_file_, semantic_label_file_);
+    // parse the next house while this one is rendered
+    for (size_t j = i + 1; j < houses.size(); ++j)
+      if (houses[j].obj_file != houses[i].obj_file) {
+        api_.prefetchScene(houses[j].obj_file, model_category_file_, semantic_label_file_);
+        break;
+      }
+    render_house_(houses[i]);
+  }
+  wait_();
+  lock_guard<mutex> lg(mutex_);
+  return nr_written_;
+}
+
+void TrajectoryRenderer::render_house_(const House& house) {
+  int n = house.poses.size();
+  if (n == 0)
+    return;
+  vector<int> order = spatial_order(house.poses);
+  Geometry geo = api_.resolution();
+  Format format = options_.format;
+  SUNCGScene::RenderMode old_mode = api_.getMode();
+  Camera old_camera = *api_.getCamera();
+
+  for (auto mode : options_.modes) {
+    api_.setMode(mode);
+    string name = string(mode_name(mode)) + (options_.cube_map ? "_cube" : "");
+    int rows = geo.h, cols = options_.cube_map ? 6 * geo.w : geo.w, c = api_.numChannels();
+    size_t frame_bytes = (size_t)rows * cols * c;
+
+    shared_ptr<RawFile> raw;
+    string dir = house.out_dir + "/" + name;
+    make_dirs(format == Format::RAW ? house.out_dir : dir);
+    if (format == Format::RAW) {
+      raw = make_shared<RawFile>(dir + ".raw", frame_bytes * n);
+      ofstream meta(dir + ".raw.json");
+      meta << ssprintf("{\"shape\": [%d, %d, %d, %d], \"dtype\": \"uint8\"}\n", n, rows, cols, c);
+      if (!meta.good())
+        throw runtime_error(ssprintf("Cannot write %s.raw.json", dir.c_str()));
+    }
+    const char* ext = format == Format::JPEG ? "jpg" : "png";
+
+    // write the frames of img, stacked vertically, as poses frames[k]
+    auto write = [=](shared_ptr<Matuc> img, vector<int> frames) {
+      for (size_t k = 0; k < frames.size(); ++k) {
+        const unsigned char* src = img->ptr(k * rows);
+        if (raw) {
+          raw->write(src, frame_bytes, frame_bytes * frames[k]);
+          continue;
+        }
+        Matuc out(rows, cols, 3);
+        if (c == 3) {
+          memcpy(out.ptr(), src, frame_bytes);
+        } else {
+          unsigned char* dst = out.ptr();
+          for (size_t p = 0; p < (size_t)rows * cols; ++p)
+            for (int ch = 0; ch < 3; ++ch)
+              dst[p * 3 + ch] = ch < c ? src[p * c + ch] : 0;
+        }
+        write_rgb(ssprintf("%s/%06d.%s", dir.c_str(), frames[k], ext).c_str(), out);
+      }
+      lock_guard<mutex> lg(mutex_);
+      nr_written_ += frames.size();
+    };
+
+    if (options_.cube_map) {
+      for (int i : order) {
+        auto& p = house.poses[i];
+        Camera& cam = *api_.getCamera();
+        cam.pos = glm::vec3{p.x, p.y, p.z};
+        cam.yaw = p.yaw;
+        cam.pitch = p.pitch;
+        cam.updateDirection();
+        auto img = make_shared<Matuc>(api_.renderCubeMap());
+        push_([=]() { write(img, {i}); });
+      }
+      continue;
+    }
+    for (int start = 0; start < n; start += options_.batch) {
+      vector<int> frames(order.begin() + start,
+          order.begin() + min(n, start + options_.batch));
+      CameraBatch cams(frames.size());
+      // the intrinsics of the API camera, as renderCubeMap() above
+      cams.near = old_camera.near;
+      cams.far = old_camera.far;
+      cams.vertical_fov = old_camera.vertical_fov;
+      for (size_t k = 0; k < frames.size(); ++k) {
+        auto& p = house.poses[frames[k]];
+        cams.set(k, Camera{glm::vec3{p.x, p.y, p.z}, p.yaw, p.pitch});
+      }
+      auto img = make_shared<Matuc>(api_.renderBatch(cams));
+      push_([=]() { write(img, frames); });
+    }
+  }
+  api_.setMode(old_mode);
+  *api_.getCamera() = old_camera;
+}
+
+} // namespace render
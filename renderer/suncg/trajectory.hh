@@ -0,0 +1,103 @@
+// Copyright 2017-present, Facebook, Inc.
+// All rights reserved.
+//
+// This source code is licensed under the license found in the
+// LICENSE file in the root directory of this source tree.
+//File: trajectory.hh
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "render.hh"
+
+namespace render {
+
+// A camera pose of a trajectory: Camera::pos, yaw and pitch in degrees.
+struct TrajectoryPose {
+  float x, y, z, yaw, pitch;
+};
+
+// Read the poses of a text file with one "x y z yaw [pitch]" per line.
+// Empty lines and lines starting with '#' are skipped.
+// Throws std::runtime_error if the file can't be read.
+std::vector<TrajectoryPose> read_trajectory(const std::string& fname);
+
+// Render the poses of many houses in the modes of a dataset, and write the
+// images to disk, for datasets of recorded trajectories.
+//
+// Each house is loaded once, while the next one is parsed in the
+// background, and its poses are drawn with renderBatch() in an order close
+// in space, so that the views of a batch see the same rooms. A pool of
+// writer threads encodes and writes the images meanwhile.
+//
+// The images of pose i of a house in mode m are written to:
+//   JPEG, PNG: out_dir/m/i.jpg (or .png), with i padded to 6 digits
+//   RAW: frame i of out_dir/m.raw, a (n, h, w, c) uint8 array in C order,
+//     described by out_dir/m.raw.json
+// with m one of rgb, semantic, instance, depth, invdepth, or the same with
+// a "_cube" suffix for cube maps. Images of 2 channels (depth) are written
+// with a third channel of 0 in JPEG and PNG. Use PNG or RAW for depth and
+// labels, as JPEG is lossy.
+class TrajectoryRenderer {
+  public:
+    enum class Format { JPEG, PNG, RAW };
+
+    struct Options {
+      std::vector<SUNCGScene::RenderMode> modes{SUNCGScene::RenderMode::RGB};
+      bool cube_map = false;  // render cube maps instead of views
+      Format format = Format::PNG;
+      int nr_writers = 4;
+      int batch = 32;         // views per renderBatch()
+    };
+
+    struct House {
+      std::string obj_file;
+      std::vector<TrajectoryPose> poses;
+      std::string out_dir;
+    };
+
+    // api must outlive this object, and be used by this thread only.
+    TrajectoryRenderer(SUNCGRenderAPI& api, std::string model_category_file,
+        std::string semantic_label_file, Options options);
+    ~TrajectoryRenderer();
+    TrajectoryRenderer(const TrajectoryRenderer&) = delete;
+    TrajectoryRenderer& operator = (const TrajectoryRenderer&) = delete;
+
+    // Render and write the poses of all houses, and wait for the writes.
+    // Returns the number of images written. Throws std::runtime_error if
+    // an image can't be written.
+    size_t run(std::vector<House> houses);
+
+    static const char* mode_name(SUNCGScene::RenderMode mode);
+
+  private:
+    SUNCGRenderAPI& api_;
+    std::string model_category_file_, semantic_label_file_;
+    Options options_;
+
+    // the writer threads, and their bounded queue of jobs
+    std::vector<std::thread> writers_;
+    std::mutex mutex_;   // guards the fields below
+    std::condition_variable not_empty_, not_full_, idle_;
+    std::queue<std::function<void()>> jobs_;
+    int nr_running_ = 0;
+    bool stopped_ = false;
+    std::string error_;   // of the first write that failed
+    size_t nr_written_ = 0;
+
+    void push_(std::function<void()> job);
+    void write_loop_();
+    // wait until all jobs are done, and throw their error if any
+    void wait_();
+
+    void render_house_(const House& house);
+};
+
+} // namespace render
@@ -15,18 +15,30 @@ from House3D import objrender
 from House3D import Environment, create_default_config
 
 
-def worker(idx, house_id, device):
+N = 15000
+
+
+def ring_name(idx):
+    return '/house3d-benchmark-{}-{}'.format(os.getpid(), idx)
+
+
+def worker(idx, house_id, device, ring=None):
     colormapFile = "../metadata/colormap_coarse.csv"
     api = objrender.RenderAPI(w=args.width, h=args.height, device=device)
     env = Environment(api, house_id, cfg)
-    N = 15000
+    if ring is not None:
+        ring = objrender.ShmRing(ring)
     start = time.time()
     cnt = 0
     env.reset()
     for t in range(N):
         cnt += 1
         env.move_forward(random.random() * 3, random.random() * 3)
-        mat = env.render()
+        if ring is not None:
+            # ship the frame to the main process through shared memory
+            api.renderIntoRing(ring)
+        else:
+            mat = env.render()
         if (cnt % 50 == 0):
             env.reset()
     end = time.time()
@@ -52,6 +64,8 @@ if __name__ == '__main__':
     parser.add_argument('--num-gpu', type=int, default=1)
     parser.add_argument('--width', type=int, default=120)
     parser.add_argument('--height', type=int, default=90)
+    parser.add_argument('--shm', action='store_true',
+                        help='send the frames to the main process through shared memory')
     args = parser.parse_args()
 
     prefix = os.path.dirname(os.path.dirname(args.obj))
@@ -60,14 +74,30 @@ if __name__ == '__main__':
     global cfg
     cfg = create_default_config(prefix)
 
+    rings = []
+    if args.shm:
+        # rgb frames, created before the workers open them
+        rings = [objrender.ShmRing(ring_name(i), 8, args.height, args.width, 3)
+                 for i in range(args.num_proc)]
+
     procs = []
     for i in range(args.num_proc):
         device = i % args.num_gpu
-        procs.append(mp.Process(target=worker, args=(i, house_id, device)))
+        ring = ring_name(i) if args.shm else None
+        procs.append(mp.Process(target=worker, args=(i, house_id, device, ring)))
 
     for p in procs:
         p.start()
 
+    if rings:
+        start = time.time()
+        for t in range(N):
+            for ring in rings:
+                frame = ring.read()     # a view of the shared memory
+                frame.sum()
+                ring.release()
+        print("Main process received {:.3f} fps".format(N * len(rings) / (time.time() - start)))
+
     for p in procs:
         p.join()
 
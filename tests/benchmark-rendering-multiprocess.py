@@ -25,15 +25,24 @@ def worker(idx, device, num_iter):
     api.loadScene(args.obj, mappingFile, colormapFile)
     cam = api.getCamera()
 
+    if args.batch > 1:
+        cams = [Camera(cam) for _ in range(args.batch)]
+        for k, c in enumerate(cams):
+            c.turn(360.0 / args.batch * k, 0)
+        num_iter = max(num_iter // args.batch, 1)
+
     start = time.time()
     for t in range(num_iter):
         if t % 2 == 1:
             api.setMode(RenderMode.RGB)
         else:
             api.setMode(RenderMode.SEMANTIC)
-        mat = np.array(api.render(), copy=False)
+        if args.batch > 1:
+            mat = api.renderBatch(cams)
+        else:
+            mat = np.array(api.render(), copy=False)
     end = time.time()
-    print("Worker {}, speed {:.3f} fps".format(idx, num_iter / (end - start)))
+    print("Worker {}, speed {:.3f} fps".format(idx, num_iter * args.batch / (end - start)))
 
 
 if __name__ == '__main__':
@@ -66,6 +75,8 @@ if __name__ == '__main__':
     parser.add_argument('--width', type=int, default=120)
     parser.add_argument('--height', type=int, default=90)
     parser.add_argument('--num-iter', type=int, default=5000)
+    parser.add_argument('--batch', type=int, default=1,
+                        help='number of views rendered per renderBatch call')
     args = parser.parse_args()
 
     global cfg
@@ -4,12 +4,18 @@
 # This source code is licensed under the license found in the
 # LICENSE file in the root directory of this source tree.
 
+import collections
 import numpy as np
 import os
+import pickle
+import shutil
+import tempfile
 import unittest
+from multiprocessing.pool import ThreadPool
 
 from House3D import objrender, Environment, load_config, House
 from House3D.objrender import RenderMode
+from House3D.roomnav import VecRoomNavTask
 
 PIXEL_MAX = np.iinfo(np.uint16).max
 ROOM_TYPE = 'kitchen'
@@ -23,7 +29,7 @@ def depth_of_inverse_depth(inverse_depth):
     return NEAR * PIXEL_MAX / inverse_depth.astype(np.float)
 
 
-def create_house(houseID, config):
+def create_house(houseID, config, **kwargs):
     obj_file = os.path.join(config['prefix'], houseID, 'house.obj')
     json_file = os.path.join(config['prefix'], houseID, 'house.json')
     assert (
@@ -37,7 +43,8 @@ def create_house(houseID, config):
         obj_file,
         config["modelCategoryFile"],
         CachedFile=cache_file,
-        SetTarget=False)
+        SetTarget=False,
+        **kwargs)
 
 
 def find_first_good_house(cfg):
@@ -48,14 +55,21 @@ def find_first_good_house(cfg):
             return (house_id, house)
 
 
+def create_env(api=None):
+    '''An Environment of the first good house, on api or on a new SIDE x SIDE
+    RenderAPI, at a random location in a ROOM_TYPE room.'''
+    if api is None:
+        api = objrender.RenderAPI(w=SIDE, h=SIDE, device=0)
+    cfg = load_config('config.json')
+    houseID, house = find_first_good_house(cfg)
+    env = Environment(api, house, cfg)
+    env.reset(*house.getRandomLocation(ROOM_TYPE))
+    return env
+
+
 class TestCubeMap(unittest.TestCase):
     def test_render(self):
-        api = objrender.RenderAPI(w=SIDE, h=SIDE, device=0)
-        cfg = load_config('config.json')
-        houseID, house = find_first_good_house(cfg)
-        env = Environment(api, house, cfg)
-        location = house.getRandomLocation(ROOM_TYPE)
-        env.reset(*location)
+        env = create_env()
 
         # Check RGB
         env.set_render_mode(RenderMode.RGB)
@@ -96,5 +110,846 @@ class TestCubeMap(unittest.TestCase):
             depth2[0, 0], depth_value, delta=depth_value * 0.05)
 
 
+class TestRenderBatch(unittest.TestCase):
+    def test_render_batch(self):
+        env = create_env()
+        api = env.api
+
+        cams = []
+        for k in range(4):
+            cam = objrender.Camera(env.cam)
+            cam.turn(90 * k, 0)
+            cams.append(cam)
+
+        for mode, nc in [(RenderMode.RGB, 3), (RenderMode.DEPTH, 2)]:
+            env.set_render_mode(mode)
+            batch = api.renderBatch(cams)
+            self.assertEqual(batch.shape, (len(cams), SIDE, SIDE, nc))
+            # every view matches a single render from the same camera
+            for cam, img in zip(cams, batch):
+                env.cam.yaw, env.cam.pitch = cam.yaw, cam.pitch
+                env.cam.updateDirection()
+                self.assertTrue(np.array_equal(img, env.render(copy=True)))
+            env.cam.yaw, env.cam.pitch = cams[0].yaw, cams[0].pitch
+            env.cam.updateDirection()
+
+
+class TestProfiler(unittest.TestCase):
+    def test_stats(self):
+        env = create_env()
+
+        objrender.enableProfiler()
+        objrender.resetStats()
+        for _ in range(10):
+            env.render(copy=True)
+        objrender.enableProfiler(False)
+        stats = objrender.getStats()
+        zones = {z.name: z for z in stats.zones}
+        counters = dict(stats.counters)
+        self.assertEqual(zones['draw'].count, 10)
+        self.assertLessEqual(zones['draw'].self, zones['draw'].total)
+        self.assertGreaterEqual(counters['readback_bytes'], 10 * SIDE * SIDE * 3)
+        self.assertGreater(counters['draw_calls'], 0)
+
+        objrender.resetStats()
+        self.assertEqual(len(objrender.getStats().zones), 0)
+
+
+class TestBufferPool(unittest.TestCase):
+    def test_reuse(self):
+        env = create_env()
+
+        env.render(copy=True)
+        before = objrender.getBufferPoolStats()
+        for _ in range(5):
+            env.render(copy=True)
+        # every frame reuses the block of the one before
+        after = objrender.getBufferPoolStats()
+        self.assertEqual(after.misses, before.misses)
+        self.assertEqual(after.hits, before.hits + 5)
+        self.assertLessEqual(after.free_bytes, objrender.BUFFER_POOL_MAX_FREE_BYTES)
+
+
+class TestCameraBatch(unittest.TestCase):
+    def test_render_batch(self):
+        env = create_env()
+        api = env.api
+
+        cams = []
+        for k in range(4):
+            cam = objrender.Camera(env.cam)
+            cam.turn(90 * k, 0)
+            cams.append(cam)
+        batch = objrender.CameraBatch(len(cams))
+        pos = np.array([[c.pos.x, c.pos.y, c.pos.z] for c in cams])
+        batch.setPoses(pos, np.array([c.yaw for c in cams]),
+                       np.array([c.pitch for c in cams]))
+        self.assertEqual(len(batch), len(cams))
+        self.assertTrue(np.allclose(batch.getPositions(), pos))
+        self.assertTrue(np.array_equal(
+            api.renderBatch(batch), api.renderBatch(cams)))
+
+
+class TestCameraRig(unittest.TestCase):
+    def test_render_rig(self):
+        env = create_env()
+        api = env.api
+        rig = objrender.CameraRig.stereo(0.065)
+        rig.addView((0.1, 0, 0), yaw=90, vertical_fov=90)
+        self.assertEqual(len(rig), 3)
+        cams = rig.cameras(env.cam)
+        self.assertAlmostEqual(cams[1].pos.x - cams[0].pos.x, 0.065 * env.cam.right.x, places=5)
+        self.assertAlmostEqual(cams[2].yaw, env.cam.yaw + 90, places=5)
+        imgs = api.renderRig(rig)
+        self.assertEqual(imgs.shape, (len(cams), SIDE, SIDE, 3))
+        # every view is a single render() with the camera moved to it
+        for cam, img in zip(cams, imgs):
+            env.cam.pos = cam.pos
+            env.cam.yaw, env.cam.pitch = cam.yaw, cam.pitch
+            env.cam.vertical_fov = cam.vertical_fov
+            env.cam.updateDirection()
+            self.assertTrue(np.array_equal(img, env.render(copy=True)))
+
+
+class TestTrajectory(unittest.TestCase):
+    def test_raw(self):
+        env = create_env()
+        api = env.api
+        house = env.house
+        cfg = env.config
+        cams = []
+        for k in range(5):
+            cam = objrender.Camera(env.cam)
+            cam.turn(70 * k, 0)
+            cams.append(cam)
+        poses = np.array([[c.pos.x, c.pos.y, c.pos.z, c.yaw, c.pitch] for c in cams])
+
+        out_dir = tempfile.mkdtemp()
+        n = objrender.renderTrajectories(
+            api, [(house.objFile, poses, out_dir)],
+            house.metaDataFile, cfg['colorFile'],
+            modes=[RenderMode.RGB, RenderMode.DEPTH], format='raw', batch=2)
+        self.assertEqual(n, 2 * len(cams))
+        api.loadScene(house.objFile, house.metaDataFile, cfg['colorFile'])
+        for mode, name, nc in [(RenderMode.RGB, 'rgb', 3), (RenderMode.DEPTH, 'depth', 2)]:
+            raw = np.fromfile(os.path.join(out_dir, name + '.raw'), dtype=np.uint8)
+            api.setMode(mode)
+            self.assertTrue(np.array_equal(
+                raw.reshape(len(cams), SIDE, SIDE, nc), api.renderBatch(cams)))
+        shutil.rmtree(out_dir)
+
+
+class TestRenderMulti(unittest.TestCase):
+    def test_render_multi(self):
+        env = create_env()
+
+        modes = ['semantic', 'instance', 'depth', 'invdepth']
+        imgs = env.render_multi(modes)
+        self.assertEqual(len(imgs), len(modes))
+        for mode, img in zip(modes, imgs):
+            self.assertTrue(np.array_equal(img, env.render(mode=mode, copy=True)))
+
+
+class TestRenderViews(unittest.TestCase):
+    def test_render_views(self):
+        env = create_env(objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0))
+        api = env.api
+        views = []
+        for k, mode in enumerate([RenderMode.RGB, RenderMode.SEMANTIC, RenderMode.DEPTH]):
+            cam = objrender.Camera(env.cam)
+            cam.turn(90 * k, 0)
+            views.append((mode, cam))
+        imgs = api.renderViews(views)
+        self.assertEqual(len(imgs), len(views))
+        for (mode, cam), img in zip(views, imgs):
+            api.setMode(mode)
+            env.cam.yaw, env.cam.pitch = cam.yaw, cam.pitch
+            env.cam.updateDirection()
+            self.assertTrue(np.array_equal(img, api.render()))
+
+
+class TestRenderInto(unittest.TestCase):
+    def test_render_into(self):
+        env = create_env()
+
+        for mode, nc in [(RenderMode.RGB, 3), (RenderMode.DEPTH, 2)]:
+            env.set_render_mode(mode)
+            out = np.zeros((2, SIDE, SIDE, nc), dtype=np.uint8)
+            env.render_into(out[1])
+            self.assertTrue(np.array_equal(out[1], env.render(copy=True)))
+            self.assertFalse(out[0].any())
+
+        env.set_render_mode(RenderMode.RGB)
+        with self.assertRaises(ValueError):
+            env.render_into(np.zeros((SIDE, SIDE, 2), dtype=np.uint8))
+        with self.assertRaises(ValueError):
+            env.render_into(np.zeros((SIDE, SIDE, 3), dtype=np.float32))
+        with self.assertRaises(ValueError):
+            env.render_into(np.zeros((SIDE, SIDE * 2, 3), dtype=np.uint8)[:, ::2])
+        # the mode is restored when the render fails
+        with self.assertRaises(ValueError):
+            env.render_into(np.zeros((SIDE, SIDE, 3), dtype=np.uint8), mode='depth')
+        self.assertEqual(env.api.getMode(), RenderMode.RGB)
+
+
+class TestPrefetchScene(unittest.TestCase):
+    def test_prefetch(self):
+        env = create_env()
+        house, cfg = env.house, env.config
+        expected = env.render(mode='rgb', copy=True)
+
+        # a separate context, so that the scene is not cached yet
+        api = objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0)
+        api.prefetchScene(house.objFile, house.metaDataFile, cfg['colorFile'])
+        other = Environment(api, house, cfg)
+        other.reset(x=env.cam.pos.x, y=env.cam.pos.z, yaw=env.cam.yaw)
+        self.assertTrue(np.array_equal(other.render(mode='rgb', copy=True), expected))
+
+    def test_failed_prefetch(self):
+        cfg = load_config('config.json')
+        api = objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0)
+        tmp_dir = tempfile.mkdtemp()
+        obj_file = os.path.join(tmp_dir, 'house.obj')
+        api.prefetchScene(obj_file, cfg['modelCategoryFile'], cfg['colorFile'])
+        # the error of the prefetch, then of a new parse: not a stale future
+        for _ in range(2):
+            with self.assertRaisesRegex(RuntimeError, 'Cannot open file'):
+                api.loadScene(obj_file, cfg['modelCategoryFile'], cfg['colorFile'])
+        shutil.rmtree(tmp_dir)
+
+
+class TestNativeHouse(unittest.TestCase):
+    def test_check_occupy(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        rng = np.random.RandomState(0)
+        for gx, gy in rng.randint(0, house.n_row + 1, size=(500, 2)):
+            cx, cy = house.to_coor(gx, gy, True)
+            self.assertEqual(house._native.check_occupy(house.obsMap, cx, cy),
+                             house.check_occupy(cx, cy))
+
+    def test_movable_map(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        c = house.n_row // 2
+        roi = (c - 40, c - 40, c + 40, c + 40)
+        native = np.zeros_like(house.moveMap, dtype=np.int8)
+        house._native.genMovableMap(house.obsMap, native, *roi)
+        house.moveMap = np.zeros(native.shape, dtype=np.int32)   # forces the python version
+        house._updateMovableMap(*roi)
+        self.assertTrue(np.array_equal(native, house.moveMap))
+
+    def test_obstacle_map(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        native = np.ones_like(house.tinyObsMap)
+        house.genObstacleMap(house.metaDataFile, gen_debug_map=False, dest=native,
+                             n_row=native.shape[0] - 1)
+        house._debugMap = np.ones(native.shape, dtype=np.float)   # forces the python version
+        python = np.ones_like(native)
+        house.genObstacleMap(house.metaDataFile, dest=python, n_row=python.shape[0] - 1)
+        self.assertTrue(np.array_equal(native, python))
+
+    def test_components(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        dirs = [[0, 1], [1, 0], [-1, 0], [0, -1]]   # explicit dirs use the python version
+        for room in house._getRooms(ROOM_TYPE):
+            bounds = house._getRoomBounds(room)
+            for largest, is_open in [(True, False), (False, True)]:
+                native = house._find_components(*bounds, return_largest=largest, return_open=is_open)
+                python = house._find_components(*bounds, dirs=dirs, return_largest=largest,
+                                                return_open=is_open)
+                if largest or isinstance(python[0], tuple):
+                    native, python = [native], [python]
+                self.assertEqual([[tuple(c) for c in comp] for comp in native], python)
+        # nothing is outside of the whole map: return_open falls back to the largest one
+        bounds = (0, 0, house.n_row, house.n_row)
+        native = house._find_components(*bounds, return_open=True)
+        self.assertIsInstance(native, np.ndarray)
+        python = house._find_components(*bounds, dirs=dirs, return_open=True)
+        self.assertEqual([tuple(c) for c in native], python)
+
+    def test_walls(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        # the text scan of house.obj it replaces
+        groups, vers = [], None
+        with open(house.objFile) as f:
+            for line in f:
+                if line[0] == 'g':
+                    vers = [] if 'Wall' in line else None
+                    if vers is not None:
+                        groups.append(vers)
+                elif vers is not None and line[:2] == 'v ':
+                    vers.append([float(v) for v in line[2:].split()])
+        # the walls of the ground floor
+        python = [(np.min(v, axis=0).tolist(), np.max(v, axis=0).tolist())
+                  for v in groups if len(v) and np.min(v, axis=0)[1] < house.robotHei]
+        native = [(w['bbox']['min'], w['bbox']['max']) for w in house.all_walls]
+        self.assertEqual(native, python)
+
+        # a bare `g` ends the wall before it
+        tmp_dir = tempfile.mkdtemp()
+        fname = os.path.join(tmp_dir, 'walls.obj')
+        with open(fname, 'w') as f:
+            f.write('g Wall#1\nv 0 0 0\nv 1 1 1\ng\nv 2 2 2\n')
+        walls = objrender._House.parseWalls(fname, 10)
+        self.assertEqual([w['bbox']['max'] for w in walls], [[1, 1, 1]])
+        shutil.rmtree(tmp_dir)
+        with self.assertRaises(RuntimeError):
+            objrender._House.parseWalls(fname, 10)
+
+    def test_maps(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        tmp_dir = tempfile.mkdtemp()
+        fname = os.path.join(tmp_dir, 'house.maps')
+        house.saveMaps(fname)
+        maps = objrender._House.loadMaps(fname)
+        self.assertEqual(len(maps), max(house.validLevels) + 1)
+        obs, move = maps[0]
+        self.assertTrue(np.array_equal(obs, house.obsMap != 0))
+        self.assertTrue(np.array_equal(move, house.moveMap > 0))
+        self.assertEqual((obs.dtype, move.dtype), (np.uint8, np.int8))
+        # not a file of saveMaps
+        self.assertIsNone(objrender._House.loadMaps(cfg['modelCategoryFile']))
+
+        json_file = os.path.join(os.path.dirname(house.objFile), 'house.json')
+        cached = House(json_file, house.objFile, cfg['modelCategoryFile'], CachedFile=fname,
+                       SetTarget=False)
+        shutil.rmtree(tmp_dir)
+        for k in house.validLevels:
+            house.setLevel(k)
+            cached.setLevel(k)
+            self.assertTrue(np.array_equal(cached.moveMap > 0, house.moveMap > 0))
+
+    def test_inactive_levels(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        house.setLevel(0)
+        house.setTargetRoom(ROOM_TYPE)
+        connMap, moveMap = house.connMap.copy(), house.moveMap.copy()
+        house._store_level(house._levelStates[0], pack=True)
+        state = house._levelStates[0]
+        # only the compact forms are kept for a level not in use
+        self.assertIsInstance(state['moveMap'], tuple)
+        self.assertIsNone(state['connMap'])
+        self.assertIsNotNone(state['_activeConn'])
+        house._load_level(0)
+        self.assertTrue(np.array_equal(house.moveMap, moveMap))
+        self.assertTrue(np.array_equal(house.connMap, connMap))
+
+    def test_pack_maps(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        house.setTargetRoom(ROOM_TYPE)
+        obsMap, connMap = house.obsMap.copy(), house.connMap.copy()
+        # the current level too, e.g. for the houses a MultiHouseEnv is not on
+        house.packMaps()
+        self.assertIsNone(house.obsMap)
+        self.assertIsNone(house.connMap)
+        self.assertIsInstance(house._levelStates[house.levelIdx]['obsMap'], tuple)
+        house.unpackMaps()
+        self.assertTrue(np.array_equal(house.obsMap, obsMap))
+        self.assertTrue(np.array_equal(house.connMap, connMap))
+
+    def test_house_set(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        tmp_dir = tempfile.mkdtemp()
+        fname = os.path.join(tmp_dir, 'house.maps')
+        house.saveMaps(fname)
+        houseSet = objrender._HouseSet([house.objFile, house.objFile], [fname, ''])
+        self.assertEqual(len(houseSet), 2)
+        self.assertEqual(houseSet.walls(1, 2.0), objrender._House.parseWalls(house.objFile, 2.0))
+        self.assertIsNone(houseSet.maps(1))
+        obs, move = houseSet.maps(0)[0]
+        self.assertTrue(np.array_equal(move, house.moveMap > 0))
+
+        json_file = os.path.join(os.path.dirname(house.objFile), 'house.json')
+        preloaded = House(json_file, house.objFile, cfg['modelCategoryFile'], CachedFile=fname,
+                          SetTarget=False, Preloaded=(houseSet, 0))
+        shutil.rmtree(tmp_dir)
+        self.assertTrue(np.array_equal(preloaded.moveMap, house.moveMap > 0))
+        self.assertEqual(len(preloaded.all_walls), len(house.all_walls))
+
+    def test_conn_map_cache(self):
+        cfg = load_config('config.json')
+        houseID, _ = find_first_good_house(cfg)
+        cache_dir = tempfile.mkdtemp()
+        # without a target yet, so setTargetRoom() computes and stores it
+        house = create_house(houseID, cfg, ConnMapCacheDir=cache_dir)
+        regions = []
+        for room in house._getRooms(ROOM_TYPE):
+            _x1, _, _y1 = room['bbox']['min']
+            _x2, _, _y2 = room['bbox']['max']
+            regions.append(house.rescale(_x1, _y1, _x2, _y2) + ((_x1 + _x2) / 2, (_y1 + _y2) / 2))
+        connMap, que, inroomDist, maxConnDist, _, _ = house._native.genConnMaps(
+            house._native_move_map(), [np.array(regions, dtype=np.float64)], True)[0]
+        house.setTargetRoom(ROOM_TYPE)
+        self.assertTrue(np.array_equal(house.connMap, connMap))
+        self.assertTrue(np.array_equal(house.inroomDist, inroomDist))
+        self.assertEqual(house.maxConnDist, maxConnDist)
+        self.assertEqual(sorted(map(tuple, house.connectedCoors)), sorted(map(tuple, que)))
+        dist = house.connMap[house.connectedCoors[:, 0], house.connectedCoors[:, 1]]
+        self.assertTrue(np.all(np.diff(dist) >= 0))
+
+        # computed once, then mapped from the file, also when pickled
+        fname = house._conn_map_file(ROOM_TYPE)
+        self.assertEqual(house.connMapDict[ROOM_TYPE].fname, fname)
+        loaded = house._load_conn_map(ROOM_TYPE)
+        self.assertTrue(np.array_equal(loaded.connMap(), connMap))
+        self.assertEqual(pickle.loads(pickle.dumps(loaded)).fname, fname)
+        shutil.rmtree(cache_dir)
+
+    def test_geodesic(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        house.setTargetRoom(ROOM_TYPE)
+        target = tuple(house.connectedCoors[0])
+        # BFS distances to the target cell
+        dist = -np.ones(house.moveMap.shape, dtype=np.int32)
+        dist[target] = 0
+        que = collections.deque([target])
+        while que:
+            x, y = que.popleft()
+            for nx, ny in ((x + 1, y), (x - 1, y), (x, y + 1), (x, y - 1)):
+                if 0 <= nx < dist.shape[0] and 0 <= ny < dist.shape[1] and \
+                        house.moveMap[nx, ny] > 0 and dist[nx, ny] < 0:
+                    dist[nx, ny] = dist[x, y] + 1
+                    que.append((nx, ny))
+
+        rng = np.random.RandomState(0)
+        starts = house.connectedCoors[rng.randint(len(house.connectedCoors), size=100)]
+        ends = np.tile(np.array(target, dtype=np.int32), (len(starts), 1))
+        geodesics = house.geodesics(starts, ends)
+        for (x, y), d in zip(starts, geodesics):
+            self.assertEqual(d, dist[x, y])
+            self.assertGreaterEqual(d, house.connMap[x, y])
+            self.assertEqual(house.geodesic(target[0], target[1], x, y), d)
+            path = house.shortestPath(x, y, target[0], target[1])
+            self.assertEqual(len(path), d + 1)
+            self.assertTrue(np.all(np.abs(np.diff(path, axis=0)).sum(axis=1) == 1))
+            self.assertTrue(np.all(house.moveMap[path[:, 0], path[:, 1]] > 0))
+        self.assertEqual(house.geodesic(-1, 0, target[0], target[1]), -1)
+
+
+class TestCheckMoves(unittest.TestCase):
+    def test_check_moves(self):
+        env = create_env()
+        rng = np.random.RandomState(0)
+        starts, ends = [], []
+        for _ in range(100):
+            env.reset()
+            starts.append([env.cam.pos.x, env.cam.pos.z])
+            ends.append(np.array(starts[-1]) + rng.uniform(-1, 1, size=2))
+        starts, ends = np.array(starts), np.array(ends)
+        success, endpoints = env.check_moves(starts, ends)
+        for a, b, ok, end in zip(starts, ends, success, endpoints):
+            pA, pB = np.array([a[0], 0, a[1]]), np.array([b[0], 0, b[1]])
+            self.assertEqual(ok, env._check_collision(pA, pB))
+            if ok:
+                self.assertTrue(np.allclose(end, b))
+
+
+class TestVecRoomNav(unittest.TestCase):
+    def test_step(self):
+        env = create_env()
+        house = env.house
+        num_agents = 4
+        task = VecRoomNavTask(env, num_agents, seed=0, success_measure='stay', discrete_action=True)
+        obs = task.reset()
+        self.assertEqual(obs.shape, (num_agents, SIDE, SIDE, 4))
+        obs, reward, done, info = task.step([0] * num_agents)
+        self.assertEqual(obs.shape, (num_agents, SIDE, SIDE, 4))
+        self.assertEqual(reward.shape, (num_agents,))
+        self.assertFalse(done.any())
+        for i in range(num_agents):
+            # same observation as rendering from the camera of the agent
+            cam = task.engine.getCamera(i)
+            env.reset(x=cam.pos.x, y=cam.pos.z, yaw=cam.yaw)
+            self.assertTrue(np.array_equal(obs[i][..., :3], env.render(mode='semantic', copy=True)))
+            self.assertTrue(np.array_equal(obs[i][..., 3], env.render(mode='depth', copy=True)[..., 0]))
+            house.setTargetRoom(info['target_room'][i])
+            gx, gy = house.to_grid(*info['loc'][i])
+            self.assertEqual(info['dist'][i], house.connMap[gx, gy])
+
+
+class TestShmRing(unittest.TestCase):
+    def test_render_into_ring(self):
+        env = create_env()
+        api = env.api
+        ring = objrender.ShmRing('/house3d-test-{}'.format(os.getpid()), 2, SIDE, SIDE, 3)
+        reader = objrender.ShmRing(ring.name)
+        self.assertEqual(reader.read(timeout_ms=0), None)
+        self.assertTrue(api.renderIntoRing(ring))
+        self.assertTrue(ring.write(np.zeros((SIDE, SIDE, 3), dtype=np.uint8)))
+        self.assertFalse(api.renderIntoRing(ring, timeout_ms=0))   # full
+        self.assertTrue(np.array_equal(reader.read(), env.render(copy=True)))
+        reader.release()
+        self.assertFalse(reader.read().any())
+        reader.release()
+        self.assertEqual(ring.size(), 0)
+        with self.assertRaises(RuntimeError):
+            reader.release()
+        self.assertEqual(ring.size(), 0)
+
+
+@unittest.skipIf(shutil.which('ffmpeg') is None, 'needs ffmpeg')
+class TestVideoWriter(unittest.TestCase):
+    def test_record_frame(self):
+        env = create_env()
+        api = env.api
+        out_dir = tempfile.mkdtemp()
+        fname = os.path.join(out_dir, 'video.mp4')
+        with objrender.VideoWriter(fname, SIDE, SIDE, fps=10) as video:
+            for k in range(5):
+                api.recordFrame(video)
+                env.cam.turn(10, 0)
+            video.write(np.zeros((SIDE, SIDE, 3), dtype=np.uint8))
+            self.assertEqual(video.numFrames(), 6)
+        self.assertGreater(os.path.getsize(fname), 0)
+        api.setMode(RenderMode.DEPTH)
+        with self.assertRaises(ValueError):
+            api.recordFrame(objrender.VideoWriter(fname, SIDE, SIDE))
+        shutil.rmtree(out_dir)
+
+
+class TestRenderServer(unittest.TestCase):
+    def test_clients(self):
+        server = objrender.RenderServer(w=SIDE, h=SIDE, devices=[0])
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        envs = [Environment(objrender.RenderClient(server), house, cfg) for _ in range(3)]
+        for env in envs:
+            env.reset()
+        # submitted together, so they are drawn in one batch
+        futures = [env.api.renderAsync() for env in envs]
+        imgs = [np.array(f.get()) for f in futures]
+
+        ref = create_env()
+        for env, img in zip(envs, imgs):
+            ref.reset(x=env.cam.pos.x, y=env.cam.pos.z, yaw=env.cam.yaw)
+            self.assertTrue(np.array_equal(img, ref.render(copy=True)))
+            self.assertTrue(np.array_equal(env.render(copy=True), img))
+
+
+class TestRenderAsync(unittest.TestCase):
+    def test_misuse(self):
+        env = create_env()
+        api = env.api
+        expected = env.render(copy=True)
+        with self.assertRaises(RuntimeError):
+            api.collect()
+        api.renderAsync()
+        api.renderAsync()
+        with self.assertRaises(RuntimeError):
+            api.renderAsync()
+        self.assertTrue(np.array_equal(np.array(api.collect()), expected))
+        self.assertEqual(api.numPendingFrames(), 1)
+
+    def test_dropped_future(self):
+        env = create_env(objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0))
+        api = env.api
+        expected = env.render(copy=True)
+        for _ in range(5):
+            api.renderAsync()   # dropped right away
+        future = api.renderAsync()
+        self.assertTrue(np.array_equal(np.array(future.get()), expected))
+
+
+class TestDeviceManager(unittest.TestCase):
+    def test_pick(self):
+        env = create_env(objrender.RenderAPI(w=SIDE, h=SIDE, device=-1))
+        api, house = env.api, env.house
+        self.assertIn(api.device(), range(objrender.numDevices()))
+
+        load = objrender.getDeviceLoad()[api.device()]
+        self.assertGreaterEqual(load.contexts, 1)
+        self.assertGreaterEqual(load.scenes, 1)
+        self.assertGreater(load.scene_bytes, 0)
+        # the house stays on the device that has it
+        self.assertEqual(objrender.pickDevice(house.objFile), api.device())
+
+
+class TestSharedContext(unittest.TestCase):
+    def test_share(self):
+        ref = create_env()
+        expected = ref.render(mode='rgb', copy=True)
+
+        # the second one uses the buffers and textures of the first
+        apis = [objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0, share=True) for _ in range(2)]
+        envs = [Environment(a, ref.house, ref.config) for a in apis]
+        for env in envs:
+            env.reset(x=ref.cam.pos.x, y=ref.cam.pos.z, yaw=ref.cam.yaw)
+        for env in envs:
+            self.assertTrue(np.array_equal(env.render(mode='rgb', copy=True), expected))
+        # the shared buffers outlive the API that uploaded them
+        del envs[0], apis[0]
+        self.assertTrue(np.array_equal(envs[0].render(mode='rgb', copy=True), expected))
+
+    def test_threads(self):
+        cfg = load_config('config.json')
+        houseID, house = find_first_good_house(cfg)
+        location = house.getRandomLocation(ROOM_TYPE)
+        apis = [objrender.RenderAPIThread(w=SIDE, h=SIDE, device=0) for _ in range(2)]
+        envs = [Environment(a, house, cfg) for a in apis]
+        for env in envs:
+            env.reset(*location)
+        expected = envs[0].render(mode='rgb', copy=True)
+
+        # the APIs load and render at once, as the calls release the GIL
+        def run(env):
+            env.reset(*location)
+            return [env.render(mode='rgb', copy=True) for _ in range(10)]
+        pool = ThreadPool(len(envs))
+        for images in pool.map(run, envs):
+            for img in images:
+                self.assertTrue(np.array_equal(img, expected))
+        pool.close()
+
+
+class TestPortalCulling(unittest.TestCase):
+    def test_portal_culling(self):
+        env = create_env()
+        rooms, portals = env.house.getRoomPortals()
+        self.assertEqual(rooms.shape[1], 4)
+        self.assertEqual(portals.shape[1], 6)
+
+        def render_counting_triangles():
+            objrender.enableProfiler()
+            objrender.resetStats()
+            img = env.render(copy=True)
+            objrender.enableProfiler(False)
+            return img, dict(objrender.getStats().counters)['triangles']
+
+        expected, nr_all = render_counting_triangles()
+        env.set_portal_culling(True)
+        # from inside a room, the rooms behind its walls are skipped
+        img, nr_culled = render_counting_triangles()
+        self.assertTrue(np.array_equal(img, expected))
+        self.assertLess(nr_culled, nr_all)
+        env.set_portal_culling(False)
+        self.assertTrue(np.array_equal(env.render(copy=True), expected))
+
+
+class TestRenderDepth(unittest.TestCase):
+    def test_render_depth(self):
+        env = create_env()
+
+        depth = env.render_depth()
+        self.assertEqual(depth.dtype, np.float32)
+        self.assertEqual(depth.shape, (SIDE, SIDE, 1))
+        # the same as the quantized depth mode, where it is not clipped
+        img = env.render(mode='depth', copy=True)
+        hit = (img[:, :, 1] == 0) & (img[:, :, 0] < 255)
+        quantized = img[:, :, 0].astype(np.float32) / 255.0 * 20.0
+        self.assertTrue(np.all(np.isinf(depth[:, :, 0][img[:, :, 1] > 0])))
+        self.assertLess(np.max(np.abs(depth[:, :, 0][hit] - quantized[hit])), 0.2)
+
+
+class TestResolution(unittest.TestCase):
+    def test_set_resolution(self):
+        env = create_env()
+        api = env.api
+        house = env.house
+        cfg = env.config
+        expected = env.render(copy=True)
+        semantic = env.render(mode='semantic', copy=True)
+
+        api.setResolution(SIDE * 2, SIDE)
+        img = env.render(copy=True)
+        self.assertEqual(img.shape, (SIDE, SIDE * 2, 3))
+        # the same as a new context of that size
+        wide = Environment(objrender.RenderAPI(w=SIDE * 2, h=SIDE, device=0), house, cfg)
+        wide.reset(x=env.cam.pos.x, y=env.cam.pos.z, yaw=env.cam.yaw)
+        self.assertTrue(np.array_equal(img, wide.render(copy=True)))
+        api.setResolution(SIDE, SIDE)
+        self.assertTrue(np.array_equal(env.render(copy=True), expected))
+
+        with self.assertRaises(ValueError):
+            api.setResolution(1 << 20, SIDE)
+        api.renderAsync()
+        with self.assertRaises(RuntimeError):
+            api.setResolution(SIDE * 2, SIDE)
+        api.collect()
+        self.assertEqual(env.render(copy=True).shape, expected.shape)
+
+        # 4x supersampling with MSAA: still an image of SIDE x SIDE
+        api.setAntialiasing(4, 4)
+        img = env.render(mode='rgb', copy=True)
+        self.assertEqual(img.shape, expected.shape)
+        # labels are never averaged
+        self.assertTrue(np.array_equal(env.render(mode='semantic', copy=True), semantic))
+        api.setAntialiasing(0, 1)
+        self.assertTrue(np.array_equal(env.render(copy=True), expected))
+
+    def test_texture_streaming(self):
+        env = create_env()
+        api = env.api
+        full = api.getSceneCacheStats().gpu_bytes
+        semantic = env.render(mode='semantic', copy=True)
+
+        api.setTextureStreaming(True)
+        api.setResolution(64, 64)
+        low = api.getSceneCacheStats().gpu_bytes
+        self.assertLess(low, full)
+        # higher levels are paged in again for a higher resolution
+        api.setResolution(SIDE, SIDE)
+        self.assertGreater(api.getSceneCacheStats().gpu_bytes, low)
+        # labels don't use the textures
+        self.assertTrue(np.array_equal(env.render(mode='semantic', copy=True), semantic))
+
+        api.setTextureStreaming(False)
+        self.assertEqual(api.getSceneCacheStats().gpu_bytes, full)
+        api.setTextureBudget(1)
+        self.assertLess(api.getSceneCacheStats().gpu_bytes, full)
+
+
+class TestInstanceIds(unittest.TestCase):
+    def test_instance_ids(self):
+        env = create_env()
+        api = env.api
+
+        ids = env.render_instance_ids()
+        self.assertEqual(ids.dtype, np.uint32)
+        self.assertEqual(ids.shape, (SIDE, SIDE, 1))
+        names = env.get_instance_names()
+        self.assertEqual(names[0], '')
+        self.assertLess(ids.max(), len(names))
+
+        # the same objects as the colors of the instance mode
+        colors = env.render(mode='instance', copy=True)
+        for id in np.unique(ids)[1:10]:
+            r, g, b = colors[ids[:, :, 0] == id][0]
+            self.assertEqual(api.getNameFromInstanceColor(int(r), int(g), int(b)), names[id])
+
+        counts = env.count_instance_pixels()
+        self.assertEqual(len(counts), len(names))
+        self.assertTrue(np.array_equal(counts, np.bincount(ids.ravel(), minlength=len(names))))
+
+
+class TestObjectEdits(unittest.TestCase):
+    def test_move_and_hide(self):
+        env = create_env()
+        api = env.api
+        house = env.house
+        cfg = env.config
+        ids = env.render_instance_ids()
+        rgb = env.render(mode='rgb', copy=True)
+        obj = int(np.bincount(ids.ravel())[1:].argmax()) + 1
+
+        api.setObjectVisible(obj, False)
+        self.assertFalse(api.isObjectVisible(obj))
+        self.assertFalse((env.render_instance_ids() == obj).any())
+        api.setObjectVisible(obj, True)
+        self.assertTrue(np.array_equal(env.render_instance_ids(), ids))
+
+        up = np.eye(4, dtype=np.float32)
+        up[1, 3] = 100
+        api.setObjectTransform(obj, up)
+        self.assertTrue(np.array_equal(api.getObjectTransform(obj), up))
+        self.assertFalse((env.render_instance_ids() == obj).any())
+        api.setObjectTransform(obj, np.eye(4))
+        self.assertTrue(np.array_equal(env.render_instance_ids(), ids))
+        self.assertTrue(np.array_equal(env.render(mode='rgb', copy=True), rgb))
+        with self.assertRaises(IndexError):
+            api.setObjectVisible(0, False)
+
+        # raycast() and queryAABB() see the edits too
+        cam = api.getCamera()
+        origin = np.array([[cam.pos.x, cam.pos.y, cam.pos.z]], dtype=np.float32)
+        front = np.array([[cam.front.x, cam.front.y, cam.front.z]], dtype=np.float32)
+        distance, instance = api.raycast(origin, front)
+        hit_obj = int(instance[0])
+        self.assertGreater(hit_obj, 0)
+        hit = origin[0] + front[0] * distance[0]
+        box = np.concatenate([hit - 0.01, hit + 0.01])
+        self.assertIn(hit_obj, api.queryAABB(box))
+        api.setObjectVisible(hit_obj, False)
+        self.assertNotEqual(api.raycast(origin, front)[1][0], hit_obj)
+        self.assertNotIn(hit_obj, api.queryAABB(box))
+        api.setObjectVisible(hit_obj, True)
+        api.setObjectTransform(hit_obj, up)
+        self.assertNotIn(hit_obj, api.queryAABB(box))
+        self.assertIn(hit_obj, api.queryAABB(box + np.array([0, 100, 0, 0, 100, 0])))
+
+        # loading the scene again, from the cache, undoes the edits
+        api.setObjectVisible(obj, False)
+        env = Environment(api, house, cfg)
+        self.assertTrue(api.isObjectVisible(obj))
+        self.assertTrue(np.array_equal(api.getObjectTransform(hit_obj), np.eye(4)))
+
+
+class TestDepthPrepass(unittest.TestCase):
+    def test_depth_prepass(self):
+        env = create_env()
+        api = env.api
+        expected = env.render(mode='rgb', copy=True)
+
+        api.setDepthPrepass(True)
+        img = env.render(mode='rgb', copy=True)
+        # coplanar faces may be resolved differently
+        self.assertGreater(np.mean(img == expected), 0.99)
+        api.setDepthPrepass(False)
+        self.assertTrue(np.array_equal(env.render(mode='rgb', copy=True), expected))
+
+    def test_cube_map(self):
+        env = create_env()
+        api = env.api
+        env.set_render_mode(RenderMode.RGB)
+        expected = env.render_cube_map()
+
+        # the cube map is drawn without the pre-pass
+        api.setDepthPrepass(True)
+        self.assertTrue(np.array_equal(env.render_cube_map(), expected))
+
+
+class TestRaycast(unittest.TestCase):
+    def test_raycast(self):
+        env = create_env(objrender.RenderAPI(w=SIDE + 1, h=SIDE + 1, device=0))
+        api = env.api
+        cam = api.getCamera()
+        origin = np.array([[cam.pos.x, cam.pos.y, cam.pos.z]], dtype=np.float32)
+        front = np.array([[cam.front.x, cam.front.y, cam.front.z]], dtype=np.float32)
+
+        # the center pixel is on the view direction
+        distance, instance = api.raycast(origin, front)
+        depth = env.render_depth()[SIDE // 2, SIDE // 2, 0]
+        ids = env.render_instance_ids()
+        self.assertAlmostEqual(distance[0], depth, delta=0.01 * depth)
+        self.assertEqual(instance[0], ids[SIDE // 2, SIDE // 2, 0])
+
+        hit = origin[0] + front[0] * distance[0]
+        box = np.concatenate([hit - 0.01, hit + 0.01])
+        self.assertIn(instance[0], api.queryAABB(box))
+
+
+class TestCPURender(unittest.TestCase):
+    def test_cpu_render(self):
+        env = create_env()
+        cpu = Environment(objrender.CPURenderAPI(w=SIDE, h=SIDE), env.house, env.config)
+        cpu.reset(x=env.cam.pos.x, y=env.cam.pos.z, yaw=env.cam.yaw)
+
+        # pixels on the edges of triangles may differ
+        def agree(a, b):
+            return np.mean(np.all(a == b, axis=2))
+        for mode in ['depth', 'semantic', 'instance']:
+            self.assertGreater(agree(cpu.render(mode=mode), env.render(mode=mode)), 0.98)
+        self.assertGreater(agree(cpu.render_instance_ids(), env.render_instance_ids()), 0.98)
+        depth, ref = cpu.render_depth(), env.render_depth()
+        hit = np.isfinite(ref)
+        self.assertGreater(np.mean(np.abs(depth[hit] - ref[hit]) < 0.01 * ref[hit]), 0.98)
+
+        ranges = cpu.api.lidarScan(nr_beams=360)
+        self.assertEqual(ranges.shape, (360,))
+        # the middle beams look along the camera front
+        front = np.array([[cpu.cam.front.x, 0, cpu.cam.front.z]], dtype=np.float32)
+        origin = np.array([[cpu.cam.pos.x, cpu.cam.pos.y, cpu.cam.pos.z]], dtype=np.float32)
+        distance, _ = cpu.api.raycast(origin, front)
+        self.assertAlmostEqual(ranges[179], distance[0], delta=0.05 * distance[0] + 0.05)
+
+
 if __name__ == '__main__':
     unittest.main()